@@ -0,0 +1,556 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements running many sub-commands in one process. Each
+ * command goes through the regular command table, with its output
+ * captured and reported as one JSON record per line.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "batch.h"
+#include "common.h"
+#include "util/argconfig.h"
+
+#define BATCH_MAX_ARGS	128
+#define JSON_MAX_DEPTH	64
+
+/* stdout and stderr of the running command are redirected to these */
+static int capture_fds[2] = { -1, -1 };
+
+static int capture_open(void)
+{
+	FILE *f;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (capture_fds[i] >= 0)
+			continue;
+		f = tmpfile();
+		if (!f)
+			return -errno;
+		capture_fds[i] = dup(fileno(f));
+		fclose(f);
+		if (capture_fds[i] < 0)
+			return -errno;
+	}
+	return 0;
+}
+
+/* read back what was captured and rewind for the next command */
+static int capture_collect(int fd, char **buf, size_t *len)
+{
+	off_t size = lseek(fd, 0, SEEK_END);
+	ssize_t n;
+
+	*buf = NULL;
+	*len = 0;
+	if (size < 0)
+		return -errno;
+
+	*buf = malloc(size + 1);
+	if (!*buf)
+		return -ENOMEM;
+	n = pread(fd, *buf, size, 0);
+	if (n < 0)
+		n = 0;
+	(*buf)[n] = '\0';
+	*len = n;
+
+	if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+		return -errno;
+	return 0;
+}
+
+/*
+ * Run one command through the command table of the given plugin, the
+ * same way main() does, and return its status and output.
+ */
+int batch_exec(struct plugin *plugin, int argc, char **argv,
+	       struct batch_result *res)
+{
+	int saved_out, saved_err, err;
+
+	memset(res, 0, sizeof(*res));
+	err = capture_open();
+	if (err)
+		return err;
+
+	fflush(stdout);
+	fflush(stderr);
+	saved_out = dup(STDOUT_FILENO);
+	saved_err = dup(STDERR_FILENO);
+	if (saved_out < 0 || saved_err < 0) {
+		err = -errno;
+		goto close_saved;
+	}
+	if (dup2(capture_fds[0], STDOUT_FILENO) < 0 ||
+	    dup2(capture_fds[1], STDERR_FILENO) < 0) {
+		err = -errno;
+		goto restore;
+	}
+
+	res->status = handle_plugin(argc, argv, plugin);
+
+	fflush(stdout);
+	fflush(stderr);
+restore:
+	dup2(saved_out, STDOUT_FILENO);
+	dup2(saved_err, STDERR_FILENO);
+close_saved:
+	if (saved_out >= 0)
+		close(saved_out);
+	if (saved_err >= 0)
+		close(saved_err);
+	if (err)
+		return err;
+
+	err = capture_collect(capture_fds[0], &res->out, &res->out_len);
+	if (!err)
+		err = capture_collect(capture_fds[1], &res->err, &res->err_len);
+	return err;
+}
+
+void batch_free_result(struct batch_result *res)
+{
+	free(res->out);
+	free(res->err);
+}
+
+void batch_print_json_string(FILE *f, const char *s, size_t len)
+{
+	size_t i;
+
+	fputc('"', f);
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		switch (c) {
+		case '"':
+			fputs("\\\"", f);
+			break;
+		case '\\':
+			fputs("\\\\", f);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		case '\t':
+			fputs("\\t", f);
+			break;
+		case '\r':
+			fputs("\\r", f);
+			break;
+		default:
+			if (c < 0x20 || c == 0x7f)
+				fprintf(f, "\\u%04x", c);
+			else
+				fputc(c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+void batch_skip_ws(const char **p)
+{
+	while (isspace((unsigned char)**p))
+		(*p)++;
+}
+
+static void put_utf8(char **q, unsigned int c)
+{
+	if (c < 0x80) {
+		*(*q)++ = c;
+	} else if (c < 0x800) {
+		*(*q)++ = 0xc0 | (c >> 6);
+		*(*q)++ = 0x80 | (c & 0x3f);
+	} else {
+		*(*q)++ = 0xe0 | (c >> 12);
+		*(*q)++ = 0x80 | ((c >> 6) & 0x3f);
+		*(*q)++ = 0x80 | (c & 0x3f);
+	}
+}
+
+/* parse a JSON string; the decoded value is returned if out is given */
+int batch_json_parse_string(const char **p, char **out)
+{
+	const char *s = *p;
+	char *buf, *q, hex[5] = { };
+	unsigned int c;
+	int i;
+
+	if (*s++ != '"')
+		return -EINVAL;
+
+	/* decoding never makes the string longer */
+	buf = q = malloc(strlen(s) + 1);
+	if (!buf)
+		return -ENOMEM;
+
+	while (*s && *s != '"') {
+		if ((unsigned char)*s < 0x20)
+			goto err;
+		if (*s != '\\') {
+			*q++ = *s++;
+			continue;
+		}
+		switch (*++s) {
+		case '"':
+		case '\\':
+		case '/':
+			*q++ = *s;
+			break;
+		case 'b':
+			*q++ = '\b';
+			break;
+		case 'f':
+			*q++ = '\f';
+			break;
+		case 'n':
+			*q++ = '\n';
+			break;
+		case 'r':
+			*q++ = '\r';
+			break;
+		case 't':
+			*q++ = '\t';
+			break;
+		case 'u':
+			for (i = 0; i < 4; i++) {
+				if (!isxdigit((unsigned char)s[i + 1]))
+					goto err;
+				hex[i] = s[i + 1];
+			}
+			c = strtoul(hex, NULL, 16);
+			if (!c)
+				goto err;
+			put_utf8(&q, c);
+			s += 4;
+			break;
+		default:
+			goto err;
+		}
+		s++;
+	}
+	if (*s != '"')
+		goto err;
+
+	*q = '\0';
+	*p = s + 1;
+	if (out)
+		*out = buf;
+	else
+		free(buf);
+	return 0;
+err:
+	free(buf);
+	return -EINVAL;
+}
+
+static int json_skip_literal(const char **p, const char *lit)
+{
+	size_t len = strlen(lit);
+
+	if (strncmp(*p, lit, len))
+		return -EINVAL;
+	*p += len;
+	return 0;
+}
+
+static int json_skip_number(const char **p)
+{
+	const char *s = *p;
+
+	if (*s == '-')
+		s++;
+	if (!isdigit((unsigned char)*s))
+		return -EINVAL;
+	while (isdigit((unsigned char)*s))
+		s++;
+	if (*s == '.') {
+		s++;
+		if (!isdigit((unsigned char)*s))
+			return -EINVAL;
+		while (isdigit((unsigned char)*s))
+			s++;
+	}
+	if (*s == 'e' || *s == 'E') {
+		s++;
+		if (*s == '+' || *s == '-')
+			s++;
+		if (!isdigit((unsigned char)*s))
+			return -EINVAL;
+		while (isdigit((unsigned char)*s))
+			s++;
+	}
+	*p = s;
+	return 0;
+}
+
+/* check and skip over any JSON value */
+int batch_json_skip_value(const char **p, int depth)
+{
+	char close;
+	int err;
+
+	if (depth > JSON_MAX_DEPTH)
+		return -EINVAL;
+
+	batch_skip_ws(p);
+	switch (**p) {
+	case '"':
+		return batch_json_parse_string(p, NULL);
+	case '{':
+	case '[':
+		close = **p == '{' ? '}' : ']';
+		(*p)++;
+		batch_skip_ws(p);
+		if (**p == close) {
+			(*p)++;
+			return 0;
+		}
+		while (1) {
+			if (close == '}') {
+				batch_skip_ws(p);
+				err = batch_json_parse_string(p, NULL);
+				if (err)
+					return err;
+				batch_skip_ws(p);
+				if (*(*p)++ != ':')
+					return -EINVAL;
+			}
+			err = batch_json_skip_value(p, depth + 1);
+			if (err)
+				return err;
+			batch_skip_ws(p);
+			if (**p == ',') {
+				(*p)++;
+				continue;
+			}
+			if (*(*p)++ != close)
+				return -EINVAL;
+			return 0;
+		}
+	case 't':
+		return json_skip_literal(p, "true");
+	case 'f':
+		return json_skip_literal(p, "false");
+	case 'n':
+		return json_skip_literal(p, "null");
+	default:
+		return json_skip_number(p);
+	}
+}
+
+bool batch_is_json(const char *s)
+{
+	if (batch_json_skip_value(&s, 0))
+		return false;
+	batch_skip_ws(&s);
+	return !*s;
+}
+
+/*
+ * Print the ",output" or ",stdout" and ",stderr" members of a result
+ * record. Output which is a JSON document is embedded as is.
+ */
+void batch_print_output(FILE *f, struct batch_result *res)
+{
+	char *p;
+
+	if (res->out_len && batch_is_json(res->out)) {
+		/* raw line breaks can only be whitespace in valid JSON */
+		for (p = res->out; *p; p++)
+			if (*p == '\n' || *p == '\r')
+				*p = ' ';
+		fprintf(f, ",\"output\":%s", res->out);
+	} else {
+		fprintf(f, ",\"stdout\":");
+		batch_print_json_string(f, res->out ?: "", res->out_len);
+	}
+	fprintf(f, ",\"stderr\":");
+	batch_print_json_string(f, res->err ?: "", res->err_len);
+}
+
+/*
+ * Split a command line into arguments. Single and double quotes group
+ * words and a backslash escapes the next character; everything after
+ * an unquoted '#' is a comment.
+ */
+static int batch_split(char *line, char **argv, int max)
+{
+	char *p = line, *q;
+	char quote;
+	int argc = 0;
+
+	while (*p) {
+		while (isspace((unsigned char)*p))
+			p++;
+		if (!*p || *p == '#')
+			break;
+		if (argc == max - 1)
+			return -E2BIG;
+
+		argv[argc++] = q = p;
+		while (*p && !isspace((unsigned char)*p)) {
+			if (*p == '\'' || *p == '"') {
+				quote = *p++;
+				while (*p && *p != quote)
+					*q++ = *p++;
+				if (!*p)
+					return -EINVAL;
+				p++;
+			} else if (*p == '\\' && p[1]) {
+				p++;
+				*q++ = *p++;
+			} else {
+				*q++ = *p++;
+			}
+		}
+		if (*p)
+			p++;
+		*q = '\0';
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+static void batch_print_record(int lineno, const char *cmdline,
+			       struct batch_result *res)
+{
+	printf("{\"line\":%d,\"command\":", lineno);
+	batch_print_json_string(stdout, cmdline, strlen(cmdline));
+	printf(",\"status\":%d", res->status);
+	batch_print_output(stdout, res);
+	printf("}\n");
+	fflush(stdout);
+}
+
+int nvme_batch(const char *desc, int argc, char **argv,
+	       struct plugin *plugin)
+{
+	const char *stop_on_error = "stop at the first command which fails";
+	const char *no_cache = "reopen devices and re-identify controllers "\
+		"for every command";
+	char *line = NULL, *cmdline = NULL, *args[BATCH_MAX_ARGS];
+	struct batch_result res;
+	const char *path = "-";
+	size_t size = 0;
+	ssize_t len;
+	int n, lineno = 0, err, ret = 0;
+	FILE *f;
+
+	struct config {
+		int stop_on_error;
+		int no_cache;
+	};
+
+	struct config cfg = {
+		.stop_on_error = 0,
+		.no_cache = 0,
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_FLAG("stop-on-error", 'e', &cfg.stop_on_error, stop_on_error),
+		OPT_FLAG("no-cache",      'n', &cfg.no_cache,      no_cache),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	if (optind < argc)
+		path = argv[optind];
+	if (strcmp(path, "-")) {
+		f = fopen(path, "r");
+		if (!f) {
+			perror(path);
+			return -errno;
+		}
+	} else {
+		f = stdin;
+	}
+
+	if (!cfg.no_cache) {
+		nvme_dev_cache_enable(true);
+		nvme_identify_cache_enable(true);
+	}
+
+	while ((len = getline(&line, &size, f)) >= 0) {
+		lineno++;
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		free(cmdline);
+		cmdline = strdup(line);
+		if (!cmdline) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		n = batch_split(line, args, ARRAY_SIZE(args));
+		if (!n)
+			continue;
+		/* allow lines to be copied from a shell script as is */
+		if (n > 0 && !strcmp(args[0], "nvme")) {
+			memmove(args, args + 1, n * sizeof(*args));
+			n--;
+		}
+
+		if (n > 0 && (!strcmp(args[0], "batch") ||
+			      !strcmp(args[0], "serve") ||
+			      !strcmp(args[0], "monitor")))
+			n = -EINVAL;
+
+		if (n <= 0) {
+			memset(&res, 0, sizeof(res));
+			res.status = n ?: -EINVAL;
+			res.err = strdup("invalid command line\n");
+			res.err_len = res.err ? strlen(res.err) : 0;
+		} else {
+			err = batch_exec(plugin, n, args, &res);
+			if (err) {
+				fprintf(stderr, "failed to run line %d: %s\n",
+					lineno, strerror(-err));
+				ret = err;
+				batch_free_result(&res);
+				break;
+			}
+		}
+
+		batch_print_record(lineno, cmdline, &res);
+		batch_free_result(&res);
+		if (res.status) {
+			/* details are in the records, only flag the failure */
+			ret = 1;
+			if (cfg.stop_on_error)
+				break;
+		}
+	}
+
+	nvme_dev_cache_enable(false);
+	nvme_identify_cache_enable(false);
+	free(cmdline);
+	free(line);
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
@@ -0,0 +1,31 @@
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "plugin.h"
+
+struct batch_result {
+	int status;
+	char *out;	/* captured stdout */
+	size_t out_len;
+	char *err;	/* captured stderr */
+	size_t err_len;
+};
+
+int batch_exec(struct plugin *plugin, int argc, char **argv,
+	       struct batch_result *res);
+void batch_free_result(struct batch_result *res);
+void batch_print_json_string(FILE *f, const char *s, size_t len);
+void batch_print_output(FILE *f, struct batch_result *res);
+
+/* minimal JSON scanner for requests and command output */
+void batch_skip_ws(const char **p);
+int batch_json_parse_string(const char **p, char **out);
+int batch_json_skip_value(const char **p, int depth);
+bool batch_is_json(const char *s);
+
+extern int nvme_batch(const char *desc, int argc, char **argv,
+		      struct plugin *plugin);
+
+#endif
@@ -0,0 +1,716 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements 'make bench', micro-benchmarks of the decoding
+ * and printing the tool does itself. Synthetic fixtures are written for
+ * the mock device of nvme-mock.c, and every benchmark runs a sub-command
+ * against them in a child process with its output going to /dev/null.
+ *
+ * Reported are the median time per run and per record, the allocations
+ * of one run and the peak RSS, as one JSON object per line so that the
+ * results of two commits can be compared with --compare.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "nvme.h"
+#include "common.h"
+
+/* main() of nvme.c, renamed when it is built for the benchmarks */
+extern int nvme_main(int argc, char **argv);
+
+#define BENCH_ZONES		(1 << 20)
+#define BENCH_ERR_ENTRIES	256
+#define BENCH_PEL_EVENTS	(1 << 17)
+#define BENCH_TELEMETRY_BLOCKS	0xffff	/* largest Data Area 3 */
+#define BENCH_SUBSYSTEMS	256
+#define BENCH_NAMESPACES	4	/* per subsystem */
+
+struct bench {
+	const char *name;
+	__u64 records;
+	const char *args[8];
+};
+
+static const struct bench benches[] = {
+	{ "report-zones", BENCH_ZONES,
+	  { "zns", "report-zones", "/dev/nvme0n1", "-d", "1048576" } },
+	{ "error-log", BENCH_ERR_ENTRIES,
+	  { "error-log", "/dev/nvme0", "-e", "256" } },
+	{ "error-log-json", BENCH_ERR_ENTRIES,
+	  { "error-log", "/dev/nvme0", "-e", "256", "-o", "json" } },
+	{ "persistent-event-log", BENCH_PEL_EVENTS,
+	  { "persistent-event-log", "/dev/nvme0", "-a", "0" } },
+	{ "persistent-event-log-json", BENCH_PEL_EVENTS,
+	  { "persistent-event-log", "/dev/nvme0", "-a", "0", "-o", "json" } },
+	{ "telemetry-log", BENCH_TELEMETRY_BLOCKS,
+	  { "telemetry-log", "/dev/nvme0", "-d", "3", "-o", "/dev/null" } },
+	{ "intel-smart-log-add", 1,
+	  { "intel", "smart-log-add", "/dev/nvme0" } },
+	{ "intel-smart-log-add-json", 1,
+	  { "intel", "smart-log-add", "/dev/nvme0", "--json" } },
+	{ "list", BENCH_SUBSYSTEMS * BENCH_NAMESPACES,
+	  { "list" } },
+	{ "list-json", BENCH_SUBSYSTEMS * BENCH_NAMESPACES,
+	  { "list", "-o", "json" } },
+};
+
+struct bench_sample {
+	int status;
+	__u64 ns;
+	__u64 allocs;
+	__u64 alloc_bytes;
+};
+
+struct bench_result {
+	char name[64];
+	__u64 records;
+	int iterations;
+	double ns_per_run;
+	double ns_per_record;
+	__u64 allocs;
+	__u64 alloc_bytes;
+	long peak_rss_kb;
+};
+
+/*
+ * Allocations are counted by replacing the malloc family, which glibc
+ * supports, and passing the calls on to its own implementation. A realloc
+ * of an existing block is not a new allocation and only its growth is
+ * added to the bytes.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *p);
+
+static __u64 nr_allocs, nr_alloc_bytes;
+
+static void count_alloc(size_t size)
+{
+	__atomic_add_fetch(&nr_allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&nr_alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size)
+{
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	count_alloc(n * size);
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	size_t old;
+
+	if (!p) {
+		count_alloc(size);
+		return __libc_realloc(p, size);
+	}
+
+	old = malloc_usable_size(p);
+	if (size > old)
+		__atomic_add_fetch(&nr_alloc_bytes, size - old,
+				   __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+	count_alloc(size);
+	return __libc_memalign(align, size);
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	return memalign(align, size);
+}
+
+int posix_memalign(void **p, size_t align, size_t size)
+{
+	*p = memalign(align, size);
+	return *p ? 0 : ENOMEM;
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+
+static int bench_mkdirs(int dirfd, const char *path)
+{
+	char buf[PATH_MAX], *p;
+
+	snprintf(buf, sizeof(buf), "%s", path);
+	for (p = strchr(buf, '/'); p; p = strchr(p + 1, '/')) {
+		*p = '\0';
+		if (mkdirat(dirfd, buf, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+	return 0;
+}
+
+static int bench_write(int dirfd, const char *name, const void *buf,
+		       size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	if (bench_mkdirs(dirfd, name))
+		return -errno;
+	fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -errno;
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			close(fd);
+			return -errno;
+		}
+		buf = (const char *)buf + ret;
+		len -= ret;
+	}
+	return close(fd) ? -errno : 0;
+}
+
+static int bench_attr(int dirfd, const char *fmt, const char *value, ...)
+{
+	char name[PATH_MAX];
+	va_list ap;
+
+	va_start(ap, value);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+	return bench_write(dirfd, name, value, strlen(value));
+}
+
+static int bench_identify(int dirfd)
+{
+	struct nvme_id_ctrl ctrl = { 0 };
+	struct nvme_id_ns ns = { 0 };
+	int err;
+
+	ctrl.vid = cpu_to_le16(0x8086);
+	memcpy(ctrl.sn, "BENCH0001           ", sizeof(ctrl.sn));
+	memcpy(ctrl.mn, "Benchmark Controller                    ",
+	       sizeof(ctrl.mn));
+	memcpy(ctrl.fr, "1.0     ", sizeof(ctrl.fr));
+	ctrl.elpe = BENCH_ERR_ENTRIES - 1;
+	ctrl.nn = cpu_to_le32(BENCH_NAMESPACES);
+	err = bench_write(dirfd, "identify-01.bin", &ctrl, sizeof(ctrl));
+	if (err)
+		return err;
+
+	ns.nsze = ns.ncap = cpu_to_le64(1ULL << 28);
+	ns.nuse = cpu_to_le64(1ULL << 27);
+	ns.lbaf[0].ds = 12;
+	return bench_write(dirfd, "identify-00.bin", &ns, sizeof(ns));
+}
+
+static int bench_zones(int dirfd)
+{
+	struct nvme_zns_desc *descs;
+	int fd, i, err = 0;
+	size_t len;
+
+	descs = calloc(4096, sizeof(*descs));
+	if (!descs)
+		return -ENOMEM;
+	fd = openat(dirfd, "zones-1.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(descs);
+		return -errno;
+	}
+	for (i = 0; i < BENCH_ZONES && !err; i++) {
+		struct nvme_zns_desc *d = &descs[i % 4096];
+
+		d->zt = NVME_ZONE_TYPE_SEQWRITE_REQ;
+		d->zs = (i % 7 ? NVME_ZNS_ZS_EMPTY : NVME_ZNS_ZS_FULL) << 4;
+		d->zcap = cpu_to_le64(0x8000);
+		d->zslba = cpu_to_le64((__u64)i * 0x8000);
+		d->wp = d->zslba;
+		if (i % 4096 == 4095) {
+			len = 4096 * sizeof(*descs);
+			if (write(fd, descs, len) != len)
+				err = -EIO;
+		}
+	}
+	free(descs);
+	if (close(fd))
+		return -errno;
+	return err;
+}
+
+static int bench_error_log(int dirfd)
+{
+	struct nvme_error_log_page log[BENCH_ERR_ENTRIES] = { { 0 } };
+	int i;
+
+	for (i = 0; i < BENCH_ERR_ENTRIES; i++) {
+		log[i].error_count = cpu_to_le64(BENCH_ERR_ENTRIES - i);
+		log[i].sqid = cpu_to_le16(i % 8);
+		log[i].cmdid = cpu_to_le16(i);
+		log[i].status_field = cpu_to_le16(NVME_SC_INVALID_FIELD << 1);
+		log[i].lba = cpu_to_le64(i * 8);
+		log[i].nsid = cpu_to_le32(1);
+	}
+	return bench_write(dirfd, "log-01.bin", log, sizeof(log));
+}
+
+/* Timestamp events, each an event header followed by the timestamp */
+static int bench_pel(int dirfd)
+{
+	struct nvme_persistent_event_log_head *head;
+	struct nvme_persistent_event_entry_head *eh;
+	size_t ev_len = sizeof(*eh) + 8;
+	size_t len = sizeof(*head) + BENCH_PEL_EVENTS * ev_len;
+	char *buf, *p;
+	__u64 ts;
+	int i, err;
+
+	buf = calloc(1, len);
+	if (!buf)
+		return -ENOMEM;
+	head = (void *)buf;
+	head->log_id = NVME_LOG_PERSISTENT_EVENT;
+	head->tnev = cpu_to_le32(BENCH_PEL_EVENTS);
+	head->tll = cpu_to_le64(len);
+	head->head_len = cpu_to_le16(sizeof(*head));
+	head->timestamp = cpu_to_le64(1600000000000ULL);
+	memset(head->supp_event_bm, 0xff, sizeof(head->supp_event_bm));
+
+	for (i = 0, p = buf + sizeof(*head); i < BENCH_PEL_EVENTS; i++) {
+		eh = (void *)p;
+		ts = 1600000000000ULL - (BENCH_PEL_EVENTS - i) * 1000ULL;
+		eh->etype = NVME_TIMESTAMP_EVENT;
+		eh->ehl = sizeof(*eh) - 3;
+		eh->ctrl_id = cpu_to_le16(1);
+		eh->etimestamp = cpu_to_le64(ts);
+		eh->el = cpu_to_le16(8);
+		ts = cpu_to_le64(ts);
+		memcpy(p + sizeof(*eh), &ts, 8);
+		p += ev_len;
+	}
+	err = bench_write(dirfd, "log-0d.bin", buf, len);
+	free(buf);
+	return err;
+}
+
+/* The data area is left as a hole, only the header is written */
+static int bench_telemetry(int dirfd)
+{
+	struct nvme_telemetry_log_page_hdr hdr = { 0 };
+	int err, fd;
+
+	hdr.lpi = NVME_LOG_TELEMETRY_HOST;
+	hdr.dalb1 = cpu_to_le16(BENCH_TELEMETRY_BLOCKS / 4);
+	hdr.dalb2 = cpu_to_le16(BENCH_TELEMETRY_BLOCKS / 2);
+	hdr.dalb3 = cpu_to_le16(BENCH_TELEMETRY_BLOCKS);
+	err = bench_write(dirfd, "log-07.bin", &hdr, sizeof(hdr));
+	if (err)
+		return err;
+	fd = openat(dirfd, "log-07.bin", O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	err = ftruncate(fd, 512 + BENCH_TELEMETRY_BLOCKS * 512ULL) ? -errno : 0;
+	close(fd);
+	return err;
+}
+
+static int bench_intel_smart(int dirfd)
+{
+	__u8 log[512] = { 0 };
+	int i;
+
+	/* key, reserved, normalized value, reserved and a 6 byte raw value */
+	for (i = 0; i < 512 / 12; i++) {
+		log[i * 12] = 0xab + i;
+		log[i * 12 + 3] = 100;
+		log[i * 12 + 5] = i;
+	}
+	return bench_write(dirfd, "log-ca.bin", log, sizeof(log));
+}
+
+static int bench_sysfs(int dirfd)
+{
+	const char *subsys = "sys/class/nvme-subsystem/nvme-subsys";
+	char nqn[64], nsid[8];
+	int i, j, err = 0;
+
+	for (i = 0; i < BENCH_SUBSYSTEMS && !err; i++) {
+		snprintf(nqn, sizeof(nqn), "nqn.2014-08.org.nvmexpress:bench%d\n",
+			 i);
+		err = bench_attr(dirfd, "%s%d/subsysnqn", nqn, subsys, i);
+		err = err ?: bench_attr(dirfd, "%s%d/nvme%d/transport", "pcie\n",
+					subsys, i, i);
+		err = err ?: bench_attr(dirfd, "%s%d/nvme%d/address",
+					"0000:00:00.0\n", subsys, i, i);
+		err = err ?: bench_attr(dirfd, "%s%d/nvme%d/state", "live\n",
+					subsys, i, i);
+		for (j = 1; j <= BENCH_NAMESPACES && !err; j++) {
+			snprintf(nsid, sizeof(nsid), "%d\n", j);
+			err = bench_attr(dirfd, "%s%d/nvme%dn%d/nsid", nsid,
+					 subsys, i, i, j);
+			err = err ?: bench_attr(dirfd, "%s%d/nvme%d/nvme%dc%dn%d/nsid",
+						nsid, subsys, i, i, i, i, j);
+		}
+	}
+	return err;
+}
+
+static int bench_fixtures(int dirfd)
+{
+	int err;
+
+	err = bench_identify(dirfd);
+	err = err ?: bench_zones(dirfd);
+	err = err ?: bench_error_log(dirfd);
+	err = err ?: bench_pel(dirfd);
+	err = err ?: bench_telemetry(dirfd);
+	err = err ?: bench_intel_smart(dirfd);
+	err = err ?: bench_sysfs(dirfd);
+	return err;
+}
+
+static __u64 bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void __attribute__((noreturn))
+bench_child(const struct bench *b, int out)
+{
+	struct bench_sample s = { 0 };
+	char *argv[ARRAY_SIZE(b->args) + 1] = { "nvme" };
+	int argc = 1, fd;
+	__u64 start;
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+	while (argc <= ARRAY_SIZE(b->args) && b->args[argc - 1]) {
+		argv[argc] = strdup(b->args[argc - 1]);
+		argc++;
+	}
+
+	nr_allocs = nr_alloc_bytes = 0;
+	start = bench_ns();
+	s.status = nvme_main(argc, argv);
+	fflush(stdout);
+	s.ns = bench_ns() - start;
+	s.allocs = nr_allocs;
+	s.alloc_bytes = nr_alloc_bytes;
+
+	_exit(write(out, &s, sizeof(s)) == sizeof(s) ? 0 : 1);
+}
+
+static int bench_run_once(const struct bench *b, struct bench_sample *s,
+			  long *rss_kb)
+{
+	struct rusage ru;
+	int pfd[2], wstatus;
+	ssize_t ret;
+	pid_t pid;
+
+	if (pipe(pfd))
+		return -errno;
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -errno;
+	}
+	if (!pid) {
+		close(pfd[0]);
+		bench_child(b, pfd[1]);
+	}
+	close(pfd[1]);
+	ret = read(pfd[0], s, sizeof(*s));
+	close(pfd[0]);
+	if (wait4(pid, &wstatus, 0, &ru) < 0)
+		return -errno;
+	if (ret != sizeof(*s) || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus))
+		return -EIO;
+	*rss_kb = max(*rss_kb, ru.ru_maxrss);
+	return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int bench_run(const struct bench *b, int iterations,
+		     struct bench_result *r)
+{
+	struct bench_sample s;
+	__u64 *ns;
+	int i, err;
+
+	ns = calloc(iterations, sizeof(*ns));
+	if (!ns)
+		return -ENOMEM;
+
+	memset(r, 0, sizeof(*r));
+	snprintf(r->name, sizeof(r->name), "%s", b->name);
+	r->records = b->records;
+	r->iterations = iterations;
+
+	/* one run to warm up the page cache, not counted */
+	err = bench_run_once(b, &s, &r->peak_rss_kb);
+	for (i = 0; i < iterations && !err; i++) {
+		err = bench_run_once(b, &s, &r->peak_rss_kb);
+		if (!err && s.status) {
+			fprintf(stderr, "%s failed with status %d\n", b->name,
+				s.status);
+			err = -EIO;
+		}
+		ns[i] = s.ns;
+	}
+	if (!err) {
+		qsort(ns, iterations, sizeof(*ns), cmp_u64);
+		r->ns_per_run = ns[iterations / 2];
+		r->ns_per_record = r->ns_per_run / r->records;
+		r->allocs = s.allocs;
+		r->alloc_bytes = s.alloc_bytes;
+	}
+	free(ns);
+	return err;
+}
+
+static void bench_print(FILE *f, const struct bench_result *r)
+{
+	fprintf(f, "{\"name\":\"%s\",\"records\":%llu,\"iterations\":%d,"
+		"\"ns_per_run\":%.0f,\"ns_per_record\":%.2f,\"allocs\":%llu,"
+		"\"alloc_bytes\":%llu,\"peak_rss_kb\":%ld}\n", r->name,
+		(unsigned long long)r->records, r->iterations, r->ns_per_run,
+		r->ns_per_record, (unsigned long long)r->allocs,
+		(unsigned long long)r->alloc_bytes, r->peak_rss_kb);
+}
+
+static bool bench_parse(const char *line, struct bench_result *r)
+{
+	unsigned long long records, allocs, alloc_bytes;
+
+	memset(r, 0, sizeof(*r));
+	if (sscanf(line, "{\"name\":\"%63[^\"]\",\"records\":%llu,"
+		   "\"iterations\":%d,\"ns_per_run\":%lf,"
+		   "\"ns_per_record\":%lf,\"allocs\":%llu,"
+		   "\"alloc_bytes\":%llu,\"peak_rss_kb\":%ld}", r->name,
+		   &records, &r->iterations, &r->ns_per_run,
+		   &r->ns_per_record, &allocs, &alloc_bytes,
+		   &r->peak_rss_kb) != 8)
+		return false;
+	r->records = records;
+	r->allocs = allocs;
+	r->alloc_bytes = alloc_bytes;
+	return true;
+}
+
+static double bench_delta(double old, double new)
+{
+	return old ? (new - old) * 100 / old : 0;
+}
+
+static void bench_compare(FILE *f, const struct bench_result *r,
+			  const struct bench_result *old)
+{
+	fprintf(f, "%-26s %12.2f %12.2f %+7.1f%% %10llu %10llu %8ld %8ld\n",
+		r->name, old->ns_per_record, r->ns_per_record,
+		bench_delta(old->ns_per_record, r->ns_per_record),
+		(unsigned long long)old->allocs, (unsigned long long)r->allocs,
+		old->peak_rss_kb, r->peak_rss_kb);
+}
+
+static struct bench_result *bench_load(const char *path, int *nr)
+{
+	struct bench_result *rs = NULL, *tmp;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	*nr = 0;
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return NULL;
+	}
+	while (getline(&line, &len, f) > 0) {
+		tmp = realloc(rs, (*nr + 1) * sizeof(*rs));
+		if (!tmp)
+			break;
+		rs = tmp;
+		if (bench_parse(line, &rs[*nr]))
+			(*nr)++;
+	}
+	free(line);
+	fclose(f);
+	return rs;
+}
+
+static int bench_rm(const char *path, const struct stat *st, int flag,
+		    struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--iterations=<n>] [--filter=<name>] "
+		"[--output=<file>] [--compare=<file>] [--dir=<dir>]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option opts[] = {
+		{ "iterations",	required_argument,	NULL, 'n' },
+		{ "filter",	required_argument,	NULL, 'f' },
+		{ "output",	required_argument,	NULL, 'o' },
+		{ "compare",	required_argument,	NULL, 'c' },
+		{ "dir",	required_argument,	NULL, 'd' },
+		{ "help",	no_argument,		NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	char tmpdir[] = "/tmp/nvme-bench-XXXXXX", *dir = NULL, *end;
+	const char *filter = NULL, *output = NULL, *compare = NULL;
+	struct bench_result r, *old = NULL;
+	int opt, i, j, nr_old = 0, iterations = 5, dirfd, err = 0;
+	FILE *out = stdout;
+
+	while ((opt = getopt_long(argc, argv, "n:f:o:c:d:h", opts,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtol(optarg, &end, 0);
+			if (*end || iterations < 1) {
+				fprintf(stderr, "invalid iterations: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			compare = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (compare) {
+		old = bench_load(compare, &nr_old);
+		if (!old)
+			return 1;
+	}
+	if (output) {
+		out = fopen(output, "w");
+		if (!out) {
+			fprintf(stderr, "Failed to open %s: %s\n", output,
+				strerror(errno));
+			return 1;
+		}
+	}
+	if (!dir) {
+		dir = mkdtemp(tmpdir);
+		if (!dir) {
+			perror("mkdtemp");
+			return 1;
+		}
+	} else if (mkdir(dir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %s\n", dir,
+			strerror(errno));
+		return 1;
+	}
+
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", dir,
+			strerror(errno));
+		return 1;
+	}
+	err = bench_fixtures(dirfd);
+	close(dirfd);
+	if (err) {
+		fprintf(stderr, "Failed to write fixtures to %s: %s\n", dir,
+			strerror(-err));
+		goto out;
+	}
+	setenv("NVME_MOCK", dir, 1);
+	unsetenv("NVME_MOCK_LATENCY");
+
+	if (old)
+		fprintf(stderr, "%-26s %12s %12s %8s %10s %10s %8s %8s\n",
+			"benchmark", "ns/rec old", "ns/rec new", "delta",
+			"allocs old", "allocs new", "rss old", "rss new");
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		if (filter && !strstr(benches[i].name, filter))
+			continue;
+		if (bench_run(&benches[i], iterations, &r)) {
+			fprintf(stderr, "%s: benchmark failed\n",
+				benches[i].name);
+			err = -EIO;
+			continue;
+		}
+		bench_print(out, &r);
+		fflush(out);
+		for (j = 0; j < nr_old; j++)
+			if (!strcmp(old[j].name, r.name))
+				bench_compare(stderr, &r, &old[j]);
+	}
+out:
+	if (dir == tmpdir)
+		nftw(dir, bench_rm, 16, FTW_DEPTH | FTW_PHYS);
+	if (out != stdout)
+		fclose(out);
+	free(old);
+	return err ? 1 : 0;
+}
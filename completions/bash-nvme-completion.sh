@@ -10,7 +10,8 @@ _cmds="list id-ctrl id-ns list-ns id-iocs nvm-id-ctrl create-ns delete-ns \
 	security-recv resv-acquire resv-register resv-release \
 	resv-report dsm flush compare read write write-zeroes \
 	write-uncor copy reset subsystem-reset show-regs discover \
-	connect-all connect disconnect version help \
+	connect-all connect disconnect monitor batch serve replay feature-snapshot \
+	feature-diff version help \
 	intel lnvm memblaze list-subsys endurance-event-agg-log \
 	lba-status-log resv-notif-log"
 
@@ -77,7 +78,9 @@ nvme_list_opts () {
 			;;
 		"persistent-event-log")
 		opts+=" --action= -a --log-len= -l \
-			--raw-binary -b --output-format= -o"
+			--raw-binary -b --output-format= -o \
+			--event-type= -t --since= -S --until= -U \
+			--last= -n --state-file= -s"
 			;;
 		"pred-lat-event-agg-log")
 		opts+=" --log-entries= -e  --rae -r \
@@ -99,7 +102,7 @@ nvme_list_opts () {
 			;;
 		"error-log")
 		opts+=" --namespace-id= -n --raw-binary -b --log-entries= -e \
-			--output-format= -o"
+			--output-format= -o --state-file= -s --interval= -i"
 			;;
 		"endurance-event-agg-log")
 		opts+=" --log-entries= -e  --rae -r \
@@ -122,7 +125,7 @@ nvme_list_opts () {
 			;;
 		"format")
 		opts+=" --namespace-id= -n --timeout= -t --lbaf= -l \
-			--ses= -s --pil= -p -pi= -i --ms= -m --reset -r"
+			--ses= -s --pil= -p -pi= -i --ms= -m --reset -r --wait -w"
 			;;
 		"fw-activate")
 		opts+=" --action= -a --slot= -s"
@@ -235,7 +238,29 @@ nvme_list_opts () {
 			;;
 		"connect-all")
 		opts+=" --transport= -t --traddr= -a --trsvcid= -s
-			--hostnqn= -q --raw= -r"
+			--hostnqn= -q --raw= -r --jobs= -j"
+			;;
+		"monitor")
+		opts+=" --transport= -t --traddr= -a --trsvcid= -s
+			--hostnqn= -q --jobs= -j --batch-delay= -b
+			--verbose -v --quiet -S --timestamps"
+			;;
+		"batch")
+		opts+=" --stop-on-error -e --no-cache -n"
+			;;
+		"serve")
+		opts+=" --socket= -s --jobs= -j"
+			;;
+		"replay")
+		opts+=" --input= -i --compare= -c --pace= -p \
+			--output-format= -o --verbose -v --force -f"
+			;;
+		"feature-snapshot")
+		opts+=" --namespace-id= -n --output-file= -O"
+			;;
+		"feature-diff")
+		opts+=" --profile= -p --snapshot= -s --namespace-id= -n \
+			--exclude= -x --strict -S"
 			;;
 		"connect")
 		opts+=" --transport= -t --nqn= -n --traddr= -a --trsvcid -s \
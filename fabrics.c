@@ -34,6 +34,7 @@
 #include <stddef.h>
 #include <syslog.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -69,6 +70,8 @@ const char *conarg_host_traddr = "host_traddr";
 
 struct fabrics_config fabrics_cfg = {
 	.ctrl_loss_tmo = -1,
+	.jobs = NVMF_DEF_JOBS,
+	.discovery_tmo = NVMF_DEF_DISC_ENTRY_TMO,
 	.output_format = "normal",
 };
 
@@ -83,11 +86,14 @@ struct connect_args {
 };
 
 struct connect_args *tracked_ctrls;
+static pthread_mutex_t tracked_ctrls_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define PATH_NVME_FABRICS	"/dev/nvme-fabrics"
 #define PATH_NVMF_DISC		"/etc/nvme/discovery.conf"
 #define PATH_NVMF_HOSTNQN	"/etc/nvme/hostnqn"
 #define PATH_NVMF_HOSTID	"/etc/nvme/hostid"
+#define PATH_NVMF_RUNDIR	"/run/nvme"
+#define PATH_NVMF_DISC_CACHE	PATH_NVMF_RUNDIR "/discovery"
 #define MAX_DISC_ARGS		10
 #define MAX_DISC_RETRIES	10
 
@@ -272,38 +278,113 @@ int ctrl_instance(const char *device)
 }
 
 /*
- * Given a controller name, create a connect_args with its
- * attributes and compare the attributes against the connect args
- * given.
- * Return true/false based on whether it matches
+ * Snapshot of the connection attributes of all controllers in the system,
+ * taken once per invocation. Entries are hashed by their complete set of
+ * connect arguments, so looking up an existing controller for a discovery
+ * log record does not need to rescan sysfs.
  */
-static bool ctrl_matches_connectargs(const char *name, struct connect_args *args)
-{
+struct ctrl_index_entry {
+	char *name;
 	struct connect_args cargs;
-	bool found = false;
-	char *path = NULL, *addr;
-	int ret;
-	bool persistent = true;
+	bool persistent;
+	bool removed;
+	struct ctrl_index_entry *hnext;
+	struct ctrl_index_entry *next;
+};
 
-	ret = asprintf(&path, "%s/%s", SYS_NVME, name);
-	if (ret < 0)
-		return found;
+struct ctrl_index {
+	pthread_mutex_t lock;
+	bool valid;
+	int sysfd;	/* SYS_NVME, attributes are read relative to it */
+	char sys_nvme[PATH_MAX];
+	unsigned int nr_buckets;
+	struct ctrl_index_entry **buckets;
+	struct ctrl_index_entry *entries;
+	struct ctrl_index_entry **tail;
+};
+
+static struct ctrl_index ctrl_index = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.sysfd = -1,
+};
+
+static unsigned int ctrl_index_hash(struct connect_args *args)
+{
+	const char *fields[] = {
+		args->subsysnqn, args->transport, args->traddr,
+		args->trsvcid, args->host_traddr,
+	};
+	unsigned int hash = 2166136261u;
+	const char *p;
+	int i;
 
-	addr = nvme_get_ctrl_attr(path, "address");
-	if (!addr) {
-		fprintf(stderr, "nvme_get_ctrl_attr failed\n");
-		return found;
+	for (i = 0; i < ARRAY_SIZE(fields); i++) {
+		for (p = fields[i]; *p; p++)
+			hash = (hash ^ (unsigned char)*p) * 16777619u;
+		hash = (hash ^ ',') * 16777619u;
 	}
+	return hash;
+}
+
+static void free_ctrl_index_entry(struct ctrl_index_entry *e)
+{
+	free(e->cargs.subsysnqn);
+	free(e->cargs.transport);
+	free(e->cargs.traddr);
+	free(e->cargs.trsvcid);
+	free(e->cargs.host_traddr);
+	free(e->name);
+	free(e);
+}
 
-	cargs.subsysnqn = nvme_get_ctrl_attr(path, "subsysnqn");
-	cargs.transport = nvme_get_ctrl_attr(path, "transport");
-	cargs.traddr = parse_conn_arg(addr, ' ', conarg_traddr);
-	cargs.trsvcid = parse_conn_arg(addr, ' ', conarg_trsvcid);
-	cargs.host_traddr = parse_conn_arg(addr, ' ', conarg_host_traddr);
+/*
+ * Given a controller name, create an index entry with its
+ * connection attributes. Called with ctrl_index.lock held.
+ */
+static struct ctrl_index_entry *ctrl_index_read(const char *name)
+{
+	struct ctrl_index_entry *e;
+	char addr[1024], buf[1024];
+	int dirfd;
+
+	if (ctrl_index.sysfd < 0)
+		ctrl_index.sysfd = open(ctrl_index.sys_nvme,
+					O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	dirfd = openat(ctrl_index.sysfd, name,
+		       O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0)
+		return NULL;
 
-	if (!strcmp(cargs.subsysnqn, NVME_DISC_SUBSYS_NAME)) {
-		char *kato_str = nvme_get_ctrl_attr(path, "kato"), *p;
+	if (sysfs_read_attr(dirfd, "address", addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "failed to read %s/%s/address\n",
+			ctrl_index.sys_nvme, name);
+		close(dirfd);
+		return NULL;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		goto out;
+
+	e->name = strdup(name);
+	e->persistent = true;
+	if (sysfs_read_attr(dirfd, "subsysnqn", buf, sizeof(buf)) >= 0)
+		e->cargs.subsysnqn = strdup(buf);
+	if (sysfs_read_attr(dirfd, "transport", buf, sizeof(buf)) >= 0)
+		e->cargs.transport = strdup(buf);
+	e->cargs.traddr = parse_conn_arg(addr, ',', conarg_traddr);
+	e->cargs.trsvcid = parse_conn_arg(addr, ',', conarg_trsvcid);
+	e->cargs.host_traddr = parse_conn_arg(addr, ',', conarg_host_traddr);
+	if (!e->name || !e->cargs.subsysnqn || !e->cargs.transport ||
+	    !e->cargs.traddr || !e->cargs.trsvcid || !e->cargs.host_traddr) {
+		free_ctrl_index_entry(e);
+		e = NULL;
+		goto out;
+	}
+
+	if (!strcmp(e->cargs.subsysnqn, NVME_DISC_SUBSYS_NAME)) {
 		unsigned int kato = 0;
+		char *p;
 
 		/*
 		 * When looking up discovery controllers we have to skip
@@ -314,34 +395,141 @@ static bool ctrl_matches_connectargs(const char *name, struct connect_args *args
 		 * On older kernels, the 'kato' attribute isn't present.
 		 * Assume a persistent controller for these installations.
 		 */
-		if (kato_str) {
-			kato = strtoul(kato_str, &p, 0);
-			if (p == kato_str)
+		if (sysfs_read_attr(dirfd, "kato", buf, sizeof(buf)) >= 0) {
+			kato = strtoul(buf, &p, 0);
+			if (p == buf)
 				kato = 0;
-			free(kato_str);
-			persistent = (kato != 0);
+			e->persistent = (kato != 0);
 		}
 	}
+out:
+	close(dirfd);
+	return e;
+}
+
+/* called with ctrl_index.lock held */
+static void ctrl_index_insert(struct ctrl_index_entry *e)
+{
+	unsigned int bucket;
+
+	bucket = ctrl_index_hash(&e->cargs) & (ctrl_index.nr_buckets - 1);
+	e->hnext = ctrl_index.buckets[bucket];
+	ctrl_index.buckets[bucket] = e;
+	*ctrl_index.tail = e;
+	ctrl_index.tail = &e->next;
+}
+
+/* called with ctrl_index.lock held */
+static int ctrl_index_build(void)
+{
+	struct dirent **devices;
+	struct ctrl_index_entry *e;
+	int i, n;
+
+	if (ctrl_index.valid)
+		return 0;
+
+	ctrl_index.entries = NULL;
+	ctrl_index.tail = &ctrl_index.entries;
+
+	snprintf(ctrl_index.sys_nvme, sizeof(ctrl_index.sys_nvme), "%s%s",
+		 nvme_backend->sysfs_root, SYS_NVME);
+	n = scandir(ctrl_index.sys_nvme, &devices, scan_ctrls_filter,
+		    alphasort);
+	if (n < 0) {
+		msg(LOG_ERR, "no NVMe controller(s) detected.\n");
+		n = 0;
+		devices = NULL;
+	}
+
+	/* keep the load factor below one, including controllers we add */
+	ctrl_index.nr_buckets = 64;
+	while (ctrl_index.nr_buckets < 2 * n)
+		ctrl_index.nr_buckets <<= 1;
+	ctrl_index.buckets = calloc(ctrl_index.nr_buckets,
+				    sizeof(*ctrl_index.buckets));
+	if (!ctrl_index.buckets) {
+		msg(LOG_ERR, "no memory for controller index\n");
+		goto free_devices;
+	}
+
+	for (i = 0; i < n; i++) {
+		e = ctrl_index_read(devices[i]->d_name);
+		if (e)
+			ctrl_index_insert(e);
+	}
+	ctrl_index.valid = true;
+
+free_devices:
+	for (i = 0; i < n; i++)
+		free(devices[i]);
+	free(devices);
+
+	return ctrl_index.valid ? 0 : -ENOMEM;
+}
 
-	if (persistent &&
-	    !strcmp(cargs.subsysnqn, args->subsysnqn) &&
-	    !strcmp(cargs.transport, args->transport) &&
-	    (!strcmp(cargs.traddr, args->traddr) ||
+static bool ctrl_index_entry_matches(struct ctrl_index_entry *e,
+				     struct connect_args *args)
+{
+	return !e->removed && e->persistent &&
+	    !strcmp(e->cargs.subsysnqn, args->subsysnqn) &&
+	    !strcmp(e->cargs.transport, args->transport) &&
+	    (!strcmp(e->cargs.traddr, args->traddr) ||
 	     !strcmp(args->traddr, "none")) &&
-	    (!strcmp(cargs.trsvcid, args->trsvcid) ||
+	    (!strcmp(e->cargs.trsvcid, args->trsvcid) ||
 	     !strcmp(args->trsvcid, "none")) &&
-	    (!strcmp(cargs.host_traddr, args->host_traddr) ||
-	     !strcmp(args->host_traddr, "none")))
-		found = true;
-
-	free(cargs.subsysnqn);
-	free(cargs.transport);
-	free(cargs.traddr);
-	free(cargs.trsvcid);
-	free(cargs.host_traddr);
-	free(addr);
-	free(path);
+	    (!strcmp(e->cargs.host_traddr, args->host_traddr) ||
+	     !strcmp(args->host_traddr, "none"));
+}
+
+/* called with ctrl_index.lock held */
+static struct ctrl_index_entry *ctrl_index_find(struct connect_args *args)
+{
+	struct ctrl_index_entry *e, *found = NULL;
+	unsigned int bucket;
+
+	/* wildcard arguments can't be hashed, fall back to a full walk */
+	if (!strcmp(args->traddr, "none") || !strcmp(args->trsvcid, "none") ||
+	    !strcmp(args->host_traddr, "none")) {
+		for (e = ctrl_index.entries; e; e = e->next)
+			if (ctrl_index_entry_matches(e, args))
+				return e;
+		return NULL;
+	}
 
+	/*
+	 * Chains are in reverse insertion order; return the last match
+	 * to find the same controller a sorted sysfs walk would find.
+	 */
+	bucket = ctrl_index_hash(args) & (ctrl_index.nr_buckets - 1);
+	for (e = ctrl_index.buckets[bucket]; e; e = e->hnext)
+		if (ctrl_index_entry_matches(e, args))
+			found = e;
+	return found;
+}
+
+/*
+ * Compare the attributes of the named controller against the connect
+ * args given.
+ * Return true/false based on whether it matches
+ */
+static bool ctrl_matches_connectargs(const char *name, struct connect_args *args)
+{
+	struct ctrl_index_entry *e;
+	bool found = false;
+
+	pthread_mutex_lock(&ctrl_index.lock);
+	if (ctrl_index_build())
+		goto out;
+
+	for (e = ctrl_index.entries; e; e = e->next) {
+		if (strcmp(e->name, name))
+			continue;
+		found = ctrl_index_entry_matches(e, args);
+		break;
+	}
+out:
+	pthread_mutex_unlock(&ctrl_index.lock);
 	return found;
 }
 
@@ -354,32 +542,90 @@ static bool ctrl_matches_connectargs(const char *name, struct connect_args *args
  */
 static char *find_ctrl_with_connectargs(struct connect_args *args)
 {
-	struct dirent **devices;
+	struct ctrl_index_entry *e;
 	char *devname = NULL;
-	int i, n;
 
-	n = scandir(SYS_NVME, &devices, scan_ctrls_filter, alphasort);
-	if (n < 0) {
-		msg(LOG_ERR, "no NVMe controller(s) detected.\n");
-		return NULL;
+	pthread_mutex_lock(&ctrl_index.lock);
+	if (ctrl_index_build())
+		goto out;
+
+	e = ctrl_index_find(args);
+	if (e) {
+		devname = strdup(e->name);
+		if (devname == NULL)
+			msg(LOG_ERR, "no memory for ctrl name %s\n", e->name);
 	}
+out:
+	pthread_mutex_unlock(&ctrl_index.lock);
+	return devname;
+}
 
-	for (i = 0; i < n; i++) {
-		if (ctrl_matches_connectargs(devices[i]->d_name, args)) {
-			devname = strdup(devices[i]->d_name);
-			if (devname == NULL)
-				msg(LOG_ERR, "no memory for ctrl name %s\n",
-						devices[i]->d_name);
-			goto cleanup_devices;
-		}
+/*
+ * Keep the index in sync with controllers created or deleted by this
+ * invocation. Nothing needs to be done before the index has been built,
+ * it will pick up the current state of the system when it is.
+ */
+static void ctrl_index_add(int instance)
+{
+	struct ctrl_index_entry *e;
+	char name[32];
+
+	snprintf(name, sizeof(name), "nvme%d", instance);
+	pthread_mutex_lock(&ctrl_index.lock);
+	if (ctrl_index.valid) {
+		e = ctrl_index_read(name);
+		if (e)
+			ctrl_index_insert(e);
 	}
+	pthread_mutex_unlock(&ctrl_index.lock);
+}
 
-cleanup_devices:
-	for (i = 0; i < n; i++)
-		free(devices[i]);
-	free(devices);
+static void ctrl_index_remove(int instance)
+{
+	struct ctrl_index_entry *e;
+	char name[32];
+
+	snprintf(name, sizeof(name), "nvme%d", instance);
+	pthread_mutex_lock(&ctrl_index.lock);
+	for (e = ctrl_index.valid ? ctrl_index.entries : NULL; e; e = e->next)
+		if (!strcmp(e->name, name))
+			e->removed = true;
+	pthread_mutex_unlock(&ctrl_index.lock);
+}
 
-	return devname;
+static void free_connect_args(struct connect_args *cargs);
+
+/*
+ * Forget everything learned about existing controllers so far. Long
+ * running callers use this to pick up controllers which were added or
+ * removed behind our back since the last lookup.
+ */
+void nvmf_reset_ctrl_state(void)
+{
+	struct ctrl_index_entry *e;
+	struct connect_args *c;
+
+	pthread_mutex_lock(&ctrl_index.lock);
+	while (ctrl_index.valid && ctrl_index.entries) {
+		e = ctrl_index.entries;
+		ctrl_index.entries = e->next;
+		free_ctrl_index_entry(e);
+	}
+	free(ctrl_index.buckets);
+	ctrl_index.buckets = NULL;
+	ctrl_index.valid = false;
+	if (ctrl_index.sysfd >= 0)
+		close(ctrl_index.sysfd);
+	ctrl_index.sysfd = -1;
+	pthread_mutex_unlock(&ctrl_index.lock);
+
+	pthread_mutex_lock(&tracked_ctrls_lock);
+	while (tracked_ctrls) {
+		c = tracked_ctrls;
+		tracked_ctrls = c->next;
+		free_connect_args(c);
+	}
+	pthread_mutex_unlock(&tracked_ctrls_lock);
 }
 
 static struct connect_args *extract_connect_args(char *argstr)
@@ -420,11 +666,13 @@ static void track_ctrl(char *argstr)
 	if (!cargs)
 		return;
 
+	pthread_mutex_lock(&tracked_ctrls_lock);
 	if (!tracked_ctrls)
 		tracked_ctrls = cargs;
 	else
 		tracked_ctrls->tail->next = cargs;
 	tracked_ctrls->tail = cargs;
+	pthread_mutex_unlock(&tracked_ctrls_lock);
 }
 
 static int add_ctrl(const char *argstr)
@@ -433,7 +681,7 @@ static int add_ctrl(const char *argstr)
 	char buf[BUF_SIZE], *options, *p;
 	int token, ret, fd, len = strlen(argstr);
 
-	fd = open(PATH_NVME_FABRICS, O_RDWR);
+	fd = nvme_backend->open(PATH_NVME_FABRICS, O_RDWR);
 	if (fd < 0) {
 		msg(LOG_ERR, "Failed to open %s: %s\n",
 			 PATH_NVME_FABRICS, strerror(errno));
@@ -441,7 +689,7 @@ static int add_ctrl(const char *argstr)
 		goto out;
 	}
 
-	ret = write(fd, argstr, len);
+	ret = nvme_backend->write(fd, argstr, len);
 	if (ret != len) {
 		if (errno != EALREADY)
 			msg(LOG_NOTICE, "Failed to write to %s: %s\n",
@@ -450,7 +698,7 @@ static int add_ctrl(const char *argstr)
 		goto out_close;
 	}
 
-	len = read(fd, buf, BUF_SIZE);
+	len = nvme_backend->read(fd, buf, BUF_SIZE);
 	if (len < 0) {
 		msg(LOG_ERR, "Failed to read from %s: %s\n",
 			 PATH_NVME_FABRICS, strerror(errno));
@@ -471,6 +719,7 @@ static int add_ctrl(const char *argstr)
 				goto out_fail;
 			ret = token;
 			track_ctrl((char *)argstr);
+			ctrl_index_add(ret);
 			goto out_close;
 		default:
 			/* ignore */
@@ -491,7 +740,7 @@ static int remove_ctrl_by_path(char *sysfs_path)
 {
 	int ret, fd;
 
-	fd = open(sysfs_path, O_WRONLY);
+	fd = nvme_backend->open(sysfs_path, O_WRONLY);
 	if (fd < 0) {
 		ret = -errno;
 		msg(LOG_ERR, "Failed to open %s: %s\n", sysfs_path,
@@ -499,7 +748,7 @@ static int remove_ctrl_by_path(char *sysfs_path)
 		goto out;
 	}
 
-	if (write(fd, "1", 1) != 1) {
+	if (nvme_backend->write(fd, "1", 1) != 1) {
 		ret = -errno;
 		goto out_close;
 	}
@@ -516,28 +765,27 @@ int remove_ctrl(int instance)
 	char *sysfs_path;
 	int ret;
 
-	if (asprintf(&sysfs_path, "/sys/class/nvme/nvme%d/delete_controller",
-			instance) < 0) {
+	if (asprintf(&sysfs_path, "%s%s/nvme%d/delete_controller",
+			nvme_backend->sysfs_root, SYS_NVME, instance) < 0) {
 		ret = -errno;
 		goto out;
 	}
 
 	ret = remove_ctrl_by_path(sysfs_path);
 	free(sysfs_path);
+	if (!ret)
+		ctrl_index_remove(instance);
 out:
 	return ret;
 }
 
-enum {
-	DISC_OK,
-	DISC_NO_LOG,
-	DISC_GET_NUMRECS,
-	DISC_GET_LOG,
-	DISC_RETRY_EXHAUSTED,
-	DISC_NOT_EQUAL,
-};
-
+/*
+ * If cached is given and the generation counter and number of records
+ * reported by the controller still match it, the cached log is returned
+ * in *logp after reading just the log header.
+ */
 static int nvmf_get_log_page_discovery(const char *dev_path,
+		struct nvmf_disc_rsp_page_hdr *cached,
 		struct nvmf_disc_rsp_page_hdr **logp, int *numrec, int *status)
 {
 	struct nvmf_disc_rsp_page_hdr *log;
@@ -545,7 +793,7 @@ static int nvmf_get_log_page_discovery(const char *dev_path,
 	unsigned long genctr;
 	int error, fd, max_retries = MAX_DISC_RETRIES, retries = 0;
 
-	fd = open(dev_path, O_RDWR);
+	fd = nvme_backend->open(dev_path, O_RDWR);
 	if (fd < 0) {
 		error = -errno;
 		msg(LOG_ERR, "Failed to open %s: %s\n",
@@ -561,9 +809,10 @@ static int nvmf_get_log_page_discovery(const char *dev_path,
 
 	/*
 	 * Issue first get log page w/numdl small enough to retrieve numrec.
-	 * We just want to know how many records to retrieve.
+	 * We just want to know how many records to retrieve.  The buffer
+	 * covers the whole header so it can be compared against cached.
 	 */
-	log = calloc(1, hdr_size);
+	log = calloc(1, sizeof(*log));
 	if (!log) {
 		perror("could not alloc memory for discovery log header");
 		error = -ENOMEM;
@@ -576,6 +825,14 @@ static int nvmf_get_log_page_discovery(const char *dev_path,
 		goto out_free_log;
 	}
 
+	if (cached && log->numrec && log->genctr == cached->genctr &&
+	    log->numrec == cached->numrec) {
+		*numrec = le64_to_cpu(cached->numrec);
+		*logp = cached;
+		error = DISC_OK;
+		goto out_free_log;
+	}
+
 	do {
 		unsigned int log_size;
 
@@ -670,6 +927,158 @@ static int space_strip_len(int max, const char *str)
 	return i + 1;
 }
 
+/*
+ * Discovery logs retrieved through persistent discovery controllers are
+ * cached under PATH_NVMF_DISC_CACHE, keyed by the discovery controller
+ * address and host NQN. As long as the generation counter reported by
+ * the controller is unchanged the cached copy is used, which saves
+ * transferring the full log on every invocation.
+ */
+struct nvmf_disc_cache_hdr {
+	char	magic[8];
+	__u32	keylen;
+	__u32	loglen;
+};
+
+#define NVMF_DISC_CACHE_MAGIC	"NVMFDLC1"
+
+static char *disc_cache_key(const char *argstr)
+{
+	const char *fields[] = {
+		conarg_transport, conarg_traddr, conarg_trsvcid,
+		conarg_host_traddr, "hostnqn",
+	};
+	char *key = NULL, *value, *tmp;
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(fields); i++) {
+		value = parse_conn_arg(argstr, ',', fields[i]);
+		if (!value)
+			goto err;
+		ret = asprintf(&tmp, "%s%s%s=%s", key ? key : "",
+			       key ? "," : "", fields[i], value);
+		free(value);
+		if (ret < 0)
+			goto err;
+		free(key);
+		key = tmp;
+	}
+	return key;
+err:
+	free(key);
+	return NULL;
+}
+
+static char *disc_cache_path(const char *key)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	char *path;
+
+	for (; *key; key++)
+		hash = (hash ^ (unsigned char)*key) * 1099511628211ULL;
+	if (asprintf(&path, "%s%s/%016llx", nvme_backend->sysfs_root,
+		     PATH_NVMF_DISC_CACHE, hash) < 0)
+		return NULL;
+	return path;
+}
+
+static struct nvmf_disc_rsp_page_hdr *disc_cache_load(const char *key)
+{
+	struct nvmf_disc_rsp_page_hdr *log = NULL;
+	struct nvmf_disc_cache_hdr hdr;
+	char *path, *k = NULL;
+	size_t keylen = strlen(key);
+	int fd;
+
+	path = disc_cache_path(key);
+	if (!path)
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return NULL;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, NVMF_DISC_CACHE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.keylen != keylen ||
+	    hdr.loglen < sizeof(struct nvmf_disc_rsp_page_hdr))
+		goto out;
+
+	k = malloc(keylen);
+	log = malloc(hdr.loglen);
+	if (!k || !log ||
+	    read(fd, k, keylen) != keylen || memcmp(k, key, keylen) ||
+	    read(fd, log, hdr.loglen) != hdr.loglen ||
+	    hdr.loglen != sizeof(*log) + le64_to_cpu(log->numrec) *
+			  sizeof(struct nvmf_disc_rsp_page_entry)) {
+		free(log);
+		log = NULL;
+	}
+out:
+	free(k);
+	close(fd);
+	return log;
+}
+
+static void disc_cache_store(const char *key,
+			     struct nvmf_disc_rsp_page_hdr *log, int numrec)
+{
+	struct nvmf_disc_cache_hdr hdr = {
+		.magic = NVMF_DISC_CACHE_MAGIC,
+		.keylen = strlen(key),
+		.loglen = sizeof(*log) +
+			numrec * sizeof(struct nvmf_disc_rsp_page_entry),
+	};
+	char *path, *tmp, *p;
+	int fd, err;
+
+	path = disc_cache_path(key);
+	if (!path)
+		return;
+	if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+		goto free_path;
+
+	/* create PATH_NVMF_DISC_CACHE and its parents below the root */
+	for (p = tmp + strlen(nvme_backend->sysfs_root) + 1;
+	     (p = strchr(p, '/')); p++) {
+		*p = '\0';
+		err = mkdir(tmp, strchr(p + 1, '/') ? 0755 : 0700);
+		*p = '/';
+		if (err && errno != EEXIST)
+			goto free_tmp;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto free_tmp;
+
+	/* write to a temporary file first so readers never see partial logs */
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write(fd, key, hdr.keylen) != hdr.keylen ||
+	    write(fd, log, hdr.loglen) != hdr.loglen ||
+	    rename(tmp, path)) {
+		msg(LOG_DEBUG, "failed to write discovery cache %s\n", path);
+		unlink(tmp);
+	}
+	close(fd);
+free_tmp:
+	free(tmp);
+free_path:
+	free(path);
+}
+
+static void disc_cache_remove(const char *key)
+{
+	char *path;
+
+	path = disc_cache_path(key);
+	if (!path)
+		return;
+	unlink(path);
+	free(path);
+}
+
 static void print_discovery_log(struct nvmf_disc_rsp_page_hdr *log, int numrec)
 {
 	int i;
@@ -1082,7 +1491,11 @@ free_addrinfo:
 	return ret;
 }
 
-static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e)
+static int __do_discover(char *argstr, bool connect,
+			 enum nvme_print_flags flags, struct fabrics_config *cfg);
+
+static int connect_ctrl(struct nvmf_disc_rsp_page_entry *e,
+			struct fabrics_config *cfg)
 {
 	char argstr[BUF_SIZE], *p;
 	const char *transport;
@@ -1109,78 +1522,78 @@ retry:
 		return -EINVAL;
 	p += len;
 
-	if (fabrics_cfg.hostnqn && strcmp(fabrics_cfg.hostnqn, "none")) {
-		len = sprintf(p, ",hostnqn=%s", fabrics_cfg.hostnqn);
+	if (cfg->hostnqn && strcmp(cfg->hostnqn, "none")) {
+		len = sprintf(p, ",hostnqn=%s", cfg->hostnqn);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.hostid && strcmp(fabrics_cfg.hostid, "none")) {
-		len = sprintf(p, ",hostid=%s", fabrics_cfg.hostid);
+	if (cfg->hostid && strcmp(cfg->hostid, "none")) {
+		len = sprintf(p, ",hostid=%s", cfg->hostid);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.queue_size && !discover) {
-		len = sprintf(p, ",queue_size=%d", fabrics_cfg.queue_size);
+	if (cfg->queue_size && !discover) {
+		len = sprintf(p, ",queue_size=%d", cfg->queue_size);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.nr_io_queues && !discover) {
-		len = sprintf(p, ",nr_io_queues=%d", fabrics_cfg.nr_io_queues);
+	if (cfg->nr_io_queues && !discover) {
+		len = sprintf(p, ",nr_io_queues=%d", cfg->nr_io_queues);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.nr_write_queues) {
-		len = sprintf(p, ",nr_write_queues=%d", fabrics_cfg.nr_write_queues);
+	if (cfg->nr_write_queues) {
+		len = sprintf(p, ",nr_write_queues=%d", cfg->nr_write_queues);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.nr_poll_queues) {
-		len = sprintf(p, ",nr_poll_queues=%d", fabrics_cfg.nr_poll_queues);
+	if (cfg->nr_poll_queues) {
+		len = sprintf(p, ",nr_poll_queues=%d", cfg->nr_poll_queues);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.host_traddr && strcmp(fabrics_cfg.host_traddr, "none")) {
-		len = sprintf(p, ",host_traddr=%s", fabrics_cfg.host_traddr);
+	if (cfg->host_traddr && strcmp(cfg->host_traddr, "none")) {
+		len = sprintf(p, ",host_traddr=%s", cfg->host_traddr);
 		if (len < 0)
 			return -EINVAL;
 		p+= len;
 	}
 
-	if (fabrics_cfg.reconnect_delay) {
-		len = sprintf(p, ",reconnect_delay=%d", fabrics_cfg.reconnect_delay);
+	if (cfg->reconnect_delay) {
+		len = sprintf(p, ",reconnect_delay=%d", cfg->reconnect_delay);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if ((e->trtype != NVMF_TRTYPE_LOOP) && (fabrics_cfg.ctrl_loss_tmo >= -1)) {
-		len = sprintf(p, ",ctrl_loss_tmo=%d", fabrics_cfg.ctrl_loss_tmo);
+	if ((e->trtype != NVMF_TRTYPE_LOOP) && (cfg->ctrl_loss_tmo >= -1)) {
+		len = sprintf(p, ",ctrl_loss_tmo=%d", cfg->ctrl_loss_tmo);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.tos != -1) {
-		len = sprintf(p, ",tos=%d", fabrics_cfg.tos);
+	if (cfg->tos != -1) {
+		len = sprintf(p, ",tos=%d", cfg->tos);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.keep_alive_tmo) {
-		len = sprintf(p, ",keep_alive_tmo=%d", fabrics_cfg.keep_alive_tmo);
+	if (cfg->keep_alive_tmo) {
+		len = sprintf(p, ",keep_alive_tmo=%d", cfg->keep_alive_tmo);
 		if (len < 0)
 			return -EINVAL;
 		p += len;
@@ -1198,14 +1611,14 @@ retry:
 		return -EINVAL;
 	p += len;
 
-	if (fabrics_cfg.hdr_digest) {
+	if (cfg->hdr_digest) {
 		len = sprintf(p, ",hdr_digest");
 		if (len < 0)
 			return -EINVAL;
 		p += len;
 	}
 
-	if (fabrics_cfg.data_digest) {
+	if (cfg->data_digest) {
 		len = sprintf(p, ",data_digest");
 		if (len < 0)
 			return -EINVAL;
@@ -1265,10 +1678,10 @@ retry:
 	if (discover) {
 		enum nvme_print_flags flags;
 
-		flags = validate_output_format(fabrics_cfg.output_format);
+		flags = validate_output_format(cfg->output_format);
 		if (flags < 0)
 			flags = NORMAL;
-		ret = do_discover(argstr, true, flags);
+		ret = __do_discover(argstr, true, flags, cfg);
 	} else
 		ret = add_ctrl(argstr);
 	if (ret == -EINVAL && disable_sqflow &&
@@ -1280,157 +1693,325 @@ retry:
 	return ret;
 }
 
-static bool cargs_match_found(struct nvmf_disc_rsp_page_entry *entry)
+static bool cargs_match_found(struct nvmf_disc_rsp_page_entry *entry,
+			      struct fabrics_config *cfg)
 {
 	struct connect_args cargs __cleanup__(destruct_connect_args) = { NULL, };
-	struct connect_args *c = tracked_ctrls;
+	struct connect_args *c;
 
 	cargs.traddr = strdup(entry->traddr);
 	cargs.transport = strdup(trtype_str(entry->trtype));
 	cargs.subsysnqn = strdup(entry->subnqn);
 	cargs.trsvcid = strdup(entry->trsvcid);
-	cargs.host_traddr = strdup(fabrics_cfg.host_traddr ?: "\0");
+	cargs.host_traddr = strdup(cfg->host_traddr ?: "\0");
 
 	/* check if we have a match in the discovery recursion */
-	while (c) {
+	pthread_mutex_lock(&tracked_ctrls_lock);
+	for (c = tracked_ctrls; c; c = c->next) {
 		if (!strcmp(cargs.subsysnqn, c->subsysnqn) &&
 		    !strcmp(cargs.transport, c->transport) &&
 		    !strcmp(cargs.traddr, c->traddr) &&
 		    !strcmp(cargs.trsvcid, c->trsvcid) &&
 		    !strcmp(cargs.host_traddr, c->host_traddr))
-			return true;
-		c = c->next;
+			break;
 	}
+	pthread_mutex_unlock(&tracked_ctrls_lock);
+	if (c)
+		return true;
 
 	/* check if we have a matching existing controller */
 	return find_ctrl_with_connectargs(&cargs) != NULL;
 }
 
-static bool should_connect(struct nvmf_disc_rsp_page_entry *entry)
+static bool should_connect(struct nvmf_disc_rsp_page_entry *entry,
+			   struct fabrics_config *cfg)
 {
 	int len;
 
-	if (cargs_match_found(entry))
+	if (cargs_match_found(entry, cfg))
 		return false;
 
-	if (!fabrics_cfg.matching_only || !fabrics_cfg.traddr)
+	if (!cfg->matching_only || !cfg->traddr)
 		return true;
 
 	len = space_strip_len(NVMF_TRADDR_SIZE, entry->traddr);
-	return !strncmp(fabrics_cfg.traddr, entry->traddr, len);
+	return !strncmp(cfg->traddr, entry->traddr, len);
 }
 
-static int connect_ctrls(struct nvmf_disc_rsp_page_hdr *log, int numrec)
+struct connect_pool {
+	pthread_mutex_t lock;
+	struct connect_job *jobs;
+	int nr_jobs;
+	int next;
+};
+
+static void *connect_worker(void *arg)
 {
-	int i;
-	int instance;
-	int ret = 0;
+	struct connect_pool *pool = arg;
+	struct connect_job *job;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		job = NULL;
+		while (pool->next < pool->nr_jobs && !job) {
+			job = &pool->jobs[pool->next++];
+			if (!job->queued)
+				job = NULL;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		if (!job)
+			break;
+		job->instance = connect_ctrl(job->e, job->cfg);
+	}
+	return NULL;
+}
 
-	for (i = 0; i < numrec; i++) {
-		if (!should_connect(&log->entries[i]))
-			continue;
+/*
+ * Connect to all queued I/O controllers using up to fabrics_cfg.jobs
+ * concurrent workers. Writes to /dev/nvme-fabrics block until the
+ * transport association is established, so issuing them from several
+ * threads bounds the total time by the slowest connect rather than the
+ * sum of all of them. The calling thread acts as one of the workers.
+ */
+static void run_connect_pool(struct connect_job *jobs, int nr_jobs,
+			     int nr_queued)
+{
+	struct connect_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.jobs = jobs,
+		.nr_jobs = nr_jobs,
+	};
+	pthread_t *threads = NULL;
+	int i, err, nr_threads;
 
-		instance = connect_ctrl(&log->entries[i]);
+	nr_threads = min(fabrics_cfg.jobs, nr_queued) - 1;
+	if (nr_threads > 0)
+		threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		nr_threads = 0;
 
-		/* clean success */
-		if (instance >= 0)
-			continue;
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&threads[i], NULL, connect_worker, &pool);
+		if (err) {
+			msg(LOG_WARNING, "failed to start connect worker: %s\n",
+			    strerror(err));
+			break;
+		}
+	}
+	nr_threads = i;
+
+	connect_worker(&pool);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void report_connect_result(struct nvmf_disc_rsp_page_entry *e,
+				  int instance)
+{
+	/* already connected print message	*/
+	if (instance == -EALREADY)
+		msg(LOG_NOTICE, "traddr=%.*s is already connected\n",
+		    space_strip_len(NVMF_TRADDR_SIZE, e->traddr), e->traddr);
+
+	/*
+	 * don't error out. The Discovery Log may contain
+	 * devices that aren't necessarily connectable via
+	 * the system/host transport port. Let those items
+	 * fail and continue on to the next log element.
+	 */
+}
+
+/* a log page may report the same port more than once */
+static bool connect_job_dup(struct connect_job *jobs, int i)
+{
+	int j;
+
+	for (j = 0; j < i; j++)
+		if (disc_entry_equal(jobs[j].e, jobs[j].cfg,
+				     jobs[i].e, jobs[i].cfg))
+			return true;
+	return false;
+}
+
+/*
+ * I/O controllers are independent of each other and are connected
+ * in parallel. Referrals to other discovery controllers recurse
+ * into __do_discover(), which updates the configuration they came
+ * from, so those are still handled one at a time once the pool has
+ * drained. Either kind of job is marked queued once it was handled,
+ * with the result in instance; for a referral that is 0 on success.
+ */
+void connect_jobs(struct connect_job *jobs, int nr_jobs)
+{
+	int i, nr_queued = 0;
 
-		/* already connected print message	*/
-		if (instance == -EALREADY) {
-			const char *traddr = log->entries[i].traddr;
+	for (i = 0; i < nr_jobs; i++) {
+		struct connect_job *job = &jobs[i];
 
-			msg(LOG_NOTICE, "traddr=%.*s is already connected\n",
-					space_strip_len(NVMF_TRADDR_SIZE,
-							traddr),
-					traddr);
+		job->queued = job->e->subtype != NVME_NQN_DISC &&
+			!connect_job_dup(jobs, i) &&
+			should_connect(job->e, job->cfg);
+		if (job->queued)
+			nr_queued++;
+	}
+
+	run_connect_pool(jobs, nr_jobs, nr_queued);
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (jobs[i].queued)
+			report_connect_result(jobs[i].e, jobs[i].instance);
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		struct connect_job *job = &jobs[i];
+
+		if (job->e->subtype != NVME_NQN_DISC ||
+		    connect_job_dup(jobs, i) ||
+		    !should_connect(job->e, job->cfg))
 			continue;
-		}
+		job->queued = true;
+		job->instance = connect_ctrl(job->e, job->cfg);
+		report_connect_result(job->e, job->instance);
+	}
+}
 
-		/*
-		 * don't error out. The Discovery Log may contain
-		 * devices that aren't necessarily connectable via
-		 * the system/host transport port. Let those items
-		 * fail and continue on to the next log element.
-		 */
+static int connect_ctrls(struct nvmf_disc_rsp_page_hdr *log, int numrec,
+			 struct fabrics_config *cfg)
+{
+	struct connect_job *jobs;
+	int i;
+
+	jobs = calloc(numrec, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < numrec; i++) {
+		jobs[i].e = &log->entries[i];
+		jobs[i].cfg = cfg;
 	}
+	connect_jobs(jobs, numrec);
+	free(jobs);
 
-	return ret;
+	return 0;
 }
 
-static void nvmf_get_host_identifiers(int ctrl_instance)
+static void nvmf_get_host_identifiers(int ctrl_instance,
+				      struct fabrics_config *cfg)
 {
 	char *path;
 
-	if (asprintf(&path, "%s/nvme%d", SYS_NVME, ctrl_instance) < 0)
+	if (asprintf(&path, "%s%s/nvme%d", nvme_backend->sysfs_root, SYS_NVME,
+		     ctrl_instance) < 0)
 		return;
-	fabrics_cfg.hostnqn = nvme_get_ctrl_attr(path, "hostnqn");
-	fabrics_cfg.hostid = nvme_get_ctrl_attr(path, "hostid");
+	cfg->hostnqn = nvme_get_ctrl_attr(path, "hostnqn");
+	cfg->hostid = nvme_get_ctrl_attr(path, "hostid");
 }
 
-static DEFINE_CLEANUP_FUNC(cleanup_log, struct nvmf_disc_rsp_page_hdr *, free);
-
-int do_discover(char *argstr, bool connect, enum nvme_print_flags flags)
+/*
+ * Retrieve the discovery log from the discovery controller described by
+ * argstr, reusing an existing controller when possible. Only the given
+ * configuration is updated, so this may run for several discovery
+ * controllers concurrently.
+ */
+int nvmf_discover(char *argstr, struct fabrics_config *cfg,
+		  struct nvmf_disc_result *res)
 {
-	struct nvmf_disc_rsp_page_hdr *log __cleanup__(cleanup_log) = NULL;
-	char *dev_name;
-	int instance, numrec = 0, ret, err;
-	int status = 0;
+	struct nvmf_disc_rsp_page_hdr *cached = NULL;
 	struct connect_args *cargs;
+	char *dev_name, *key = NULL;
+	int instance, err;
+	bool hit;
 
 	cargs = extract_connect_args(argstr);
 	if (!cargs)
 		return -ENOMEM;
 
-	if (fabrics_cfg.device &&
-	    !ctrl_matches_connectargs(fabrics_cfg.device, cargs)) {
-		free(fabrics_cfg.device);
-		fabrics_cfg.device = NULL;
+	if (cfg->device &&
+	    !ctrl_matches_connectargs(cfg->device, cargs)) {
+		free(cfg->device);
+		cfg->device = NULL;
 	}
-	if (!fabrics_cfg.device)
-		fabrics_cfg.device = find_ctrl_with_connectargs(cargs);
+	if (!cfg->device)
+		cfg->device = find_ctrl_with_connectargs(cargs);
 	free_connect_args(cargs);
 
-	if (!fabrics_cfg.device) {
+	if (!cfg->device) {
 		instance = add_ctrl(argstr);
 	} else {
-		instance = ctrl_instance(fabrics_cfg.device);
-		nvmf_get_host_identifiers(instance);
+		instance = ctrl_instance(cfg->device);
+		nvmf_get_host_identifiers(instance, cfg);
 	}
 	if (instance < 0)
 		return instance;
+	res->instance = instance;
 
 	if (asprintf(&dev_name, "/dev/nvme%d", instance) < 0)
 		return -errno;
-	ret = nvmf_get_log_page_discovery(dev_name, &log, &numrec, &status);
+
+	/*
+	 * The generation counter is only meaningful to us while talking to
+	 * the same discovery controller, so only persistent controllers
+	 * make use of the cache.
+	 */
+	if (cfg->persistent || cfg->device) {
+		key = disc_cache_key(argstr);
+		if (key)
+			cached = disc_cache_load(key);
+	}
+
+	res->ret = nvmf_get_log_page_discovery(dev_name, cached, &res->log,
+					       &res->numrec, &res->status);
 	free(dev_name);
-	if (fabrics_cfg.persistent)
+	hit = cached && res->log == cached;
+	if (hit)
+		msg(LOG_DEBUG, "discovery log unchanged, using cached copy\n");
+	else
+		free(cached);
+	if (key) {
+		if (res->ret == DISC_OK && !hit)
+			disc_cache_store(key, res->log, res->numrec);
+		else if (res->ret == DISC_NO_LOG)
+			disc_cache_remove(key);
+		free(key);
+	}
+	if (cfg->persistent)
 		msg(LOG_NOTICE, "Persistent device: nvme%d\n", instance);
-	if (!fabrics_cfg.device && !fabrics_cfg.persistent) {
+	if (!cfg->device && !cfg->persistent) {
 		err = remove_ctrl(instance);
 		if (err)
 			return err;
 	}
 
+	return 0;
+}
+
+static int handle_discovery_log(struct nvmf_disc_result *res,
+				struct fabrics_config *cfg, bool connect,
+				enum nvme_print_flags flags)
+{
+	int ret = res->ret;
+
 	switch (ret) {
 	case DISC_OK:
 		if (connect)
-			ret = connect_ctrls(log, numrec);
-		else if (fabrics_cfg.raw || flags == BINARY)
-			save_discovery_log(log, numrec);
+			ret = connect_ctrls(res->log, res->numrec, cfg);
+		else if (cfg->raw || flags == BINARY)
+			save_discovery_log(res->log, res->numrec);
 		else if (flags == JSON)
-			json_discovery_log(log, numrec);
+			json_discovery_log(res->log, res->numrec);
 		else
-			print_discovery_log(log, numrec);
+			print_discovery_log(res->log, res->numrec);
 		break;
 	case DISC_GET_NUMRECS:
 		msg(LOG_ERR,
 			"Get number of discovery log entries failed.\n");
-		ret = status;
+		ret = res->status;
 		break;
 	case DISC_GET_LOG:
 		msg(LOG_ERR, "Get discovery log entries failed.\n");
-		ret = status;
+		ret = res->status;
 		break;
 	case DISC_NO_LOG:
 		fprintf(stdout, "No discovery log entries to fetch.\n");
@@ -1453,13 +2034,248 @@ int do_discover(char *argstr, bool connect, enum nvme_print_flags flags)
 	return ret;
 }
 
-static int discover_from_conf_file(const char *desc, char *argstr,
-		const struct argconfig_commandline_options *opts, bool connect)
+static int __do_discover(char *argstr, bool connect,
+			 enum nvme_print_flags flags, struct fabrics_config *cfg)
+{
+	struct nvmf_disc_result res = { };
+	int ret;
+
+	ret = nvmf_discover(argstr, cfg, &res);
+	if (!ret)
+		ret = handle_discovery_log(&res, cfg, connect, flags);
+	free(res.log);
+
+	return ret;
+}
+
+int do_discover(char *argstr, bool connect, enum nvme_print_flags flags)
+{
+	return __do_discover(argstr, connect, flags, &fabrics_cfg);
+}
+
+struct conf_disc {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int nr_pending;
+	int refs;		/* the waiter plus every running worker */
+	bool abandoned;		/* the waiter has stopped waiting */
+};
+
+static void conf_disc_put(struct conf_disc *disc)
+{
+	bool last;
+
+	pthread_mutex_lock(&disc->lock);
+	last = !--disc->refs;
+	pthread_mutex_unlock(&disc->lock);
+	if (!last)
+		return;
+	pthread_cond_destroy(&disc->cond);
+	free(disc);
+}
+
+/*
+ * A worker that finishes after the waiter gave up owns its entry and
+ * throws the result away, it is no longer on the caller's list.
+ */
+static void *conf_disc_worker(void *arg)
+{
+	struct conf_disc_entry *e = arg;
+	struct conf_disc *disc = e->disc;
+	bool abandoned;
+
+	e->err = nvmf_discover(e->argstr, &e->cfg, &e->res);
+
+	pthread_mutex_lock(&disc->lock);
+	abandoned = disc->abandoned;
+	e->done = true;
+	disc->nr_pending--;
+	pthread_cond_broadcast(&disc->cond);
+	pthread_mutex_unlock(&disc->lock);
+
+	if (abandoned)
+		free_conf_disc_entry(e);
+	conf_disc_put(disc);
+	return NULL;
+}
+
+/*
+ * Retrieve the discovery logs of all entries concurrently, one thread per
+ * discovery controller, and wait until all of them have completed or the
+ * per-entry timeout has expired. Entries still outstanding afterwards are
+ * unlinked from the list and left to their detached worker, the number of
+ * those is returned.
+ */
+static int conf_disc_fetch_all(struct conf_disc *disc,
+			       struct conf_disc_entry **entries, int tmo)
+{
+	struct conf_disc_entry *e, **pe;
+	struct timespec deadline;
+	int err, timedout = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += tmo;
+
+	for (e = *entries; e; e = e->next) {
+		e->disc = disc;
+		pthread_mutex_lock(&disc->lock);
+		disc->nr_pending++;
+		disc->refs++;
+		pthread_mutex_unlock(&disc->lock);
+		err = pthread_create(&e->thread, NULL, conf_disc_worker, e);
+		if (err) {
+			msg(LOG_WARNING,
+			    "failed to start discovery worker: %s\n",
+			    strerror(err));
+			conf_disc_worker(e);
+			continue;
+		}
+		e->started = true;
+	}
+
+	pthread_mutex_lock(&disc->lock);
+	while (disc->nr_pending) {
+		if (tmo <= 0)
+			err = pthread_cond_wait(&disc->cond, &disc->lock);
+		else
+			err = pthread_cond_timedwait(&disc->cond, &disc->lock,
+						     &deadline);
+		if (err == ETIMEDOUT)
+			break;
+	}
+	disc->abandoned = true;
+	for (pe = entries; (e = *pe); ) {
+		if (e->done) {
+			pe = &e->next;
+			continue;
+		}
+		msg(LOG_ERR, "discovery at %s timed out after %d seconds\n",
+		    e->traddr, tmo);
+		pthread_detach(e->thread);
+		*pe = e->next;
+		timedout++;
+	}
+	pthread_mutex_unlock(&disc->lock);
+
+	for (e = *entries; e; e = e->next)
+		if (e->started)
+			pthread_join(e->thread, NULL);
+	return timedout;
+}
+
+bool disc_entry_equal(struct nvmf_disc_rsp_page_entry *a,
+		      struct fabrics_config *acfg,
+		      struct nvmf_disc_rsp_page_entry *b,
+		      struct fabrics_config *bcfg)
 {
+	const char *ahost = acfg->host_traddr ?: "";
+	const char *bhost = bcfg->host_traddr ?: "";
+
+	return a->trtype == b->trtype && a->adrfam == b->adrfam &&
+		a->subtype == b->subtype &&
+		!strncmp(a->subnqn, b->subnqn, NVMF_NQN_SIZE) &&
+		space_strip_len(NVMF_TRADDR_SIZE, a->traddr) ==
+			space_strip_len(NVMF_TRADDR_SIZE, b->traddr) &&
+		!strncmp(a->traddr, b->traddr,
+			 space_strip_len(NVMF_TRADDR_SIZE, a->traddr)) &&
+		space_strip_len(NVMF_TRSVCID_SIZE, a->trsvcid) ==
+			space_strip_len(NVMF_TRSVCID_SIZE, b->trsvcid) &&
+		!strncmp(a->trsvcid, b->trsvcid,
+			 space_strip_len(NVMF_TRSVCID_SIZE, a->trsvcid)) &&
+		!strcmp(ahost, bhost);
+}
+
+/*
+ * Merge the discovery logs of all completed entries into a single list
+ * of connect jobs. The same subsystem port is usually reported by every
+ * discovery controller of a fabric, so duplicates reached through the
+ * same host interface are dropped before anything gets connected.
+ */
+static int conf_disc_connect(struct conf_disc_entry *entries)
+{
+	struct connect_job *jobs = NULL;
+	struct conf_disc_entry *e;
+	int i, j, nr_jobs = 0, max_jobs = 0;
+
+	for (e = entries; e; e = e->next)
+		if (!e->err && e->res.ret == DISC_OK)
+			max_jobs += e->res.numrec;
+	if (!max_jobs)
+		return 0;
+
+	jobs = calloc(max_jobs, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	for (e = entries; e; e = e->next) {
+		if (e->err || e->res.ret != DISC_OK)
+			continue;
+
+		for (i = 0; i < e->res.numrec; i++) {
+			struct nvmf_disc_rsp_page_entry *d = &e->res.log->entries[i];
+
+			for (j = 0; j < nr_jobs; j++)
+				if (disc_entry_equal(jobs[j].e, jobs[j].cfg,
+						     d, &e->cfg))
+					break;
+			if (j < nr_jobs)
+				continue;
+			jobs[nr_jobs].e = d;
+			jobs[nr_jobs].cfg = &e->cfg;
+			nr_jobs++;
+		}
+	}
+
+	connect_jobs(jobs, nr_jobs);
+	free(jobs);
+	return 0;
+}
+
+void free_conf_disc_entry(struct conf_disc_entry *e)
+{
+	free(e->res.log);
+	free(e->cfg.device);
+	free(e->args);
+	free(e->argv);
+	free(e);
+}
+
+/*
+ * Fill in the discovery connect arguments for the discovery controller
+ * described by fabrics_cfg.
+ */
+int prepare_discovery(char *argstr)
+{
+	int ret;
+
+	set_discovery_kato(&fabrics_cfg);
+
+	if (traddr_is_hostname(&fabrics_cfg)) {
+		ret = hostname2traddr(&fabrics_cfg);
+		if (ret)
+			return ret;
+	}
+
+	if (!fabrics_cfg.trsvcid)
+		discovery_trsvcid(&fabrics_cfg);
+
+	return build_options(argstr, BUF_SIZE, true);
+}
+
+/*
+ * Parse /etc/nvme/discovery.conf into a list of discovery controllers,
+ * each with its own copy of the options in effect for its line.
+ */
+int read_discovery_conf(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		struct conf_disc_entry **entries)
+{
+	struct conf_disc_entry **tail = entries, *e;
 	FILE *f;
-	char line[256], *ptr, *all_args, *args, **argv;
+	char line[256], *ptr;
 	int argc, err, ret = 0;
 
+	*entries = NULL;
 	f = fopen(PATH_NVMF_DISC, "r");
 	if (f == NULL) {
 		msg(LOG_ERR, "No discover params given and no %s\n",
@@ -1468,75 +2284,136 @@ static int discover_from_conf_file(const char *desc, char *argstr,
 	}
 
 	while (fgets(line, sizeof(line), f) != NULL) {
-		enum nvme_print_flags flags;
-
 		if (line[0] == '#' || line[0] == '\n')
 			continue;
 
-		args = strdup(line);
-		if (!args) {
+		e = calloc(1, sizeof(*e));
+		if (!e) {
+			msg(LOG_ERR, "failed to allocate discovery entry\n");
+			ret = -ENOMEM;
+			break;
+		}
+
+		e->args = strdup(line);
+		if (!e->args) {
 			msg(LOG_ERR, "failed to strdup args\n");
+			free(e);
 			ret = -ENOMEM;
-			goto out;
+			break;
 		}
-		all_args = args;
 
-		argv = calloc(MAX_DISC_ARGS, BUF_SIZE);
-		if (!argv) {
+		e->argv = calloc(MAX_DISC_ARGS, BUF_SIZE);
+		if (!e->argv) {
 			msg(LOG_ERR, "failed to allocate argv vector: %m\n");
-			free(args);
+			free(e->args);
+			free(e);
 			ret = -ENOMEM;
-			goto out;
+			break;
 		}
 
+		/*
+		 * The parsed options point into args, which therefore has
+		 * to stay around until the entry has been processed.
+		 */
+		ptr = e->args;
 		argc = 0;
-		argv[argc++] = "discover";
-		while ((ptr = strsep(&args, " =\n")) != NULL)
-			argv[argc++] = ptr;
+		e->argv[argc++] = "discover";
+		while ((e->argv[argc] = strsep(&ptr, " =\n")) != NULL)
+			argc++;
 
-		err = argconfig_parse(argc, argv, desc, opts);
+		err = argconfig_parse(argc, e->argv, desc, opts);
 		if (err)
 			goto free_and_continue;
 
 		if (!fabrics_cfg.transport || !fabrics_cfg.traddr)
 			goto free_and_continue;
 
-		err = flags = validate_output_format(fabrics_cfg.output_format);
+		err = e->flags = validate_output_format(fabrics_cfg.output_format);
 		if (err < 0)
 			goto free_and_continue;
-		set_discovery_kato(&fabrics_cfg);
-
-		if (traddr_is_hostname(&fabrics_cfg)) {
-			ret = hostname2traddr(&fabrics_cfg);
-			if (ret)
-				goto out;
-		}
 
-		if (!fabrics_cfg.trsvcid)
-			discovery_trsvcid(&fabrics_cfg);
-
-		err = build_options(argstr, BUF_SIZE, true);
+		err = prepare_discovery(e->argstr);
 		if (err) {
 			ret = err;
 			goto free_and_continue;
 		}
 
-		err = do_discover(argstr, connect, flags);
-		if (err)
-			ret = err;
+		/* each entry gets its own copy of the parsed options */
+		e->cfg = fabrics_cfg;
+		e->traddr = e->cfg.traddr;
+		if (fabrics_cfg.device)
+			e->cfg.device = strdup(fabrics_cfg.device);
+		*tail = e;
+		tail = &e->next;
+		e = NULL;
 
 free_and_continue:
-		free(all_args);
-		free(argv);
+		if (e)
+			free_conf_disc_entry(e);
 		fabrics_cfg.transport = fabrics_cfg.traddr =
 			fabrics_cfg.trsvcid = fabrics_cfg.host_traddr = NULL;
 	}
 
-out:
 	fclose(f);
 	return ret;
 }
 
+static int discover_from_conf_file(const char *desc,
+		const struct argconfig_commandline_options *opts, bool connect)
+{
+	struct conf_disc_entry *entries, *e;
+	struct conf_disc *disc;
+	pthread_condattr_t attr;
+	int err, ret;
+
+	ret = read_discovery_conf(desc, opts, &entries);
+	if (ret == -EINVAL && !entries)
+		return ret;
+
+	disc = calloc(1, sizeof(*disc));
+	if (!disc) {
+		ret = -ENOMEM;
+		goto free;
+	}
+	pthread_mutex_init(&disc->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&disc->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	disc->refs = 1;
+
+	/* every entry left on the list has completed and been joined */
+	if (conf_disc_fetch_all(disc, &entries, fabrics_cfg.discovery_tmo))
+		ret = -ETIMEDOUT;
+	conf_disc_put(disc);
+
+	for (e = entries; e; e = e->next) {
+		if (e->err) {
+			ret = e->err;
+			continue;
+		}
+		if (connect && e->res.ret == DISC_OK)
+			continue;
+		err = handle_discovery_log(&e->res, &e->cfg, connect, e->flags);
+		if (err)
+			ret = err;
+	}
+
+	if (connect) {
+		err = conf_disc_connect(entries);
+		if (err)
+			ret = err;
+	}
+
+free:
+	while (entries) {
+		e = entries;
+		entries = e->next;
+		free_conf_disc_entry(e);
+	}
+	return ret;
+}
+
 int fabrics_discover(const char *desc, int argc, char **argv, bool connect)
 {
 	char argstr[BUF_SIZE];
@@ -1566,6 +2443,8 @@ int fabrics_discover(const char *desc, int argc, char **argv, bool connect)
 		OPT_FLAG("persistent",     'p', &fabrics_cfg.persistent,      "persistent discovery connection"),
 		OPT_FLAG("quiet",          'S', &quiet,               "suppress already connected errors"),
 		OPT_FLAG("matching",       'm', &fabrics_cfg.matching_only,   "connect only records matching the traddr"),
+		OPT_INT("jobs",            'j', &fabrics_cfg.jobs,            "maximum number of concurrent connects (default 8)"),
+		OPT_INT("discovery-tmo",   'D', &fabrics_cfg.discovery_tmo,   "per-entry timeout in seconds for discovery.conf entries (default 60)"),
 		OPT_FMT("output-format",   'o', &fabrics_cfg.output_format,   output_format),
 		OPT_END()
 	};
@@ -1595,20 +2474,9 @@ int fabrics_discover(const char *desc, int argc, char **argv, bool connect)
 	fabrics_cfg.nqn = NVME_DISC_SUBSYS_NAME;
 
 	if (!fabrics_cfg.transport && !fabrics_cfg.traddr) {
-		ret = discover_from_conf_file(desc, argstr, opts, connect);
+		ret = discover_from_conf_file(desc, opts, connect);
 	} else {
-		set_discovery_kato(&fabrics_cfg);
-
-		if (traddr_is_hostname(&fabrics_cfg)) {
-			ret = hostname2traddr(&fabrics_cfg);
-			if (ret)
-				goto out;
-		}
-
-		if (!fabrics_cfg.trsvcid)
-			discovery_trsvcid(&fabrics_cfg);
-
-		ret = build_options(argstr, BUF_SIZE, true);
+		ret = prepare_discovery(argstr);
 		if (ret)
 			goto out;
 
@@ -1694,9 +2562,11 @@ static int disconnect_subsys(const char *nqn, char *ctrl)
 	char subsysnqn[NVMF_NQN_SIZE] = {};
 	int fd, ret = 0;
 
-	if (asprintf(&sysfs_nqn_path, "%s/%s/subsysnqn", SYS_NVME, ctrl) < 0)
+	if (asprintf(&sysfs_nqn_path, "%s%s/%s/subsysnqn",
+		     nvme_backend->sysfs_root, SYS_NVME, ctrl) < 0)
 		goto free;
-	if (asprintf(&sysfs_del_path, "%s/%s/delete_controller", SYS_NVME, ctrl) < 0)
+	if (asprintf(&sysfs_del_path, "%s%s/%s/delete_controller",
+		     nvme_backend->sysfs_root, SYS_NVME, ctrl) < 0)
 		goto free;
 
 	fd = open(sysfs_nqn_path, O_RDONLY);
@@ -1729,12 +2599,16 @@ static int disconnect_subsys(const char *nqn, char *ctrl)
 static int disconnect_by_nqn(const char *nqn)
 {
 	struct dirent **devices = NULL;
+	char *path;
 	int i, n, ret = 0;
 
 	if (strlen(nqn) > NVMF_NQN_SIZE)
 		return -EINVAL;
 
-	n = scandir(SYS_NVME, &devices, scan_sys_nvme_filter, alphasort);
+	if (asprintf(&path, "%s%s", nvme_backend->sysfs_root, SYS_NVME) < 0)
+		return -ENOMEM;
+	n = scandir(path, &devices, scan_sys_nvme_filter, alphasort);
+	free(path);
 	if (n < 0)
 		return n;
 
@@ -1816,7 +2690,8 @@ int fabrics_disconnect_all(const char *desc, int argc, char **argv)
 	if (err)
 		goto out;
 
-	err = scan_subsystems(&t, NULL, 0, 0, NULL);
+	err = scan_subsystems(&t, NULL, 0, 0, NULL,
+			      NVME_SCAN_CTRL_ATTRS);
 	if (err) {
 		msg(LOG_ERR, "Failed to scan namespaces\n");
 		goto out;
@@ -1,7 +1,11 @@
 #ifndef _DISCOVER_H
 #define _DISCOVER_H
 
+#include <pthread.h>
+
 #define NVMF_DEF_DISC_TMO	30
+#define NVMF_DEF_JOBS		8
+#define NVMF_DEF_DISC_ENTRY_TMO	60
 
 extern char *hostnqn_read(void);
 
@@ -38,6 +42,8 @@ struct fabrics_config {
 	int  data_digest;
 	bool persistent;
 	bool matching_only;
+	int  jobs;
+	int  discovery_tmo;
 	const char *output_format;
 };
 extern struct fabrics_config fabrics_cfg;
@@ -46,8 +52,63 @@ extern const char *const trtypes[];
 
 #define BUF_SIZE 4096
 
+enum {
+	DISC_OK,
+	DISC_NO_LOG,
+	DISC_GET_NUMRECS,
+	DISC_GET_LOG,
+	DISC_RETRY_EXHAUSTED,
+	DISC_NOT_EQUAL,
+};
+
+struct nvmf_disc_result {
+	struct nvmf_disc_rsp_page_hdr *log;
+	int numrec;
+	int instance;	/* discovery controller the log was read from */
+	int ret;	/* DISC_* code of nvmf_get_log_page_discovery() */
+	int status;
+};
+
+struct conf_disc;
+
+struct conf_disc_entry {
+	struct fabrics_config cfg;
+	char argstr[BUF_SIZE];
+	const char *traddr;	/* for messages while the worker runs */
+	char *args;
+	char **argv;
+	enum nvme_print_flags flags;
+	struct nvmf_disc_result res;
+	int err;
+	bool done;
+	bool started;
+	pthread_t thread;
+	struct conf_disc *disc;
+	struct conf_disc_entry *next;
+};
+
+struct connect_job {
+	struct nvmf_disc_rsp_page_entry *e;
+	struct fabrics_config *cfg;
+	bool queued;
+	int instance;
+};
+
 int build_options(char *argstr, int max_len, bool discover);
+int prepare_discovery(char *argstr);
 int do_discover(char *argstr, bool connect, enum nvme_print_flags flags);
+int nvmf_discover(char *argstr, struct fabrics_config *cfg,
+		  struct nvmf_disc_result *res);
+int read_discovery_conf(const char *desc,
+		const struct argconfig_commandline_options *opts,
+		struct conf_disc_entry **entries);
+void free_conf_disc_entry(struct conf_disc_entry *e);
+void connect_jobs(struct connect_job *jobs, int nr_jobs);
+bool disc_entry_equal(struct nvmf_disc_rsp_page_entry *a,
+		      struct fabrics_config *acfg,
+		      struct nvmf_disc_rsp_page_entry *b,
+		      struct fabrics_config *bcfg);
+void nvmf_reset_ctrl_state(void);
 int ctrl_instance(const char *device);
 char *parse_conn_arg(const char *conargs, const char delim, const char *field);
 int remove_ctrl(int instance);
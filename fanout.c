@@ -0,0 +1,539 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements running one sub-command against many devices at
+ * the same time, as in 'nvme --all smart-log'. The command handlers keep
+ * state in globals, so every device is handled by a child process of its
+ * own. Results are reported in device order, either as one JSON array or
+ * as text with every line prefixed by the device name.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "nvme.h"
+#include "batch.h"
+#include "fanout.h"
+#include "nvme-ioctl.h"
+#include "progress.h"
+
+struct fanout_job {
+	char *dev;
+	pid_t pid;
+	FILE *file;	/* result written by the child */
+	struct batch_result res;
+	bool done;
+	struct nvme_progress progress;	/* fd is -1 if not watched */
+};
+
+struct fanout {
+	struct plugin *plugin;
+	char **args;	/* command line, the device goes in the last slot */
+	int nr_args;
+	struct fanout_job *jobs;
+	int nr_jobs;
+	int sanact;	/* sanitize action, when waiting for sanitize */
+};
+
+static int fanout_add_dev(struct fanout *fo, const char *dev)
+{
+	struct fanout_job *jobs;
+
+	jobs = realloc(fo->jobs, (fo->nr_jobs + 1) * sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+	fo->jobs = jobs;
+	memset(&jobs[fo->nr_jobs], 0, sizeof(*jobs));
+	jobs[fo->nr_jobs].progress.fd = -1;
+	jobs[fo->nr_jobs].dev = strdup(dev);
+	if (!jobs[fo->nr_jobs].dev)
+		return -ENOMEM;
+	fo->nr_jobs++;
+	return 0;
+}
+
+static int fanout_cmp_dev(const void *a, const void *b)
+{
+	const struct fanout_job *ja = a, *jb = b;
+
+	return strverscmp(ja->dev, jb->dev);
+}
+
+static int fanout_add_name(struct fanout *fo, const char *name)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/dev/%s", name);
+	return fanout_add_dev(fo, path);
+}
+
+/*
+ * All controllers, or all namespace block devices, found by the topology
+ * scan. Namespaces are listed per subsystem with multipathing and per
+ * controller without, like 'nvme list' shows them.
+ */
+static int fanout_scan_all(struct fanout *fo, bool namespaces)
+{
+	struct nvme_topology t = { };
+	struct nvme_subsystem *s;
+	struct nvme_ctrl *c;
+	int i, j, k, err;
+
+	err = scan_subsystems(&t, NULL, 0, 0, NULL, NVME_SCAN_NAMES);
+	if (err) {
+		fprintf(stderr, "Failed to scan namespaces\n");
+		return err;
+	}
+	for (i = 0; i < t.nr_subsystems && !err; i++) {
+		s = &t.subsystems[i];
+		if (namespaces && s->nr_namespaces) {
+			for (j = 0; j < s->nr_namespaces && !err; j++)
+				err = fanout_add_name(fo, s->namespaces[j].name);
+			continue;
+		}
+		for (j = 0; j < s->nr_ctrls && !err; j++) {
+			c = &s->ctrls[j];
+			if (!namespaces) {
+				err = fanout_add_name(fo, c->name);
+				continue;
+			}
+			for (k = 0; k < c->nr_namespaces && !err; k++)
+				err = fanout_add_name(fo, c->namespaces[k].name);
+		}
+	}
+	free_topology(&t);
+	return err;
+}
+
+static int fanout_glob(struct fanout *fo, const char *pattern)
+{
+	struct stat st;
+	glob_t g;
+	size_t i;
+	int err = 0;
+
+	if (glob(pattern, 0, NULL, &g))
+		return 0;
+	for (i = 0; i < g.gl_pathc && !err; i++) {
+		if (stat(g.gl_pathv[i], &st) ||
+		    (!S_ISCHR(st.st_mode) && !S_ISBLK(st.st_mode)))
+			continue;
+		err = fanout_add_dev(fo, g.gl_pathv[i]);
+	}
+	globfree(&g);
+	return err;
+}
+
+static bool fanout_json_output(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--output-format=json") ||
+		    !strcmp(argv[i], "-ojson"))
+			return true;
+		if ((!strcmp(argv[i], "--output-format") ||
+		     !strcmp(argv[i], "-o")) &&
+		    i + 1 < argc && !strcmp(argv[i + 1], "json"))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Removes --wait from the command line given to the children, so the
+ * parent can wait for all devices at once instead. Returns whether it
+ * was given.
+ */
+static bool fanout_strip_wait(struct fanout *fo)
+{
+	bool wait = false;
+	int i, j;
+
+	for (i = j = 0; i < fo->nr_args - 1; i++) {
+		if (!strcmp(fo->args[i], "--wait") ||
+		    !strcmp(fo->args[i], "-w")) {
+			wait = true;
+			continue;
+		}
+		fo->args[j++] = fo->args[i];
+	}
+	fo->nr_args = j + 1;
+	fo->args[j] = NULL;
+	return wait;
+}
+
+/*
+ * Finds the sanitize action the children run with. The options are parsed
+ * the way argconfig parses them for the sanitize command, so abbreviations
+ * and grouped short options are understood the same way. The action must
+ * be a whole number the sanitize command accepts, anything else is
+ * rejected before a device is sanitized.
+ */
+static int fanout_sanact(struct fanout *fo)
+{
+	static const struct option opts[] = {
+		{ "no-dealloc",	no_argument,		NULL, 'd' },
+		{ "oipbp",	no_argument,		NULL, 'i' },
+		{ "owpass",	required_argument,	NULL, 'n' },
+		{ "ause",	no_argument,		NULL, 'u' },
+		{ "sanact",	required_argument,	NULL, 'a' },
+		{ "ovrpat",	required_argument,	NULL, 'p' },
+		{ "wait",	no_argument,		NULL, 'w' },
+		{ NULL, 0, NULL, 0 },
+	};
+	unsigned long sanact = 0;
+	int opt, argc = fo->nr_args - 1, err = 0;
+	char **argv, *end;
+
+	/* getopt reorders the arguments, the children need them as given */
+	argv = calloc(argc + 1, sizeof(*argv));
+	if (!argv)
+		return -ENOMEM;
+	memcpy(argv, fo->args, argc * sizeof(*argv));
+
+	optind = 0;
+	opterr = 0;
+	while ((opt = getopt_long_only(argc, argv, "din:ua:p:w", opts,
+				       NULL)) != -1) {
+		if (opt != 'a')
+			continue;
+		errno = 0;
+		sanact = strtoul(optarg, &end, 0);
+		if (errno || sanact >= (1 << 8) || optarg == end || *end) {
+			fprintf(stderr, "Expected byte argument for 'sanact' "\
+				"but got '%s'!\n", optarg);
+			err = -EINVAL;
+			break;
+		}
+	}
+	opterr = 1;
+	free(argv);
+	if (err)
+		return err;
+
+	switch (sanact) {
+	case NVME_SANITIZE_ACT_CRYPTO_ERASE:
+	case NVME_SANITIZE_ACT_BLOCK_ERASE:
+	case NVME_SANITIZE_ACT_EXIT:
+	case NVME_SANITIZE_ACT_OVERWRITE:
+		return sanact;
+	default:
+		fprintf(stderr, "Invalid Sanitize Action\n");
+		return -EINVAL;
+	}
+}
+
+/*
+ * Reads the state of every device before the children start the
+ * operation, so that fanout_wait() does not take the outcome of an
+ * earlier one for it.
+ */
+static void fanout_prepare(struct fanout *fo,
+			   int (*poll)(struct nvme_progress *))
+{
+	struct fanout_job *job;
+	int i, fd, nsid;
+
+	for (i = 0; i < fo->nr_jobs; i++) {
+		job = &fo->jobs[i];
+		fd = nvme_open(job->dev, O_RDONLY);
+		if (fd < 0) {
+			perror(job->dev);
+			continue;
+		}
+		nvme_progress_init(&job->progress, job->dev, fd, fo->args[0],
+				   poll);
+		job->progress.arg = fo->sanact;
+		if (poll == nvme_progress_format) {
+			nsid = nvme_get_nsid(fd);
+			job->progress.nsid = nsid > 0 ? nsid : 1;
+		}
+		nvme_progress_prepare(&job->progress);
+	}
+}
+
+/*
+ * Waits for the operation the command started on every device it
+ * succeeded for.
+ */
+static int fanout_wait(struct fanout *fo, FILE *out)
+{
+	struct nvme_progress *p;
+	int i, nr = 0, err;
+
+	p = calloc(fo->nr_jobs, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	for (i = 0; i < fo->nr_jobs; i++)
+		if (!fo->jobs[i].res.status && fo->jobs[i].progress.fd >= 0)
+			p[nr++] = fo->jobs[i].progress;
+
+	err = nvme_progress_wait(p, nr, out);
+	free(p);
+	return err;
+}
+
+static void __attribute__((noreturn))
+fanout_child(struct fanout *fo, struct fanout_job *job)
+{
+	struct batch_result res;
+	int err;
+
+	fo->args[fo->nr_args - 1] = job->dev;
+	err = batch_exec(fo->plugin, fo->nr_args, fo->args, &res);
+	if (err) {
+		memset(&res, 0, sizeof(res));
+		res.status = err;
+	}
+
+	fwrite(&res.status, sizeof(res.status), 1, job->file);
+	fwrite(&res.out_len, sizeof(res.out_len), 1, job->file);
+	fwrite(res.out ?: "", 1, res.out_len, job->file);
+	fwrite(&res.err_len, sizeof(res.err_len), 1, job->file);
+	fwrite(res.err ?: "", 1, res.err_len, job->file);
+	_exit(fflush(job->file) ? 1 : 0);
+}
+
+static int fanout_read_buf(FILE *f, char **buf, size_t *len)
+{
+	if (fread(len, sizeof(*len), 1, f) != 1)
+		return -EIO;
+	*buf = malloc(*len + 1);
+	if (!*buf)
+		return -ENOMEM;
+	if (fread(*buf, 1, *len, f) != *len)
+		return -EIO;
+	(*buf)[*len] = '\0';
+	return 0;
+}
+
+static void fanout_collect(struct fanout_job *job, int wstatus)
+{
+	struct batch_result *res = &job->res;
+	int err = -EIO;
+
+	rewind(job->file);
+	if (WIFEXITED(wstatus) && !WEXITSTATUS(wstatus) &&
+	    fread(&res->status, sizeof(res->status), 1, job->file) == 1) {
+		err = fanout_read_buf(job->file, &res->out, &res->out_len);
+		if (!err)
+			err = fanout_read_buf(job->file, &res->err,
+					      &res->err_len);
+	}
+	if (err) {
+		batch_free_result(res);
+		memset(res, 0, sizeof(*res));
+		res->status = err;
+		res->err = strdup("command did not complete\n");
+		res->err_len = res->err ? strlen(res->err) : 0;
+	}
+	fclose(job->file);
+	job->file = NULL;
+	job->done = true;
+}
+
+static int fanout_start(struct fanout *fo, struct fanout_job *job)
+{
+	job->file = tmpfile();
+	if (!job->file)
+		return -errno;
+
+	fflush(stdout);
+	fflush(stderr);
+	job->pid = fork();
+	if (job->pid < 0) {
+		fclose(job->file);
+		job->file = NULL;
+		return -errno;
+	}
+	if (!job->pid)
+		fanout_child(fo, job);
+	return 0;
+}
+
+static void fanout_print_lines(FILE *f, const char *name, const char *buf)
+{
+	const char *eol;
+
+	while (*buf) {
+		eol = strchrnul(buf, '\n');
+		fprintf(f, "%s: %.*s\n", name, (int)(eol - buf), buf);
+		buf = *eol ? eol + 1 : eol;
+	}
+}
+
+static void fanout_print(struct fanout_job *job, bool json, bool first)
+{
+	struct batch_result *res = &job->res;
+
+	if (json) {
+		printf("%s  {\"device\":", first ? "" : ",\n");
+		batch_print_json_string(stdout, job->dev, strlen(job->dev));
+		printf(",\"status\":%d", res->status);
+		batch_print_output(stdout, res);
+		printf("}");
+	} else {
+		fanout_print_lines(stdout, basename(job->dev), res->out ?: "");
+		fanout_print_lines(stderr, basename(job->dev), res->err ?: "");
+	}
+	fflush(stdout);
+}
+
+int nvme_fanout(int argc, char **argv, struct plugin *plugin)
+{
+	static const struct option opts[] = {
+		{ "all",	no_argument,		NULL, 'A' },
+		{ "all-namespaces", no_argument,	NULL, 'N' },
+		{ "devices",	required_argument,	NULL, 'D' },
+		{ "jobs",	required_argument,	NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
+	struct fanout fo = { .plugin = plugin };
+	int (*poll)(struct nvme_progress *) = NULL;
+	int opt, i, wstatus, jobs = 0, running = 0, next = 0, printed = 0;
+	bool all = false, all_ns = false, json, failed = false;
+	char *pattern = NULL, *end;
+	pid_t pid;
+	int err = 0;
+
+	optind = 1;
+	while ((opt = getopt_long(argc, argv, "+", opts, NULL)) != -1) {
+		switch (opt) {
+		case 'A':
+			all = true;
+			break;
+		case 'N':
+			all = all_ns = true;
+			break;
+		case 'D':
+			pattern = optarg;
+			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 0);
+			if (*end || jobs < 0) {
+				fprintf(stderr, "invalid jobs: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	if (optind >= argc || (!all && !pattern)) {
+		fprintf(stderr, "usage: %s --all | --all-namespaces | "\
+			"--devices=<pattern> [--jobs=<n>] <command> "\
+			"[OPTIONS]\n", argv[0]);
+		return -EINVAL;
+	}
+	if (!strcmp(argv[optind], "batch") || !strcmp(argv[optind], "serve") ||
+	    !strcmp(argv[optind], "monitor")) {
+		fprintf(stderr, "%s can not be run for many devices\n",
+			argv[optind]);
+		return -EINVAL;
+	}
+
+	fo.nr_args = argc - optind + 1;
+	fo.args = calloc(fo.nr_args + 1, sizeof(*fo.args));
+	if (!fo.args)
+		return -ENOMEM;
+	memcpy(fo.args, &argv[optind], (argc - optind) * sizeof(*fo.args));
+	json = fanout_json_output(argc - optind, &argv[optind]);
+	poll = nvme_progress_poller(fo.args[0]);
+	if (poll && !fanout_strip_wait(&fo))
+		poll = NULL;
+	if (poll == nvme_progress_sanitize) {
+		err = fo.sanact = fanout_sanact(&fo);
+		if (err < 0)
+			goto free;
+	}
+
+	err = all ? fanout_scan_all(&fo, all_ns) : fanout_glob(&fo, pattern);
+	if (err)
+		goto free;
+	if (!fo.nr_jobs) {
+		fprintf(stderr, "no devices found\n");
+		err = -ENODEV;
+		goto free;
+	}
+	qsort(fo.jobs, fo.nr_jobs, sizeof(*fo.jobs), fanout_cmp_dev);
+	if (poll)
+		fanout_prepare(&fo, poll);
+
+	if (json)
+		printf("[\n");
+	while (printed < fo.nr_jobs) {
+		while (next < fo.nr_jobs && (!jobs || running < jobs)) {
+			i = fanout_start(&fo, &fo.jobs[next]);
+			if (i) {
+				fo.jobs[next].res.status = i;
+				fo.jobs[next].done = true;
+			} else {
+				running++;
+			}
+			next++;
+		}
+
+		while (printed < fo.nr_jobs && fo.jobs[printed].done) {
+			if (fo.jobs[printed].res.status)
+				failed = true;
+			fanout_print(&fo.jobs[printed], json, !printed);
+			printed++;
+		}
+		if (!running)
+			continue;
+
+		pid = wait(&wstatus);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("wait");
+			err = -errno;
+			break;
+		}
+		for (i = 0; i < fo.nr_jobs; i++) {
+			if (fo.jobs[i].pid == pid && !fo.jobs[i].done) {
+				fanout_collect(&fo.jobs[i], wstatus);
+				running--;
+				break;
+			}
+		}
+	}
+	if (json)
+		printf("\n]\n");
+	if (!err && poll && fanout_wait(&fo, json ? stderr : stdout))
+		failed = true;
+	if (!err && failed)
+		err = 1;
+free:
+	for (i = 0; i < fo.nr_jobs; i++) {
+		if (fo.jobs[i].file)
+			fclose(fo.jobs[i].file);
+		batch_free_result(&fo.jobs[i].res);
+		if (fo.jobs[i].progress.fd >= 0)
+			close(fo.jobs[i].progress.fd);
+		free(fo.jobs[i].dev);
+	}
+	free(fo.jobs);
+	free(fo.args);
+	return err;
+}
@@ -0,0 +1,8 @@
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+#include "plugin.h"
+
+extern int nvme_fanout(int argc, char **argv, struct plugin *plugin);
+
+#endif
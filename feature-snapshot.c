@@ -0,0 +1,534 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements taking a snapshot of every feature a controller
+ * supports, and comparing a snapshot or a live device with a profile.
+ *
+ * A snapshot is a text file with one line per feature and select value:
+ *
+ *   <fid> <current|default|saved|supported> <value> [<data>]
+ *
+ * with the data buffer, if the feature has one, in hex without its
+ * trailing zero bytes. Lines starting with '#' are comments, so a
+ * profile is simply a snapshot with the lines of no interest removed.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "nvme-status.h"
+#include "feature-snapshot.h"
+#include "common.h"
+#include "util/argconfig.h"
+
+#define FEAT_SEL_CURRENT	0
+#define FEAT_SEL_DEFAULT	1
+#define FEAT_SEL_SAVED		2
+#define FEAT_SEL_SUPPORTED	3
+
+/* supported capabilities of a feature */
+#define FEAT_CAP_SAVEABLE	(1 << 0)
+
+#define FEAT_MAX_DATA_LEN	4096
+
+static const char *feat_sel_names[] = {
+	[FEAT_SEL_CURRENT]	= "current",
+	[FEAT_SEL_DEFAULT]	= "default",
+	[FEAT_SEL_SAVED]	= "saved",
+	[FEAT_SEL_SUPPORTED]	= "supported",
+};
+
+struct feat_entry {
+	__u8 fid;
+	__u8 sel;
+	__u32 value;
+	__u32 len;	/* data without its trailing zero bytes */
+	__u8 *data;
+};
+
+struct feat_snapshot {
+	struct feat_entry *entries;
+	int nr, alloc;
+};
+
+static void feat_free(struct feat_snapshot *s)
+{
+	int i;
+
+	for (i = 0; i < s->nr; i++)
+		free(s->entries[i].data);
+	free(s->entries);
+}
+
+static int feat_add(struct feat_snapshot *s, __u8 fid, __u8 sel, __u32 value,
+		    const __u8 *data, __u32 len)
+{
+	struct feat_entry *e;
+
+	if (s->nr == s->alloc) {
+		s->alloc = s->alloc ? s->alloc * 2 : 64;
+		e = realloc(s->entries, s->alloc * sizeof(*e));
+		if (!e)
+			return -ENOMEM;
+		s->entries = e;
+	}
+
+	while (len && !data[len - 1])
+		len--;
+	e = &s->entries[s->nr];
+	e->fid = fid;
+	e->sel = sel;
+	e->value = value;
+	e->len = len;
+	e->data = NULL;
+	if (len) {
+		e->data = malloc(len);
+		if (!e->data)
+			return -ENOMEM;
+		memcpy(e->data, data, len);
+	}
+	s->nr++;
+	return 0;
+}
+
+static int feat_cmp_entry(const void *a, const void *b)
+{
+	const struct feat_entry *ea = a, *eb = b;
+
+	if (ea->fid != eb->fid)
+		return ea->fid - eb->fid;
+	return ea->sel - eb->sel;
+}
+
+/*
+ * Reads one select value of a feature. Returns 1 if the controller
+ * rejected it, which is how an unsupported feature shows up.
+ */
+static int feat_get(int fd, __u32 nsid, __u8 fid, __u8 sel, void *buf,
+		    struct feat_snapshot *s, __u32 *result)
+{
+	__u32 len = sel == FEAT_SEL_SUPPORTED ? 0 : nvme_feat_buf_len[fid];
+	int err;
+
+	if (len)
+		memset(buf, 0, len);
+	err = nvme_get_feature(fd, nsid, fid, sel, 0, len, len ? buf : NULL,
+			       result);
+	if (err < 0) {
+		perror("get-feature");
+		return -errno;
+	}
+	if (err)
+		return 1;
+	return feat_add(s, fid, sel, *result, buf, len);
+}
+
+/*
+ * Walks every feature identifier. If the controller supports the select
+ * field, the supported capabilities tell which features exist and
+ * whether they have a saved value; otherwise only current values are
+ * read.
+ */
+static int feat_take_snapshot(int fd, __u32 nsid, struct feat_snapshot *s)
+{
+	struct nvme_id_ctrl ctrl;
+	bool select;
+	__u32 caps, result;
+	void *buf;
+	int fid, err;
+
+	err = nvme_identify_ctrl(fd, &ctrl);
+	if (err) {
+		if (err < 0)
+			perror("identify-ctrl");
+		else
+			nvme_show_status(err);
+		return err;
+	}
+	select = le16_to_cpu(ctrl.oncs) & NVME_CTRL_ONCS_SAVE_FEATURES;
+
+	if (posix_memalign(&buf, getpagesize(), FEAT_MAX_DATA_LEN)) {
+		fprintf(stderr, "can not allocate feature payload\n");
+		return -ENOMEM;
+	}
+
+	for (fid = 1; fid <= 0xff; fid++) {
+		err = 0;
+		if (select) {
+			err = feat_get(fd, nsid, fid, FEAT_SEL_SUPPORTED, buf,
+				       s, &caps);
+			if (err < 0)
+				break;
+			if (err)
+				continue;
+			err = feat_get(fd, nsid, fid, FEAT_SEL_DEFAULT, buf,
+				       s, &result);
+			if (err < 0)
+				break;
+			if (caps & FEAT_CAP_SAVEABLE) {
+				err = feat_get(fd, nsid, fid, FEAT_SEL_SAVED,
+					       buf, s, &result);
+				if (err < 0)
+					break;
+			}
+		}
+		err = feat_get(fd, nsid, fid, FEAT_SEL_CURRENT, buf, s,
+			       &result);
+		if (err < 0)
+			break;
+	}
+	if (err > 0)
+		err = 0;
+	free(buf);
+	if (!err)
+		qsort(s->entries, s->nr, sizeof(*s->entries), feat_cmp_entry);
+	return err;
+}
+
+static void feat_write(FILE *f, struct feat_snapshot *s)
+{
+	struct feat_entry *e;
+	__u32 i;
+	int n;
+
+	for (n = 0; n < s->nr; n++) {
+		e = &s->entries[n];
+		fprintf(f, "0x%02x %s 0x%08x", e->fid, feat_sel_names[e->sel],
+			e->value);
+		if (e->len)
+			fputc(' ', f);
+		for (i = 0; i < e->len; i++)
+			fprintf(f, "%02x", e->data[i]);
+		fputc('\n', f);
+	}
+}
+
+static int feat_parse_hex(const char *str, __u8 *data, __u32 *len)
+{
+	unsigned int byte;
+
+	for (*len = 0; str[0] && !isspace(str[0]); str += 2) {
+		if (*len == FEAT_MAX_DATA_LEN || !isxdigit(str[1]) ||
+		    sscanf(str, "%2x", &byte) != 1)
+			return -EINVAL;
+		data[(*len)++] = byte;
+	}
+	return 0;
+}
+
+static int feat_read(const char *path, struct feat_snapshot *s)
+{
+	char *line = NULL, sel[16];
+	unsigned int fid, value;
+	int err = 0, pos, lineno = 0, i;
+	size_t size = 0;
+	__u8 *data;
+	__u32 len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -errno;
+	}
+	data = malloc(FEAT_MAX_DATA_LEN);
+	if (!data) {
+		fclose(f);
+		return -ENOMEM;
+	}
+
+	while (getline(&line, &size, f) > 0) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+
+		pos = 0;
+		if (sscanf(line, "%x %15s %x %n", &fid, sel, &value, &pos) < 3 ||
+		    fid > 0xff)
+			goto invalid;
+		for (i = 0; i <= FEAT_SEL_SUPPORTED; i++)
+			if (!strcmp(sel, feat_sel_names[i]))
+				break;
+		if (i > FEAT_SEL_SUPPORTED)
+			goto invalid;
+		len = 0;
+		if (pos && feat_parse_hex(line + pos, data, &len))
+			goto invalid;
+		err = feat_add(s, fid, i, value, data, len);
+		if (err)
+			break;
+		continue;
+invalid:
+		fprintf(stderr, "%s:%d: invalid feature line\n", path, lineno);
+		err = -EINVAL;
+		break;
+	}
+	free(line);
+	free(data);
+	fclose(f);
+
+	if (!err)
+		qsort(s->entries, s->nr, sizeof(*s->entries), feat_cmp_entry);
+	return err;
+}
+
+static __u32 feat_default_nsid(int fd)
+{
+	int nsid = nvme_get_nsid(fd);
+
+	return nsid > 0 ? nsid : NVME_NSID_ALL;
+}
+
+int nvme_feature_snapshot(const char *desc, int argc, char **argv)
+{
+	const char *namespace_id = "namespace to read namespace specific "\
+		"features for";
+	const char *output_file = "write the snapshot to this file instead "\
+		"of stdout";
+	struct feat_snapshot s = { };
+	FILE *f = stdout;
+	int err, fd;
+
+	struct config {
+		__u32 namespace_id;
+		char *output_file;
+	};
+
+	struct config cfg = {
+		.namespace_id = 0,
+		.output_file  = "",
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_UINT("namespace-id", 'n', &cfg.namespace_id, namespace_id),
+		OPT_FILE("output-file",  'O', &cfg.output_file,  output_file),
+		OPT_END()
+	};
+
+	err = fd = parse_and_open(argc, argv, desc, opts);
+	if (fd < 0)
+		goto ret;
+
+	if (!cfg.namespace_id)
+		cfg.namespace_id = feat_default_nsid(fd);
+
+	err = feat_take_snapshot(fd, cfg.namespace_id, &s);
+	if (err)
+		goto free;
+
+	if (strlen(cfg.output_file)) {
+		f = fopen(cfg.output_file, "w");
+		if (!f) {
+			perror(cfg.output_file);
+			err = -errno;
+			goto free;
+		}
+	}
+	fprintf(f, "# nvme feature-snapshot %s, namespace %#x\n",
+		devicename, cfg.namespace_id);
+	feat_write(f, &s);
+	if (f != stdout && fclose(f)) {
+		perror(cfg.output_file);
+		err = -errno;
+	}
+
+free:
+	feat_free(&s);
+	close(fd);
+ret:
+	return nvme_status_to_errno(err, false);
+}
+
+static bool feat_excluded(int *exclude, int nr, __u8 fid)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (exclude[i] == fid)
+			return true;
+	return false;
+}
+
+static void feat_show_entry(const char *what, struct feat_entry *e)
+{
+	printf("0x%02x (%s) %s: %s\n", e->fid, nvme_feature_to_string(e->fid),
+	       feat_sel_names[e->sel], what);
+}
+
+static bool feat_show_diff(struct feat_entry *p, struct feat_entry *s)
+{
+	__u32 i, len = p->len > s->len ? p->len : s->len;
+	__u8 pb, sb;
+
+	if (p->value != s->value) {
+		printf("0x%02x (%s) %s: 0x%08x, profile 0x%08x\n", p->fid,
+		       nvme_feature_to_string(p->fid), feat_sel_names[p->sel],
+		       s->value, p->value);
+		return true;
+	}
+	for (i = 0; i < len; i++) {
+		pb = i < p->len ? p->data[i] : 0;
+		sb = i < s->len ? s->data[i] : 0;
+		if (pb != sb) {
+			printf("0x%02x (%s) %s: data byte %u is 0x%02x, "\
+			       "profile 0x%02x\n", p->fid,
+			       nvme_feature_to_string(p->fid),
+			       feat_sel_names[p->sel], i, sb, pb);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Both snapshots are sorted by feature and select value, so they are
+ * compared in one merge pass.
+ */
+static int feat_diff(struct feat_snapshot *profile, struct feat_snapshot *s,
+		     int *exclude, int nr_exclude, bool strict)
+{
+	int i = 0, j = 0, cmp, diffs = 0;
+	struct feat_entry *pe, *se;
+
+	while (i < profile->nr || j < s->nr) {
+		pe = i < profile->nr ? &profile->entries[i] : NULL;
+		se = j < s->nr ? &s->entries[j] : NULL;
+		if (!se)
+			cmp = -1;
+		else if (!pe)
+			cmp = 1;
+		else
+			cmp = feat_cmp_entry(pe, se);
+
+		if (cmp < 0) {
+			if (!feat_excluded(exclude, nr_exclude, pe->fid)) {
+				feat_show_entry("missing", pe);
+				diffs++;
+			}
+			i++;
+		} else if (cmp > 0) {
+			if (strict &&
+			    !feat_excluded(exclude, nr_exclude, se->fid)) {
+				feat_show_entry("not in profile", se);
+				diffs++;
+			}
+			j++;
+		} else {
+			if (!feat_excluded(exclude, nr_exclude, pe->fid) &&
+			    feat_show_diff(pe, se))
+				diffs++;
+			i++;
+			j++;
+		}
+	}
+	return diffs;
+}
+
+int nvme_feature_diff(const char *desc, int argc, char **argv)
+{
+	const char *profile = "snapshot or profile to compare with (required)";
+	const char *snapshot = "compare this snapshot instead of a device";
+	const char *namespace_id = "namespace to read namespace specific "\
+		"features for";
+	const char *exclude = "comma separated list of feature ids to ignore";
+	const char *strict = "also report features which are not in the "\
+		"profile";
+	struct feat_snapshot p = { }, s = { };
+	int exclude_fids[0x100];
+	int err, fd = -1, nr_exclude = 0, diffs = 0;
+
+	struct config {
+		char *profile;
+		char *snapshot;
+		__u32 namespace_id;
+		char *exclude;
+		int strict;
+	};
+
+	struct config cfg = {
+		.profile      = "",
+		.snapshot     = "",
+		.namespace_id = 0,
+		.exclude      = "",
+		.strict       = 0,
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("profile",      'p', &cfg.profile,      profile),
+		OPT_FILE("snapshot",     's', &cfg.snapshot,     snapshot),
+		OPT_UINT("namespace-id", 'n', &cfg.namespace_id, namespace_id),
+		OPT_LIST("exclude",      'x', &cfg.exclude,      exclude),
+		OPT_FLAG("strict",       'S', &cfg.strict,       strict),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	if (!strlen(cfg.profile)) {
+		fprintf(stderr, "Required parameter --profile not given\n");
+		return -EINVAL;
+	}
+	if (strlen(cfg.exclude)) {
+		nr_exclude = argconfig_parse_comma_sep_array(cfg.exclude,
+				exclude_fids, ARRAY_SIZE(exclude_fids));
+		if (nr_exclude < 0) {
+			fprintf(stderr, "Invalid feature id list\n");
+			return -EINVAL;
+		}
+	}
+
+	err = feat_read(cfg.profile, &p);
+	if (err)
+		goto free;
+
+	if (strlen(cfg.snapshot)) {
+		err = feat_read(cfg.snapshot, &s);
+	} else {
+		if (optind >= argc) {
+			fprintf(stderr, "Device or --snapshot required\n");
+			err = -EINVAL;
+			goto free;
+		}
+		fd = nvme_open(argv[optind], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[optind]);
+			err = -errno;
+			goto free;
+		}
+		if (!cfg.namespace_id)
+			cfg.namespace_id = feat_default_nsid(fd);
+		err = feat_take_snapshot(fd, cfg.namespace_id, &s);
+		close(fd);
+	}
+	if (err)
+		goto free;
+
+	diffs = feat_diff(&p, &s, exclude_fids, nr_exclude, cfg.strict);
+	if (diffs)
+		printf("%d difference%s\n", diffs, diffs > 1 ? "s" : "");
+free:
+	feat_free(&p);
+	feat_free(&s);
+	if (err)
+		return nvme_status_to_errno(err, false);
+	return diffs ? 1 : 0;
+}
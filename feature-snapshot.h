@@ -0,0 +1,7 @@
+#ifndef _FEATURE_SNAPSHOT_H
+#define _FEATURE_SNAPSHOT_H
+
+extern int nvme_feature_snapshot(const char *desc, int argc, char **argv);
+extern int nvme_feature_diff(const char *desc, int argc, char **argv);
+
+#endif
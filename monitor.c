@@ -0,0 +1,771 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements a long running discovery mode. Persistent
+ * discovery controllers are kept open, and discovery log change events
+ * only cause the difference between the previous and the current
+ * discovery log to be connected or disconnected.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+
+#include "nvme.h"
+#include "fabrics.h"
+#include "monitor.h"
+
+#include "common.h"
+#include "util/argconfig.h"
+#include "util/log.h"
+
+/* delay between the first event of a burst and acting on it */
+#define MONITOR_DEF_BATCH_DELAY	500	/* milliseconds */
+/* delay before retrying a discovery controller which failed */
+#define MONITOR_RETRY_DELAY	30	/* seconds */
+
+#define UEVENT_BUF_SIZE		8192
+
+/* marks previous log records which have been matched to the new log */
+#define RECORD_CLAIMED		INT_MIN
+/* a referral which has been discovered, there is no controller to track */
+#define RECORD_REFERRAL		(INT_MIN + 1)
+
+/* type NOTICE, info DISCOVERY_LOG_CHANGE, log page DISCOVERY_LOG_PAGE */
+#define NVME_AEN_DISC_LOG_CHANGE	"0x70f002"
+
+struct monitor_dc {
+	struct conf_disc_entry *ce;
+	char *strs[4];		/* connection parameters owned by us */
+	int *instances;		/* controllers we connected, per log record */
+	bool pending;
+	uint64_t retry;		/* time of the next attempt after a failure */
+	struct monitor_dc *next;
+};
+
+struct monitor {
+	struct monitor_dc *dcs;
+	int batch_delay;
+	bool armed;
+	uint64_t deadline;
+	int nl_fd;
+	int sig_fd;
+	int timer_fd;
+	int epoll_fd;
+};
+
+struct uevent {
+	const char *action;
+	const char *subsystem;
+	const char *devname;
+	const char *aen;
+	const char *event;
+	const char *trtype;
+	const char *traddr;
+	const char *trsvcid;
+	const char *host_traddr;
+	const char *fc_event;
+	const char *fc_traddr;
+	const char *fc_host_traddr;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void monitor_arm(struct monitor *mon, uint64_t when)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = when / 1000,
+		.it_value.tv_nsec = (when % 1000) * 1000000,
+	};
+
+	if (mon->armed && mon->deadline <= when)
+		return;
+
+	/* a zero it_value would disarm the timer */
+	if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+		its.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(mon->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		msg(LOG_ERR, "failed to arm timer: %m\n");
+		return;
+	}
+	mon->armed = true;
+	mon->deadline = when;
+}
+
+static void monitor_schedule(struct monitor *mon, struct monitor_dc *dc)
+{
+	dc->pending = true;
+	monitor_arm(mon, now_ms() + mon->batch_delay);
+}
+
+static const char *dc_traddr(struct monitor_dc *dc)
+{
+	return dc->ce->cfg.traddr ?: "none";
+}
+
+static int dc_instance(struct monitor_dc *dc)
+{
+	if (!dc->ce->cfg.device)
+		return -ENODEV;
+	return ctrl_instance(dc->ce->cfg.device);
+}
+
+static void free_monitor_dc(struct monitor_dc *dc)
+{
+	int i;
+
+	free_conf_disc_entry(dc->ce);
+	for (i = 0; i < ARRAY_SIZE(dc->strs); i++)
+		free(dc->strs[i]);
+	free(dc->instances);
+	free(dc);
+}
+
+static void monitor_link_dc(struct monitor *mon, struct monitor_dc *dc)
+{
+	struct monitor_dc **pp;
+
+	/* keep discovery.conf order */
+	for (pp = &mon->dcs; *pp; pp = &(*pp)->next)
+		;
+	*pp = dc;
+}
+
+static struct monitor_dc *monitor_add_dc(struct monitor *mon,
+					 struct conf_disc_entry *ce)
+{
+	struct monitor_dc *dc;
+
+	dc = calloc(1, sizeof(*dc));
+	if (!dc) {
+		msg(LOG_ERR, "failed to allocate discovery controller\n");
+		free_conf_disc_entry(ce);
+		return NULL;
+	}
+	dc->ce = ce;
+	monitor_link_dc(mon, dc);
+	return dc;
+}
+
+/*
+ * Set up a discovery controller which was not listed in
+ * discovery.conf, but was given on the command line or announced by
+ * an event. The options given on the command line apply to it.
+ */
+static struct monitor_dc *monitor_new_dc(struct monitor *mon,
+		const char *transport, const char *traddr,
+		const char *trsvcid, const char *host_traddr,
+		const char *device)
+{
+	const char *saved[] = {
+		fabrics_cfg.transport, fabrics_cfg.traddr,
+		fabrics_cfg.trsvcid, fabrics_cfg.host_traddr,
+	};
+	const char *params[] = { transport, traddr, trsvcid, host_traddr };
+	struct monitor_dc *dc;
+	struct conf_disc_entry *ce;
+	int i, ret;
+
+	dc = calloc(1, sizeof(*dc));
+	ce = calloc(1, sizeof(*ce));
+	if (!dc || !ce) {
+		msg(LOG_ERR, "failed to allocate discovery controller\n");
+		free(dc);
+		free(ce);
+		return NULL;
+	}
+	dc->ce = ce;
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		if (params[i] && !(dc->strs[i] = strdup(params[i])))
+			goto out_free;
+	}
+
+	fabrics_cfg.transport = dc->strs[0];
+	fabrics_cfg.traddr = dc->strs[1];
+	fabrics_cfg.trsvcid = dc->strs[2];
+	fabrics_cfg.host_traddr = dc->strs[3];
+	ret = prepare_discovery(ce->argstr);
+	ce->cfg = fabrics_cfg;
+	ce->cfg.device = NULL;
+	fabrics_cfg.transport = saved[0];
+	fabrics_cfg.traddr = saved[1];
+	fabrics_cfg.trsvcid = saved[2];
+	fabrics_cfg.host_traddr = saved[3];
+	if (ret)
+		goto out_free;
+
+	if (device && strcmp(device, "none") &&
+	    !(ce->cfg.device = strdup(device)))
+		goto out_free;
+
+	monitor_link_dc(mon, dc);
+	return dc;
+
+out_free:
+	free_monitor_dc(dc);
+	return NULL;
+}
+
+/*
+ * Compare a freshly read discovery log with the previous one. Records
+ * which are new, or whose connect failed before, are connected; the
+ * controllers we connected for records which went away are removed.
+ * Controllers which existed before are left alone.
+ */
+static void monitor_apply_log(struct monitor_dc *dc,
+			      struct nvmf_disc_rsp_page_hdr *log, int numrec)
+{
+	struct conf_disc_entry *ce = dc->ce;
+	struct nvmf_disc_rsp_page_hdr *old = ce->res.log;
+	struct connect_job *jobs;
+	int *instances, *idx;
+	int i, j, nr_jobs = 0, err;
+
+	instances = calloc(numrec + 1, sizeof(*instances));
+	idx = calloc(numrec + 1, sizeof(*idx));
+	jobs = calloc(numrec + 1, sizeof(*jobs));
+	if (!instances || !idx || !jobs) {
+		msg(LOG_ERR, "no memory to process discovery log\n");
+		free(instances);
+		free(idx);
+		free(jobs);
+		free(log);
+		return;
+	}
+
+	for (i = 0; i < numrec; i++) {
+		instances[i] = -ENOENT;
+		for (j = 0; j < ce->res.numrec; j++) {
+			if (dc->instances[j] == RECORD_CLAIMED)
+				continue;
+			if (disc_entry_equal(&log->entries[i], &ce->cfg,
+					     &old->entries[j], &ce->cfg))
+				break;
+		}
+		if (j < ce->res.numrec) {
+			instances[i] = dc->instances[j];
+			dc->instances[j] = RECORD_CLAIMED;
+			if (instances[i] >= 0 || instances[i] == -EALREADY ||
+			    instances[i] == RECORD_REFERRAL)
+				continue;
+		}
+
+		jobs[nr_jobs].e = &log->entries[i];
+		jobs[nr_jobs].cfg = &ce->cfg;
+		jobs[nr_jobs].instance = -ENOENT;
+		idx[nr_jobs++] = i;
+	}
+
+	if (nr_jobs) {
+		msg(LOG_INFO, "%s: connecting %d of %d log entries\n",
+		    dc_traddr(dc), nr_jobs, numrec);
+		connect_jobs(jobs, nr_jobs);
+	}
+	for (i = 0; i < nr_jobs; i++) {
+		if (!jobs[i].queued)
+			continue;
+		if (jobs[i].e->subtype == NVME_NQN_DISC) {
+			/* failed referrals are retried with the next log */
+			if (!jobs[i].instance)
+				instances[idx[i]] = RECORD_REFERRAL;
+			continue;
+		}
+		instances[idx[i]] = jobs[i].instance;
+		if (jobs[i].instance >= 0)
+			msg(LOG_NOTICE, "%s: connected nvme%d\n",
+			    dc_traddr(dc), jobs[i].instance);
+	}
+
+	for (j = 0; j < ce->res.numrec; j++) {
+		if (dc->instances[j] < 0)
+			continue;
+		msg(LOG_NOTICE, "%s: removing nvme%d, no longer in discovery log\n",
+		    dc_traddr(dc), dc->instances[j]);
+		err = remove_ctrl(dc->instances[j]);
+		if (err)
+			msg(LOG_ERR, "failed to remove nvme%d: %s\n",
+			    dc->instances[j], strerror(-err));
+	}
+
+	free(old);
+	free(dc->instances);
+	ce->res.log = log;
+	ce->res.numrec = numrec;
+	dc->instances = instances;
+	free(idx);
+	free(jobs);
+}
+
+static void monitor_refresh_dc(struct monitor_dc *dc)
+{
+	struct conf_disc_entry *ce = dc->ce;
+	struct nvmf_disc_result res = { };
+	int ret;
+
+	dc->pending = false;
+	dc->retry = 0;
+
+	ret = nvmf_discover(ce->argstr, &ce->cfg, &res);
+	if (!ret && !ce->cfg.device &&
+	    asprintf(&ce->cfg.device, "nvme%d", res.instance) < 0)
+		ce->cfg.device = NULL;
+
+	if (ret || (res.ret != DISC_OK && res.ret != DISC_NO_LOG)) {
+		msg(LOG_WARNING,
+		    "%s: discovery failed, retrying in %d seconds\n",
+		    dc_traddr(dc), MONITOR_RETRY_DELAY);
+		free(res.log);
+		dc->retry = now_ms() + MONITOR_RETRY_DELAY * 1000;
+		return;
+	}
+
+	if (res.ret == DISC_NO_LOG) {
+		free(res.log);
+		res.log = NULL;
+		res.numrec = 0;
+	}
+	monitor_apply_log(dc, res.log, res.numrec);
+}
+
+static void monitor_run(struct monitor *mon)
+{
+	struct monitor_dc *dc;
+	uint64_t now = now_ms(), next = 0;
+	bool reset = false;
+
+	for (dc = mon->dcs; dc; dc = dc->next) {
+		if (dc->retry && dc->retry <= now)
+			dc->pending = true;
+		if (!dc->pending)
+			continue;
+		/* controllers may have come and gone since the last run */
+		if (!reset) {
+			nvmf_reset_ctrl_state();
+			reset = true;
+		}
+		monitor_refresh_dc(dc);
+	}
+
+	for (dc = mon->dcs; dc; dc = dc->next) {
+		if (dc->retry && (!next || dc->retry < next))
+			next = dc->retry;
+	}
+	if (next)
+		monitor_arm(mon, next);
+}
+
+static struct monitor_dc *monitor_find_dc(struct monitor *mon, int instance)
+{
+	struct monitor_dc *dc;
+
+	for (dc = mon->dcs; dc; dc = dc->next) {
+		if (instance >= 0 && dc_instance(dc) == instance)
+			return dc;
+	}
+	return NULL;
+}
+
+static void monitor_ctrl_removed(struct monitor *mon, int instance)
+{
+	struct monitor_dc *dc;
+	int i;
+
+	for (dc = mon->dcs; dc; dc = dc->next) {
+		for (i = 0; i < dc->ce->res.numrec; i++) {
+			if (dc->instances[i] == instance)
+				dc->instances[i] = -ENOENT;
+		}
+		if (dc_instance(dc) != instance)
+			continue;
+
+		/* the kernel gave up on it, set up a new one */
+		msg(LOG_NOTICE, "%s: discovery controller nvme%d went away\n",
+		    dc_traddr(dc), instance);
+		free(dc->ce->cfg.device);
+		dc->ce->cfg.device = NULL;
+		monitor_schedule(mon, dc);
+	}
+}
+
+static void monitor_fc_event(struct monitor *mon, struct uevent *ev)
+{
+	struct monitor_dc *dc;
+	const char *host_traddr;
+
+	for (dc = mon->dcs; dc; dc = dc->next) {
+		struct fabrics_config *cfg = &dc->ce->cfg;
+
+		host_traddr = cfg->host_traddr ?: "none";
+		if (cfg->transport && !strcmp(cfg->transport, "fc") &&
+		    cfg->traddr && !strcmp(cfg->traddr, ev->fc_traddr) &&
+		    !strcmp(host_traddr, ev->fc_host_traddr))
+			break;
+	}
+	if (!dc)
+		dc = monitor_new_dc(mon, "fc", ev->fc_traddr, "none",
+				    ev->fc_host_traddr, NULL);
+	if (dc)
+		monitor_schedule(mon, dc);
+}
+
+static void monitor_handle_uevent(struct monitor *mon, struct uevent *ev)
+{
+	struct monitor_dc *dc;
+	int instance;
+
+	if (ev->subsystem && !strcmp(ev->subsystem, "fc")) {
+		if (ev->action && !strcmp(ev->action, "change") &&
+		    ev->fc_event && !strcmp(ev->fc_event, "nvmediscovery") &&
+		    ev->fc_traddr && ev->fc_host_traddr)
+			monitor_fc_event(mon, ev);
+		return;
+	}
+
+	if (!ev->subsystem || strcmp(ev->subsystem, "nvme") ||
+	    !ev->action || !ev->devname)
+		return;
+
+	instance = ctrl_instance(ev->devname);
+	if (instance < 0)
+		return;
+
+	if (!strcmp(ev->action, "remove")) {
+		monitor_ctrl_removed(mon, instance);
+		return;
+	}
+	if (strcmp(ev->action, "change"))
+		return;
+
+	dc = monitor_find_dc(mon, instance);
+	if (ev->aen && !strcmp(ev->aen, NVME_AEN_DISC_LOG_CHANGE)) {
+		/* adopt persistent discovery controllers set up elsewhere */
+		if (!dc && ev->trtype)
+			dc = monitor_new_dc(mon, ev->trtype, ev->traddr,
+					    ev->trsvcid, ev->host_traddr,
+					    ev->devname);
+		if (dc)
+			monitor_schedule(mon, dc);
+	} else if (dc && ev->event && !strcmp(ev->event, "connected")) {
+		/* the log may have changed while we were disconnected */
+		monitor_schedule(mon, dc);
+	}
+}
+
+static void parse_uevent(char *buf, int len, struct uevent *ev)
+{
+	static const struct {
+		const char *key;
+		size_t offset;
+	} keys[] = {
+		{ "ACTION=", offsetof(struct uevent, action) },
+		{ "SUBSYSTEM=", offsetof(struct uevent, subsystem) },
+		{ "DEVNAME=", offsetof(struct uevent, devname) },
+		{ "NVME_AEN=", offsetof(struct uevent, aen) },
+		{ "NVME_EVENT=", offsetof(struct uevent, event) },
+		{ "NVME_TRTYPE=", offsetof(struct uevent, trtype) },
+		{ "NVME_TRADDR=", offsetof(struct uevent, traddr) },
+		{ "NVME_TRSVCID=", offsetof(struct uevent, trsvcid) },
+		{ "NVME_HOST_TRADDR=", offsetof(struct uevent, host_traddr) },
+		{ "FC_EVENT=", offsetof(struct uevent, fc_event) },
+		{ "NVMEFC_TRADDR=", offsetof(struct uevent, fc_traddr) },
+		{ "NVMEFC_HOST_TRADDR=", offsetof(struct uevent, fc_host_traddr) },
+	};
+	char *p;
+	int i;
+
+	memset(ev, 0, sizeof(*ev));
+	/* the first string is the "action@devpath" summary */
+	for (p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+		for (i = 0; i < ARRAY_SIZE(keys); i++) {
+			size_t n = strlen(keys[i].key);
+
+			if (!strncmp(p, keys[i].key, n)) {
+				*(const char **)((char *)ev + keys[i].offset) =
+					p + n;
+				break;
+			}
+		}
+	}
+}
+
+static void monitor_read_uevents(struct monitor *mon)
+{
+	char buf[UEVENT_BUF_SIZE];
+	struct sockaddr_nl addr;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+	struct msghdr hdr = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	struct uevent ev;
+	ssize_t len;
+
+	while (1) {
+		hdr.msg_namelen = sizeof(addr);
+		len = recvmsg(mon->nl_fd, &hdr, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == ENOBUFS)
+				msg(LOG_WARNING, "uevents were lost\n");
+			else if (errno != EAGAIN && errno != EINTR)
+				msg(LOG_ERR, "failed to read uevent: %m\n");
+			if (errno == ENOBUFS || errno == EINTR)
+				continue;
+			break;
+		}
+		/* only trust messages sent by the kernel */
+		if (addr.nl_pid != 0 || !len)
+			continue;
+		buf[len] = '\0';
+
+		parse_uevent(buf, len, &ev);
+		msg(LOG_DEBUG, "uevent %s\n", buf);
+		monitor_handle_uevent(mon, &ev);
+	}
+}
+
+static int monitor_setup(struct monitor *mon)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,	/* kernel uevents */
+	};
+	struct epoll_event ev = { .events = EPOLLIN };
+	int fds[3], i;
+	sigset_t mask;
+
+	mon->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+			    NETLINK_KOBJECT_UEVENT);
+	if (mon->nl_fd < 0) {
+		msg(LOG_ERR, "failed to open uevent socket: %m\n");
+		return -errno;
+	}
+	if (bind(mon->nl_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		msg(LOG_ERR, "failed to bind uevent socket: %m\n");
+		return -errno;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	mon->sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (mon->sig_fd < 0) {
+		msg(LOG_ERR, "failed to create signalfd: %m\n");
+		return -errno;
+	}
+
+	mon->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (mon->timer_fd < 0) {
+		msg(LOG_ERR, "failed to create timerfd: %m\n");
+		return -errno;
+	}
+
+	mon->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (mon->epoll_fd < 0) {
+		msg(LOG_ERR, "failed to create epoll instance: %m\n");
+		return -errno;
+	}
+
+	fds[0] = mon->nl_fd;
+	fds[1] = mon->sig_fd;
+	fds[2] = mon->timer_fd;
+	for (i = 0; i < ARRAY_SIZE(fds); i++) {
+		ev.data.fd = fds[i];
+		if (epoll_ctl(mon->epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+			msg(LOG_ERR, "failed to add fd to epoll: %m\n");
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+static void monitor_cleanup(struct monitor *mon)
+{
+	struct monitor_dc *dc;
+
+	if (mon->epoll_fd >= 0)
+		close(mon->epoll_fd);
+	if (mon->timer_fd >= 0)
+		close(mon->timer_fd);
+	if (mon->sig_fd >= 0)
+		close(mon->sig_fd);
+	if (mon->nl_fd >= 0)
+		close(mon->nl_fd);
+
+	while (mon->dcs) {
+		dc = mon->dcs;
+		mon->dcs = dc->next;
+		free_monitor_dc(dc);
+	}
+}
+
+static int monitor_loop(struct monitor *mon)
+{
+	struct epoll_event events[3];
+	struct signalfd_siginfo si;
+	struct monitor_dc *dc;
+	uint64_t expirations;
+	int i, n;
+
+	/* the initial discovery runs right away */
+	monitor_run(mon);
+
+	while (1) {
+		n = epoll_wait(mon->epoll_fd, events, ARRAY_SIZE(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			msg(LOG_ERR, "epoll_wait failed: %m\n");
+			return -errno;
+		}
+
+		for (i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == mon->sig_fd) {
+				if (read(fd, &si, sizeof(si)) != sizeof(si))
+					continue;
+				if (si.ssi_signo == SIGHUP) {
+					/* rediscover everything */
+					for (dc = mon->dcs; dc; dc = dc->next)
+						monitor_schedule(mon, dc);
+					continue;
+				}
+				msg(LOG_NOTICE, "monitor exiting on signal %d\n",
+				    si.ssi_signo);
+				return 0;
+			} else if (fd == mon->nl_fd) {
+				monitor_read_uevents(mon);
+			} else if (fd == mon->timer_fd) {
+				if (read(fd, &expirations, sizeof(expirations)) < 0 &&
+				    errno != EAGAIN)
+					msg(LOG_ERR, "failed to read timer: %m\n");
+				mon->armed = false;
+				monitor_run(mon);
+			}
+		}
+	}
+}
+
+int aen_monitor(const char *desc, int argc, char **argv)
+{
+	struct monitor mon = {
+		.batch_delay = MONITOR_DEF_BATCH_DELAY,
+		.nl_fd = -1,
+		.sig_fd = -1,
+		.timer_fd = -1,
+		.epoll_fd = -1,
+	};
+	struct conf_disc_entry *entries = NULL, *ce;
+	struct monitor_dc *dc;
+	bool quiet = false, verbose = false, timestamps = false;
+	int ret;
+
+	OPT_ARGS(opts) = {
+		OPT_LIST("transport",      't', &fabrics_cfg.transport,       "transport type"),
+		OPT_LIST("traddr",         'a', &fabrics_cfg.traddr,          "transport address"),
+		OPT_LIST("trsvcid",        's', &fabrics_cfg.trsvcid,         "transport service id (e.g. IP port)"),
+		OPT_LIST("host-traddr",    'w', &fabrics_cfg.host_traddr,     "host traddr (e.g. FC WWN's)"),
+		OPT_LIST("hostnqn",        'q', &fabrics_cfg.hostnqn,         "user-defined hostnqn (if default not used)"),
+		OPT_LIST("hostid",         'I', &fabrics_cfg.hostid,          "user-defined hostid (if default not used)"),
+		OPT_LIST("device",         'd', &fabrics_cfg.device,          "existing discovery controller device"),
+		OPT_INT("keep-alive-tmo",  'k', &fabrics_cfg.keep_alive_tmo,  "keep alive timeout period in seconds"),
+		OPT_INT("reconnect-delay", 'c', &fabrics_cfg.reconnect_delay, "reconnect timeout period in seconds"),
+		OPT_INT("ctrl-loss-tmo",   'l', &fabrics_cfg.ctrl_loss_tmo,   "controller loss timeout period in seconds"),
+		OPT_INT("tos",             'T', &fabrics_cfg.tos,             "type of service"),
+		OPT_FLAG("hdr_digest",     'g', &fabrics_cfg.hdr_digest,      "enable transport protocol header digest (TCP transport)"),
+		OPT_FLAG("data_digest",    'G', &fabrics_cfg.data_digest,     "enable transport protocol data digest (TCP transport)"),
+		OPT_INT("nr-io-queues",    'i', &fabrics_cfg.nr_io_queues,    "number of io queues to use (default is core count)"),
+		OPT_INT("nr-write-queues", 'W', &fabrics_cfg.nr_write_queues, "number of write queues to use (default 0)"),
+		OPT_INT("nr-poll-queues",  'P', &fabrics_cfg.nr_poll_queues,  "number of poll queues to use (default 0)"),
+		OPT_INT("queue-size",      'Q', &fabrics_cfg.queue_size,      "number of io queue elements to use (default 128)"),
+		OPT_FLAG("persistent",     'p', &fabrics_cfg.persistent,      "persistent discovery connection (always on)"),
+		OPT_FLAG("matching",       'm', &fabrics_cfg.matching_only,   "connect only records matching the traddr"),
+		OPT_INT("jobs",            'j', &fabrics_cfg.jobs,            "maximum number of concurrent connects (default 8)"),
+		OPT_INT("batch-delay",     'b', &mon.batch_delay,             "milliseconds to collect events before acting (default 500)"),
+		OPT_FLAG("quiet",          'S', &quiet,                       "suppress already connected errors"),
+		OPT_FLAG("verbose",        'v', &verbose,                     "log events and changes"),
+		OPT_FLAG("timestamps",     0,   &timestamps,                  "print timestamps in log messages"),
+		OPT_END()
+	};
+
+	fabrics_cfg.tos = -1;
+	ret = argconfig_parse(argc, argv, desc, opts);
+	if (ret)
+		goto out;
+
+	if (quiet)
+		log_level = LOG_WARNING;
+	if (verbose)
+		log_level = LOG_INFO;
+	log_timestamp = timestamps;
+	if (mon.batch_delay < 0)
+		mon.batch_delay = 0;
+
+	/* the whole point is to keep the discovery controllers around */
+	fabrics_cfg.persistent = true;
+	fabrics_cfg.nqn = NVME_DISC_SUBSYS_NAME;
+
+	if (!fabrics_cfg.transport && !fabrics_cfg.traddr) {
+		ret = read_discovery_conf(desc, opts, &entries);
+		if (ret && !entries)
+			goto out;
+		while (entries) {
+			ce = entries;
+			entries = ce->next;
+			ce->next = NULL;
+			monitor_add_dc(&mon, ce);
+		}
+	} else if (!monitor_new_dc(&mon, fabrics_cfg.transport,
+				   fabrics_cfg.traddr, fabrics_cfg.trsvcid,
+				   fabrics_cfg.host_traddr, fabrics_cfg.device)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = monitor_setup(&mon);
+	if (ret)
+		goto out;
+
+	for (dc = mon.dcs; dc; dc = dc->next)
+		dc->pending = true;
+
+	ret = monitor_loop(&mon);
+out:
+	monitor_cleanup(&mon);
+	return ret;
+}
@@ -79,8 +79,14 @@ COMMAND_LIST(
 	ENTRY("connect", "Connect to NVMeoF subsystem", connect_cmd)
 	ENTRY("disconnect", "Disconnect from NVMeoF subsystem", disconnect_cmd)
 	ENTRY("disconnect-all", "Disconnect from all connected NVMeoF subsystems", disconnect_all_cmd)
+	ENTRY("monitor", "Monitor discovery controllers and connect to changed NVMeoF subsystems", monitor_cmd)
 	ENTRY("gen-hostnqn", "Generate NVMeoF host NQN", gen_hostnqn_cmd)
 	ENTRY("show-hostnqn", "Show NVMeoF host NQN", show_hostnqn_cmd)
+	ENTRY("batch", "Run many sub-commands in one process", batch_cmd)
+	ENTRY("serve", "Run sub-commands on behalf of local clients", serve_cmd)
+	ENTRY("replay", "Replay and compare recorded passthrough commands", replay_cmd)
+	ENTRY("feature-snapshot", "Save all supported features to a file", feature_snapshot_cmd)
+	ENTRY("feature-diff", "Compare features with a snapshot or profile", feature_diff_cmd)
 	ENTRY("dir-receive", "Submit a Directive Receive command, return results", dir_receive)
 	ENTRY("dir-send", "Submit a Directive Send command, return results", dir_send)
 	ENTRY("virt-mgmt", "Manage Flexible Resources between Primary and Secondary Controller ", virtual_mgmt)
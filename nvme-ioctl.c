@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <errno.h>
 
@@ -12,8 +13,42 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
 
 #include "nvme-ioctl.h"
+#include "common.h"
+
+static int kernel_open(const char *path, int flags)
+{
+	return open(path, flags);
+}
+
+static int kernel_stat(const char *path, struct stat *st)
+{
+	return stat(path, st);
+}
+
+static int kernel_ioctl(int fd, unsigned long req, void *arg)
+{
+	return ioctl(fd, req, arg);
+}
+
+static const struct nvme_backend kernel_backend = {
+	.open		= kernel_open,
+	.stat		= kernel_stat,
+	.dup		= dup,
+	.ioctl		= kernel_ioctl,
+	.read		= read,
+	.write		= write,
+	.sysfs_root	= "",
+};
+
+const struct nvme_backend *nvme_backend = &kernel_backend;
+
+int nvme_open(const char *path, int flags)
+{
+	return nvme_backend->open(path, flags);
+}
 
 static int nvme_verify_chr(int fd)
 {
@@ -32,6 +67,103 @@ static int nvme_verify_chr(int fd)
 	return 0;
 }
 
+/*
+ * Identify Controller data, cached per device for callers running many
+ * commands in one process. Any admin command other than Identify, Get
+ * Log Page and Get Features may change it and drops the cached copy, as
+ * do resets and rescans, which activate committed firmware.
+ */
+struct id_ctrl_cache_entry {
+	dev_t rdev;
+	struct nvme_id_ctrl id;
+	struct id_ctrl_cache_entry *next;
+};
+
+static bool id_ctrl_cache_enabled;
+static struct id_ctrl_cache_entry *id_ctrl_cache;
+static unsigned int id_ctrl_cache_gen;
+
+static struct id_ctrl_cache_entry *id_ctrl_cache_lookup(int fd, dev_t *rdev)
+{
+	struct id_ctrl_cache_entry *e;
+	struct stat st;
+
+	if (!id_ctrl_cache_enabled || fstat(fd, &st) < 0)
+		return NULL;
+	*rdev = st.st_rdev;
+	for (e = id_ctrl_cache; e; e = e->next)
+		if (e->rdev == st.st_rdev)
+			return e;
+	return NULL;
+}
+
+static void id_ctrl_cache_add(dev_t rdev, const void *id)
+{
+	struct id_ctrl_cache_entry *e;
+
+	e = malloc(sizeof(*e));
+	if (!e)
+		return;
+	e->rdev = rdev;
+	memcpy(&e->id, id, sizeof(e->id));
+	e->next = id_ctrl_cache;
+	id_ctrl_cache = e;
+}
+
+static void id_ctrl_cache_clear(void)
+{
+	struct id_ctrl_cache_entry *e;
+
+	while (id_ctrl_cache) {
+		e = id_ctrl_cache;
+		id_ctrl_cache = e->next;
+		free(e);
+	}
+	id_ctrl_cache_gen++;
+}
+
+static void id_ctrl_cache_invalidate(__u8 opcode)
+{
+	/*
+	 * Namespace block devices and the controller character device
+	 * have different device numbers, so drop everything.
+	 */
+	if (id_ctrl_cache && opcode != nvme_admin_identify &&
+	    opcode != nvme_admin_get_log_page &&
+	    opcode != nvme_admin_get_features)
+		id_ctrl_cache_clear();
+}
+
+void nvme_identify_cache_enable(bool enable)
+{
+	id_ctrl_cache_enabled = enable;
+	if (!enable)
+		id_ctrl_cache_clear();
+}
+
+/* whether Identify Controller data of the device is cached */
+bool nvme_identify_cache_has(int fd)
+{
+	dev_t rdev;
+
+	return id_ctrl_cache_lookup(fd, &rdev) != NULL;
+}
+
+/* cache Identify Controller data read elsewhere, e.g. in a child process */
+void nvme_identify_cache_add(int fd, const struct nvme_id_ctrl *id)
+{
+	dev_t rdev = 0;
+
+	if (!id_ctrl_cache_lookup(fd, &rdev) && rdev)
+		id_ctrl_cache_add(rdev, id);
+}
+
+/* changes whenever cached data was dropped */
+unsigned int nvme_identify_cache_generation(void)
+{
+	return id_ctrl_cache_gen;
+}
+
 int nvme_subsystem_reset(int fd)
 {
 	int ret;
@@ -39,7 +171,8 @@ int nvme_subsystem_reset(int fd)
 	ret = nvme_verify_chr(fd);
 	if (ret)
 		return ret;
-	return ioctl(fd, NVME_IOCTL_SUBSYS_RESET);
+	id_ctrl_cache_clear();
+	return nvme_backend->ioctl(fd, NVME_IOCTL_SUBSYS_RESET, NULL);
 }
 
 int nvme_reset_controller(int fd)
@@ -49,7 +182,8 @@ int nvme_reset_controller(int fd)
 	ret = nvme_verify_chr(fd);
 	if (ret)
 		return ret;
-	return ioctl(fd, NVME_IOCTL_RESET);
+	id_ctrl_cache_clear();
+	return nvme_backend->ioctl(fd, NVME_IOCTL_RESET, NULL);
 }
 
 int nvme_ns_rescan(int fd)
@@ -59,7 +193,8 @@ int nvme_ns_rescan(int fd)
 	ret = nvme_verify_chr(fd);
 	if (ret)
 		return ret;
-	return ioctl(fd, NVME_IOCTL_RESCAN);
+	id_ctrl_cache_clear();
+	return nvme_backend->ioctl(fd, NVME_IOCTL_RESCAN, NULL);
 }
 
 int nvme_get_nsid(int fd)
@@ -70,23 +205,444 @@ int nvme_get_nsid(int fd)
 	if (err < 0)
 		return -errno;
 
-	return ioctl(fd, NVME_IOCTL_ID);
+	return nvme_backend->ioctl(fd, NVME_IOCTL_ID, NULL);
+}
+
+/*
+ * Opt-in command tracing. With NVME_TRACE set to a file name ("-" for
+ * stderr) every passthrough command is timed and recorded in a ring of
+ * NVME_TRACE_ENTRIES (default 4096) records, which is written out when
+ * the process exits: as JSON with a per opcode latency summary, or with
+ * NVME_TRACE_FORMAT=binary as a struct nvme_trace_file_hdr followed by
+ * the records, oldest first, in host byte order.
+ *
+ * The ring is a shared mapping, so the children fanout and serve fork
+ * add their commands to it and the tracing process writes them all out.
+ */
+static struct {
+	struct nvme_trace_rec *recs;
+	__u64 *nr_recs;		/* records ever taken, the ring keeps the last */
+	__u32 size;
+	const char *path;
+	bool binary;
+	pid_t pid;
+	struct timespec epoch;
+} trace;
+
+/*
+ * With NVME_RECORD set to a file name every passthrough command is
+ * appended to it as it completes: a struct nvme_record_cmd followed by
+ * the data sent to and the data returned by the controller, for replay
+ * with 'nvme replay'. Every record is written with a single write() to
+ * an O_APPEND descriptor, so the children fanout and serve fork append
+ * their commands to the same file without interleaving.
+ */
+static struct {
+	int fd;
+	struct timespec epoch;
+} record = {
+	.fd = -1,
+};
+
+static __u64 ts_ns(const struct timespec *epoch, const struct timespec *ts)
+{
+	return (ts->tv_sec - epoch->tv_sec) * 1000000000ULL +
+		ts->tv_nsec - epoch->tv_nsec;
+}
+
+static __u64 trace_ns(const struct timespec *ts)
+{
+	return ts_ns(&trace.epoch, ts);
+}
+
+static void trace_add(__u8 queue, __u8 opcode, __u32 nsid, const __u32 *cdw,
+		      __u32 data_len, int status, const struct timespec *start,
+		      const struct timespec *end)
+{
+	struct nvme_trace_rec *rec;
+	__u64 seq;
+
+	seq = __atomic_fetch_add(trace.nr_recs, 1, __ATOMIC_RELAXED);
+	rec = &trace.recs[seq % trace.size];
+	rec->start_ns = trace_ns(start);
+	rec->duration_ns = trace_ns(end) - rec->start_ns;
+	rec->queue = queue;
+	rec->opcode = opcode;
+	rec->nsid = nsid;
+	memcpy(rec->cdw, cdw, sizeof(rec->cdw));
+	rec->data_len = data_len;
+	rec->status = status;
+}
+
+static void record_add(unsigned long req, void *arg, const void *out,
+		       int status, const struct timespec *start,
+		       const struct timespec *end)
+{
+	struct nvme_passthru_cmd *cmd = arg;	/* same layout as cmd64 */
+	struct nvme_record_cmd rec = {
+		.opcode = cmd->opcode,
+		.flags = cmd->flags,
+		.nsid = cmd->nsid,
+		.cdw2 = cmd->cdw2,
+		.cdw3 = cmd->cdw3,
+		.data_len = cmd->data_len,
+		.metadata_len = cmd->metadata_len,
+		.timeout_ms = cmd->timeout_ms,
+		.status = status,
+		.start_ns = ts_ns(&record.epoch, start),
+		.duration_ns = ts_ns(start, end),
+	};
+	void *data = (void *)(uintptr_t)cmd->addr;
+	size_t len;
+	ssize_t n;
+	char *buf;
+
+	switch (req) {
+	case NVME_IOCTL_ADMIN_CMD:
+		rec.queue = NVME_TRACE_ADMIN;
+		rec.result = cmd->result;
+		break;
+	case NVME_IOCTL_IO_CMD:
+		rec.queue = NVME_TRACE_IO;
+		rec.result = cmd->result;
+		break;
+	case NVME_IOCTL_IO64_CMD:
+		rec.queue = NVME_TRACE_IO64;
+		rec.result = ((struct nvme_passthru_cmd64 *)arg)->result;
+		break;
+	default:
+		return;
+	}
+	memcpy(rec.cdw, &cmd->cdw10, sizeof(rec.cdw));
+
+	/* the data transfer direction is in the low opcode bits */
+	if (out)
+		rec.out_len = cmd->data_len;
+	if (data && (cmd->opcode & 2) && !status)
+		rec.in_len = cmd->data_len;
+
+	len = sizeof(rec) + rec.out_len + rec.in_len;
+	buf = malloc(len);
+	if (!buf) {
+		fprintf(stderr, "Failed to record command: %s\n",
+			strerror(ENOMEM));
+		return;
+	}
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + sizeof(rec), out, rec.out_len);
+	memcpy(buf + sizeof(rec) + rec.out_len, data, rec.in_len);
+	n = write(record.fd, buf, len);
+	if (n < 0 || (size_t)n != len)
+		fprintf(stderr, "Failed to record command: %s\n",
+			n < 0 ? strerror(errno) : "short write");
+	free(buf);
+}
+
+/*
+ * Issue an ioctl for a command with the given opcode, nsid, command dwords
+ * 10 to 15 and data length, and trace and record it when enabled.
+ */
+static int trace_ioctl(int fd, unsigned long req, void *arg, __u8 queue,
+		       __u8 opcode, __u32 nsid, const __u32 *cdw,
+		       __u32 data_len)
+{
+	struct nvme_passthru_cmd *cmd = arg;	/* same layout as cmd64 */
+	struct timespec start, end;
+	void *out = NULL;
+	int ret, err;
+
+	/* passthru() hands the request number over sign extended from int */
+	req = (__u32)req;
+
+	if (!trace.recs && record.fd < 0)
+		return nvme_backend->ioctl(fd, req, arg);
+
+	/*
+	 * Keep the data sent to the controller, a bidirectional command
+	 * overwrites it with the data returned.
+	 */
+	if (record.fd >= 0 && (req == NVME_IOCTL_ADMIN_CMD ||
+	    req == NVME_IOCTL_IO_CMD || req == NVME_IOCTL_IO64_CMD) &&
+	    cmd->addr && cmd->data_len && (cmd->opcode & 1)) {
+		out = malloc(cmd->data_len);
+		if (out)
+			memcpy(out, (void *)(uintptr_t)cmd->addr,
+			       cmd->data_len);
+		else
+			fprintf(stderr, "Failed to record command data: %s\n",
+				strerror(ENOMEM));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	ret = nvme_backend->ioctl(fd, req, arg);
+	err = errno;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+	if (trace.recs)
+		trace_add(queue, opcode, nsid, cdw, data_len,
+			  ret < 0 ? -err : ret, &start, &end);
+	if (record.fd >= 0)
+		record_add(req, arg, out, ret < 0 ? -err : ret, &start, &end);
+	free(out);
+	errno = err;
+	return ret;
+}
+
+static int trace_passthru(int fd, unsigned long ioctl_cmd,
+			  struct nvme_passthru_cmd *cmd)
+{
+	return trace_ioctl(fd, ioctl_cmd, cmd,
+			   ioctl_cmd == NVME_IOCTL_ADMIN_CMD ?
+			   NVME_TRACE_ADMIN : NVME_TRACE_IO, cmd->opcode,
+			   cmd->nsid, &cmd->cdw10, cmd->data_len);
+}
+
+static int trace_cmp(const void *a, const void *b)
+{
+	const struct nvme_trace_rec *ra = a, *rb = b;
+
+	if (ra->queue != rb->queue)
+		return ra->queue - rb->queue;
+	if (ra->opcode != rb->opcode)
+		return ra->opcode - rb->opcode;
+	return ra->duration_ns < rb->duration_ns ? -1 :
+		ra->duration_ns > rb->duration_ns;
+}
+
+static const char *trace_queue(__u8 queue)
+{
+	return queue == NVME_TRACE_ADMIN ? "admin" : "io";
+}
+
+/* recs holds n records of one opcode, sorted by duration */
+static void trace_print_summary(FILE *f, struct nvme_trace_rec *recs, __u64 n,
+				bool json)
+{
+	__u64 i, total = 0;
+
+	for (i = 0; i < n; i++)
+		total += recs[i].duration_ns;
+
+	fprintf(f, json ? "{\"queue\":\"%s\",\"opcode\":%u,\"count\":%llu,"\
+		"\"min_ns\":%llu,\"avg_ns\":%llu,\"max_ns\":%llu,"\
+		"\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu}" :
+		"%-5s 0x%02x %8llu %12llu %12llu %12llu %12llu %12llu %12llu\n",
+		trace_queue(recs[0].queue), recs[0].opcode,
+		(unsigned long long)n,
+		(unsigned long long)recs[0].duration_ns,
+		(unsigned long long)(total / n),
+		(unsigned long long)recs[n - 1].duration_ns,
+		(unsigned long long)recs[n / 2].duration_ns,
+		(unsigned long long)recs[n * 9 / 10].duration_ns,
+		(unsigned long long)recs[n * 99 / 100].duration_ns);
+}
+
+static void trace_summary(FILE *f, struct nvme_trace_rec *recs, __u64 n,
+			  bool json)
+{
+	struct nvme_trace_rec *sorted;
+	__u64 i, first;
+
+	sorted = malloc(n * sizeof(*sorted));
+	if (!sorted)
+		return;
+	memcpy(sorted, recs, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), trace_cmp);
+
+	if (!json)
+		fprintf(f, "%-5s %-4s %8s %12s %12s %12s %12s %12s %12s\n",
+			"queue", "op", "count", "min_ns", "avg_ns", "max_ns",
+			"p50_ns", "p90_ns", "p99_ns");
+	for (first = 0, i = 1; i <= n; i++) {
+		if (i < n && sorted[i].queue == sorted[first].queue &&
+		    sorted[i].opcode == sorted[first].opcode)
+			continue;
+		if (json)
+			fprintf(f, "%s\n    ", first ? "," : "");
+		trace_print_summary(f, &sorted[first], i - first, json);
+		first = i;
+	}
+	free(sorted);
+}
+
+static void trace_write_json(FILE *f, struct nvme_trace_rec *recs, __u64 n,
+			     __u64 seq)
+{
+	struct nvme_trace_rec *rec;
+	__u64 i;
+
+	fprintf(f, "{\n  \"dropped\":%llu,\n  \"commands\":[",
+		(unsigned long long)(seq - n));
+	for (i = 0; i < n; i++) {
+		rec = &recs[i];
+		fprintf(f, "%s\n    {\"seq\":%llu,\"queue\":\"%s\","\
+			"\"opcode\":%u,\"nsid\":%u,\"cdw10\":%u,\"cdw11\":%u,"\
+			"\"cdw12\":%u,\"cdw13\":%u,\"cdw14\":%u,\"cdw15\":%u,"\
+			"\"data_len\":%u,\"status\":%d,\"start_ns\":%llu,"\
+			"\"duration_ns\":%llu}", i ? "," : "",
+			(unsigned long long)(seq - n + i),
+			trace_queue(rec->queue), rec->opcode, rec->nsid,
+			rec->cdw[0], rec->cdw[1], rec->cdw[2], rec->cdw[3],
+			rec->cdw[4], rec->cdw[5], rec->data_len, rec->status,
+			(unsigned long long)rec->start_ns,
+			(unsigned long long)rec->duration_ns);
+	}
+	fprintf(f, "\n  ],\n  \"summary\":[");
+	if (n)
+		trace_summary(f, recs, n, true);
+	fprintf(f, "\n  ]\n}\n");
+}
+
+static void trace_dump(void)
+{
+	struct nvme_trace_file_hdr hdr = {
+		.magic = NVME_TRACE_MAGIC,
+		.version = 1,
+		.rec_size = sizeof(struct nvme_trace_rec),
+	};
+	struct nvme_trace_rec *recs;
+	__u64 seq, n, start, tail;
+	FILE *f;
+
+	/* children share the ring but only the tracing process reports */
+	if (!trace.recs || getpid() != trace.pid)
+		return;
+
+	seq = __atomic_load_n(trace.nr_recs, __ATOMIC_RELAXED);
+	n = min(seq, (__u64)trace.size);
+
+	/* make the ring linear, oldest record first */
+	recs = malloc(n * sizeof(*recs) + 1);
+	if (!recs)
+		return;
+	start = (seq - n) % trace.size;
+	tail = min(n, trace.size - start);
+	memcpy(recs, &trace.recs[start], tail * sizeof(*recs));
+	memcpy(&recs[tail], trace.recs, (n - tail) * sizeof(*recs));
+
+	f = strcmp(trace.path, "-") ? fopen(trace.path, "w") : stderr;
+	if (!f) {
+		fprintf(stderr, "Failed to open trace file %s: %s\n",
+			trace.path, strerror(errno));
+		free(recs);
+		return;
+	}
+
+	if (trace.binary) {
+		hdr.nr_recs = n;
+		hdr.dropped = seq - n;
+		if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+		    fwrite(recs, sizeof(*recs), n, f) != n)
+			fprintf(stderr, "Failed to write trace file %s\n",
+				trace.path);
+		if (n)
+			trace_summary(stderr, recs, n, false);
+	} else {
+		trace_write_json(f, recs, n, seq);
+	}
+	if (f != stderr)
+		fclose(f);
+	free(recs);
+}
+
+static void record_init(void)
+{
+	struct nvme_record_file_hdr hdr = {
+		.magic = NVME_RECORD_MAGIC,
+		.version = 1,
+		.rec_size = sizeof(struct nvme_record_cmd),
+	};
+	const char *path;
+
+	path = getenv("NVME_RECORD");
+	if (!path || !*path || record.fd >= 0)
+		return;
+
+	record.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND |
+			 O_CLOEXEC, 0644);
+	if (record.fd < 0) {
+		fprintf(stderr, "Failed to open record file %s: %s\n",
+			path, strerror(errno));
+		return;
+	}
+	if (write(record.fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		fprintf(stderr, "Failed to write record file %s: %s\n",
+			path, strerror(errno));
+		close(record.fd);
+		record.fd = -1;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &record.epoch);
+}
+
+void nvme_trace_init(void)
+{
+	const char *path, *format, *entries;
+	char *end;
+	void *ring;
+
+	record_init();
+
+	path = getenv("NVME_TRACE");
+	if (!path || !*path || trace.recs)
+		return;
+
+	format = getenv("NVME_TRACE_FORMAT");
+	if (format && strcmp(format, "json") && strcmp(format, "binary")) {
+		fprintf(stderr, "Invalid NVME_TRACE_FORMAT %s\n", format);
+		return;
+	}
+	trace.binary = format && !strcmp(format, "binary");
+
+	trace.size = 4096;
+	entries = getenv("NVME_TRACE_ENTRIES");
+	if (entries) {
+		trace.size = strtoul(entries, &end, 0);
+		if (*end || !trace.size) {
+			fprintf(stderr, "Invalid NVME_TRACE_ENTRIES %s\n",
+				entries);
+			return;
+		}
+	}
+
+	/* the counter goes first, the records after it stay aligned */
+	ring = mmap(NULL, sizeof(*trace.recs) * (trace.size + 1),
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ring == MAP_FAILED) {
+		fprintf(stderr, "No memory for %u trace entries\n", trace.size);
+		return;
+	}
+	trace.nr_recs = ring;
+	trace.recs = (struct nvme_trace_rec *)ring + 1;
+	trace.path = path;
+	trace.pid = getpid();
+	clock_gettime(CLOCK_MONOTONIC_RAW, &trace.epoch);
+	atexit(trace_dump);
 }
 
 int nvme_submit_passthru(int fd, unsigned long ioctl_cmd,
 			 struct nvme_passthru_cmd *cmd)
 {
-	return ioctl(fd, ioctl_cmd, cmd);
+	if (ioctl_cmd == NVME_IOCTL_ADMIN_CMD)
+		id_ctrl_cache_invalidate(cmd->opcode);
+	return trace_passthru(fd, ioctl_cmd, cmd);
 }
 
 int nvme_submit_admin_passthru(int fd, struct nvme_passthru_cmd *cmd)
 {
-	return ioctl(fd, NVME_IOCTL_ADMIN_CMD, cmd);
+	id_ctrl_cache_invalidate(cmd->opcode);
+	return trace_passthru(fd, NVME_IOCTL_ADMIN_CMD, cmd);
 }
 
 int nvme_submit_io_passthru(int fd, struct nvme_passthru_cmd *cmd)
 {
-	return ioctl(fd, NVME_IOCTL_IO_CMD, cmd);
+	return trace_passthru(fd, NVME_IOCTL_IO_CMD, cmd);
+}
+
+int nvme_submit_io_passthru64(int fd, struct nvme_passthru_cmd64 *cmd)
+{
+	return trace_ioctl(fd, NVME_IOCTL_IO64_CMD, cmd, NVME_TRACE_IO,
+			   cmd->opcode, cmd->nsid, &cmd->cdw10, cmd->data_len);
 }
 
 int nvme_passthru(int fd, unsigned long ioctl_cmd, __u8 opcode,
@@ -142,7 +698,13 @@ int nvme_io(int fd, __u8 opcode, __u64 slba, __u16 nblocks, __u16 control,
 		.appmask	= appmask,
 		.apptag		= apptag,
 	};
-	return ioctl(fd, NVME_IOCTL_SUBMIT_IO, &io);
+	__u32 cdw[6] = {
+		slba & 0xffffffff, slba >> 32, nblocks | (control << 16),
+		dsmgmt, reftag, apptag | (appmask << 16),
+	};
+
+	return trace_ioctl(fd, NVME_IOCTL_SUBMIT_IO, &io, NVME_TRACE_IO,
+			   opcode, 0, cdw, 0);
 }
 
 int nvme_verify(int fd, __u32 nsid, __u64 slba, __u16 nblocks,
@@ -377,8 +939,23 @@ int nvme_identify(int fd, __u32 nsid, __u32 cdw10, void *data)
 
 int nvme_identify_ctrl(int fd, void *data)
 {
+	struct id_ctrl_cache_entry *e;
+	dev_t rdev = 0;
+	int err;
+
+	e = id_ctrl_cache_lookup(fd, &rdev);
+	if (e) {
+		memcpy(data, &e->id, sizeof(e->id));
+		return 0;
+	}
+
 	memset(data, 0, sizeof(struct nvme_id_ctrl));
-	return nvme_identify(fd, 0, 1, data);
+	err = nvme_identify(fd, 0, 1, data);
+	if (err || !rdev)
+		return err;
+
+	id_ctrl_cache_add(rdev, data);
+	return 0;
 }
 
 int nvme_identify_ns(int fd, __u32 nsid, bool present, void *data)
@@ -1063,7 +1640,7 @@ int nvme_zns_append(int fd, __u32 nsid, __u64 zslba, __u16 nlb, __u16 control,
 
 	int err;
 
-	err = ioctl(fd, NVME_IOCTL_IO64_CMD, &cmd);
+	err = nvme_submit_io_passthru64(fd, &cmd);
 	if (!err && result)
 		*result = cmd.result;
 	return err;
@@ -3,6 +3,8 @@
 
 #include <linux/types.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "linux/nvme_ioctl.h"
 #include "nvme.h"
 
@@ -10,11 +12,91 @@
 
 int nvme_get_nsid(int fd);
 
+/* Command tracing, see nvme_trace_init() */
+#define NVME_TRACE_MAGIC	"NVMETRC"
+
+enum {
+	NVME_TRACE_ADMIN	= 0,
+	NVME_TRACE_IO		= 1,
+	NVME_TRACE_IO64		= 2,	/* 64-bit result, recordings only */
+};
+
+struct nvme_trace_rec {
+	__u64	start_ns;	/* since tracing started */
+	__u64	duration_ns;
+	__u8	queue;
+	__u8	opcode;
+	__u16	rsvd;
+	__u32	nsid;
+	__u32	cdw[6];		/* command dwords 10 to 15 */
+	__u32	data_len;
+	__s32	status;		/* NVMe status, or negative errno */
+};
+
+struct nvme_trace_file_hdr {
+	char	magic[8];
+	__u32	version;
+	__u32	rec_size;
+	__u64	nr_recs;
+	__u64	dropped;	/* older records overwritten in the ring */
+};
+
+/* Command recording for 'nvme replay', see nvme_trace_init() */
+#define NVME_RECORD_MAGIC	"NVMEREC"
+
+struct nvme_record_file_hdr {
+	char	magic[8];
+	__u32	version;
+	__u32	rec_size;
+};
+
+/* followed by out_len bytes sent and in_len bytes returned */
+struct nvme_record_cmd {
+	__u64	start_ns;	/* since recording started */
+	__u64	duration_ns;
+	__u8	queue;
+	__u8	opcode;
+	__u8	flags;
+	__u8	rsvd;
+	__u32	nsid;
+	__u32	cdw2;
+	__u32	cdw3;
+	__u32	cdw[6];		/* command dwords 10 to 15 */
+	__u32	data_len;
+	__u32	metadata_len;
+	__u32	timeout_ms;
+	__s32	status;		/* NVMe status, or negative errno */
+	__u64	result;
+	__u32	out_len;
+	__u32	in_len;
+};
+
+void nvme_trace_init(void);
+
+/*
+ * Device opens and ioctls go through a backend: the kernel by default,
+ * or the file backed mock device of nvme-mock.c.
+ */
+struct nvme_backend {
+	int (*open)(const char *path, int flags);
+	int (*stat)(const char *path, struct stat *st);
+	int (*dup)(int fd);
+	int (*ioctl)(int fd, unsigned long req, void *arg);
+	ssize_t (*read)(int fd, void *buf, size_t len);
+	ssize_t (*write)(int fd, const void *buf, size_t len);
+	const char *sysfs_root;	/* prepended to sysfs and /run paths */
+};
+
+extern const struct nvme_backend *nvme_backend;
+
+int nvme_open(const char *path, int flags);
+
 /* Generic passthrough */
 int nvme_submit_passthru(int fd, unsigned long ioctl_cmd,
 			 struct nvme_passthru_cmd *cmd);
 int nvme_submit_admin_passthru(int fd, struct nvme_passthru_cmd *cmd);
 int nvme_submit_io_passthru(int fd, struct nvme_passthru_cmd *cmd);
+int nvme_submit_io_passthru64(int fd, struct nvme_passthru_cmd64 *cmd);
 
 int nvme_passthru(int fd, unsigned long ioctl_cmd, __u8 opcode, __u8 flags,
 		  __u16 rsvd, __u32 nsid, __u32 cdw2, __u32 cdw3,
@@ -72,6 +154,10 @@ int nvme_resv_report(int fd, __u32 nsid, __u32 numd, __u32 cdw11, void *data);
 int nvme_identify13(int fd, __u32 nsid, __u32 cdw10, __u32 cdw11, void *data);
 int nvme_identify(int fd, __u32 nsid, __u32 cdw10, void *data);
 int nvme_identify_ctrl(int fd, void *data);
+void nvme_identify_cache_enable(bool enable);
+bool nvme_identify_cache_has(int fd);
+void nvme_identify_cache_add(int fd, const struct nvme_id_ctrl *id);
+unsigned int nvme_identify_cache_generation(void);
 int nvme_identify_ns(int fd, __u32 nsid, bool present, void *data);
 int nvme_identify_ns_list(int fd, __u32 nsid, bool all, void *data);
 int nvme_identify_ns_list_csi(int fd, __u32 nsid, __u8 csi, bool all, void *data);
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "nvme-lightnvm.h"
 #include "nvme-print.h"
@@ -698,3 +699,421 @@ int lnvm_do_set_bbtbl(int fd, int nsid,
 
 	return __lnvm_do_set_bbtbl(fd, ppa, value);
 }
+
+/* upper bound for chunk log pages when MDTS does not limit them */
+#define LNVM_SWEEP_MAX_XFER	(128 * 1024)
+
+/* OCSSD 1.2 bad block table entries */
+#define LNVM_BLK_FACTORY_BAD	(1 << 0)
+#define LNVM_BLK_GROWN_BAD	(1 << 1)
+#define LNVM_BLK_DEV_RESV	(1 << 2)
+#define LNVM_BLK_HOST_RESV	(1 << 3)
+
+struct lnvm_pu_stats {
+	__u32 free, open, closed, offline;
+	__u32 wli[LNVM_WLI_BUCKETS];
+	__u32 blks, factory_bad, grown_bad, dev_resv, host_resv;
+};
+
+/*
+ * A sweep splits the geometry into items, chunk log pages for 2.0 and
+ * (channel, LUN) bad block tables for 1.2, which a pool of threads
+ * fetches concurrently from the same file descriptor.
+ */
+struct lnvm_sweep {
+	int fd;
+	__u32 nsid;
+	struct nvme_nvm_id *id;
+	int (*fetch)(struct lnvm_sweep *sw, int item, void *buf);
+	int nr_items;
+	int next;
+	int err;
+	__u32 buf_len;
+	pthread_mutex_t lock;
+
+	/* 2.0 geometry */
+	__u32 nr_chk;		/* chunks per parallel unit */
+	__u64 log_len;
+	__u32 xfer;
+
+	struct lnvm_pu_stats *stats;
+	int nr_pus;
+};
+
+static void lnvm_count_chunk(struct lnvm_pu_stats *st,
+			     struct nvme_nvm_chunk_desc *desc)
+{
+	switch (desc->cs) {
+	case 1 << 0:
+		st->free++;
+		break;
+	case 1 << 1:
+		st->closed++;
+		break;
+	case 1 << 2:
+		st->open++;
+		break;
+	case 1 << 3:
+		st->offline++;
+		break;
+	}
+	st->wli[desc->wli * LNVM_WLI_BUCKETS / 256]++;
+}
+
+static void lnvm_add_stats(struct lnvm_pu_stats *to, struct lnvm_pu_stats *from)
+{
+	int i;
+
+	to->free += from->free;
+	to->open += from->open;
+	to->closed += from->closed;
+	to->offline += from->offline;
+	for (i = 0; i < LNVM_WLI_BUCKETS; i++)
+		to->wli[i] += from->wli[i];
+	to->blks += from->blks;
+	to->factory_bad += from->factory_bad;
+	to->grown_bad += from->grown_bad;
+	to->dev_resv += from->dev_resv;
+	to->host_resv += from->host_resv;
+}
+
+/*
+ * Fetches one page of the chunk information log. A page may end in the
+ * middle of a parallel unit, so it is counted into a local copy first
+ * and merged under the lock.
+ */
+static int lnvm_fetch_chunk_page(struct lnvm_sweep *sw, int item, void *buf)
+{
+	struct nvme_nvm_chunk_desc *desc = buf;
+	__u64 off = (__u64)item * sw->xfer;
+	__u32 len = sw->log_len - off < sw->xfer ? sw->log_len - off : sw->xfer;
+	__u64 first = off / sizeof(*desc);
+	struct lnvm_pu_stats st;
+	int i, nr = len / sizeof(*desc), pu = first / sw->nr_chk;
+	int err;
+
+	err = nvme_get_log13(sw->fd, sw->nsid, NVM_LID_CHUNK_INFO, 0, off, 0,
+			     false, len, buf);
+	if (err)
+		return err < 0 ? -errno : err;
+
+	memset(&st, 0, sizeof(st));
+	for (i = 0; i < nr; i++) {
+		if ((first + i) / sw->nr_chk != pu) {
+			pthread_mutex_lock(&sw->lock);
+			lnvm_add_stats(&sw->stats[pu], &st);
+			pthread_mutex_unlock(&sw->lock);
+			memset(&st, 0, sizeof(st));
+			pu = (first + i) / sw->nr_chk;
+		}
+		lnvm_count_chunk(&st, &desc[i]);
+	}
+	pthread_mutex_lock(&sw->lock);
+	lnvm_add_stats(&sw->stats[pu], &st);
+	pthread_mutex_unlock(&sw->lock);
+	return 0;
+}
+
+static int lnvm_fetch_bbtbl(struct lnvm_sweep *sw, int item, void *buf)
+{
+	struct nvme_nvm_id12 *id = (struct nvme_nvm_id12 *)sw->id;
+	struct nvme_nvm_id12_group *grp = &id->groups[0];
+	struct lnvm_pu_stats *st = &sw->stats[item];
+	struct nvme_nvm_bb_tbl *bbtbl = buf;
+	struct ppa_addr ppa;
+	__u32 i, nr_blks = sw->buf_len - sizeof(*bbtbl);
+	int err;
+
+	ppa.ppa = 0;
+	ppa.g.ch = item / grp->num_lun;
+	ppa.g.lun = item % grp->num_lun;
+	ppa = generic_to_dev_addr(&id->ppaf, ppa);
+
+	struct nvme_nvm_getbbtbl cmd = {
+		.opcode		= nvme_nvm_admin_get_bb_tbl,
+		.nsid		= cpu_to_le32(sw->nsid),
+		.addr		= (__u64)(uintptr_t)bbtbl,
+		.data_len	= sw->buf_len,
+		.ppa		= cpu_to_le64(ppa.ppa),
+	};
+	void *tmp = &cmd;
+
+	memset(bbtbl, 0, sw->buf_len);
+	err = nvme_submit_passthru(sw->fd, NVME_IOCTL_ADMIN_CMD, tmp);
+	if (err)
+		return err < 0 ? -errno : err;
+
+	/* a short or foreign reply must not count as all blocks good */
+	if (memcmp(bbtbl->tblid, "BBLT", 4) ||
+	    le16_to_cpu(bbtbl->verid) != 1 ||
+	    le32_to_cpu(bbtbl->tblks) != nr_blks) {
+		fprintf(stderr, "ch %d lun %d: invalid bad block table\n",
+			item / grp->num_lun, item % grp->num_lun);
+		return -EINVAL;
+	}
+
+	st->blks = nr_blks;
+	for (i = 0; i < nr_blks; i++) {
+		if (bbtbl->blk[i] & LNVM_BLK_FACTORY_BAD)
+			st->factory_bad++;
+		if (bbtbl->blk[i] & LNVM_BLK_GROWN_BAD)
+			st->grown_bad++;
+		if (bbtbl->blk[i] & LNVM_BLK_DEV_RESV)
+			st->dev_resv++;
+		if (bbtbl->blk[i] & LNVM_BLK_HOST_RESV)
+			st->host_resv++;
+	}
+	return 0;
+}
+
+static void *lnvm_sweep_worker(void *arg)
+{
+	struct lnvm_sweep *sw = arg;
+	void *buf;
+	int item, err = 0;
+
+	if (posix_memalign(&buf, getpagesize(), sw->buf_len)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&sw->lock);
+		item = sw->err ? sw->nr_items : sw->next++;
+		pthread_mutex_unlock(&sw->lock);
+		if (item >= sw->nr_items)
+			break;
+
+		err = sw->fetch(sw, item, buf);
+		if (err)
+			break;
+	}
+	free(buf);
+out:
+	if (err) {
+		pthread_mutex_lock(&sw->lock);
+		if (!sw->err)
+			sw->err = err;
+		pthread_mutex_unlock(&sw->lock);
+	}
+	return NULL;
+}
+
+static int lnvm_sweep_run(struct lnvm_sweep *sw, int jobs)
+{
+	pthread_t *threads;
+	int i, started;
+
+	if (jobs > sw->nr_items)
+		jobs = sw->nr_items;
+	if (jobs < 1)
+		jobs = 1;
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (!threads)
+		return -ENOMEM;
+
+	for (started = 0; started < jobs; started++)
+		if (pthread_create(&threads[started], NULL, lnvm_sweep_worker,
+				   sw))
+			break;
+	if (!started)
+		lnvm_sweep_worker(sw);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return sw->err;
+}
+
+static __u32 lnvm_sweep_xfer(int fd)
+{
+	struct nvme_id_ctrl ctrl;
+	__u32 xfer = LNVM_SWEEP_MAX_XFER;
+
+	if (!nvme_identify_ctrl(fd, &ctrl) && ctrl.mdts &&
+	    (4096ULL << ctrl.mdts) < xfer)
+		xfer = 4096 << ctrl.mdts;
+	return xfer;
+}
+
+static void show_lnvm_sweep20(struct lnvm_sweep *sw, unsigned int flags)
+{
+	struct nvme_nvm_id20 *geo = (struct nvme_nvm_id20 *)sw->id;
+	int i, j, num_pu = le16_to_cpu(geo->num_pu);
+	struct lnvm_pu_stats total, *st;
+	struct json_object *root, *pus, *pu, *wli;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < sw->nr_pus; i++)
+		lnvm_add_stats(&total, &sw->stats[i]);
+
+	if (flags & JSON) {
+		root = json_create_object();
+		pus = json_create_array();
+		json_object_add_value_array(root, "pus", pus);
+		for (i = 0; i <= sw->nr_pus; i++) {
+			st = i < sw->nr_pus ? &sw->stats[i] : &total;
+			pu = json_create_object();
+			if (i < sw->nr_pus) {
+				json_object_add_value_uint(pu, "group", i / num_pu);
+				json_object_add_value_uint(pu, "pu", i % num_pu);
+			}
+			json_object_add_value_uint(pu, "free", st->free);
+			json_object_add_value_uint(pu, "open", st->open);
+			json_object_add_value_uint(pu, "closed", st->closed);
+			json_object_add_value_uint(pu, "offline", st->offline);
+			wli = json_create_array();
+			for (j = 0; j < LNVM_WLI_BUCKETS; j++)
+				json_array_add_value_uint(wli, st->wli[j]);
+			json_object_add_value_array(pu, "wli", wli);
+			if (i < sw->nr_pus)
+				json_array_add_value_object(pus, pu);
+			else
+				json_object_add_value_object(root, "total", pu);
+		}
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+		return;
+	}
+
+	printf("Group    PU     Free     Open   Closed  Offline  "\
+	       "WLI histogram (%d buckets of %d)\n", LNVM_WLI_BUCKETS,
+	       256 / LNVM_WLI_BUCKETS);
+	for (i = 0; i <= sw->nr_pus; i++) {
+		st = i < sw->nr_pus ? &sw->stats[i] : &total;
+		if (i < sw->nr_pus)
+			printf("%5d %5d", i / num_pu, i % num_pu);
+		else
+			printf("%-11s", "Total");
+		printf(" %8u %8u %8u %8u ", st->free, st->open, st->closed,
+		       st->offline);
+		for (j = 0; j < LNVM_WLI_BUCKETS; j++)
+			printf(" %u", st->wli[j]);
+		printf("\n");
+	}
+}
+
+static void show_lnvm_sweep12(struct lnvm_sweep *sw, unsigned int flags)
+{
+	struct nvme_nvm_id12 *id = (struct nvme_nvm_id12 *)sw->id;
+	int i, num_lun = id->groups[0].num_lun;
+	struct lnvm_pu_stats total, *st;
+	struct json_object *root, *pus, *pu;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < sw->nr_pus; i++)
+		lnvm_add_stats(&total, &sw->stats[i]);
+
+	if (flags & JSON) {
+		root = json_create_object();
+		pus = json_create_array();
+		json_object_add_value_array(root, "pus", pus);
+		for (i = 0; i <= sw->nr_pus; i++) {
+			st = i < sw->nr_pus ? &sw->stats[i] : &total;
+			pu = json_create_object();
+			if (i < sw->nr_pus) {
+				json_object_add_value_uint(pu, "channel", i / num_lun);
+				json_object_add_value_uint(pu, "lun", i % num_lun);
+			}
+			json_object_add_value_uint(pu, "blocks", st->blks);
+			json_object_add_value_uint(pu, "factory_bad", st->factory_bad);
+			json_object_add_value_uint(pu, "grown_bad", st->grown_bad);
+			json_object_add_value_uint(pu, "device_reserved", st->dev_resv);
+			json_object_add_value_uint(pu, "host_reserved", st->host_resv);
+			if (i < sw->nr_pus)
+				json_array_add_value_object(pus, pu);
+			else
+				json_object_add_value_object(root, "total", pu);
+		}
+		json_print_object(root, NULL);
+		printf("\n");
+		json_free_object(root);
+		return;
+	}
+
+	printf("Channel   LUN   Blocks  Factory    Grown  DevResv HostResv\n");
+	for (i = 0; i <= sw->nr_pus; i++) {
+		st = i < sw->nr_pus ? &sw->stats[i] : &total;
+		if (i < sw->nr_pus)
+			printf("%7d %5d", i / num_lun, i % num_lun);
+		else
+			printf("%-13s", "Total");
+		printf(" %8u %8u %8u %8u %8u\n", st->blks, st->factory_bad,
+		       st->grown_bad, st->dev_resv, st->host_resv);
+	}
+}
+
+int lnvm_do_sweep(int fd, __u32 nsid, int jobs, unsigned int flags)
+{
+	struct lnvm_sweep sw = {
+		.fd	= fd,
+		.nsid	= nsid,
+		.lock	= PTHREAD_MUTEX_INITIALIZER,
+	};
+	struct nvme_nvm_id12 *id12;
+	struct nvme_nvm_id20 *geo;
+	struct nvme_nvm_id nvm_id;
+	int err;
+
+	err = lnvm_get_identity(fd, nsid, &nvm_id);
+	if (err) {
+		if (err > 0)
+			fprintf(stderr, "NVMe Status:%s(%x) NSID:%d\n",
+				nvme_status_to_string(err), err, nsid);
+		else
+			perror("identity");
+		return err;
+	}
+	sw.id = &nvm_id;
+
+	switch (nvm_id.ver_id) {
+	case 1:
+		id12 = (struct nvme_nvm_id12 *)&nvm_id;
+		sw.nr_pus = id12->groups[0].num_ch * id12->groups[0].num_lun;
+		sw.nr_items = sw.nr_pus;
+		sw.buf_len = sizeof(struct nvme_nvm_bb_tbl) +
+			le16_to_cpu(id12->groups[0].num_blk) *
+			id12->groups[0].num_pln;
+		sw.fetch = lnvm_fetch_bbtbl;
+		break;
+	case 2:
+		geo = (struct nvme_nvm_id20 *)&nvm_id;
+		sw.nr_pus = le16_to_cpu(geo->num_grp) *
+			le16_to_cpu(geo->num_pu);
+		sw.nr_chk = le32_to_cpu(geo->num_chk);
+		sw.log_len = (__u64)sw.nr_pus * sw.nr_chk *
+			sizeof(struct nvme_nvm_chunk_desc);
+		sw.xfer = lnvm_sweep_xfer(fd);
+		sw.nr_items = (sw.log_len + sw.xfer - 1) / sw.xfer;
+		sw.buf_len = sw.xfer;
+		sw.fetch = lnvm_fetch_chunk_page;
+		break;
+	default:
+		fprintf(stderr, "Sweep not supported on version %d\n",
+			nvm_id.ver_id);
+		return -EINVAL;
+	}
+	if (!sw.nr_pus || (nvm_id.ver_id == 2 && !sw.nr_chk)) {
+		fprintf(stderr, "Geometry reports no parallel units\n");
+		return -EINVAL;
+	}
+
+	sw.stats = calloc(sw.nr_pus, sizeof(*sw.stats));
+	if (!sw.stats)
+		return -ENOMEM;
+
+	err = lnvm_sweep_run(&sw, jobs);
+	if (err > 0)
+		fprintf(stderr, "NVMe Status:%s(%x) NSID:%d\n",
+			nvme_status_to_string(err), err, nsid);
+	else if (err < 0)
+		fprintf(stderr, "sweep: %s\n", strerror(-err));
+	else if (nvm_id.ver_id == 1)
+		show_lnvm_sweep12(&sw, flags);
+	else
+		show_lnvm_sweep20(&sw, flags);
+
+	free(sw.stats);
+	return err;
+}
@@ -250,6 +250,9 @@ enum {
 	NVM_LID_CHUNK_INFO = 0xCA,
 };
 
+/* wear-level index histogram of a sweep, over the range 0-255 */
+#define LNVM_WLI_BUCKETS	8
+
 struct nvme_nvm_chunk_desc {
 	__u8	cs;
 	__u8	ct;
@@ -325,5 +328,6 @@ int lnvm_do_id_ns(int, int, unsigned int);
 int lnvm_do_chunk_log(int, __u32, __u32, void *, unsigned int);
 int lnvm_do_get_bbtbl(int, int, int, int, unsigned int);
 int lnvm_do_set_bbtbl(int, int, int, int, int, int, __u8);
+int lnvm_do_sweep(int, __u32, int, unsigned int);
 
 #endif
@@ -0,0 +1,791 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements a file backed mock device, enabled with
+ * NVME_MOCK=<dir>. Commands to nvme devices are answered from fixture
+ * files in <dir> instead of the kernel, and topology scans read the
+ * sysfs tree in <dir>/sys, so the cost of the tool itself can be
+ * measured repeatably on any machine. NVME_MOCK_LATENCY=<usec> adds a
+ * fixed delay to every command.
+ *
+ * Fixtures are looked up in <dir>/<controller> first, then in <dir>:
+ *
+ *   identify-<cns>[-<nsid>].bin	Identify data
+ *   log-<lid>[-<nsid>].bin		Get Log Page data, read at the offset
+ *   feature-<fid>			Get Features result, as a number
+ *   feature-<fid>.bin		Get Features data
+ *   zones-<nsid>.bin		zone descriptors for Report Zones
+ *   ns-<nsid>.img			namespace data for Read and Write
+ *   admin-<opcode>.bin		data for any other admin command
+ *   io-<opcode>.bin		data for any other I/O command
+ *
+ * cns, lid, fid and opcode are two hex digits. Missing data is read as
+ * zeroes, a missing fixture fails the command with Invalid Field.
+ *
+ * Fabrics connects through /dev/nvme-fabrics create the controller in
+ * <dir>/sys/class/nvme, writing its delete_controller attribute removes
+ * it again, so discovery can be exercised without a target.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-mock.h"
+#include "common.h"
+
+struct mock_dev {
+	bool open;
+	bool fabrics;		/* /dev/nvme-fabrics */
+	char reply[64];		/* what a read of it returns */
+	char ctrl[32];		/* controller the device belongs to */
+	__u32 nsid;		/* 0 for a controller */
+	int lba_shift;		/* 0 until read from the Identify fixture */
+	int img_fd;
+};
+
+/* a passthrough or Submit I/O command in one form */
+struct mock_cmd {
+	bool admin;
+	__u8 opcode;
+	__u32 nsid;
+	__u32 cdw[6];		/* command dwords 10 to 15 */
+	void *data;
+	__u32 data_len;
+	__u64 result;
+};
+
+static struct {
+	int dirfd;
+	char sysfs_root[PATH_MAX];
+	struct timespec latency;
+	/*
+	 * Indexed by file descriptor. Commands are issued from several
+	 * threads, so the table is only accessed with lock held; entries
+	 * are allocated once and never move.
+	 */
+	pthread_mutex_t lock;
+	struct mock_dev **devs;
+	int nr_devs;
+	__u32 features[256];	/* values set in this process */
+	bool feature_set[256];
+} mock = {
+	.dirfd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct mock_dev *mock_dev(int fd)
+{
+	struct mock_dev *d = NULL;
+
+	pthread_mutex_lock(&mock.lock);
+	if (fd >= 0 && fd < mock.nr_devs && mock.devs[fd] &&
+	    mock.devs[fd]->open)
+		d = mock.devs[fd];
+	pthread_mutex_unlock(&mock.lock);
+	return d;
+}
+
+static struct mock_dev *mock_dev_add(int fd)
+{
+	struct mock_dev **devs, *d = NULL;
+
+	pthread_mutex_lock(&mock.lock);
+	if (fd >= mock.nr_devs) {
+		devs = realloc(mock.devs, (fd + 1) * sizeof(*devs));
+		if (!devs)
+			goto out;
+		memset(&devs[mock.nr_devs], 0,
+		       (fd + 1 - mock.nr_devs) * sizeof(*devs));
+		mock.devs = devs;
+		mock.nr_devs = fd + 1;
+	}
+	if (!mock.devs[fd]) {
+		mock.devs[fd] = calloc(1, sizeof(*d));
+		if (!mock.devs[fd])
+			goto out;
+	}
+	d = mock.devs[fd];
+	/* the descriptor was closed and reused since */
+	if (d->open && d->img_fd >= 0)
+		close(d->img_fd);
+	memset(d, 0, sizeof(*d));
+	d->img_fd = -1;
+	d->open = true;
+out:
+	pthread_mutex_unlock(&mock.lock);
+	return d;
+}
+
+/* Open something else, forgetting a mock device the fd was used for */
+static int mock_open_plain(const char *path, int flags)
+{
+	struct mock_dev *d;
+	int fd = open(path, flags);
+
+	d = mock_dev(fd);
+	if (d) {
+		if (d->img_fd >= 0)
+			close(d->img_fd);
+		d->open = false;
+	}
+	return fd;
+}
+
+#define MOCK_SYS_NVME		"sys/class/nvme"
+#define MOCK_FABRICS		"/dev/nvme-fabrics"
+
+static void mock_write_attr(int dirfd, const char *attr, const char *val)
+{
+	int fd;
+
+	fd = openat(dirfd, attr, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		    0644);
+	if (fd < 0)
+		return;
+	if (write(fd, val, strlen(val)) < 0 || write(fd, "\n", 1) < 0)
+		fprintf(stderr, "mock: failed to write %s\n", attr);
+	close(fd);
+}
+
+/* The first controller with the given connection attributes, or -1 */
+static int mock_find_ctrl(const char *transport, const char *nqn,
+			  const char *address)
+{
+	char attrs[3][256], name[32];
+	const char *want[] = { transport, nqn, address };
+	const char *files[] = { "transport", "subsysnqn", "address" };
+	int i, n, dirfd;
+	bool match;
+
+	for (n = 0; n < 1024; n++) {
+		snprintf(name, sizeof(name), MOCK_SYS_NVME "/nvme%d", n);
+		dirfd = openat(mock.dirfd, name, O_RDONLY | O_DIRECTORY);
+		if (dirfd < 0)
+			continue;
+		match = true;
+		for (i = 0; i < ARRAY_SIZE(files) && match; i++)
+			match = sysfs_read_attr(dirfd, files[i], attrs[i],
+						sizeof(attrs[i])) >= 0 &&
+				!strcmp(attrs[i], want[i]);
+		close(dirfd);
+		if (match)
+			return n;
+	}
+	return -1;
+}
+
+/*
+ * A connect: create the controller under the lowest free instance and
+ * prepare the "instance=" reply. Like the kernel a second controller
+ * with the same attributes is refused with EALREADY.
+ */
+static ssize_t mock_fabrics_connect(struct mock_dev *d, const char *buf,
+				    size_t len)
+{
+	const char *transport = "", *nqn = "", *traddr = "none",
+		   *trsvcid = "none", *host_traddr = NULL, *kato = "0";
+	char opts[1024], address[256], name[32], *o, *p;
+	int n, dirfd;
+
+	snprintf(opts, sizeof(opts), "%.*s", (int)len, buf);
+	for (o = opts; (p = strsep(&o, ",\n")); ) {
+		if (!strncmp(p, "transport=", 10))
+			transport = p + 10;
+		else if (!strncmp(p, "nqn=", 4))
+			nqn = p + 4;
+		else if (!strncmp(p, "traddr=", 7))
+			traddr = p + 7;
+		else if (!strncmp(p, "trsvcid=", 8))
+			trsvcid = p + 8;
+		else if (!strncmp(p, "host_traddr=", 12))
+			host_traddr = p + 12;
+		else if (!strncmp(p, "keep_alive_tmo=", 15))
+			kato = p + 15;
+	}
+	n = snprintf(address, sizeof(address), "traddr=%s,trsvcid=%s",
+		     traddr, trsvcid);
+	if (host_traddr)
+		snprintf(address + n, sizeof(address) - n, ",host_traddr=%s",
+			 host_traddr);
+
+	if (mock_find_ctrl(transport, nqn, address) >= 0) {
+		errno = EALREADY;
+		return -1;
+	}
+
+	for (n = 0; n < 1024; n++) {
+		snprintf(name, sizeof(name), MOCK_SYS_NVME "/nvme%d", n);
+		if (!mkdirat(mock.dirfd, name, 0755))
+			break;
+		if (errno != EEXIST)
+			return -1;
+	}
+	dirfd = openat(mock.dirfd, name, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0)
+		return -1;
+	mock_write_attr(dirfd, "transport", transport);
+	mock_write_attr(dirfd, "subsysnqn", nqn);
+	mock_write_attr(dirfd, "address", address);
+	mock_write_attr(dirfd, "kato", kato);
+	mock_write_attr(dirfd, "state", "live");
+	close(dirfd);
+
+	snprintf(d->reply, sizeof(d->reply), "instance=%d,cntlid=%d\n", n, n);
+	return len;
+}
+
+/* Remove the controller whose delete_controller attribute is at path */
+static int mock_delete_ctrl(const char *path)
+{
+	char dir[PATH_MAX];
+	struct dirent *de;
+	int dirfd;
+	DIR *dp;
+
+	snprintf(dir, sizeof(dir), "%.*s",
+		 (int)(strrchr(path, '/') - path), path);
+	dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0)
+		return -1;
+	dp = fdopendir(dirfd);
+	if (!dp) {
+		close(dirfd);
+		return -1;
+	}
+	while ((de = readdir(dp)))
+		if (de->d_type != DT_DIR)
+			unlinkat(dirfd, de->d_name, 0);
+	closedir(dp);
+	if (rmdir(dir) < 0)
+		return -1;
+	return mock_open_plain("/dev/null", O_WRONLY);
+}
+
+static bool mock_is_delete_ctrl(const char *path)
+{
+	size_t root = strlen(mock.sysfs_root), len = strlen(path);
+	const char *attr = "/delete_controller";
+
+	return len > root + strlen(attr) &&
+		!strncmp(path, mock.sysfs_root, root) &&
+		!strcmp(path + len - strlen(attr), attr);
+}
+
+static ssize_t mock_read_fd(int fd, void *buf, size_t len)
+{
+	struct mock_dev *d = mock_dev(fd);
+	size_t n;
+
+	if (!d || !d->fabrics)
+		return read(fd, buf, len);
+	n = min(len, strlen(d->reply));
+	memcpy(buf, d->reply, n);
+	d->reply[0] = '\0';
+	return n;
+}
+
+static ssize_t mock_write_fd(int fd, const void *buf, size_t len)
+{
+	struct mock_dev *d = mock_dev(fd);
+
+	if (!d || !d->fabrics)
+		return write(fd, buf, len);
+	return mock_fabrics_connect(d, buf, len);
+}
+
+static int mock_open(const char *path, int flags)
+{
+	int instance, nsid, fd;
+	struct mock_dev *d;
+
+	if (mock_is_delete_ctrl(path))
+		return mock_delete_ctrl(path);
+
+	if (!strcmp(path, MOCK_FABRICS)) {
+		fd = open("/dev/null", flags & O_ACCMODE);
+		if (fd < 0)
+			return fd;
+		d = mock_dev_add(fd);
+		if (!d) {
+			close(fd);
+			errno = ENOMEM;
+			return -1;
+		}
+		d->fabrics = true;
+		return fd;
+	}
+
+	if (!nvme_dev_name_parse(path, &instance, &nsid))
+		return mock_open_plain(path, flags);
+
+	/* a character device, like the real controller */
+	fd = open("/dev/null", flags & O_ACCMODE);
+	if (fd < 0)
+		return fd;
+	d = mock_dev_add(fd);
+	if (!d) {
+		close(fd);
+		errno = ENOMEM;
+		return -1;
+	}
+	snprintf(d->ctrl, sizeof(d->ctrl), "nvme%d", instance);
+	d->nsid = nsid;
+	return fd;
+}
+
+static int mock_dup(int fd)
+{
+	struct mock_dev *d = mock_dev(fd), *nd;
+	int newfd;
+
+	newfd = dup(fd);
+	if (newfd < 0 || !d)
+		return newfd;
+	nd = mock_dev_add(newfd);
+	if (!nd) {
+		close(newfd);
+		errno = ENOMEM;
+		return -1;
+	}
+	strcpy(nd->ctrl, d->ctrl);
+	nd->nsid = d->nsid;
+	nd->lba_shift = d->lba_shift;
+	return newfd;
+}
+
+static int mock_stat(const char *path, struct stat *st)
+{
+	int instance, nsid;
+
+	if (!nvme_dev_name_parse(path, &instance, &nsid))
+		return stat(path, st);
+	return stat("/dev/null", st);
+}
+
+/* Open a fixture of the device's controller, or one shared by all */
+static int mock_open_fixture(struct mock_dev *d, int flags,
+			     const char *fmt, ...)
+{
+	char name[64], path[sizeof(d->ctrl) + sizeof(name)];
+	va_list ap;
+	int fd;
+
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+
+	snprintf(path, sizeof(path), "%s/%s", d->ctrl, name);
+	fd = openat(mock.dirfd, path, flags | O_CLOEXEC, 0644);
+	if (fd < 0 && errno == ENOENT)
+		fd = openat(mock.dirfd, name, flags | O_CLOEXEC, 0644);
+	return fd;
+}
+
+/* Fill buf from offset off of fd, zeroing what is past the end */
+static int mock_pread(int fd, void *buf, __u32 len, __u64 off)
+{
+	ssize_t ret = 0;
+	__u32 n = 0;
+
+	while (n < len) {
+		ret = pread(fd, (char *)buf + n, len - n, off + n);
+		if (ret <= 0)
+			break;
+		n += ret;
+	}
+	memset((char *)buf + n, 0, len - n);
+	return ret < 0 ? -errno : 0;
+}
+
+/* Read a per namespace fixture, falling back to one for all namespaces */
+static int mock_read(struct mock_dev *d, const char *kind, __u8 id,
+		     __u32 nsid, void *buf, __u32 len, __u64 off)
+{
+	int fd, ret;
+
+	fd = mock_open_fixture(d, O_RDONLY, "%s-%02x-%u.bin", kind, id, nsid);
+	if (fd < 0 && errno == ENOENT)
+		fd = mock_open_fixture(d, O_RDONLY, "%s-%02x.bin", kind, id);
+	if (fd < 0)
+		return -errno;
+	ret = mock_pread(fd, buf, len, off);
+	close(fd);
+	return ret;
+}
+
+/* Turn a fixture error into an NVMe status, or -1 with errno set */
+static int mock_status(int err)
+{
+	if (!err)
+		return 0;
+	if (err == -ENOENT)
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+	errno = -err;
+	return -1;
+}
+
+static int mock_identify(struct mock_dev *d, struct mock_cmd *c)
+{
+	return mock_status(mock_read(d, "identify", c->cdw[0] & 0xff, c->nsid,
+				     c->data, c->data_len, 0));
+}
+
+static int mock_get_log(struct mock_dev *d, struct mock_cmd *c)
+{
+	__u64 off = c->cdw[2] | (__u64)c->cdw[3] << 32;
+
+	return mock_status(mock_read(d, "log", c->cdw[0] & 0xff, c->nsid,
+				     c->data, c->data_len, off));
+}
+
+static int mock_get_features(struct mock_dev *d, struct mock_cmd *c)
+{
+	__u8 fid = c->cdw[0] & 0xff;
+	char buf[32] = "";
+	bool found = false;
+	int fd, ret;
+
+	if (c->data_len) {
+		fd = mock_open_fixture(d, O_RDONLY, "feature-%02x.bin", fid);
+		if (fd >= 0) {
+			ret = mock_pread(fd, c->data, c->data_len, 0);
+			close(fd);
+			if (ret)
+				return mock_status(ret);
+			found = true;
+		} else {
+			memset(c->data, 0, c->data_len);
+		}
+	}
+
+	if (mock.feature_set[fid]) {
+		c->result = mock.features[fid];
+		return 0;
+	}
+	fd = mock_open_fixture(d, O_RDONLY, "feature-%02x", fid);
+	if (fd < 0)
+		return found ? 0 : mock_status(-errno);
+	ret = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (ret < 0)
+		return mock_status(-errno);
+	c->result = strtoul(buf, NULL, 0);
+	return 0;
+}
+
+static int mock_set_features(struct mock_cmd *c)
+{
+	__u8 fid = c->cdw[0] & 0xff;
+
+	mock.features[fid] = c->cdw[1];
+	mock.feature_set[fid] = true;
+	return 0;
+}
+
+static int mock_lba_shift(struct mock_dev *d, __u32 nsid)
+{
+	struct nvme_id_ns ns;
+
+	if (d->lba_shift)
+		return d->lba_shift;
+	if (mock_read(d, "identify", NVME_ID_CNS_NS, nsid, &ns, sizeof(ns), 0))
+		memset(&ns, 0, sizeof(ns));
+	d->lba_shift = ns.lbaf[ns.flbas & 0xf].ds ?: 9;
+	return d->lba_shift;
+}
+
+static int mock_rw(struct mock_dev *d, struct mock_cmd *c, __u64 slba,
+		   __u32 nlb)
+{
+	int shift = mock_lba_shift(d, c->nsid);
+	__u64 off = slba << shift;
+	size_t len = (size_t)nlb << shift;
+	ssize_t ret;
+
+	if (len > c->data_len)
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+
+	/* the image is created sparse on the first write */
+	if (d->img_fd < 0) {
+		d->img_fd = mock_open_fixture(d, c->opcode == nvme_cmd_write ?
+					      O_RDWR | O_CREAT : O_RDWR,
+					      "ns-%u.img", c->nsid);
+		if (d->img_fd < 0 && errno == ENOENT) {
+			memset(c->data, 0, len);
+			return 0;
+		}
+		if (d->img_fd < 0)
+			return mock_status(-errno);
+	}
+
+	if (c->opcode == nvme_cmd_read)
+		return mock_status(mock_pread(d->img_fd, c->data, len, off));
+	ret = pwrite(d->img_fd, c->data, len, off);
+	if (ret < 0)
+		return mock_status(-errno);
+	return ret == len ? 0 : NVME_SC_WRITE_FAULT;
+}
+
+/* Zone Receive Action Specific Field values to zone states */
+static const __u8 mock_zone_states[] = {
+	[1] = NVME_ZNS_ZS_EMPTY,
+	[2] = NVME_ZNS_ZS_IMPL_OPEN,
+	[3] = NVME_ZNS_ZS_EXPL_OPEN,
+	[4] = NVME_ZNS_ZS_CLOSED,
+	[5] = NVME_ZNS_ZS_FULL,
+	[6] = NVME_ZNS_ZS_READ_ONLY,
+	[7] = NVME_ZNS_ZS_OFFLINE,
+};
+
+static int mock_report_zones(struct mock_dev *d, struct mock_cmd *c)
+{
+	__u64 slba = c->cdw[0] | (__u64)c->cdw[1] << 32, nr = 0, max;
+	__u8 zra = c->cdw[3] & 0xff, zrasf = (c->cdw[3] >> 8) & 0xff;
+	bool partial = c->cdw[3] & (1 << 16);
+	struct nvme_zone_report *r = c->data;
+	struct nvme_zns_desc descs[256], *desc;
+	ssize_t len;
+	int fd, i;
+
+	if (zra != NVME_ZNS_ZRA_REPORT_ZONES || c->data_len < sizeof(*r) ||
+	    zrasf >= ARRAY_SIZE(mock_zone_states))
+		return NVME_SC_INVALID_FIELD | NVME_SC_DNR;
+	fd = mock_open_fixture(d, O_RDONLY, "zones-%u.bin", c->nsid);
+	if (fd < 0)
+		return mock_status(-errno);
+
+	memset(c->data, 0, c->data_len);
+	max = (c->data_len - sizeof(*r)) / sizeof(*desc);
+	while ((len = read(fd, descs, sizeof(descs))) >= sizeof(*desc)) {
+		for (i = 0; i < len / sizeof(*desc); i++) {
+			desc = &descs[i];
+			if (le64_to_cpu(desc->zslba) +
+			    le64_to_cpu(desc->zcap) <= slba)
+				continue;
+			if (zrasf && desc->zs >> 4 != mock_zone_states[zrasf])
+				continue;
+			if (nr < max)
+				r->entries[nr] = *desc;
+			else if (partial)
+				goto out;
+			nr++;
+		}
+	}
+out:
+	close(fd);
+	r->nr_zones = cpu_to_le64(nr);
+	return 0;
+}
+
+/* Commands without a model of their own just return the fixture data */
+static int mock_other(struct mock_dev *d, struct mock_cmd *c)
+{
+	int fd, ret = 0;
+
+	fd = mock_open_fixture(d, O_RDONLY, "%s-%02x.bin",
+			       c->admin ? "admin" : "io", c->opcode);
+	if (fd < 0 && errno == ENOENT)
+		return NVME_SC_INVALID_OPCODE | NVME_SC_DNR;
+	if (fd < 0)
+		return mock_status(-errno);
+	if (c->opcode & 2 && c->data_len)
+		ret = mock_pread(fd, c->data, c->data_len, 0);
+	close(fd);
+	return mock_status(ret);
+}
+
+static int mock_admin(struct mock_dev *d, struct mock_cmd *c)
+{
+	switch (c->opcode) {
+	case nvme_admin_identify:
+		return mock_identify(d, c);
+	case nvme_admin_get_log_page:
+		return mock_get_log(d, c);
+	case nvme_admin_get_features:
+		return mock_get_features(d, c);
+	case nvme_admin_set_features:
+		return mock_set_features(c);
+	default:
+		return mock_other(d, c);
+	}
+}
+
+static int mock_io(struct mock_dev *d, struct mock_cmd *c)
+{
+	switch (c->opcode) {
+	case nvme_cmd_read:
+	case nvme_cmd_write:
+		return mock_rw(d, c, c->cdw[0] | (__u64)c->cdw[1] << 32,
+			       (c->cdw[2] & 0xffff) + 1);
+	case nvme_cmd_flush:
+	case nvme_cmd_dsm:
+		return 0;
+	case nvme_zns_cmd_mgmt_recv:
+		return mock_report_zones(d, c);
+	default:
+		return mock_other(d, c);
+	}
+}
+
+static int mock_submit(struct mock_dev *d, struct mock_cmd *c)
+{
+	if (mock.latency.tv_sec || mock.latency.tv_nsec)
+		nanosleep(&mock.latency, NULL);
+	if (!c->nsid)
+		c->nsid = d->nsid;
+	return c->admin ? mock_admin(d, c) : mock_io(d, c);
+}
+
+static int mock_passthru(struct mock_dev *d, bool admin,
+			 struct nvme_passthru_cmd *cmd)
+{
+	struct mock_cmd c = {
+		.admin		= admin,
+		.opcode		= cmd->opcode,
+		.nsid		= cmd->nsid,
+		.data		= (void *)(uintptr_t)cmd->addr,
+		.data_len	= cmd->data_len,
+	};
+	int ret;
+
+	memcpy(c.cdw, &cmd->cdw10, sizeof(c.cdw));
+	ret = mock_submit(d, &c);
+	cmd->result = c.result;
+	return ret;
+}
+
+static int mock_passthru64(struct mock_dev *d, bool admin,
+			   struct nvme_passthru_cmd64 *cmd)
+{
+	struct mock_cmd c = {
+		.admin		= admin,
+		.opcode		= cmd->opcode,
+		.nsid		= cmd->nsid,
+		.data		= (void *)(uintptr_t)cmd->addr,
+		.data_len	= cmd->data_len,
+	};
+	int ret;
+
+	memcpy(c.cdw, &cmd->cdw10, sizeof(c.cdw));
+	ret = mock_submit(d, &c);
+	cmd->result = c.result;
+	return ret;
+}
+
+static int mock_submit_io(struct mock_dev *d, struct nvme_user_io *io)
+{
+	int shift = mock_lba_shift(d, d->nsid);
+	struct mock_cmd c = {
+		.opcode		= io->opcode,
+		.data		= (void *)(uintptr_t)io->addr,
+		.data_len	= (io->nblocks + 1) << shift,
+		.cdw		= {
+			io->slba & 0xffffffff, io->slba >> 32,
+			io->nblocks | io->control << 16,
+		},
+	};
+
+	return mock_submit(d, &c);
+}
+
+static int mock_ioctl(int fd, unsigned long req, void *arg)
+{
+	struct mock_dev *d = mock_dev(fd);
+
+	if (!d)
+		return ioctl(fd, req, arg);
+
+	switch (req) {
+	case NVME_IOCTL_ID:
+		if (d->nsid)
+			return d->nsid;
+		break;
+	case NVME_IOCTL_RESET:
+	case NVME_IOCTL_SUBSYS_RESET:
+	case NVME_IOCTL_RESCAN:
+		return 0;
+	case NVME_IOCTL_ADMIN_CMD:
+	case NVME_IOCTL_IO_CMD:
+		return mock_passthru(d, req == NVME_IOCTL_ADMIN_CMD, arg);
+	case NVME_IOCTL_ADMIN64_CMD:
+	case NVME_IOCTL_IO64_CMD:
+		return mock_passthru64(d, req == NVME_IOCTL_ADMIN64_CMD, arg);
+	case NVME_IOCTL_SUBMIT_IO:
+		if (d->nsid)
+			return mock_submit_io(d, arg);
+		break;
+	case BLKSSZGET:
+	case BLKPBSZGET:
+		if (d->nsid) {
+			*(int *)arg = 1 << mock_lba_shift(d, d->nsid);
+			return 0;
+		}
+		break;
+	}
+	errno = ENOTTY;
+	return -1;
+}
+
+static struct nvme_backend mock_backend = {
+	.open		= mock_open,
+	.stat		= mock_stat,
+	.dup		= mock_dup,
+	.ioctl		= mock_ioctl,
+	.read		= mock_read_fd,
+	.write		= mock_write_fd,
+	.sysfs_root	= mock.sysfs_root,
+};
+
+void nvme_mock_init(void)
+{
+	const char *dir, *latency;
+	unsigned long usec = 0;
+	char *end;
+
+	dir = getenv("NVME_MOCK");
+	if (!dir || !*dir || mock.dirfd >= 0)
+		return;
+
+	latency = getenv("NVME_MOCK_LATENCY");
+	if (latency) {
+		usec = strtoul(latency, &end, 0);
+		if (*end) {
+			fprintf(stderr, "Invalid NVME_MOCK_LATENCY %s\n",
+				latency);
+			return;
+		}
+	}
+
+	mock.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (mock.dirfd < 0) {
+		fprintf(stderr, "Failed to open mock directory %s: %s\n",
+			dir, strerror(errno));
+		return;
+	}
+	mock.latency.tv_sec = usec / 1000000;
+	mock.latency.tv_nsec = (usec % 1000000) * 1000;
+	snprintf(mock.sysfs_root, sizeof(mock.sysfs_root), "%s", dir);
+	nvme_backend = &mock_backend;
+}
@@ -0,0 +1,6 @@
+#ifndef _NVME_MOCK_H
+#define _NVME_MOCK_H
+
+extern void nvme_mock_init(void);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -8,241 +9,162 @@
 #include <unistd.h>
 #include <errno.h>
 #include "nvme-models.h"
-
-static char *_fmt1 = "/sys/class/nvme/nvme%d/device/subsystem_vendor";
-static char *_fmt2 = "/sys/class/nvme/nvme%d/device/subsystem_device";
-static char *_fmt3 = "/sys/class/nvme/nvme%d/device/vendor";
-static char *_fmt4 = "/sys/class/nvme/nvme%d/device/device";
-static char *_fmt5 = "/sys/class/nvme/nvme%d/device/class";
-
-static char fmt1[78];
-static char fmt2[78];
-static char fmt3[78];
-static char fmt4[78];
-static char fmt5[78];
-
-static char *device_top;
-static char *device_mid;
-static char *device_final;
-static char *class_top;
-static char *class_mid;
-static char *class_final;
-
-
-
-static void free_all(void)
+#include "nvme-ioctl.h"
+
+static const char *sys_dev_fmt = "%s/sys/class/nvme/nvme%d/device";
+
+/*
+ * pci.ids is parsed once per process into an open addressing hash table
+ * keyed by the numeric ids; names point into the loaded file contents.
+ */
+enum pci_id_type {
+	PCI_ID_NONE = 0,
+	PCI_ID_VENDOR,
+	PCI_ID_DEVICE,
+	PCI_ID_SUBSYS,
+	PCI_ID_CLASS,
+	PCI_ID_SUBCLASS,
+	PCI_ID_PROGIF,
+};
+
+struct pci_id_entry {
+	uint64_t key;
+	enum pci_id_type type;
+	const char *name;
+};
+
+static struct {
+	char *data;
+	struct pci_id_entry *table;
+	size_t mask;
+	bool loaded;
+	bool failed;
+} pci_ids;
+
+static size_t pci_id_hash(enum pci_id_type type, uint64_t key)
 {
-	free(device_top);
-	device_top = NULL;
-	free(device_mid);
-	device_mid = NULL;
-	free(device_final);
-	device_final = NULL;
-	free(class_top);
-	class_top = NULL;
-	free(class_mid);
-	class_mid = NULL;
-	free(class_final);
-	class_final = NULL;
-}
+	uint64_t h = key ^ (type * 0x9e3779b97f4a7c15ULL);
 
-static char *find_data(char *data)
-{
-	while (*data != '\0') {
-		if (*data >= '0' && *data <= '9')
-			return data;
-		data++;
-	}
-	return NULL;
-}
-
-static char *locate_info(char *data, bool is_inner, bool is_class)
-{
-	char *orig = data;
-	char *locate = find_data(data);
-	if (!data)
-		return orig;
-
-	if (is_class)
-		return locate + 4;
-	if (!is_inner)
-		/* 4 to get over the number, 2 for spaces */
-		return locate + 4 + 2;
-
-	/* Inner data, has "sub_ven(space)sub_dev(space)(space)string */
-	return locate + 4 + 1 + 4 + 2;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h & pci_ids.mask;
 }
 
-static void format_and_print(char *save)
+static void pci_id_insert(enum pci_id_type type, uint64_t key,
+			  const char *name)
 {
+	size_t i = pci_id_hash(type, key);
 
-	if (!class_mid)
-		snprintf(save, 1024, "%s %s %s",
-		       locate_info(device_top, false, false),
-		       locate_info(device_mid, false, false),
-		       locate_info(device_final, true, false));
-	else
-		snprintf(save, 1024, "%s: %s %s %s",
-			 locate_info(class_mid, false, true),
-			 locate_info(device_top, false, false),
-			 locate_info(device_mid, false, false),
-			 locate_info(device_final, true, false));
-}
-
-static void format_all(char *save, char *vendor, char *device)
-{
-	if (device_top && device_mid && device_final)
-		format_and_print(save);
-
-	else if (device_top && !device_mid && class_mid)
-		snprintf(save, 1024, "%s: %s Device %s",
-			 locate_info(class_mid, false, true),
-			 locate_info(device_top, false, false),
-			 device);
-
-	else if (!device_top && class_mid)
-		snprintf(save, 1024, "%s: Vendor %s Device %s",
-			 locate_info(class_mid, false, true),
-			 vendor,
-			 device);
-	else
-		snprintf(save, 1024, "Unknown device");
-}
-
-static int is_final_match(char *line, char *search)
-{
-	return !memcmp(&line[2], search, 2);
-}
-
-static int is_inner_sub_vendev(char *line, char *search, char *search2)
-{
-	char combine[10];
-	snprintf(combine, sizeof(combine), "%s %s", &search[2], &search2[2]);
-       	if (line[0] != '\t' && line[1] != '\t')
-		return 0;
-
-	return !memcmp(combine, &line[2], 9);
-}
-
-static int is_mid_level_match(char *line, char *device, bool class)
-{
-	if (!class)
-		return !memcmp(&line[1], &device[2], 4);
-
-	return !memcmp(&line[1], device, 2);
-}
-
-static inline bool is_comment(char *line)
-{
-	return line[0] == '#';
+	/* the first entry wins, like the old linear scan */
+	while (pci_ids.table[i].type != PCI_ID_NONE) {
+		if (pci_ids.table[i].type == type && pci_ids.table[i].key == key)
+			return;
+		i = (i + 1) & pci_ids.mask;
+	}
+	pci_ids.table[i].type = type;
+	pci_ids.table[i].key = key;
+	pci_ids.table[i].name = name;
 }
 
-static int is_top_level_match(char *line, const char* device, bool class)
+static const char *pci_id_lookup(enum pci_id_type type, uint64_t key)
 {
-	if (line[0] == '\t')
-		return false;
-	if (line[0] == '#')
-		return false;
-	if (!class)
-		return !memcmp(line, &device[2], 4);
-	if (line[0] != 'C')
-		return false;
-	/* Skipping    C(SPACE)  0x */
-	return !memcmp(&line[2], &device[2], 2);
-}
+	size_t i;
 
-static inline int is_tab(char *line)
-{
-	return line[0] == '\t';
-}
+	if (!pci_ids.table)
+		return NULL;
 
-static inline int is_class_info(char *line)
-{
-	return !memcmp(line, "# C class", 9);
+	i = pci_id_hash(type, key);
+	while (pci_ids.table[i].type != PCI_ID_NONE) {
+		if (pci_ids.table[i].type == type && pci_ids.table[i].key == key)
+			return pci_ids.table[i].name;
+		i = (i + 1) & pci_ids.mask;
+	}
+	return NULL;
 }
 
-static void parse_vendor_device(char **line, FILE *file,
-			       char *device, char *subdev,
-			       char *subven)
+static bool parse_hex(const char *s, int digits, unsigned int *val)
 {
-	bool device_single_found = false;
-	size_t amnt = 1024;
-	size_t found = 0;
-	char *newline;
-
-	while ((found = getline(line, &amnt, file)) != -1) {
-		newline = *line;
-		if (is_comment(newline))
-			continue;
-		if (!is_tab(newline))
-			return;
-
-		newline[found - 1] = '\0';
-		if (!device_single_found && is_mid_level_match(newline, device, false)) {
-			device_single_found = true;
-			device_mid = strdup(newline);
-			continue;
-		}
+	int i;
 
-		if (device_single_found && is_inner_sub_vendev(newline, subven, subdev)) {
-			device_final = strdup(newline);
-			break;
-		}
+	*val = 0;
+	for (i = 0; i < digits; i++) {
+		char c = s[i];
+
+		if (c >= '0' && c <= '9')
+			*val = (*val << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			*val = (*val << 4) | (c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			*val = (*val << 4) | (c - 'A' + 10);
+		else
+			return false;
 	}
+	return true;
 }
 
-static void pull_class_info(char **_newline, FILE *file, char *class)
+/*
+ * Lines are "vvvv  vendor", "\tdddd  device", "\t\tssss ssss  subsystem"
+ * and in the class section "C cc  class", "\tss  subclass" and
+ * "\t\tpp  prog-if".
+ */
+static void pci_ids_index_line(char *line, size_t len, unsigned int *vendor,
+			       unsigned int *device, unsigned int *class,
+			       unsigned int *subclass, bool *in_class)
 {
-	size_t amnt;
-	size_t size = 1024;
-	bool top_found = false;
-	bool mid_found = false;
-	char *newline;
-
-	while ((amnt = getline(_newline, &size, file)) != -1) {
-		newline = *_newline;
-		newline[amnt - 1] = '\0';
-		if (!top_found && is_top_level_match(newline, class, true)) {
-			class_top = strdup(newline);
-			top_found = true;
-			continue;
+	unsigned int a, b;
+
+	if (!len || line[0] == '#')
+		return;
+
+	if (line[0] == 'C' && line[1] == ' ') {
+		*in_class = true;
+		*vendor = *device = ~0U;
+		if (len > 6 && parse_hex(line + 2, 2, class))
+			pci_id_insert(PCI_ID_CLASS, *class, line + 6);
+		else
+			*class = ~0U;
+		*subclass = ~0U;
+	} else if (line[0] == '\t' && line[1] == '\t') {
+		if (*in_class) {
+			if (*subclass != ~0U && len > 6 &&
+			    parse_hex(line + 2, 2, &a))
+				pci_id_insert(PCI_ID_PROGIF,
+					      (*class << 16) | (*subclass << 8) | a,
+					      line + 6);
+		} else if (*device != ~0U && len > 13 &&
+			   parse_hex(line + 2, 4, &a) &&
+			   parse_hex(line + 7, 4, &b)) {
+			pci_id_insert(PCI_ID_SUBSYS,
+				      ((uint64_t)*vendor << 48) |
+				      ((uint64_t)*device << 32) | (a << 16) | b,
+				      line + 13);
 		}
-		if (!mid_found && top_found &&
-		    is_mid_level_match(newline,  &class[4], true)) {
-			class_mid = strdup(newline);
-			mid_found = true;
-			continue;
-		}
-		if (top_found && mid_found &&
-		    is_final_match(newline, &class[6])) {
-			class_final = strdup(newline);
-			break;
+	} else if (line[0] == '\t') {
+		if (*in_class) {
+			if (*class != ~0U && len > 5 &&
+			    parse_hex(line + 1, 2, subclass))
+				pci_id_insert(PCI_ID_SUBCLASS,
+					      (*class << 8) | *subclass, line + 5);
+			else
+				*subclass = ~0U;
+		} else if (*vendor != ~0U && len > 7 &&
+			   parse_hex(line + 1, 4, device)) {
+			pci_id_insert(PCI_ID_DEVICE, (*vendor << 16) | *device,
+				      line + 7);
+		} else {
+			*device = ~0U;
 		}
+	} else {
+		*in_class = false;
+		*device = ~0U;
+		if (len > 6 && parse_hex(line, 4, vendor))
+			pci_id_insert(PCI_ID_VENDOR, *vendor, line + 6);
+		else
+			*vendor = ~0U;
 	}
 }
 
-static int read_sys_node(char *where, char *save, size_t savesz)
-{
-	char *new;
-	int fd, ret = 0;
-	fd = open(where, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s with errno %s\n",
-			where, strerror(errno));
-		return 1;
-	}
-	/* -1 so we can safely use strstr below */
-	if(!read(fd, save, savesz - 1))
-		ret = 1;
-
-	new = strstr(save, "\n");
-	if (new)
-		new[0] = '\0';
-
-	close(fd);
-	return ret;
-}
-
 static FILE *open_pci_ids(void)
 {
 	int i;
@@ -277,62 +199,153 @@ static FILE *open_pci_ids(void)
 	return NULL;
 }
 
-char *nvme_product_name(int id)
+static int load_pci_ids(void)
 {
-	char *line = NULL;
-	ssize_t amnt;
-	char vendor[7] = { 0 };
-	char device[7] = { 0 };
-	char sub_device[7] = { 0 };
-	char sub_vendor[7] = { 0 };
-	char class[13] = { 0 };
-	size_t size = 1024;
-	char ret;
-	FILE *file = open_pci_ids();
+	unsigned int vendor = ~0U, device = ~0U, class = ~0U, subclass = ~0U;
+	bool in_class = false;
+	size_t lines = 0, size;
+	char *p, *end, *nl;
+	struct stat st;
+	FILE *file;
+
+	if (pci_ids.loaded)
+		return 0;
+	if (pci_ids.failed)
+		return -ENOENT;
 
+	file = open_pci_ids();
 	if (!file)
-		goto error1;
-
-	snprintf(fmt1, 78, _fmt1, id);
-	snprintf(fmt2, 78, _fmt2, id);
-	snprintf(fmt3, 78, _fmt3, id);
-	snprintf(fmt4, 78, _fmt4, id);
-	snprintf(fmt5, 78, _fmt5, id);
-
-	ret = read_sys_node(fmt1, sub_vendor, 7);
-	ret |= read_sys_node(fmt2, sub_device, 7);
-	ret |= read_sys_node(fmt3, vendor, 7);
-	ret |= read_sys_node(fmt4, device, 7);
-	ret |= read_sys_node(fmt5, class, 13);
+		goto fail;
+	if (fstat(fileno(file), &st) < 0) {
+		perror("fstat");
+		goto close;
+	}
+
+	pci_ids.data = malloc(st.st_size + 1);
+	if (!pci_ids.data) {
+		fprintf(stderr, "malloc: %s\n", strerror(errno));
+		goto close;
+	}
+	size = fread(pci_ids.data, 1, st.st_size, file);
+	pci_ids.data[size] = '\0';
+	fclose(file);
+
+	end = pci_ids.data + size;
+	for (p = pci_ids.data; p < end; p++)
+		if (*p == '\n')
+			lines++;
+
+	/* keep the table at most half full */
+	for (pci_ids.mask = 1024; pci_ids.mask < 2 * (lines + 1);)
+		pci_ids.mask <<= 1;
+	pci_ids.table = calloc(pci_ids.mask, sizeof(*pci_ids.table));
+	if (!pci_ids.table) {
+		fprintf(stderr, "calloc: %s\n", strerror(errno));
+		free(pci_ids.data);
+		pci_ids.data = NULL;
+		goto fail;
+	}
+	pci_ids.mask--;
+
+	for (p = pci_ids.data; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', end - p);
+		if (!nl)
+			nl = end;
+		*nl = '\0';
+		pci_ids_index_line(p, nl - p, &vendor, &device, &class,
+				   &subclass, &in_class);
+	}
+
+	pci_ids.loaded = true;
+	return 0;
+close:
+	fclose(file);
+fail:
+	pci_ids.failed = true;
+	return -ENOENT;
+}
+
+static int read_sys_node(int dirfd, const char *dir, const char *name,
+			 unsigned int *val)
+{
+	char buf[16] = { 0 };
+	char *end;
+	int fd, ret = 0;
+
+	fd = openat(dirfd, name, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s/%s with errno %s\n",
+			dir, name, strerror(errno));
+		return 1;
+	}
+	if (read(fd, buf, sizeof(buf) - 1) <= 0)
+		ret = 1;
+	close(fd);
+
+	*val = strtoul(buf, &end, 16);
+	if (end == buf)
+		ret = 1;
+	return ret;
+}
+
+char *nvme_product_name(int id)
+{
+	unsigned int vendor, device, sub_vendor, sub_device, class;
+	const char *vendor_name, *device_name = NULL, *subsys_name = NULL;
+	const char *class_name;
+	char path[PATH_MAX];
+	char *line;
+	int dirfd, ret;
+
+	if (load_pci_ids())
+		return strdup("NULL");
+
+	snprintf(path, sizeof(path), sys_dev_fmt, nvme_backend->sysfs_root, id);
+	dirfd = open(path, O_RDONLY | O_DIRECTORY);
+	if (dirfd < 0) {
+		fprintf(stderr, "Failed to open %s with errno %s\n",
+			path, strerror(errno));
+		return strdup("NULL");
+	}
+	ret = read_sys_node(dirfd, path, "subsystem_vendor", &sub_vendor);
+	ret |= read_sys_node(dirfd, path, "subsystem_device", &sub_device);
+	ret |= read_sys_node(dirfd, path, "vendor", &vendor);
+	ret |= read_sys_node(dirfd, path, "device", &device);
+	ret |= read_sys_node(dirfd, path, "class", &class);
+	close(dirfd);
 	if (ret)
-		goto error0;
+		return strdup("NULL");
 
 	line = malloc(1024);
 	if (!line) {
 		fprintf(stderr, "malloc: %s\n", strerror(errno));
-		goto error0;
+		return strdup("NULL");
 	}
 
-	while ((amnt = getline(&line, &size, file)) != -1) {
-		if (is_comment(line) && !is_class_info(line))
-			continue;
-		if (is_top_level_match(line, vendor, false)) {
-			line[amnt - 1] = '\0';
-			device_top = strdup(line);
-			parse_vendor_device(&line, file,
-						device,
-						sub_device,
-						sub_vendor);
-		}
-		if (is_class_info(line))
-			pull_class_info(&line, file, class);
-	}
-	fclose(file);
-	format_all(line, vendor, device);
-	free_all();
+	vendor_name = pci_id_lookup(PCI_ID_VENDOR, vendor);
+	if (vendor_name)
+		device_name = pci_id_lookup(PCI_ID_DEVICE,
+					    (vendor << 16) | device);
+	if (device_name)
+		subsys_name = pci_id_lookup(PCI_ID_SUBSYS,
+					    ((uint64_t)vendor << 48) |
+					    ((uint64_t)device << 32) |
+					    (sub_vendor << 16) | sub_device);
+	class_name = pci_id_lookup(PCI_ID_SUBCLASS, class >> 8);
+
+	if (subsys_name && !class_name)
+		snprintf(line, 1024, "%s %s %s",
+			 vendor_name, device_name, subsys_name);
+	else if (subsys_name)
+		snprintf(line, 1024, "%s: %s %s %s",
+			 class_name, vendor_name, device_name, subsys_name);
+	else if (vendor_name && !device_name && class_name)
+		snprintf(line, 1024, "%s: %s Device 0x%04x",
+			 class_name, vendor_name, device);
+	else if (!vendor_name && class_name)
+		snprintf(line, 1024, "%s: Vendor 0x%04x Device 0x%04x",
+			 class_name, vendor, device);
+	else
+		snprintf(line, 1024, "Unknown device");
 	return line;
-error0:
-	fclose(file);
-error1:
-	return !line ? strdup("NULL") : strdup("Unknown Device");
 }
@@ -21,6 +21,8 @@ void nvme_show_resv_report(struct nvme_reservation_status *status, int bytes, __
 void nvme_show_lba_range(struct nvme_lba_range_type *lbrt, int nr_ranges);
 void nvme_show_error_log(struct nvme_error_log_page *err_log, int entries,
 	const char *devname, enum nvme_print_flags flags);
+void nvme_show_error_log_lines(struct nvme_error_log_page *err_log,
+	int entries, const char *devname);
 void nvme_show_smart_log(struct nvme_smart_log *smart, unsigned int nsid,
 	const char *devname, enum nvme_print_flags flags);
 void nvme_show_ana_log(struct nvme_ana_rsp_hdr *ana_log, const char *devname,
@@ -53,6 +55,14 @@ void json_persistent_event_log(void *pevent_log_info, __u32 size);
 void nvme_show_persistent_event_log(void *pevent_log_info,
 	__u8 action, __u32 size, const char *devname,
 	enum nvme_print_flags flags);
+struct json_object *nvme_show_persistent_event_log_head(
+	struct nvme_persistent_event_log_head *pevent_log_head,
+	__u8 action, const char *devname, enum nvme_print_flags flags,
+	struct json_object **entries);
+void nvme_show_persistent_event_entry(struct json_object *entries,
+	struct nvme_persistent_event_entry_head *pevent_entry_head,
+	void *event, const char *devname, enum nvme_print_flags flags);
+void nvme_show_persistent_event_log_end(struct json_object *root);
 void json_endurance_group_event_agg_log(
 	struct nvme_event_agg_log_page *endurance_log,
 	__u64 log_entries);
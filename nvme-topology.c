@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -18,81 +20,178 @@ static const char *dev = "/dev/";
 static const char *subsys_dir = "/sys/class/nvme-subsystem/";
 static void free_ctrl(struct nvme_ctrl *c);
 
-char *get_nvme_subsnqn(char *path)
+/*
+ * sysfs attributes are at most a page. Values are read straight into
+ * arena chunks, so a whole topology scan needs only a few allocations.
+ */
+#define SYSFS_ATTR_MAX		4096
+#define SYSFS_ARENA_CHUNK	(4 * SYSFS_ATTR_MAX)
+
+struct sysfs_arena_chunk {
+	struct sysfs_arena_chunk *next;
+	size_t used;
+	char data[SYSFS_ARENA_CHUNK];
+};
+
+/*
+ * Read attribute attr of the sysfs directory dirfd into buf, without the
+ * trailing newline. Returns the length of the NUL terminated value or a
+ * negative errno.
+ */
+ssize_t sysfs_read_attr(int dirfd, const char *attr, char *buf, size_t size)
 {
-	char sspath[320], *subsysnqn;
-	int fd, ret;
+	ssize_t len;
+	int fd, err;
+
+	fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, buf, size - 1);
+	err = errno;
+	close(fd);
+	if (len < 0)
+		return -err;
 
-	snprintf(sspath, sizeof(sspath), "%s/subsysnqn", path);
+	if (len && buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+	return len;
+}
 
-	fd = open(sspath, O_RDONLY);
-	if (fd < 0) {
+static char *sysfs_arena_reserve(struct sysfs_arena *a, size_t size)
+{
+	struct sysfs_arena_chunk *c = a->chunks;
+
+	if (size > SYSFS_ARENA_CHUNK) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!c || SYSFS_ARENA_CHUNK - c->used < size) {
+		c = malloc(sizeof(*c));
+		if (!c)
+			return NULL;
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	return c->data + c->used;
+}
+
+/*
+ * Returns the value of attribute attr of the sysfs directory dirfd, valid
+ * until the arena is freed, and its length in len. NULL if the attribute
+ * can not be read.
+ */
+char *sysfs_arena_read(struct sysfs_arena *a, int dirfd, const char *attr,
+		       size_t *len)
+{
+	char *value;
+	ssize_t ret;
+
+	value = sysfs_arena_reserve(a, SYSFS_ATTR_MAX + 1);
+	if (!value)
+		return NULL;
+	ret = sysfs_read_attr(dirfd, attr, value, SYSFS_ATTR_MAX + 1);
+	if (ret < 0) {
+		errno = -ret;
+		return NULL;
+	}
+
+	a->chunks->used += ret + 1;
+	if (len)
+		*len = ret;
+	return value;
+}
+
+char *sysfs_arena_strdup(struct sysfs_arena *a, const char *str)
+{
+	size_t len = strlen(str);
+	char *copy;
+
+	copy = sysfs_arena_reserve(a, len + 1);
+	if (!copy)
+		return NULL;
+	memcpy(copy, str, len + 1);
+	a->chunks->used += len + 1;
+	return copy;
+}
+
+void sysfs_arena_free(struct sysfs_arena *a)
+{
+	struct sysfs_arena_chunk *c;
+
+	while ((c = a->chunks)) {
+		a->chunks = c->next;
+		free(c);
+	}
+}
+
+/* list valued attributes like the address are shown space separated */
+static void sysfs_split_list(char *value, size_t len)
+{
+	char *p = value;
+
+	while ((p = memchr(p, ',', value + len - p)))
+		*p++ = ' ';
+}
+
+char *get_nvme_subsnqn(char *path)
+{
+	char *subsysnqn;
+	ssize_t ret;
+	int dirfd;
+
+	dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
 		fprintf(stderr, "Failed to open %s: %s\n",
-				sspath, strerror(errno));
+				path, strerror(errno));
 		return NULL;
 	}
 
-	subsysnqn = calloc(1, 256);
+	subsysnqn = malloc(256);
 	if (!subsysnqn)
 		goto close_fd;
 
-	ret = read(fd, subsysnqn, 256);
+	ret = sysfs_read_attr(dirfd, "subsysnqn", subsysnqn, 256);
 	if (ret < 0) {
-		fprintf(stderr, "Failed to read %s: %s\n", sspath,
-				strerror(errno));
+		fprintf(stderr, "Failed to read %s/subsysnqn: %s\n", path,
+				strerror(-ret));
 		free(subsysnqn);
 		subsysnqn = NULL;
-	} else if (subsysnqn[strlen(subsysnqn) - 1] == '\n') {
-		subsysnqn[strlen(subsysnqn) - 1] = '\0';
 	}
 
 close_fd:
-	close(fd);
+	close(dirfd);
 	return subsysnqn;
 }
 
 char *nvme_get_ctrl_attr(const char *path, const char *attr)
 {
-	char *attrpath, *value;
+	char *value;
 	ssize_t ret;
-	int fd, i;
+	int dirfd;
 
-	ret = asprintf(&attrpath, "%s/%s", path, attr);
-	if (ret < 0)
+	dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0)
 		return NULL;
 
-	value = calloc(1, 1024);
+	value = malloc(1024);
 	if (!value)
-		goto err_free_path;
-
-	fd = open(attrpath, O_RDONLY);
-	if (fd < 0)
-		goto err_free_value;
+		goto close_fd;
 
-	ret = read(fd, value, 1024);
+	ret = sysfs_read_attr(dirfd, attr, value, 1024);
 	if (ret < 0) {
-		fprintf(stderr, "read :%s :%s\n", attrpath, strerror(errno));
-		goto err_close_fd;
-	}
-
-	if (value[strlen(value) - 1] == '\n')
-		value[strlen(value) - 1] = '\0';
-
-	for (i = 0; i < strlen(value); i++) {
-		if (value[i] == ',' )
-			value[i] = ' ';
+		if (ret != -ENOENT)
+			fprintf(stderr, "read :%s/%s :%s\n", path, attr,
+				strerror(-ret));
+		free(value);
+		value = NULL;
+		goto close_fd;
 	}
-
-	close(fd);
-	free(attrpath);
+	sysfs_split_list(value, ret);
+close_fd:
+	close(dirfd);
 	return value;
-err_close_fd:
-	close(fd);
-err_free_value:
-	free(value);
-err_free_path:
-	free(attrpath);
-	return NULL;
 }
 
 static char *path_trim_last(char *path, char needle)
@@ -154,7 +253,7 @@ static int scan_namespace(struct nvme_namespace *n)
 	if (ret < 0)
 		return ret;
 
-	fd = open(path, O_RDONLY);
+	fd = nvme_open(path, O_RDONLY);
 	if (fd < 0)
 		goto free;
 
@@ -174,25 +273,19 @@ free:
 	return 0;
 }
 
-static char *get_nvme_ctrl_path_ana_state(char *path, int nsid)
+static char *get_nvme_ctrl_path_ana_state(struct sysfs_arena *a, int dirfd,
+					  char *path, int nsid)
 {
 	struct dirent **paths;
-	char *ana_state;
+	char *ana_state = NULL;
 	int i, n;
 
-	ana_state = calloc(1, 16);
-	if (!ana_state)
-		return NULL;
-
 	n = scandir(path, &paths, scan_ctrl_paths_filter, alphasort);
-	if (n <= 0) {
-		free(ana_state);
+	if (n <= 0)
 		return NULL;
-	}
 	for (i = 0; i < n; i++) {
-		int id, cntlid, ns, fd;
-		char *ctrl_path;
-		ssize_t ret;
+		int id, cntlid, ns;
+		char attr[NAME_MAX + 16];
 
 		if (sscanf(paths[i]->d_name, "nvme%dc%dn%d",
 			   &id, &cntlid, &ns) != 3) {
@@ -204,30 +297,11 @@ static char *get_nvme_ctrl_path_ana_state(char *path, int nsid)
 		if (ns != nsid)
 			continue;
 
-		ret = asprintf(&ctrl_path, "%s/%s/ana_state",
-			       path, paths[i]->d_name);
-		if (ret < 0) {
-			free(ana_state);
-			ana_state = NULL;
-			break;
-		}
-		fd = open(ctrl_path, O_RDONLY);
-		if (fd < 0) {
-			free(ctrl_path);
-			free(ana_state);
-			ana_state = NULL;
-			break;
-		}
-		ret = read(fd, ana_state, 16);
-		if (ret < 0) {
-			fprintf(stderr, "Failed to read ANA state from %s\n",
-				ctrl_path);
-			free(ana_state);
-			ana_state = NULL;
-		} else if (ana_state[strlen(ana_state) - 1] == '\n')
-			ana_state[strlen(ana_state) - 1] = '\0';
-		close(fd);
-		free(ctrl_path);
+		snprintf(attr, sizeof(attr), "%s/ana_state", paths[i]->d_name);
+		ana_state = sysfs_arena_read(a, dirfd, attr, NULL);
+		if (!ana_state && errno != ENOENT)
+			fprintf(stderr, "Failed to read ANA state from %s/%s\n",
+				path, attr);
 		break;
 	}
 	for (i = 0; i < n; i++)
@@ -249,60 +323,104 @@ static bool ns_attached_to_ctrl(int nsid, struct nvme_ctrl *ctrl)
 	return false;
 }
 
-static int scan_ctrl(struct nvme_ctrl *c, char *p, __u32 ns_instance)
+static char *scan_ctrl_attr(struct sysfs_arena *a, int dirfd,
+			    const char *attr)
+{
+	size_t len;
+	char *value;
+
+	value = sysfs_arena_read(a, dirfd, attr, &len);
+	if (value)
+		sysfs_split_list(value, len);
+	return value;
+}
+
+static int scan_ctrl_id(struct nvme_ctrl *c)
+{
+	char *path;
+	int ret, fd;
+
+	ret = asprintf(&path, "%s%s", c->path, c->name);
+	if (ret < 0)
+		return ret;
+
+	fd = nvme_open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		goto free;
+	}
+
+	ret = nvme_identify_ctrl(fd, &c->id);
+	if (ret < 0)
+		goto close_fd;
+close_fd:
+	close(fd);
+free:
+	free(path);
+	return 0;
+}
+
+static int scan_ctrl(struct nvme_ctrl *c, struct sysfs_arena *a, int sdirfd,
+		     char *p, __u32 ns_instance, enum nvme_scan_flags scan)
 {
 	struct nvme_namespace *n;
 	struct dirent **ns;
 	char *path;
-	int i, fd, ret;
+	int i, dirfd, ret;
 
 	ret = asprintf(&path, "%s/%s", p, c->name);
 	if (ret < 0)
 		return ret;
 
-	c->address = nvme_get_ctrl_attr(path, "address");
-	c->transport = nvme_get_ctrl_attr(path, "transport");
-	c->state = nvme_get_ctrl_attr(path, "state");
-	c->hostnqn = nvme_get_ctrl_attr(path, "hostnqn");
-	c->hostid = nvme_get_ctrl_attr(path, "hostid");
+	dirfd = openat(sdirfd, c->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		ret = errno;
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(ret));
+		free(path);
+		return ret;
+	}
+
+	if (scan & NVME_SCAN_CTRL_ATTRS) {
+		c->address = scan_ctrl_attr(a, dirfd, "address");
+		c->transport = scan_ctrl_attr(a, dirfd, "transport");
+		c->state = scan_ctrl_attr(a, dirfd, "state");
+	}
+	if (scan & NVME_SCAN_HOST_ATTRS) {
+		c->hostnqn = scan_ctrl_attr(a, dirfd, "hostnqn");
+		c->hostid = scan_ctrl_attr(a, dirfd, "hostid");
+	}
 
 	if (ns_instance)
-		c->ana_state = get_nvme_ctrl_path_ana_state(path, ns_instance);
+		c->ana_state = get_nvme_ctrl_path_ana_state(a, dirfd, path,
+							    ns_instance);
 
 	ret = scandir(path, &ns, scan_ctrl_namespace_filter, alphasort);
 	if (ret == -1) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-		return errno;
+		ret = errno;
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(ret));
+		close(dirfd);
+		free(path);
+		return ret;
 	}
 
 	c->nr_namespaces = ret;
 	c->namespaces = calloc(c->nr_namespaces, sizeof(*n));
 	if (c->namespaces) {
 		for (i = 0; i < c->nr_namespaces; i++) {
-			char *ns_path, nsid[16];
-			int ns_fd;
+			char attr[NAME_MAX + 8], nsid[16];
 
 			n = &c->namespaces[i];
 			n->name = strdup(ns[i]->d_name);
 			n->ctrl = c;
-			ret = asprintf(&ns_path, "%s/%s/nsid", path, n->name);
-			if (ret < 0)
-				continue;
-			ns_fd = open(ns_path, O_RDONLY);
-			if (ns_fd < 0) {
-				free(ns_path);
+			/* the nsid is only needed to identify or filter */
+			if (!ns_instance && !(scan & NVME_SCAN_ID_NS))
 				continue;
-			}
-			ret = read(ns_fd, nsid, 16);
-			if (ret < 0) {
-				close(ns_fd);
-				free(ns_path);
+			snprintf(attr, sizeof(attr), "%s/nsid", ns[i]->d_name);
+			if (sysfs_read_attr(dirfd, attr, nsid, sizeof(nsid)) < 0)
 				continue;
-			}
 			n->nsid = (unsigned)strtol(nsid, NULL, 10);
-			scan_namespace(n);
-			close(ns_fd);
-			free(ns_path);
+			if (scan & NVME_SCAN_ID_NS)
+				scan_namespace(n);
 		}
 	} else {
 		i = c->nr_namespaces;
@@ -312,45 +430,47 @@ static int scan_ctrl(struct nvme_ctrl *c, char *p, __u32 ns_instance)
 	while (i--)
 		free(ns[i]);
 	free(ns);
+	close(dirfd);
 	free(path);
 
-	ret = asprintf(&path, "%s%s", c->path, c->name);
-	if (ret < 0)
-		return ret;
-
-	fd = open(path, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s\n", path);
-		goto free;
-	}
-
-	ret = nvme_identify_ctrl(fd, &c->id);
-	if (ret < 0)
-		goto close_fd;
-close_fd:
-	close(fd);
-free:
-	free(path);
+	if (scan & NVME_SCAN_ID_CTRL)
+		return scan_ctrl_id(c);
 	return 0;
 }
 
-static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance, int nsid)
+static int scan_subsystem(struct nvme_subsystem *s, struct sysfs_arena *a,
+			  __u32 ns_instance, int nsid, enum nvme_scan_flags scan)
 {
 	struct dirent **ctrls, **ns;
 	struct nvme_namespace *n;
 	struct nvme_ctrl *c;
-	int i, j = 0, ret;
+	int i, j = 0, ret, dirfd;
 	char *path;
 
-	ret = asprintf(&path, "%s%s", subsys_dir, s->name);
+	ret = asprintf(&path, "%s%s%s", nvme_backend->sysfs_root, subsys_dir,
+		       s->name);
 	if (ret < 0)
 		return ret;
 
-	s->subsysnqn = get_nvme_subsnqn(path);
+	dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		ret = errno;
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(ret));
+		free(path);
+		return ret;
+	}
+
+	s->subsysnqn = sysfs_arena_read(a, dirfd, "subsysnqn", NULL);
+	if (!s->subsysnqn)
+		fprintf(stderr, "Failed to read %s/subsysnqn: %s\n", path,
+			strerror(errno));
 	ret = scandir(path, &ctrls, scan_ctrls_filter, alphasort);
 	if (ret == -1) {
-		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
-		return errno;
+		ret = errno;
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(ret));
+		close(dirfd);
+		free(path);
+		return ret;
 	}
 	s->nr_ctrls = ret;
 	s->ctrls = calloc(s->nr_ctrls, sizeof(*c));
@@ -359,7 +479,7 @@ static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance, int nsid)
 		c->name = strdup(ctrls[i]->d_name);
 		c->path = strdup(dev);
 		c->subsys = s;
-		scan_ctrl(c, path, ns_instance);
+		scan_ctrl(c, a, dirfd, path, ns_instance, scan);
 
 		if (!ns_instance || ns_attached_to_ctrl(nsid, c))
 			j++;
@@ -371,6 +491,7 @@ static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance, int nsid)
 	while (i--)
 		free(ctrls[i]);
 	free(ctrls);
+	close(dirfd);
 
 	ret = scandir(path, &ns, scan_namespace_filter, alphasort);
 	if (ret == -1) {
@@ -385,7 +506,8 @@ static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance, int nsid)
 			n = &s->namespaces[i];
 			n->name = strdup(ns[i]->d_name);
 			n->ctrl = &s->ctrls[0];
-			scan_namespace(n);
+			if (scan & NVME_SCAN_ID_NS)
+				scan_namespace(n);
 		}
 	} else {
 		i = s->nr_namespaces;
@@ -400,7 +522,8 @@ static int scan_subsystem(struct nvme_subsystem *s, __u32 ns_instance, int nsid)
 	return 0;
 }
 
-static int verify_legacy_ns(struct nvme_namespace *n)
+static int verify_legacy_ns(struct nvme_namespace *n, struct sysfs_arena *a,
+			    enum nvme_scan_flags scan)
 {
 	struct nvme_ctrl *c = n->ctrl;
 	struct nvme_id_ctrl id;
@@ -411,18 +534,22 @@ static int verify_legacy_ns(struct nvme_namespace *n)
 	if (ret < 0)
 		return ret;
 
-	if (!n->ctrl->transport && !n->ctrl->address) {
+	if ((scan & NVME_SCAN_CTRL_ATTRS) &&
+	    !n->ctrl->transport && !n->ctrl->address) {
 		char tmp_address[64] = "";
 		legacy_get_pci_bdf(path, tmp_address);
 		if (tmp_address[0]) {
-			if (asprintf(&n->ctrl->transport, "pcie") < 0)
-				return -1;
-			if (asprintf(&n->ctrl->address, "%s", tmp_address) < 0)
-				return -1;
+			n->ctrl->transport = sysfs_arena_strdup(a, "pcie");
+			n->ctrl->address = sysfs_arena_strdup(a, tmp_address);
 		}
 	}
 
-	fd = open(path, O_RDONLY);
+	if (!(scan & NVME_SCAN_ID_CTRL)) {
+		free(path);
+		return 0;
+	}
+
+	fd = nvme_open(path, O_RDONLY);
 	free (path);
 
 	if (fd < 0)
@@ -446,7 +573,8 @@ static int verify_legacy_ns(struct nvme_namespace *n)
  * is the controller to nvme0n1 for such older kernels. We will also assume
  * every controller is its own subsystem.
  */
-static int legacy_list(struct nvme_topology *t, char *dev_dir)
+static int legacy_list(struct nvme_topology *t, char *dev_dir,
+		       enum nvme_scan_flags scan)
 {
 	struct nvme_ctrl *c;
 	struct nvme_subsystem *s;
@@ -469,7 +597,7 @@ static int legacy_list(struct nvme_topology *t, char *dev_dir)
 		s->nr_ctrls = 1;
 		s->ctrls = calloc(s->nr_ctrls, sizeof(*c));
 		s->name = strdup(devices[i]->d_name);
-		s->subsysnqn = strdup(s->name);
+		s->subsysnqn = sysfs_arena_strdup(&t->arena, s->name);
 		s->nr_namespaces = 0;
 
 		c = s->ctrls;
@@ -491,10 +619,12 @@ static int legacy_list(struct nvme_topology *t, char *dev_dir)
 			continue;
 		ret = 0;
 
-		fd = open(path, O_RDONLY);
-		if (fd > 0) {
-			nvme_identify_ctrl(fd, &c->id);
-			close(fd);
+		if (scan & NVME_SCAN_ID_CTRL) {
+			fd = nvme_open(path, O_RDONLY);
+			if (fd > 0) {
+				nvme_identify_ctrl(fd, &c->id);
+				close(fd);
+			}
 		}
 		free(path);
 
@@ -502,8 +632,9 @@ static int legacy_list(struct nvme_topology *t, char *dev_dir)
 			n = &c->namespaces[j];
 			n->name = strdup(namespaces[j]->d_name);
 			n->ctrl = c;
-			scan_namespace(n);
-			ret = verify_legacy_ns(n);
+			if (scan & NVME_SCAN_ID_NS)
+				scan_namespace(n);
+			ret = verify_legacy_ns(n, &t->arena, scan);
 			if (ret)
 				goto free;
 		}
@@ -529,12 +660,6 @@ static void free_ctrl(struct nvme_ctrl *c)
 	}
 	free(c->name);
 	free(c->path);
-	free(c->transport);
-	free(c->address);
-	free(c->state);
-	free(c->hostnqn);
-	free(c->hostid);
-	free(c->ana_state);
 	free(c->namespaces);
 }
 
@@ -549,17 +674,20 @@ static void free_subsystem(struct nvme_subsystem *s)
 		free(n->name);
 	}
 	free(s->name);
-	free(s->subsysnqn);
 	free(s->ctrls);
 	free(s->namespaces);
 }
 
-static int scan_subsystem_dir(struct nvme_topology *t, char *dev_dir)
+static int scan_subsystem_dir(struct nvme_topology *t, char *dev_dir,
+			      enum nvme_scan_flags scan)
 {
 	struct nvme_topology dev_dir_t = { };
 	int ret, i, total_nr_subsystems;
 
-	ret = legacy_list(&dev_dir_t, dev_dir);
+	/* the legacy scan allocates from our arena */
+	dev_dir_t.arena = t->arena;
+	ret = legacy_list(&dev_dir_t, dev_dir, scan);
+	t->arena = dev_dir_t.arena;
 	if (ret != 0)
 		return ret;
 
@@ -574,17 +702,116 @@ static int scan_subsystem_dir(struct nvme_topology *t, char *dev_dir)
 	return 0;
 }
 
+/*
+ * The sysfs part of an unfiltered scan, kept for processes running many
+ * commands. Callers get a copy sharing its memory, which free_topology()
+ * leaves alone, and only the Identify data they ask for is read again.
+ * The owner invalidates it when controllers or namespaces come and go.
+ */
+#define TOPOLOGY_CACHE_SCAN	(NVME_SCAN_CTRL_ATTRS | NVME_SCAN_HOST_ATTRS)
+
+static bool topology_cache_enabled;
+static bool topology_cache_valid;
+static struct nvme_topology topology_cache;
+
+void nvme_topology_cache_invalidate(void)
+{
+	if (!topology_cache_valid)
+		return;
+	topology_cache.shared = false;
+	free_topology(&topology_cache);
+	memset(&topology_cache, 0, sizeof(topology_cache));
+	topology_cache_valid = false;
+}
+
+void nvme_topology_cache_enable(bool enable)
+{
+	topology_cache_enabled = enable;
+	if (!enable)
+		nvme_topology_cache_invalidate();
+}
+
+/* scan the topology now if it is not cached, without any device I/O */
+int nvme_topology_cache_refresh(void)
+{
+	struct nvme_topology t = { };
+	int ret;
+
+	if (!topology_cache_enabled || topology_cache_valid)
+		return 0;
+	ret = scan_subsystems(&t, NULL, 0, 0, NULL, NVME_SCAN_NAMES);
+	free_topology(&t);
+	return ret;
+}
+
+static void scan_topology_ids(struct nvme_topology *t,
+			      enum nvme_scan_flags scan)
+{
+	struct nvme_subsystem *s;
+	struct nvme_ctrl *c;
+	int i, j, k;
+
+	for (i = 0; i < t->nr_subsystems; i++) {
+		s = &t->subsystems[i];
+		for (j = 0; j < s->nr_ctrls; j++) {
+			c = &s->ctrls[j];
+			if (scan & NVME_SCAN_ID_CTRL)
+				scan_ctrl_id(c);
+			if (!(scan & NVME_SCAN_ID_NS))
+				continue;
+			for (k = 0; k < c->nr_namespaces; k++)
+				scan_namespace(&c->namespaces[k]);
+		}
+		if (!(scan & NVME_SCAN_ID_NS))
+			continue;
+		for (k = 0; k < s->nr_namespaces; k++)
+			scan_namespace(&s->namespaces[k]);
+	}
+}
+
+static int scan_subsystems_cached(struct nvme_topology *t,
+				  enum nvme_scan_flags scan)
+{
+	int ret;
+
+	if (!topology_cache_valid) {
+		topology_cache_enabled = false;
+		ret = scan_subsystems(&topology_cache, NULL, 0, 0, NULL,
+				      TOPOLOGY_CACHE_SCAN);
+		topology_cache_enabled = true;
+		if (ret) {
+			free_topology(&topology_cache);
+			memset(&topology_cache, 0, sizeof(topology_cache));
+			return ret;
+		}
+		topology_cache.shared = true;
+		topology_cache_valid = true;
+	}
+
+	*t = topology_cache;
+	scan_topology_ids(t, scan);
+	return 0;
+}
+
 int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
-		    __u32 ns_instance, int nsid, char *dev_dir)
+		    __u32 ns_instance, int nsid, char *dev_dir,
+		    enum nvme_scan_flags scan)
 {
 	struct nvme_subsystem *s;
 	struct dirent **subsys;
+	char path[PATH_MAX];
 	int ret = 0, i, j = 0;
 
-	t->nr_subsystems = scandir(subsys_dir, &subsys, scan_subsys_filter,
+	if (topology_cache_enabled && !subsysnqn && !ns_instance && !nsid &&
+	    !dev_dir)
+		return scan_subsystems_cached(t, scan);
+
+	snprintf(path, sizeof(path), "%s%s", nvme_backend->sysfs_root,
+		 subsys_dir);
+	t->nr_subsystems = scandir(path, &subsys, scan_subsys_filter,
 				   alphasort);
 	if (t->nr_subsystems < 0) {
-		ret = legacy_list(t, (char *)dev);
+		ret = legacy_list(t, (char *)dev, scan);
 		if (ret != 0)
 			return ret;
 	} else {
@@ -593,9 +820,10 @@ int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
 		for (i = 0; i < t->nr_subsystems; i++) {
 			s = &t->subsystems[j];
 			s->name = strdup(subsys[i]->d_name);
-			scan_subsystem(s, ns_instance, nsid);
+			scan_subsystem(s, &t->arena, ns_instance, nsid, scan);
 
-			if (!subsysnqn || !strcmp(s->subsysnqn, subsysnqn))
+			if (!subsysnqn ||
+			    (s->subsysnqn && !strcmp(s->subsysnqn, subsysnqn)))
 				j++;
 			else
 				free_subsystem(s);
@@ -608,7 +836,7 @@ int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
 	}
 
 	if (dev_dir != NULL && strcmp(dev_dir, "/dev/")) {
-		ret = scan_subsystem_dir(t, dev_dir);
+		ret = scan_subsystem_dir(t, dev_dir, scan);
 	}
 
 	return ret;
@@ -618,9 +846,28 @@ void free_topology(struct nvme_topology *t)
 {
 	int i;
 
+	if (t->shared)
+		return;
 	for (i = 0; i < t->nr_subsystems; i++)
 		free_subsystem(&t->subsystems[i]);
 	free(t->subsystems);
+	sysfs_arena_free(&t->arena);
+}
+
+/*
+ * Parse a controller or namespace device name like nvme0 or nvme0n1, with
+ * or without its directory. The nsid is 0 for a controller.
+ */
+bool nvme_dev_name_parse(const char *path, int *instance, int *nsid)
+{
+	const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	int n = 0;
+
+	if (sscanf(name, "nvme%dn%d%n", instance, nsid, &n) == 2 && !name[n])
+		return true;
+	*nsid = 0;
+	n = 0;
+	return sscanf(name, "nvme%d%n", instance, &n) == 1 && !name[n];
 }
 
 char *nvme_char_from_block(char *dev)
@@ -635,7 +882,8 @@ char *nvme_char_from_block(char *dev)
 		return strdup(dev);
 		break;
 	case 2:
-		if (asprintf(&path, "/sys/block/%s/device", dev) < 0)
+		if (asprintf(&path, "%s/sys/block/%s/device",
+			     nvme_backend->sysfs_root, dev) < 0)
 			path = NULL;
 		break;
 	default:
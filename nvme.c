@@ -34,6 +34,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
 #include <dirent.h>
 #include <libgen.h>
 
@@ -43,6 +45,7 @@
 
 #include <linux/fs.h>
 
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -57,6 +60,14 @@
 
 #include "argconfig.h"
 #include "fabrics.h"
+#include "monitor.h"
+#include "batch.h"
+#include "serve.h"
+#include "fanout.h"
+#include "replay.h"
+#include "nvme-mock.h"
+#include "progress.h"
+#include "feature-snapshot.h"
 
 #define CREATE_CMD
 #include "nvme-builtin.h"
@@ -84,7 +95,7 @@ static struct program nvme = {
 	.extensions = &builtin,
 };
 
-static __u16 nvme_feat_buf_len[0x100] = {
+__u16 nvme_feat_buf_len[0x100] = {
 	[NVME_FEAT_LBA_RANGE]		= 4096,
 	[NVME_FEAT_AUTO_PST]		= 256,
 	[NVME_FEAT_HOST_MEM_BUF]	= 4096,
@@ -156,12 +167,81 @@ static bool is_blkdev(void)
 	return S_ISBLK(nvme_stat.st_mode);
 }
 
+/*
+ * Devices opened so far, kept open while running several commands in
+ * one process. Commands close their descriptor when done, so they are
+ * handed a duplicate of the cached one.
+ */
+struct dev_cache_entry {
+	char *path;
+	int fd;
+	struct stat st;
+	struct dev_cache_entry *next;
+};
+
+static bool dev_cache_enabled;
+static struct dev_cache_entry *dev_cache;
+
+void nvme_dev_cache_enable(bool enable)
+{
+	struct dev_cache_entry *e;
+
+	dev_cache_enabled = enable;
+	while (!enable && dev_cache) {
+		e = dev_cache;
+		dev_cache = e->next;
+		close(e->fd);
+		free(e->path);
+		free(e);
+	}
+}
+
+static int dev_cache_open(char *dev)
+{
+	struct dev_cache_entry *e;
+
+	for (e = dev_cache; e; e = e->next) {
+		if (strcmp(e->path, dev))
+			continue;
+		nvme_stat = e->st;
+		return nvme_backend->dup(e->fd);
+	}
+	return -ENOENT;
+}
+
+static void dev_cache_add(char *dev, int fd)
+{
+	struct dev_cache_entry *e;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return;
+	e->path = strdup(dev);
+	e->fd = nvme_backend->dup(fd);
+	if (!e->path || e->fd < 0) {
+		if (e->fd >= 0)
+			close(e->fd);
+		free(e->path);
+		free(e);
+		return;
+	}
+	e->st = nvme_stat;
+	e->next = dev_cache;
+	dev_cache = e;
+}
+
 static int open_dev(char *dev)
 {
 	int err, fd;
 
 	devicename = basename(dev);
-	err = open(dev, O_RDONLY);
+	if (dev_cache_enabled) {
+		fd = dev_cache_open(dev);
+		if (fd >= 0)
+			return fd;
+	}
+
+	err = nvme_open(dev, O_RDONLY);
 	if (err < 0)
 		goto perror;
 	fd = err;
@@ -176,12 +256,28 @@ static int open_dev(char *dev)
 		close(fd);
 		return -ENODEV;
 	}
+	if (dev_cache_enabled)
+		dev_cache_add(dev, fd);
 	return fd;
 perror:
 	perror(dev);
 	return err;
 }
 
+/*
+ * Open a device through the device cache, so that it stays open for
+ * commands run later in this process or its children.
+ */
+int nvme_dev_cache_open(char *dev)
+{
+	int fd;
+
+	fd = dev_cache_open(dev);
+	if (fd < 0 && dev_cache_enabled)
+		fd = open_dev(dev);
+	return fd;
+}
+
 static int check_arg_dev(int argc, char **argv)
 {
 	if (optind >= argc) {
@@ -192,7 +288,7 @@ static int check_arg_dev(int argc, char **argv)
 	return 0;
 }
 
-static int get_dev(int argc, char **argv)
+int get_dev(int argc, char **argv)
 {
 	int ret;
 
@@ -582,6 +678,220 @@ ret:
 	return nvme_status_to_errno(err, false);
 }
 
+/*
+ * Log readers which remember how far they got keep that in a state file
+ * with one "<value> <serial>" line per controller. The file is locked
+ * from log_state_load() until log_state_release().
+ */
+struct log_state {
+	int fd;
+	char key[64];
+	char *buf;
+	size_t len;
+	char *line;	/* line for key in buf, NULL if there is none */
+	char *next;	/* line following it */
+};
+
+static int log_state_open(struct log_state *s, const char *path,
+			  const char *sn, size_t sn_len)
+{
+	size_t len = min(sn_len, sizeof(s->key) - 1);
+
+	memcpy(s->key, sn, len);
+	s->key[len] = '\0';
+	while (len && (s->key[len - 1] == ' ' || !s->key[len - 1]))
+		s->key[--len] = '\0';
+	if (!len)
+		snprintf(s->key, sizeof(s->key), "%s", devicename);
+
+	s->buf = NULL;
+	s->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (s->fd < 0) {
+		perror(path);
+		return -errno;
+	}
+	return 0;
+}
+
+static int log_state_load(struct log_state *s)
+{
+	char *p, *eol, *sp;
+	struct stat st;
+	ssize_t n;
+
+	if (flock(s->fd, LOCK_EX) < 0 || fstat(s->fd, &st) < 0)
+		return -errno;
+	s->buf = malloc(st.st_size + 1);
+	if (!s->buf)
+		return -ENOMEM;
+	n = pread(s->fd, s->buf, st.st_size, 0);
+	if (n < 0)
+		return -errno;
+	s->buf[n] = '\0';
+	s->len = n;
+
+	for (p = s->buf; *p; p = eol) {
+		eol = strchrnul(p, '\n');
+		sp = memchr(p, ' ', eol - p);
+		if (sp && eol - sp - 1 == strlen(s->key) &&
+		    !strncmp(sp + 1, s->key, eol - sp - 1)) {
+			s->line = p;
+			s->next = *eol ? eol + 1 : eol;
+			return 0;
+		}
+		if (*eol)
+			eol++;
+	}
+	s->line = s->next = NULL;
+	return 0;
+}
+
+static int log_state_store(struct log_state *s, const char *value)
+{
+	size_t head = s->line ? s->line - s->buf : s->len;
+	size_t tail = s->line ? s->len - (s->next - s->buf) : 0;
+	char *entry;
+	int n, err = 0;
+
+	n = asprintf(&entry, "%s %s\n", value, s->key);
+	if (n < 0)
+		return -ENOMEM;
+
+	if (ftruncate(s->fd, 0) < 0)
+		err = -errno;
+	else if (pwrite(s->fd, s->buf, head, 0) != head)
+		err = -EIO;
+	else if (head && s->buf[head - 1] != '\n' &&
+		 pwrite(s->fd, "\n", 1, head++) != 1)
+		err = -EIO;
+	else if (tail && pwrite(s->fd, s->next, tail, head) != tail)
+		err = -EIO;
+	else if (pwrite(s->fd, entry, n, head + tail) != n)
+		err = -EIO;
+	free(entry);
+	return err;
+}
+
+static void log_state_release(struct log_state *s)
+{
+	free(s->buf);
+	s->buf = NULL;
+	flock(s->fd, LOCK_UN);
+}
+
+/*
+ * Entries are returned newest first, so read a growing prefix of the log
+ * until an entry which was already reported (or an empty one) shows up.
+ * Controllers without offset support for Get Log Page reread from 0.
+ */
+static int error_log_read_new(int fd, struct nvme_id_ctrl *ctrl,
+			      struct nvme_error_log_page *log, __u32 max,
+			      __u64 seen, __u32 *nr)
+{
+	const __u32 per_xfer = 4096 / sizeof(*log);
+	__u32 have = 0, want = 1, i, xfer;
+	__u64 count;
+	int err;
+
+	while (true) {
+		want = min(want, max);
+		if (ctrl->lpa & 0x4) {
+			for (i = have; i < want; i += xfer) {
+				xfer = min(want - i, per_xfer);
+				err = nvme_get_log13(fd, NVME_NSID_ALL,
+					NVME_LOG_ERROR, NVME_NO_LOG_LSP,
+					i * sizeof(*log), 0, false,
+					xfer * sizeof(*log), &log[i]);
+				if (err)
+					return err;
+			}
+		} else {
+			err = nvme_error_log(fd, want, log);
+			if (err)
+				return err;
+		}
+
+		for (i = have; i < want; i++) {
+			count = le64_to_cpu(log[i].error_count);
+			if (!count || count <= seen || (i &&
+			    count >= le64_to_cpu(log[i - 1].error_count))) {
+				*nr = i;
+				return 0;
+			}
+		}
+		if (want == max)
+			break;
+		have = want;
+		want *= 4;
+	}
+	*nr = max;
+	return 0;
+}
+
+static int watch_error_log(int fd, struct nvme_id_ctrl *ctrl, __u32 entries,
+			   const char *state_file, __u32 interval)
+{
+	struct nvme_error_log_page *err_log;
+	struct log_state state;
+	char value[32];
+	__u64 seen;
+	__u32 nr;
+	int err;
+
+	err = log_state_open(&state, state_file, ctrl->sn, sizeof(ctrl->sn));
+	if (err)
+		return err;
+
+	err_log = calloc(entries, sizeof(*err_log));
+	if (!err_log) {
+		perror("could not alloc buffer for error log\n");
+		err = -ENOMEM;
+		goto close_sfd;
+	}
+
+	while (true) {
+		err = log_state_load(&state);
+		if (err) {
+			fprintf(stderr, "failed to read %s: %s\n", state_file,
+				strerror(-err));
+			log_state_release(&state);
+			break;
+		}
+		seen = state.line ? strtoull(state.line, NULL, 10) : 0;
+
+		err = error_log_read_new(fd, ctrl, err_log, entries, seen, &nr);
+		if (!err && !nr && le64_to_cpu(err_log[0].error_count) < seen) {
+			/* the count went backwards, start over */
+			seen = 0;
+			err = error_log_read_new(fd, ctrl, err_log, entries,
+						 seen, &nr);
+		}
+		if (!err && nr) {
+			nvme_show_error_log_lines(err_log, nr, devicename);
+			snprintf(value, sizeof(value), "%"PRIu64,
+				 (uint64_t)le64_to_cpu(err_log[0].error_count));
+			err = log_state_store(&state, value);
+			if (err)
+				fprintf(stderr, "failed to update %s: %s\n",
+					state_file, strerror(-err));
+		} else if (err > 0) {
+			nvme_show_status(err);
+		} else if (err < 0) {
+			perror("error log");
+		}
+		log_state_release(&state);
+
+		if (err || !interval)
+			break;
+		sleep(interval);
+	}
+
+	free(err_log);
+close_sfd:
+	close(state.fd);
+	return err;
+}
+
 static int get_error_log(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "Retrieve specified number of "\
@@ -589,6 +899,10 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 		"in either decoded format (default) or binary.";
 	const char *log_entries = "number of entries to retrieve";
 	const char *raw = "dump in binary format";
+	const char *state_file = "report only entries newer than the ones "\
+		"recorded in this file, as JSON lines, and update it";
+	const char *interval = "with --state-file, poll every <interval> "\
+		"seconds instead of once";
 	struct nvme_error_log_page *err_log;
 	struct nvme_id_ctrl ctrl;
 	enum nvme_print_flags flags;
@@ -598,17 +912,23 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 		__u32 log_entries;
 		int   raw_binary;
 		char *output_format;
+		char *state_file;
+		__u32 interval;
 	};
 
 	struct config cfg = {
 		.log_entries  = 64,
 		.output_format = "normal",
+		.state_file   = NULL,
+		.interval     = 0,
 	};
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("log-entries",  'e', &cfg.log_entries,   log_entries),
 		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
 		OPT_FLAG("raw-binary",   'b', &cfg.raw_binary,    raw),
+		OPT_FILE("state-file",   's', &cfg.state_file,    state_file),
+		OPT_UINT("interval",     'i', &cfg.interval,      interval),
 		OPT_END()
 	};
 
@@ -627,6 +947,16 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 		err = -EINVAL;
 		goto close_fd;
 	}
+	if (cfg.state_file && cfg.raw_binary) {
+		fprintf(stderr, "state-file and raw-binary are exclusive\n");
+		err = -EINVAL;
+		goto close_fd;
+	}
+	if (cfg.interval && !cfg.state_file) {
+		fprintf(stderr, "interval requires a state-file\n");
+		err = -EINVAL;
+		goto close_fd;
+	}
 
 	err = nvme_identify_ctrl(fd, &ctrl);
 	if (err < 0) {
@@ -639,6 +969,11 @@ static int get_error_log(int argc, char **argv, struct command *cmd, struct plug
 	}
 
 	cfg.log_entries = min(cfg.log_entries, ctrl.elpe + 1);
+	if (cfg.state_file) {
+		err = watch_error_log(fd, &ctrl, cfg.log_entries,
+				      cfg.state_file, cfg.interval);
+		goto close_fd;
+	}
 	err_log = calloc(cfg.log_entries, sizeof(struct nvme_error_log_page));
 	if (!err_log) {
 		perror("could not alloc buffer for error log\n");
@@ -902,6 +1237,256 @@ ret:
 	return nvme_status_to_errno(err, false);
 }
 
+/*
+ * The persistent event log is decoded while it is read, through a window
+ * of PEVENT_WINDOW bytes which is refilled with transfers of at most MDTS
+ * bytes. A window always holds at least one whole event.
+ */
+#define PEVENT_WINDOW	(128 * 1024)
+#define PEVENT_TS_MASK	0xffffffffffffULL
+
+struct pevent_reader {
+	int fd;
+	__u8 action;
+	__u64 tll;
+	__u32 xfer;
+	__u8 *buf;
+	__u64 start;	/* log offset of buf[0] */
+	__u32 len;	/* valid bytes in buf */
+};
+
+/*
+ * Return a pointer to bytes [off, off + need) of the log, or NULL with
+ * *err set if reading failed and *err zero if they are beyond the log.
+ */
+static void *pevent_read(struct pevent_reader *r, __u64 off, __u32 need,
+			 int *err)
+{
+	__u64 start = off & ~3ULL;
+	__u32 keep = 0, chunk, len;
+
+	*err = 0;
+	if (off + need > r->tll)
+		return NULL;
+	if (off >= r->start && off + need <= r->start + r->len)
+		return r->buf + (off - r->start);
+
+	/* log page offsets have to be dword aligned */
+	if (start >= r->start && start < r->start + r->len) {
+		keep = r->start + r->len - start;
+		memmove(r->buf, r->buf + (start - r->start), keep);
+	}
+	len = min((__u64)PEVENT_WINDOW, r->tll - start);
+	r->start = start;
+	r->len = keep;
+	while (r->len < len) {
+		chunk = min(len - r->len, r->xfer);
+		*err = nvme_get_log13(r->fd, NVME_NSID_ALL,
+				      NVME_LOG_PERSISTENT_EVENT, r->action,
+				      start + r->len, 0, false, chunk,
+				      r->buf + r->len);
+		if (*err) {
+			r->len = 0;
+			return NULL;
+		}
+		r->len += chunk;
+	}
+	return r->buf + (off - r->start);
+}
+
+static __u64 pevent_timestamp(struct nvme_persistent_event_entry_head *eh)
+{
+	return le64_to_cpu(eh->etimestamp) & PEVENT_TS_MASK;
+}
+
+/*
+ * A timestamp is either absolute, in milliseconds like the log reports
+ * them, or relative to the log header timestamp with one of the suffixes
+ * s, m, h or d.
+ */
+static int parse_pevent_time(const char *str, __u64 now, __u64 *ts)
+{
+	unsigned long long val;
+	char *end;
+
+	errno = 0;
+	val = strtoull(str, &end, 0);
+	if (errno || end == str)
+		return -EINVAL;
+
+	switch (*end) {
+	case '\0':
+		*ts = val;
+		return 0;
+	case 'd':
+		val *= 24;
+		/* fallthrough */
+	case 'h':
+		val *= 60;
+		/* fallthrough */
+	case 'm':
+		val *= 60;
+		/* fallthrough */
+	case 's':
+		if (end[1])
+			return -EINVAL;
+		val *= 1000;
+		*ts = val < now ? now - val : 0;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+struct pevent_filter {
+	bool types_set;
+	__u8 types[256 / 8];
+	__u64 since;
+	__u64 until;
+};
+
+static bool pevent_match(struct pevent_filter *f,
+			 struct nvme_persistent_event_entry_head *eh)
+{
+	__u64 ts = pevent_timestamp(eh);
+
+	if (f->types_set && !(f->types[eh->etype / 8] & (1 << (eh->etype % 8))))
+		return false;
+	return ts >= f->since && ts <= f->until;
+}
+
+static int stream_persistent_event_log(int fd, __u8 action,
+	struct nvme_persistent_event_log_head *head,
+	struct pevent_filter *filter, __u32 last, const char *state_file,
+	enum nvme_print_flags flags)
+{
+	struct nvme_persistent_event_entry_head *eh;
+	struct pevent_reader r = {
+		.fd	= fd,
+		.action	= action,
+		.tll	= le64_to_cpu(head->tll),
+	};
+	struct log_state state = { .fd = -1 };
+	struct json_object *root, *entries;
+	struct nvme_id_ctrl ctrl;
+	__u64 off = sizeof(*head), last_off = 0, resume_ts = 0;
+	__u32 tnev = le32_to_cpu(head->tnev), total, n, matched = 0;
+	bool resumed = false, advanced = false;
+	void **ring = NULL;
+	char value[64];
+	int err;
+
+	err = nvme_identify_ctrl(fd, &ctrl);
+	if (err > 0) {
+		nvme_show_status(err);
+		return err;
+	} else if (err < 0) {
+		perror("identify controller");
+		return err;
+	}
+	/* MDTS is in units of the minimum page size, which is at least 4k */
+	r.xfer = ctrl.mdts && ctrl.mdts < 6 ? 4096 << ctrl.mdts : PEVENT_WINDOW;
+
+	r.buf = malloc(PEVENT_WINDOW);
+	if (last)
+		ring = calloc(last, sizeof(*ring));
+	if (!r.buf || (last && !ring)) {
+		perror("could not alloc buffer for persistent event log\n");
+		err = -ENOMEM;
+		goto free;
+	}
+
+	if (state_file) {
+		err = log_state_open(&state, state_file, (char *)head->sn,
+				     sizeof(head->sn));
+		if (!err)
+			err = log_state_load(&state);
+		if (err)
+			goto free;
+		if (state.line &&
+		    sscanf(state.line, "%llu,%llu", (unsigned long long *)&last_off,
+			   (unsigned long long *)&resume_ts) == 2) {
+			/*
+			 * Continue after the last event seen if it is still
+			 * there. Otherwise the log was rewritten and only the
+			 * timestamp is left to skip what was already shown.
+			 */
+			eh = pevent_read(&r, last_off, sizeof(*eh), &err);
+			if (eh && pevent_timestamp(eh) == resume_ts) {
+				off = last_off + eh->ehl + 3 + le16_to_cpu(eh->el);
+				resumed = true;
+			} else if (err) {
+				goto show_err;
+			} else {
+				filter->since = max(filter->since, resume_ts + 1);
+			}
+		}
+	}
+
+	root = nvme_show_persistent_event_log_head(head, action, devicename,
+						   flags, &entries);
+	for (n = 0; resumed || n < tnev; n++) {
+		eh = pevent_read(&r, off, sizeof(*eh), &err);
+		if (!eh)
+			break;
+		total = eh->ehl + 3 + le16_to_cpu(eh->el);
+		eh = pevent_read(&r, off, total, &err);
+		if (!eh)
+			break;
+
+		last_off = off;
+		resume_ts = pevent_timestamp(eh);
+		advanced = true;
+		off += total;
+		if (!pevent_match(filter, eh))
+			continue;
+
+		if (!last) {
+			nvme_show_persistent_event_entry(entries, eh,
+				(void *)eh + eh->ehl + 3, devicename, flags);
+			continue;
+		}
+		/* keep copies of the last matches only */
+		free(ring[matched % last]);
+		ring[matched % last] = malloc(total);
+		if (!ring[matched % last]) {
+			err = -ENOMEM;
+			break;
+		}
+		memcpy(ring[matched % last], eh, total);
+		matched++;
+	}
+	for (n = matched > last ? matched - last : 0; n < matched; n++) {
+		eh = ring[n % last];
+		nvme_show_persistent_event_entry(entries, eh,
+			(void *)eh + eh->ehl + 3, devicename, flags);
+	}
+	nvme_show_persistent_event_log_end(root);
+
+	if (!err && state_file && advanced) {
+		snprintf(value, sizeof(value), "%"PRIu64",%"PRIu64,
+			 (uint64_t)last_off, (uint64_t)resume_ts);
+		err = log_state_store(&state, value);
+		if (err)
+			fprintf(stderr, "failed to update %s: %s\n",
+				state_file, strerror(-err));
+	}
+show_err:
+	if (err > 0)
+		nvme_show_status(err);
+	else if (err < 0)
+		fprintf(stderr, "persistent event log: %s\n", strerror(-err));
+free:
+	if (state.fd >= 0) {
+		log_state_release(&state);
+		close(state.fd);
+	}
+	for (n = 0; ring && n < last; n++)
+		free(ring[n]);
+	free(ring);
+	free(r.buf);
+	return err;
+}
+
 static int get_persistent_event_log(int argc, char **argv,
 		struct command *cmd, struct plugin *plugin)
 {
@@ -912,9 +1497,19 @@ static int get_persistent_event_log(int argc, char **argv,
 			"processing this persistent log page command.";
 	const char *log_len = "number of bytes to retrieve";
 	const char *raw = "use binary output";
+	const char *event_type = "comma separated list of event types to show";
+	const char *since = "only show events at or after this timestamp "\
+		"(ms, or relative to the log timestamp with a s/m/h/d suffix)";
+	const char *until = "only show events at or before this timestamp";
+	const char *last = "only show the last <n> matching events";
+	const char *state_file = "only show events newer than the ones "\
+		"recorded in this file and update it";
 	void *pevent_log_info;
-	struct nvme_persistent_event_log_head *pevent_log_head;
+	struct nvme_persistent_event_log_head *pevent_log_head = NULL;
+	struct pevent_filter filter = { .until = PEVENT_TS_MASK };
 	enum nvme_print_flags flags;
+	int types[256], nr_types = 0, i;
+	bool stream;
 	int err, fd;
 	bool huge;
 
@@ -923,12 +1518,22 @@ static int get_persistent_event_log(int argc, char **argv,
 		__u32 log_len;
 		int raw_binary;
 		char *output_format;
+		char *event_type;
+		char *since;
+		char *until;
+		__u32 last;
+		char *state_file;
 	};
 
 	struct config cfg = {
 		.action = 0xff,
 		.log_len = 0,
 		.output_format = "normal",
+		.event_type = "",
+		.since = NULL,
+		.until = NULL,
+		.last = 0,
+		.state_file = NULL,
 	};
 
 	OPT_ARGS(opts) = {
@@ -936,6 +1541,11 @@ static int get_persistent_event_log(int argc, char **argv,
 		OPT_UINT("log_len", 	 'l', &cfg.log_len,  	  log_len),
 		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
 		OPT_FLAG("raw-binary",   'b', &cfg.raw_binary,    raw),
+		OPT_LIST("event-type",   't', &cfg.event_type,    event_type),
+		OPT_STRING("since",      'S', "TIME", &cfg.since, since),
+		OPT_STRING("until",      'U', "TIME", &cfg.until, until),
+		OPT_UINT("last",         'n', &cfg.last,          last),
+		OPT_FILE("state-file",   's', &cfg.state_file,    state_file),
 		OPT_END()
 	};
 
@@ -949,6 +1559,39 @@ static int get_persistent_event_log(int argc, char **argv,
 	if (cfg.raw_binary)
 		flags = BINARY;
 
+	if (strlen(cfg.event_type)) {
+		nr_types = argconfig_parse_comma_sep_array(cfg.event_type,
+					types, ARRAY_SIZE(types));
+		if (nr_types <= 0) {
+			fprintf(stderr, "invalid event type list\n");
+			err = -EINVAL;
+			goto close_fd;
+		}
+		for (i = 0; i < nr_types; i++) {
+			if (types[i] < 0 || types[i] > 0xff) {
+				fprintf(stderr, "invalid event type %d\n",
+					types[i]);
+				err = -EINVAL;
+				goto close_fd;
+			}
+			filter.types[types[i] / 8] |= 1 << (types[i] % 8);
+		}
+		filter.types_set = true;
+	}
+
+	/*
+	 * Decoded output is produced while the log is read, unless a given
+	 * number of bytes was asked for.
+	 */
+	stream = !(flags & BINARY) && !cfg.log_len;
+	if (!stream && (nr_types || cfg.since || cfg.until || cfg.last ||
+			cfg.state_file)) {
+		fprintf(stderr, "event filters need decoded output of the "\
+			"whole log\n");
+		err = -EINVAL;
+		goto close_fd;
+	}
+
 	pevent_log_head = calloc(sizeof(*pevent_log_head), 1);
 	if (!pevent_log_head) {
 		perror("could not alloc buffer for persistent " \
@@ -989,6 +1632,24 @@ static int get_persistent_event_log(int argc, char **argv,
 	if (cfg.action == NVME_PEVENT_LOG_EST_CTX_AND_READ)
 		cfg.action = NVME_PEVENT_LOG_READ;
 
+	if (stream) {
+		__u64 now = le64_to_cpu(pevent_log_head->timestamp) &
+			PEVENT_TS_MASK;
+
+		if ((cfg.since &&
+		     parse_pevent_time(cfg.since, now, &filter.since)) ||
+		    (cfg.until &&
+		     parse_pevent_time(cfg.until, now, &filter.until))) {
+			fprintf(stderr, "invalid timestamp\n");
+			err = -EINVAL;
+			goto close_fd;
+		}
+		err = stream_persistent_event_log(fd, cfg.action,
+				pevent_log_head, &filter, cfg.last,
+				cfg.state_file, flags);
+		goto close_fd;
+	}
+
 	pevent_log_info = nvme_alloc(cfg.log_len, &huge);
 	if (!pevent_log_info) {
 		perror("could not alloc buffer for persistent event log page\n");
@@ -1796,7 +2457,8 @@ static int list_subsys(int argc, char **argv, struct command *cmd,
 			err = -EINVAL;
 			goto ret;
 		}
-		sprintf(path, "/sys/block/%s/device", devicename);
+		snprintf(path, sizeof(path), "%s/sys/block/%s/device",
+			 nvme_backend->sysfs_root, devicename);
 		subsysnqn = get_nvme_subsnqn(path);
 		if (!subsysnqn) {
 			fprintf(stderr, "Cannot read subsys NQN from %s\n",
@@ -1817,7 +2479,8 @@ static int list_subsys(int argc, char **argv, struct command *cmd,
 	if (cfg.verbose)
 		flags |= VERBOSE;
 
-	err = scan_subsystems(&t, subsysnqn, ns_instance, nsid, NULL);
+	err = scan_subsystems(&t, subsysnqn, ns_instance, nsid, NULL,
+			      NVME_SCAN_CTRL_ATTRS);
 	if (err) {
 		fprintf(stderr, "Failed to scan namespaces\n");
 		goto free;
@@ -1873,7 +2536,8 @@ static int list(int argc, char **argv, struct command *cmd, struct plugin *plugi
 	if (cfg.verbose)
 		flags |= VERBOSE;
 
-	err = scan_subsystems(&t, NULL, 0, 0, cfg.device_dir);
+	err = scan_subsystems(&t, NULL, 0, 0, cfg.device_dir,
+			      NVME_SCAN_ALL);
 	if (err) {
 		fprintf(stderr, "Failed to scan namespaces\n");
 		return err;
@@ -2552,21 +3216,26 @@ static int device_self_test(int argc, char **argv, struct command *cmd, struct p
 		"2h Start a extended device self-test operation\n"\
 		"eh Start a vendor specific device self-test operation\n"\
 		"fh abort the device self-test operation\n";
+	const char *wait = "Wait for the device self-test to complete";
+	struct nvme_progress p;
 	int fd, err;
 
 	struct config {
 		__u32 namespace_id;
 		__u8 stc;
+		int wait;
 	};
 
 	struct config cfg = {
 		.namespace_id  = NVME_NSID_ALL,
 		.stc = 0,
+		.wait = 0,
 	};
 
 	OPT_ARGS(opts) = {
 		OPT_UINT("namespace-id",   'n', &cfg.namespace_id, namespace_id),
 		OPT_UINT("self-test-code", 's', &cfg.stc,          self_test_code),
+		OPT_FLAG("wait",           'w', &cfg.wait,         wait),
 		OPT_END()
 	};
 
@@ -2574,6 +3243,12 @@ static int device_self_test(int argc, char **argv, struct command *cmd, struct p
 	if (fd < 0)
 		goto ret;
 
+	if (cfg.wait && cfg.stc != 0xf) {
+		nvme_progress_init(&p, devicename, fd, "device-self-test",
+				   nvme_progress_self_test);
+		nvme_progress_prepare(&p);
+	}
+
 	err = nvme_self_test_start(fd, cfg.namespace_id, cfg.stc);
 	if (!err) {
 		if (cfg.stc == 0xf)
@@ -2587,6 +3262,9 @@ static int device_self_test(int argc, char **argv, struct command *cmd, struct p
 	} else
 		perror("Device self-test");
 
+	if (!err && cfg.wait && cfg.stc != 0xf)
+		err = nvme_progress_wait(&p, 1, stdout);
+
 	close(fd);
 ret:
 	return nvme_status_to_errno(err, false);
@@ -2774,24 +3452,180 @@ ret:
 	return nvme_status_to_errno(err, false);
 }
 
+/* upper bound for transfers when MDTS does not limit them */
+#define FW_XFER_MAX	(128 * 1024)
+
+struct fw_download_job {
+	const char *dev;
+	int fd;
+	void *image;
+	__u32 size;
+	__u32 offset;
+	__u32 xfer;
+	__u32 sent;	/* updated by the worker as chunks complete */
+	int err;
+	struct timespec start, end;
+};
+
+/*
+ * Use the largest transfer MDTS allows that is a multiple of the
+ * firmware update granularity, which is reported in 4KiB units.
+ */
+static __u32 fw_download_xfer(int fd, const char *dev)
+{
+	struct nvme_id_ctrl ctrl;
+	__u32 xfer, gran;
+
+	if (nvme_identify_ctrl(fd, &ctrl))
+		return 4096;
+
+	xfer = ctrl.mdts && ctrl.mdts < 6 ? 4096 << ctrl.mdts : FW_XFER_MAX;
+	if (!ctrl.fwug || ctrl.fwug == 0xff)
+		return xfer;
+
+	gran = ctrl.fwug * 4096;
+	if (gran > xfer) {
+		fprintf(stderr, "%s: update granularity %u exceeds the "\
+			"transfer limit %u\n", dev, gran, xfer);
+		return xfer;
+	}
+	return xfer - xfer % gran;
+}
+
+static void *fw_download_worker(void *arg)
+{
+	struct fw_download_job *job = arg;
+	__u32 xfer, sent = 0;
+	int err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	while (sent < job->size) {
+		xfer = min(job->xfer, job->size - sent);
+		err = nvme_fw_download(job->fd, job->offset + sent, xfer,
+				       job->image + sent);
+		if (err < 0)
+			err = -errno;
+		if (err)
+			break;
+		sent += xfer;
+		__atomic_store_n(&job->sent, sent, __ATOMIC_RELAXED);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &job->end);
+	job->err = err;
+	return NULL;
+}
+
+static void fw_download_progress(struct fw_download_job *jobs, int nr_jobs)
+{
+	int i;
+
+	fprintf(stderr, "\r");
+	for (i = 0; i < nr_jobs; i++)
+		fprintf(stderr, "%s %3u%% ", jobs[i].dev, (unsigned int)
+			((__u64)__atomic_load_n(&jobs[i].sent, __ATOMIC_RELAXED) *
+			 100 / jobs[i].size));
+}
+
+static void fw_download_report(struct fw_download_job *job)
+{
+	double secs;
+
+	if (job->err < 0) {
+		fprintf(stderr, "%s: fw-download: %s\n", job->dev,
+			strerror(-job->err));
+		return;
+	}
+	if (job->err) {
+		fprintf(stderr, "%s: NVMe status: %s(%#x)\n", job->dev,
+			nvme_status_to_string(job->err), job->err);
+		return;
+	}
+
+	secs = (job->end.tv_sec - job->start.tv_sec) +
+		(job->end.tv_nsec - job->start.tv_nsec) / 1e9;
+	printf("%s: Firmware download success, %u bytes in %u byte "\
+		"transfers, %.3f s (%.1f MiB/s)\n", job->dev, job->size,
+		job->xfer, secs, secs > 0 ? job->size / secs / (1 << 20) : 0);
+}
+
+/*
+ * Push the image to all devices at once, one thread each. Progress is
+ * shown on a terminal while the transfers run.
+ */
+static int fw_download_all(struct fw_download_job *jobs, int nr_jobs)
+{
+	struct timespec tick = { .tv_nsec = 200 * 1000 * 1000 };
+	bool progress = nr_jobs > 1 && isatty(STDERR_FILENO);
+	pthread_t *threads;
+	int i, err = 0, running, ticks = 0;
+
+	threads = calloc(nr_jobs, sizeof(*threads));
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_jobs; i++) {
+		err = pthread_create(&threads[i], NULL, fw_download_worker,
+				     &jobs[i]);
+		if (err) {
+			fprintf(stderr, "failed to start download for %s: %s\n",
+				jobs[i].dev, strerror(err));
+			err = -err;
+			break;
+		}
+	}
+	running = i;
+
+	while (progress) {
+		for (i = 0; i < running; i++)
+			if (__atomic_load_n(&jobs[i].sent, __ATOMIC_RELAXED) <
+			    jobs[i].size && !jobs[i].err)
+				break;
+		if (i == running)
+			break;
+		if (!(ticks++ % 5))
+			fw_download_progress(jobs, running);
+		nanosleep(&tick, NULL);
+	}
+
+	for (i = 0; i < running; i++)
+		pthread_join(threads[i], NULL);
+	if (progress) {
+		fw_download_progress(jobs, running);
+		fprintf(stderr, "\n");
+	}
+	free(threads);
+
+	for (i = 0; i < running; i++) {
+		if (jobs[i].err && !err)
+			err = jobs[i].err;
+		if (nr_jobs > 1)
+			fw_download_report(&jobs[i]);
+	}
+	return err;
+}
+
 static int fw_download(int argc, char **argv, struct command *cmd, struct plugin *plugin)
 {
 	const char *desc = "Copy all or part of a firmware image to "\
-		"a controller for future update. Optionally, specify how "\
-		"many KiB of the firmware to transfer at once. The offset will "\
+		"one or more controllers for future update. Optionally, "\
+		"specify how many bytes of the firmware to transfer at once, "\
+		"by default this is derived from the controller's maximum "\
+		"transfer size and firmware update granularity. The offset will "\
 		"start at 0 and automatically adjust based on xfer size "\
-		"unless fw is split across multiple files. May be submitted "\
+		"unless fw is split across multiple files. When several "\
+		"devices are given the image is sent to all of them "\
+		"concurrently. May be submitted "\
 		"while outstanding commands exist on the Admin and IO "\
 		"Submission Queues. Activate downloaded firmware with "\
 		"fw-activate, and then reset the device to apply the downloaded firmware.";
 	const char *fw = "firmware file (required)";
 	const char *xfer = "transfer chunksize limit";
 	const char *offset = "starting dword offset, default 0";
-	int err, fd, fw_fd = -1;
+	struct fw_download_job *jobs = NULL;
+	int err, fd, fw_fd = -1, i, nr_jobs = 0;
 	unsigned int fw_size;
 	struct stat sb;
-	void *fw_buf, *buf;
-	bool huge;
+	void *fw_buf;
 
 	struct config {
 		char  *fw;
@@ -2801,7 +3635,7 @@ static int fw_download(int argc, char **argv, struct command *cmd, struct plugin
 
 	struct config cfg = {
 		.fw     = "",
-		.xfer   = 4096,
+		.xfer   = 0,
 		.offset = 0,
 	};
 
@@ -2816,6 +3650,22 @@ static int fw_download(int argc, char **argv, struct command *cmd, struct plugin
 	if (fd < 0)
 		goto ret;
 
+	jobs = calloc(argc - optind, sizeof(*jobs));
+	if (!jobs) {
+		err = -ENOMEM;
+		goto close_fd;
+	}
+	jobs[nr_jobs].dev = devicename;
+	jobs[nr_jobs++].fd = fd;
+	for (i = optind + 1; i < argc; i++) {
+		jobs[nr_jobs].fd = open_dev(argv[i]);
+		if (jobs[nr_jobs].fd < 0) {
+			err = jobs[nr_jobs].fd;
+			goto close_fd;
+		}
+		jobs[nr_jobs++].dev = devicename;
+	}
+
 	fw_fd = open(cfg.fw, O_RDONLY);
 	cfg.offset <<= 2;
 	if (fw_fd < 0) {
@@ -2838,50 +3688,46 @@ static int fw_download(int argc, char **argv, struct command *cmd, struct plugin
 		goto close_fw_fd;
 	}
 
-	if (cfg.xfer == 0 || cfg.xfer % 4096)
+	if (cfg.xfer % 4096)
 		cfg.xfer = 4096;
 
-	if (cfg.xfer < HUGE_MIN)
-		fw_buf = __nvme_alloc(fw_size, &huge);
-	else
-		fw_buf = nvme_alloc(fw_size, &huge);
-
-	if (!fw_buf) {
-		perror("No memory for f/w size:\n");
-		err = -ENOMEM;
+	/* the image is shared read-only by all transfers */
+	fw_buf = mmap(NULL, fw_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+		      fw_fd, 0);
+	if (fw_buf == MAP_FAILED) {
+		err = -errno;
+		fprintf(stderr, "mmap :%s :%s\n", cfg.fw, strerror(errno));
 		goto close_fw_fd;
 	}
+	madvise(fw_buf, fw_size, MADV_SEQUENTIAL);
 
-	buf = fw_buf;
-	if (read(fw_fd, fw_buf, fw_size) != ((ssize_t)(fw_size))) {
-		err = -errno;
-		fprintf(stderr, "read :%s :%s\n", cfg.fw, strerror(errno));
-		goto free;
+	for (i = 0; i < nr_jobs; i++) {
+		jobs[i].image = fw_buf;
+		jobs[i].size = fw_size;
+		jobs[i].offset = cfg.offset;
+		jobs[i].xfer = cfg.xfer ? :
+			fw_download_xfer(jobs[i].fd, jobs[i].dev);
 	}
 
-	while (fw_size > 0) {
-		cfg.xfer = min(cfg.xfer, fw_size);
-
-		err = nvme_fw_download(fd, cfg.offset, cfg.xfer, fw_buf);
+	err = fw_download_all(jobs, nr_jobs);
+	if (nr_jobs == 1) {
 		if (err < 0) {
+			errno = -err;
 			perror("fw-download");
-			break;
-		} else if (err != 0) {
+		} else if (err) {
 			nvme_show_status(err);
-			break;
+		} else {
+			printf("Firmware download success\n");
 		}
-		fw_buf     += cfg.xfer;
-		fw_size    -= cfg.xfer;
-		cfg.offset += cfg.xfer;
 	}
-	if (!err)
-		printf("Firmware download success\n");
 
-free:
-	nvme_free(buf, huge);
+	munmap(fw_buf, fw_size);
 close_fw_fd:
 	close(fw_fd);
 close_fd:
+	for (i = 1; i < nr_jobs; i++)
+		close(jobs[i].fd);
+	free(jobs);
 	close(fd);
 ret:
 	return nvme_status_to_errno(err, false);
@@ -3060,7 +3906,9 @@ static int sanitize(int argc, char **argv, struct command *cmd, struct plugin *p
 	const char *ause_desc = "Allow unrestricted sanitize exit.";
 	const char *sanact_desc = "Sanitize action.";
 	const char *ovrpat_desc = "Overwrite pattern.";
+	const char *wait_desc = "Wait for the sanitize operation to complete.";
 
+	struct nvme_progress p;
 	int fd, ret;
 
 	struct config {
@@ -3070,6 +3918,7 @@ static int sanitize(int argc, char **argv, struct command *cmd, struct plugin *p
 		int    ause;
 		__u8   sanact;
 		__u32  ovrpat;
+		int    wait;
 	};
 
 	struct config cfg = {
@@ -3079,6 +3928,7 @@ static int sanitize(int argc, char **argv, struct command *cmd, struct plugin *p
 		.ause = 0,
 		.sanact = 0,
 		.ovrpat = 0,
+		.wait = 0,
 	};
 
 	OPT_ARGS(opts) = {
@@ -3088,6 +3938,7 @@ static int sanitize(int argc, char **argv, struct command *cmd, struct plugin *p
 		OPT_FLAG("ause",       'u', &cfg.ause,       ause_desc),
 		OPT_BYTE("sanact",     'a', &cfg.sanact,     sanact_desc),
 		OPT_UINT("ovrpat",     'p', &cfg.ovrpat,     ovrpat_desc),
+		OPT_FLAG("wait",       'w', &cfg.wait,       wait_desc),
 		OPT_END()
 	};
 
@@ -3129,12 +3980,21 @@ static int sanitize(int argc, char **argv, struct command *cmd, struct plugin *p
 		}
 	}
 
+	if (cfg.wait && cfg.sanact != NVME_SANITIZE_ACT_EXIT) {
+		nvme_progress_init(&p, devicename, fd, "sanitize",
+				   nvme_progress_sanitize);
+		p.arg = cfg.sanact;
+		nvme_progress_prepare(&p);
+	}
+
 	ret = nvme_sanitize(fd, cfg.sanact, cfg.ause, cfg.owpass, cfg.oipbp,
 			    cfg.no_dealloc, cfg.ovrpat);
 	if (ret < 0)
 		perror("sanitize");
 	else if (ret > 0)
 		nvme_show_status(ret);
+	else if (cfg.wait && cfg.sanact != NVME_SANITIZE_ACT_EXIT)
+		ret = nvme_progress_wait(&p, 1, stdout);
 
 close_fd:
 	close(fd);
@@ -3324,6 +4184,8 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 	const char *timeout = "timeout value, in milliseconds";
 	const char *bs = "target block size";
 	const char *force = "The \"I know what I'm doing\" flag, skip confirmation before sending command";
+	const char *wait = "Wait until the format operation is complete";
+	struct nvme_progress p;
 	struct nvme_id_ns ns;
 	struct nvme_id_ctrl ctrl;
 	int err, fd, i;
@@ -3341,6 +4203,7 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 		__u64 bs;
 		int reset;
 		int force;
+		int wait;
 	};
 
 	struct config cfg = {
@@ -3352,6 +4215,7 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 		.reset        = 0,
 		.force        = 0,
 		.bs           = 0,
+		.wait         = 0,
 	};
 
 	OPT_ARGS(opts) = {
@@ -3365,6 +4229,7 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 		OPT_FLAG("reset",        'r', &cfg.reset,        reset),
 		OPT_FLAG("force",        'f', &cfg.force,        force),
 		OPT_SUFFIX("block-size", 'b', &cfg.bs,           bs),
+		OPT_FLAG("wait",         'w', &cfg.wait,         wait),
 		OPT_END()
 	};
 
@@ -3501,6 +4366,17 @@ static int format(int argc, char **argv, struct command *cmd, struct plugin *plu
 		nvme_show_status(err);
 	else {
 		printf("Success formatting namespace:%x\n", cfg.namespace_id);
+		if (cfg.wait) {
+			nvme_progress_init(&p, devicename, fd, "format",
+					   nvme_progress_format);
+			if (cfg.namespace_id != NVME_NSID_ALL)
+				p.nsid = cfg.namespace_id;
+			else
+				p.nsid = 1;
+			err = nvme_progress_wait(&p, 1, stdout);
+			if (err)
+				goto close_fd;
+		}
 		if (cfg.lbaf != prev_lbaf){
 			if (is_chardev()) {
 				if(ioctl(fd, NVME_IOCTL_RESCAN) < 0){
@@ -4840,7 +5716,7 @@ static int submit_io(int opcode, char *command, const char *desc,
 		goto close_mfd;
 	}
 
-	if (ioctl(fd, BLKSSZGET, &logical_block_size) < 0)
+	if (nvme_backend->ioctl(fd, BLKSSZGET, &logical_block_size) < 0)
 		goto close_mfd;
 
 	buffer_size = (cfg.block_count + 1) * logical_block_size;
@@ -5678,6 +6554,51 @@ static int disconnect_all_cmd(int argc, char **argv, struct command *command, st
 	return fabrics_disconnect_all(desc, argc, argv);
 }
 
+static int monitor_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Keep persistent discovery controllers open and "\
+		"connect or disconnect subsystems as their discovery logs change";
+	return aen_monitor(desc, argc, argv);
+}
+
+static int batch_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Run the sub-commands listed in a file, or read "\
+		"from stdin, in a single process and report the result of "\
+		"each as a JSON record";
+	return nvme_batch(desc, argc, argv, plugin);
+}
+
+static int serve_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Run sub-commands requested by clients of a "\
+		"Unix socket and return their results as JSON";
+	return nvme_serve(desc, argc, argv, plugin);
+}
+
+static int replay_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Issue the passthrough commands recorded with "\
+		"NVME_RECORD=<file> again and compare their latencies with "\
+		"the recording";
+	return nvme_replay(desc, argc, argv);
+}
+
+static int feature_snapshot_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Read the current, default and saved value of "\
+		"every feature the controller supports and write them to a "\
+		"snapshot file";
+	return nvme_feature_snapshot(desc, argc, argv);
+}
+
+static int feature_diff_cmd(int argc, char **argv, struct command *command, struct plugin *plugin)
+{
+	const char *desc = "Compare the features of a device, or of a "\
+		"snapshot, with a snapshot or profile";
+	return nvme_feature_diff(desc, argc, argv);
+}
+
 void register_extension(struct plugin *plugin)
 {
 	plugin->parent = &nvme;
@@ -5695,6 +6616,12 @@ int main(int argc, char **argv)
 		return 0;
 	}
 	setlocale(LC_ALL, "");
+	nvme_mock_init();
+	nvme_trace_init();
+
+	if (!strcmp(argv[1], "--all") || !strcmp(argv[1], "--all-namespaces") ||
+	    !strncmp(argv[1], "--devices", 9) || !strncmp(argv[1], "--jobs", 6))
+		return nvme_fanout(argc, argv, nvme.extensions);
 
 	err = handle_plugin(argc - 1, &argv[1], nvme.extensions);
 	if (err == -ENOTTY)
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <endian.h>
 #include <sys/time.h>
+#include <sys/types.h>
 
 #include "plugin.h"
 #ifdef LIBJSONC
@@ -102,9 +103,21 @@ struct nvme_subsystem {
 	struct nvme_namespace *namespaces;
 };
 
+/*
+ * Attribute values read during a topology scan live in one arena that is
+ * released with the topology, see sysfs_arena_read().
+ */
+struct sysfs_arena_chunk;
+
+struct sysfs_arena {
+	struct sysfs_arena_chunk *chunks;
+};
+
 struct nvme_topology {
 	int    nr_subsystems;
 	struct nvme_subsystem *subsystems;
+	struct sysfs_arena arena;
+	bool   shared;		/* memory belongs to the topology cache */
 };
 
 #define SYS_NVME "/sys/class/nvme"
@@ -112,14 +125,19 @@ struct nvme_topology {
 void register_extension(struct plugin *plugin);
 int parse_and_open(int argc, char **argv, const char *desc,
 	const struct argconfig_commandline_options *clo);
+int get_dev(int argc, char **argv);
+void nvme_dev_cache_enable(bool enable);
+int nvme_dev_cache_open(char *dev);
 
 extern const char *devicename;
 extern const char *output_format;
+extern __u16 nvme_feat_buf_len[0x100];
 
 enum nvme_print_flags validate_output_format(const char *format);
 int __id_ctrl(int argc, char **argv, struct command *cmd,
 	struct plugin *plugin, void (*vs)(__u8 *vs, struct json_object *root));
 char *nvme_char_from_block(char *block);
+bool nvme_dev_name_parse(const char *path, int *instance, int *nsid);
 void *mmap_registers(const char *dev);
 
 extern int current_index;
@@ -130,11 +148,34 @@ int scan_ctrls_filter(const struct dirent *d);
 int scan_subsys_filter(const struct dirent *d);
 int scan_dev_filter(const struct dirent *d);
 
+/*
+ * What scan_subsystems() fills in besides the subsystem, controller and
+ * namespace names and the subsystem NQN.
+ */
+enum nvme_scan_flags {
+	NVME_SCAN_NAMES		= 0,
+	NVME_SCAN_CTRL_ATTRS	= 1 << 0,	/* address, transport, state */
+	NVME_SCAN_HOST_ATTRS	= 1 << 1,	/* hostnqn, hostid */
+	NVME_SCAN_ID_CTRL	= 1 << 2,	/* identify controller */
+	NVME_SCAN_ID_NS		= 1 << 3,	/* identify namespace */
+	NVME_SCAN_ALL		= NVME_SCAN_CTRL_ATTRS | NVME_SCAN_HOST_ATTRS |
+				  NVME_SCAN_ID_CTRL | NVME_SCAN_ID_NS,
+};
+
 int scan_subsystems(struct nvme_topology *t, const char *subsysnqn,
-		    __u32 ns_instance, int nsid, char *dev_dir);
+		    __u32 ns_instance, int nsid, char *dev_dir,
+		    enum nvme_scan_flags scan);
 void free_topology(struct nvme_topology *t);
+void nvme_topology_cache_enable(bool enable);
+void nvme_topology_cache_invalidate(void);
+int nvme_topology_cache_refresh(void);
 char *get_nvme_subsnqn(char *path);
 char *nvme_get_ctrl_attr(const char *path, const char *attr);
+ssize_t sysfs_read_attr(int dirfd, const char *attr, char *buf, size_t size);
+char *sysfs_arena_read(struct sysfs_arena *a, int dirfd, const char *attr,
+		       size_t *len);
+char *sysfs_arena_strdup(struct sysfs_arena *a, const char *str);
+void sysfs_arena_free(struct sysfs_arena *a);
 
 void *nvme_alloc(size_t len, bool *huge);
 void nvme_free(void *p, bool huge);
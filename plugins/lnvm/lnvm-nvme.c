@@ -434,3 +434,56 @@ static int lnvm_set_bbtbl(int argc, char **argv, struct command *cmd, struct plu
 	return lnvm_do_set_bbtbl(fd, cfg.namespace_id, cfg.chid, cfg.lunid,
 				 cfg.plnid, cfg.blkid, cfg.value);
 }
+
+static int lnvm_sweep(int argc, char **argv, struct command *cmd, struct plugin *plugin)
+{
+	const char *desc = "Read the chunk information log (2.0) or the bad "\
+		"block table of every channel and LUN (1.2) of a LightNVM "\
+		"device concurrently, and summarize them per parallel unit.";
+	const char *namespace_id = "identifier of desired namespace. default: 1";
+	const char *jobs = "number of concurrent requests. default: 8";
+	const char *output_format = "Output format: normal|json";
+	unsigned int flags = 0;
+	int err, fmt, fd;
+
+	struct config {
+		__u32 namespace_id;
+		int   jobs;
+		char *output_format;
+	};
+
+	struct config cfg = {
+		.namespace_id  = 1,
+		.jobs          = 8,
+		.output_format = "normal",
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_UINT("namespace-id",  'n', &cfg.namespace_id,  namespace_id),
+		OPT_INT("jobs",           'j', &cfg.jobs,          jobs),
+		OPT_FMT("output-format",  'o', &cfg.output_format, output_format),
+		OPT_END()
+	};
+
+	fd = parse_and_open(argc, argv, desc, opts);
+	if (fd < 0)
+		return fd;
+
+	fmt = validate_output_format(cfg.output_format);
+	if (fmt < 0) {
+		err = fmt;
+		goto close;
+	}
+	if (fmt == BINARY) {
+		fprintf(stderr, "binary output not supported\n");
+		err = -EINVAL;
+		goto close;
+	}
+	if (fmt == JSON)
+		flags |= JSON;
+
+	err = lnvm_do_sweep(fd, cfg.namespace_id, cfg.jobs, flags);
+close:
+	close(fd);
+	return err;
+}
@@ -19,6 +19,7 @@ PLUGIN(NAME("lnvm", "LightNVM specific extensions"),
 		ENTRY("factory", "Reset device to factory state", lnvm_factory_init)
 		ENTRY("diag-bbtbl", "Diagnose bad block table", lnvm_get_bbtbl)
 		ENTRY("diag-set-bbtbl", "Update bad block table", lnvm_set_bbtbl)
+		ENTRY("sweep", "Summarize chunks and bad blocks of every parallel unit", lnvm_sweep)
 	)
 );
 
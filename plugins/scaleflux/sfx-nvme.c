@@ -3,9 +3,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
 #include <linux/fs.h>
 #include <inttypes.h>
 #include <asm/byteorder.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/sysinfo.h>
 #include <sys/stat.h>
@@ -544,6 +547,402 @@ static void bd_table_show(unsigned char *bd_table, __u64 table_size)
 	printf(" ]\n");
 }
 
+/*
+ * Bad block history file: a header followed by one record per snapshot.
+ * The first record holds the whole sorted remap tables as added entries,
+ * every later one only the entries added to and removed from the
+ * previous snapshot, so unchanged tables cost one record header.
+ */
+#define SFX_BB_HIST_MAGIC	"SFXBBHS1"
+
+enum {
+	SFX_BB_MF,		/* remapped manufacturer bad blocks */
+	SFX_BB_GROWN,		/* remapped grown bad blocks */
+	SFX_BB_TABLES,
+};
+
+static const char *sfx_bb_table_names[SFX_BB_TABLES] = {
+	[SFX_BB_MF]	= "REMAP_MFBB_TABLE",
+	[SFX_BB_GROWN]	= "REMAP_GBB_TABLE",
+};
+
+struct sfx_bb_hist_rec {
+	__le64	time;
+	__le32	mf_bb_count;
+	__le32	grown_bb_count;
+	__le32	total_bb_count;
+	__le32	nr_added[SFX_BB_TABLES];
+	__le32	nr_removed[SFX_BB_TABLES];
+	__le32	rsvd;
+};
+
+struct sfx_bb_set {
+	__u64	*elem;
+	__u32	nr;
+};
+
+struct sfx_bb_snapshot {
+	time_t	time;
+	__u32	mf_bb_count;
+	__u32	grown_bb_count;
+	__u32	total_bb_count;
+	struct sfx_bb_set set[SFX_BB_TABLES];
+};
+
+static int sfx_bb_cmp(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void sfx_bb_free(struct sfx_bb_snapshot *snap)
+{
+	int t;
+
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		free(snap->set[t].elem);
+		snap->set[t].elem = NULL;
+		snap->set[t].nr = 0;
+	}
+}
+
+/* packs the remap tables of a bad block table dump into sorted arrays */
+static int sfx_bb_from_table(unsigned char *bd_table, __u64 table_size,
+			     struct sfx_bb_snapshot *snap)
+{
+	__u64 *bb_elem = (__u64 *)(bd_table + 5 * sizeof(__u32));
+	__u64 max = (table_size - 5 * sizeof(__u32)) / sizeof(__u64);
+	__u32 count[SFX_BB_TABLES];
+	int t;
+
+	snap->time = time(NULL);
+	snap->mf_bb_count = *((__u32 *)bd_table);
+	snap->grown_bb_count = *((__u32 *)(bd_table + sizeof(__u32)));
+	snap->total_bb_count = *((__u32 *)(bd_table + 2 * sizeof(__u32)));
+	count[SFX_BB_MF] = *((__u32 *)(bd_table + 3 * sizeof(__u32)));
+	count[SFX_BB_GROWN] = *((__u32 *)(bd_table + 4 * sizeof(__u32)));
+
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		if (count[t] > max)
+			count[t] = max;
+		max -= count[t];
+		snap->set[t].nr = count[t];
+		snap->set[t].elem = malloc((count[t] ?: 1) * sizeof(__u64));
+		if (!snap->set[t].elem)
+			return -ENOMEM;
+		memcpy(snap->set[t].elem, bb_elem, count[t] * sizeof(__u64));
+		bb_elem += count[t];
+		qsort(snap->set[t].elem, count[t], sizeof(__u64), sfx_bb_cmp);
+	}
+	return 0;
+}
+
+/*
+ * Linear merge of two sorted sets: entries only in @cur go to @added,
+ * entries only in @prev to @removed.
+ */
+static void sfx_bb_diff(struct sfx_bb_set *prev, struct sfx_bb_set *cur,
+			struct sfx_bb_set *added, struct sfx_bb_set *removed)
+{
+	__u32 i = 0, j = 0;
+
+	added->nr = removed->nr = 0;
+	while (i < prev->nr || j < cur->nr) {
+		if (j == cur->nr || (i < prev->nr && prev->elem[i] < cur->elem[j]))
+			removed->elem[removed->nr++] = prev->elem[i++];
+		else if (i == prev->nr || cur->elem[j] < prev->elem[i])
+			added->elem[added->nr++] = cur->elem[j++];
+		else
+			i++, j++;
+	}
+}
+
+/* applies a history record to @set, the reverse of sfx_bb_diff() */
+static int sfx_bb_apply(struct sfx_bb_set *set, struct sfx_bb_set *added,
+			struct sfx_bb_set *removed)
+{
+	__u32 i = 0, j = 0, k = 0, nr = 0;
+	__u64 *elem;
+
+	elem = malloc((set->nr + added->nr ?: 1) * sizeof(__u64));
+	if (!elem)
+		return -ENOMEM;
+	while (i < set->nr || j < added->nr) {
+		if (i < set->nr && k < removed->nr &&
+		    set->elem[i] == removed->elem[k]) {
+			i++, k++;
+			continue;
+		}
+		if (j == added->nr || (i < set->nr && set->elem[i] < added->elem[j]))
+			elem[nr++] = set->elem[i++];
+		else
+			elem[nr++] = added->elem[j++];
+	}
+	free(set->elem);
+	set->elem = elem;
+	set->nr = nr;
+	return 0;
+}
+
+static int sfx_bb_read_elems(FILE *f, struct sfx_bb_set *set, __u32 nr)
+{
+	__u32 i;
+
+	set->nr = nr;
+	set->elem = malloc((nr ?: 1) * sizeof(__u64));
+	if (!set->elem)
+		return -ENOMEM;
+	if (fread(set->elem, sizeof(__u64), nr, f) != nr)
+		return -EIO;
+	for (i = 0; i < nr; i++)
+		set->elem[i] = le64_to_cpu(set->elem[i]);
+	return 0;
+}
+
+/*
+ * Replays the history file into the last snapshot it holds. Returns the
+ * number of records, 0 for a new or empty file, and in @end the offset
+ * after the last complete record. A record cut short by an interrupted
+ * append ends the history there.
+ */
+static int sfx_bb_hist_load(FILE *f, struct sfx_bb_snapshot *last,
+			    time_t *first, off_t *end)
+{
+	struct sfx_bb_set added[SFX_BB_TABLES] = { };
+	struct sfx_bb_set removed[SFX_BB_TABLES] = { };
+	struct sfx_bb_hist_rec rec;
+	char magic[8];
+	int t, nr = 0, err = 0;
+
+	*end = 0;
+	if (fread(magic, sizeof(magic), 1, f) != 1)
+		return 0;
+	if (memcmp(magic, SFX_BB_HIST_MAGIC, sizeof(magic)))
+		return -EINVAL;
+	*end = sizeof(magic);
+
+	while (!err && fread(&rec, sizeof(rec), 1, f) == 1) {
+		for (t = 0; t < SFX_BB_TABLES && !err; t++) {
+			err = sfx_bb_read_elems(f, &added[t],
+					le32_to_cpu(rec.nr_added[t]));
+			if (!err)
+				err = sfx_bb_read_elems(f, &removed[t],
+					le32_to_cpu(rec.nr_removed[t]));
+		}
+		for (t = 0; t < SFX_BB_TABLES && !err; t++)
+			err = sfx_bb_apply(&last->set[t], &added[t],
+					   &removed[t]);
+		for (t = 0; t < SFX_BB_TABLES; t++) {
+			free(added[t].elem);
+			free(removed[t].elem);
+			added[t].elem = removed[t].elem = NULL;
+		}
+		if (err)
+			break;
+
+		if (!nr)
+			*first = le64_to_cpu(rec.time);
+		last->time = le64_to_cpu(rec.time);
+		last->mf_bb_count = le32_to_cpu(rec.mf_bb_count);
+		last->grown_bb_count = le32_to_cpu(rec.grown_bb_count);
+		last->total_bb_count = le32_to_cpu(rec.total_bb_count);
+		*end = ftello(f);
+		nr++;
+	}
+	if (ferror(f))
+		return -EIO;
+	if (err == -EIO)
+		err = 0;
+	return err ?: nr;
+}
+
+/* packs a history record, preceded by the magic for a new file */
+static void *sfx_bb_hist_pack(struct sfx_bb_snapshot *cur,
+			      struct sfx_bb_set *added,
+			      struct sfx_bb_set *removed,
+			      bool magic, size_t *len)
+{
+	struct sfx_bb_hist_rec rec = { };
+	__le64 *elem;
+	__u32 i, nr = 0;
+	char *buf, *p;
+	int t;
+
+	for (t = 0; t < SFX_BB_TABLES; t++)
+		nr += added[t].nr + removed[t].nr;
+	*len = (magic ? 8 : 0) + sizeof(rec) + nr * sizeof(__u64);
+	p = buf = malloc(*len);
+	if (!buf)
+		return NULL;
+
+	if (magic) {
+		memcpy(p, SFX_BB_HIST_MAGIC, 8);
+		p += 8;
+	}
+	rec.time = cpu_to_le64(cur->time);
+	rec.mf_bb_count = cpu_to_le32(cur->mf_bb_count);
+	rec.grown_bb_count = cpu_to_le32(cur->grown_bb_count);
+	rec.total_bb_count = cpu_to_le32(cur->total_bb_count);
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		rec.nr_added[t] = cpu_to_le32(added[t].nr);
+		rec.nr_removed[t] = cpu_to_le32(removed[t].nr);
+	}
+	memcpy(p, &rec, sizeof(rec));
+	elem = (__le64 *)(p + sizeof(rec));
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		for (i = 0; i < added[t].nr; i++)
+			*elem++ = cpu_to_le64(added[t].elem[i]);
+		for (i = 0; i < removed[t].nr; i++)
+			*elem++ = cpu_to_le64(removed[t].elem[i]);
+	}
+	return buf;
+}
+
+static void sfx_bb_show_set(const char *table, const char *what,
+			    struct sfx_bb_set *set)
+{
+	__u32 i;
+
+	if (!set->nr)
+		return;
+	printf("%s %s [", table, what);
+	for (i = 0; i < set->nr; i++)
+		printf(" 0x%"PRIx64"", (uint64_t)set->elem[i]);
+	printf(" ]\n");
+}
+
+static void sfx_bb_show_time(const char *prefix, time_t t)
+{
+	char buf[32];
+
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", localtime(&t));
+	printf("%s%s", prefix, buf);
+}
+
+/*
+ * Compares a bad block table with the last snapshot in the history file,
+ * shows only what changed and the grown bad block rate, and appends the
+ * table to the history. The file is locked for the whole run so that two
+ * runs can't interleave, and a failed append is cut off again so that
+ * the file always ends with a complete record.
+ */
+static int sfx_bb_history(const char *path, unsigned char *bd_table,
+			  __u64 table_size)
+{
+	struct sfx_bb_snapshot cur = { }, last = { };
+	struct sfx_bb_set added[SFX_BB_TABLES] = { };
+	struct sfx_bb_set removed[SFX_BB_TABLES] = { };
+	time_t first = 0;
+	struct stat st;
+	off_t end = 0;
+	double days;
+	char *buf = NULL;
+	size_t len, off;
+	ssize_t ret;
+	int t, nr, fd, err;
+	FILE *f;
+
+	fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -errno;
+	}
+	f = fdopen(fd, "r");
+	if (!f) {
+		perror(path);
+		close(fd);
+		return -errno;
+	}
+	if (flock(fd, LOCK_EX) < 0) {
+		perror(path);
+		err = -errno;
+		goto free;
+	}
+
+	err = sfx_bb_from_table(bd_table, table_size, &cur);
+	if (err)
+		goto free;
+	nr = err = sfx_bb_hist_load(f, &last, &first, &end);
+	if (err < 0) {
+		fprintf(stderr, "%s: not a valid bad block history\n", path);
+		goto free;
+	}
+	if (fstat(fd, &st) < 0)
+		goto write_err;
+	if (st.st_size > end) {
+		fprintf(stderr, "%s: dropping an incomplete record\n", path);
+		if (ftruncate(fd, end) < 0)
+			goto write_err;
+	}
+
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		added[t].elem = malloc((cur.set[t].nr ?: 1) * sizeof(__u64));
+		removed[t].elem = malloc((last.set[t].nr ?: 1) * sizeof(__u64));
+		if (!added[t].elem || !removed[t].elem) {
+			err = -ENOMEM;
+			goto free;
+		}
+		sfx_bb_diff(&last.set[t], &cur.set[t], &added[t], &removed[t]);
+	}
+
+	printf("GROWN_BB_COUNT:        %u\n", cur.grown_bb_count);
+	printf("TOTAL_BB_COUNT:        %u\n", cur.total_bb_count);
+	if (nr) {
+		days = difftime(cur.time, last.time) / 86400;
+		printf("Grown since last:      %+d", (int)(cur.grown_bb_count -
+		       last.grown_bb_count));
+		sfx_bb_show_time(" (", last.time);
+		if (days > 0)
+			printf(", %.2f per day", (cur.grown_bb_count -
+			       (double)last.grown_bb_count) / days);
+		printf(")\n");
+		printf("History:               %d snapshots", nr + 1);
+		sfx_bb_show_time(" since ", first);
+		printf("\n");
+		for (t = 0; t < SFX_BB_TABLES; t++) {
+			sfx_bb_show_set(sfx_bb_table_names[t], "added",
+					&added[t]);
+			sfx_bb_show_set(sfx_bb_table_names[t], "removed",
+					&removed[t]);
+		}
+	} else {
+		printf("History:               first snapshot, %u entries\n",
+		       cur.set[SFX_BB_MF].nr + cur.set[SFX_BB_GROWN].nr);
+	}
+
+	buf = sfx_bb_hist_pack(&cur, added, removed, !end, &len);
+	if (!buf) {
+		err = -ENOMEM;
+		goto free;
+	}
+	for (off = 0; off < len; off += ret) {
+		ret = write(fd, buf + off, len - off);
+		if (ret < 0 && errno == EINTR)
+			ret = 0;
+		else if (ret <= 0)
+			goto write_err;
+	}
+	err = 0;
+	goto free;
+
+write_err:
+	perror(path);
+	err = -EIO;
+	if (buf && ftruncate(fd, end) < 0)
+		perror(path);
+free:
+	fclose(f);
+	free(buf);
+	for (t = 0; t < SFX_BB_TABLES; t++) {
+		free(added[t].elem);
+		free(removed[t].elem);
+	}
+	sfx_bb_free(&cur);
+	sfx_bb_free(&last);
+	return err;
+}
+
 /**
  * @brief	"hooks of sfx get-bad-block"
  *
@@ -562,8 +961,19 @@ static int sfx_get_bad_block(int argc, char **argv, struct command *cmd, struct
 	int err = 0;
 
 	char *desc = "Get bad block table of sfx block device.";
+	const char *history = "compare with the last table in this history "\
+		"file, show only changed entries, and append the table to it";
+
+	struct config {
+		char *history;
+	};
+
+	struct config cfg = {
+		.history = "",
+	};
 
 	OPT_ARGS(opts) = {
+		OPT_FILE("history", 'f', &cfg.history, history),
 		OPT_END()
 	};
 
@@ -585,13 +995,15 @@ static int sfx_get_bad_block(int argc, char **argv, struct command *cmd, struct
 	} else if (err != 0) {
 		fprintf(stderr, "NVMe IO command error:%s(%x)\n",
 				nvme_status_to_string(err), err);
+	} else if (strlen(cfg.history)) {
+		err = sfx_bb_history(cfg.history, data_buf, buf_size);
 	} else {
 		bd_table_show(data_buf, buf_size);
 		printf("ScaleFlux get bad block table: success\n");
 	}
 
 	free(data_buf);
-	return 0;
+	return err;
 }
 
 static void show_cap_info(struct sfx_freespace_ctx *ctx)
@@ -29,6 +29,8 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "linux/nvme_ioctl.h"
 
@@ -38,6 +40,7 @@
 #include "nvme-ioctl.h"
 #include "plugin.h"
 #include "nvme-status.h"
+#include "progress.h"
 
 #include "argconfig.h"
 #include "suffix.h"
@@ -978,7 +981,7 @@ static long double int128_to_double(__u8 *data)
 	return result;
 }
 
-static int wdc_get_pci_ids(uint32_t *device_id, uint32_t *vendor_id)
+static int wdc_read_pci_ids(uint32_t *device_id, uint32_t *vendor_id)
 {
 	int fd, ret = -1;
 	char *block, path[512], *id;
@@ -992,11 +995,13 @@ static int wdc_get_pci_ids(uint32_t *device_id, uint32_t *vendor_id)
 	block = nvme_char_from_block((char *)devicename);
 
 	/* read the vendor ID from sys fs  */
-	sprintf(path, "/sys/class/nvme/%s/device/vendor", block);
+	sprintf(path, "%s/sys/class/nvme/%s/device/vendor",
+		nvme_backend->sysfs_root, block);
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
-		sprintf(path, "/sys/class/misc/%s/device/vendor", block);
+		sprintf(path, "%s/sys/class/misc/%s/device/vendor",
+		nvme_backend->sysfs_root, block);
 		fd = open(path, O_RDONLY);
 	}
 	if (fd < 0) {
@@ -1020,11 +1025,13 @@ static int wdc_get_pci_ids(uint32_t *device_id, uint32_t *vendor_id)
 	}
 
 	/* read the device ID from sys fs */
-	sprintf(path, "/sys/class/nvme/%s/device/device", block);
+	sprintf(path, "%s/sys/class/nvme/%s/device/device",
+		nvme_backend->sysfs_root, block);
 
 	fd = open(path, O_RDONLY);
 	if (fd < 0) {
-		sprintf(path, "/sys/class/misc/%s/device/device", block);
+		sprintf(path, "%s/sys/class/misc/%s/device/device",
+		nvme_backend->sysfs_root, block);
 		fd = open(path, O_RDONLY);
 	}
 	if (fd < 0) {
@@ -1072,6 +1079,193 @@ static int wdc_get_vendor_id(int fd, uint32_t *vendor_id)
 	return ret;
 }
 
+/*
+ * What the vendor specific commands probe before doing anything: the PCI
+ * IDs, the capabilities derived from them and the static entries of the
+ * Device Manageability log page (0xC2), i.e. the customer ID, the
+ * supported log pages and the UUID index the entries were found with.
+ * They are probed once per process for every device and dropped when an
+ * admin command which may change them was sent. With NVME_WDC_CACHE=<dir>
+ * they are also stored in <dir>, keyed by serial number and firmware
+ * revision, so later runs skip the probing as well.
+ */
+#define WDC_DEV_DESC_MAGIC		"WDCDESC1"
+#define WDC_C2_UUID_UNKNOWN		0xff
+
+enum {
+	WDC_C2_ENTRY_UNKNOWN = 0,
+	WDC_C2_ENTRY_PRESENT,
+	WDC_C2_ENTRY_ABSENT,
+};
+
+struct wdc_dev_info {
+	char	magic[8];
+	__u32	vendor_id;
+	__u32	device_id;
+	__u64	capabilities;
+	__u8	caps_valid;
+	__u8	c2_uuid_ix;
+	__u8	cust_id_state;
+	__u8	log_pages_state;
+	__u32	cust_id;
+	/* C2 entry layout: length followed by the log page identifiers */
+	__le32	log_pages_len;
+	__u8	log_pages[256];
+};
+
+struct wdc_dev_desc {
+	dev_t rdev;
+	char sn[sizeof(((struct nvme_id_ctrl *)0)->sn) + 1];
+	char fr[sizeof(((struct nvme_id_ctrl *)0)->fr) + 1];
+	struct wdc_dev_info info;
+	struct wdc_dev_desc *next;
+};
+
+static struct wdc_dev_desc *wdc_dev_descs;
+static unsigned int wdc_dev_descs_gen;
+
+static void wdc_trim_id(char *dst, const char *src, size_t len)
+{
+	size_t i;
+
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+	while (len && (dst[len - 1] == ' ' || dst[len - 1] == '\0'))
+		dst[--len] = '\0';
+	for (i = 0; i < len; i++)
+		if (dst[i] == '/' || dst[i] == ' ')
+			dst[i] = '_';
+}
+
+static int wdc_dev_desc_path(struct wdc_dev_desc *desc, char *path, size_t len)
+{
+	const char *dir = getenv("NVME_WDC_CACHE");
+
+	if (!dir || !*dir || !desc->sn[0])
+		return -1;
+	if (snprintf(path, len, "%s/%s-%s", dir, desc->sn, desc->fr) >= len)
+		return -1;
+	return 0;
+}
+
+static bool wdc_dev_desc_load(struct wdc_dev_desc *desc)
+{
+	struct wdc_dev_info info;
+	char path[PATH_MAX];
+	int fd, ret;
+
+	if (wdc_dev_desc_path(desc, path, sizeof(path)))
+		return false;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	ret = read(fd, &info, sizeof(info));
+	close(fd);
+	if (ret != sizeof(info) ||
+	    memcmp(info.magic, WDC_DEV_DESC_MAGIC, sizeof(info.magic)))
+		return false;
+	/* a corrupt file must not make callers read past the entry */
+	if (le32_to_cpu(info.log_pages_len) > ARRAY_SIZE(info.log_pages))
+		return false;
+
+	/* only entries which were found are stored */
+	if (info.cust_id_state != WDC_C2_ENTRY_PRESENT)
+		info.cust_id_state = WDC_C2_ENTRY_UNKNOWN;
+	if (info.log_pages_state != WDC_C2_ENTRY_PRESENT)
+		info.log_pages_state = WDC_C2_ENTRY_UNKNOWN;
+	desc->info = info;
+	return true;
+}
+
+static void wdc_dev_desc_save(struct wdc_dev_desc *desc)
+{
+	struct wdc_dev_info info;
+	char path[PATH_MAX], tmp[PATH_MAX + 16];
+	int fd, ret;
+
+	if (wdc_dev_desc_path(desc, path, sizeof(path)))
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	info = desc->info;
+	memcpy(info.magic, WDC_DEV_DESC_MAGIC, sizeof(info.magic));
+	ret = write(fd, &info, sizeof(info));
+	close(fd);
+	if (ret != sizeof(info) || rename(tmp, path))
+		unlink(tmp);
+}
+
+static struct wdc_dev_desc *wdc_get_dev_desc(int fd)
+{
+	struct wdc_dev_desc *desc;
+	struct nvme_id_ctrl ctrl;
+	bool have_ctrl = false;
+	uint32_t device_id = -1, vendor_id = -1;
+	struct stat st;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	if (wdc_dev_descs_gen != nvme_identify_cache_generation()) {
+		while (wdc_dev_descs) {
+			desc = wdc_dev_descs;
+			wdc_dev_descs = desc->next;
+			free(desc);
+		}
+		wdc_dev_descs_gen = nvme_identify_cache_generation();
+	}
+	for (desc = wdc_dev_descs; desc; desc = desc->next)
+		if (desc->rdev == st.st_rdev)
+			return desc;
+
+	desc = calloc(1, sizeof(*desc));
+	if (!desc) {
+		fprintf(stderr, "ERROR : WDC : %s : calloc failed\n", __func__);
+		return NULL;
+	}
+	desc->rdev = st.st_rdev;
+	desc->info.c2_uuid_ix = WDC_C2_UUID_UNKNOWN;
+
+	if (getenv("NVME_WDC_CACHE") && !nvme_identify_ctrl(fd, &ctrl)) {
+		have_ctrl = true;
+		wdc_trim_id(desc->sn, ctrl.sn, sizeof(ctrl.sn));
+		wdc_trim_id(desc->fr, ctrl.fr, sizeof(ctrl.fr));
+		if (wdc_dev_desc_load(desc))
+			goto out;
+	}
+
+	if (wdc_read_pci_ids(&device_id, &vendor_id) < 0) {
+		/* Use the identify nvme command to get vendor id due to NVMeOF device. */
+		device_id = -1;
+		if (have_ctrl)
+			vendor_id = le16_to_cpu(ctrl.vid);
+		else if (wdc_get_vendor_id(fd, &vendor_id) < 0) {
+			free(desc);
+			return NULL;
+		}
+	}
+	desc->info.vendor_id = vendor_id;
+	desc->info.device_id = device_id;
+	wdc_dev_desc_save(desc);
+out:
+	desc->next = wdc_dev_descs;
+	wdc_dev_descs = desc;
+	return desc;
+}
+
+static int wdc_get_pci_ids(int fd, uint32_t *device_id, uint32_t *vendor_id)
+{
+	struct wdc_dev_desc *desc = wdc_get_dev_desc(fd);
+
+	if (!desc)
+		return -1;
+	*device_id = desc->info.device_id;
+	*vendor_id = desc->info.vendor_id;
+	return desc->info.device_id == -1 ? -1 : 0;
+}
+
 static bool wdc_check_power_of_2(int num)
 {
 	return (num && ( !(num & (num-1))));
@@ -1101,16 +1295,13 @@ static int wdc_get_model_number(int fd, char *model)
 
 static bool wdc_check_device(int fd)
 {
-	int ret;
 	bool supported;
 	uint32_t read_device_id = -1, read_vendor_id = -1;
 
-	ret = wdc_get_pci_ids(&read_device_id, &read_vendor_id);
-	if (ret < 0) {
-		/* Use the identify nvme command to get vendor id due to NVMeOF device. */
-		if (wdc_get_vendor_id(fd, &read_vendor_id) < 0)
-			return false;
-	}
+	/* NVMeOF devices only have the vendor id from identify */
+	wdc_get_pci_ids(fd, &read_device_id, &read_vendor_id);
+	if (read_vendor_id == -1)
+		return false;
 
 	supported = false;
 
@@ -1145,20 +1336,12 @@ static bool wdc_enc_check_model(int fd)
 	return supported;
 }
 
-static __u64 wdc_get_drive_capabilities(int fd) {
-	int ret;
-	uint32_t read_device_id = -1, read_vendor_id = -1;
+static __u64 wdc_probe_drive_capabilities(int fd, uint32_t read_vendor_id,
+		uint32_t read_device_id) {
 	__u64 capabilities = 0;
 	__u8 *data;
 	__u32 *cust_id;
 
-	ret = wdc_get_pci_ids(&read_device_id, &read_vendor_id);
-	if (ret < 0)
-	{
-		if (wdc_get_vendor_id(fd, &read_vendor_id) < 0)
-			return capabilities;
-	}
-
 	/* below check condition is added due in NVMeOF device we dont have device_id so we need to use only vendor_id*/
 	if (read_device_id == -1 && read_vendor_id != -1)
 	{
@@ -1340,6 +1523,23 @@ static __u64 wdc_get_drive_capabilities(int fd) {
 	return capabilities;
 }
 
+static __u64 wdc_get_drive_capabilities(int fd) {
+	struct wdc_dev_desc *desc = wdc_get_dev_desc(fd);
+
+	if (!desc || desc->info.vendor_id == -1)
+		return 0;
+	if (!desc->info.caps_valid) {
+		desc->info.capabilities = wdc_probe_drive_capabilities(fd,
+			desc->info.vendor_id, desc->info.device_id);
+		/* -1 is returned when the customer id could not be read */
+		if (desc->info.capabilities == (__u64)-1)
+			return -1;
+		desc->info.caps_valid = 1;
+		wdc_dev_desc_save(desc);
+	}
+	return desc->info.capabilities;
+}
+
 static __u64 wdc_get_enc_drive_capabilities(int fd) {
 	int ret;
 	uint32_t read_vendor_id;
@@ -1577,21 +1777,16 @@ bool wdc_get_dev_mng_log_entry(__u32 log_length,
     return valid_log;
 }
 
-static bool get_dev_mgment_cbs_data(int fd, __u8 log_id, void **cbs_data)
+static __u8 *wdc_read_c2_log(int fd, __u8 uuid_ix)
 {
-	int ret = -1;
-	__u8* data;
 	struct wdc_c2_log_page_header *hdr_ptr;
-	struct wdc_c2_log_subpage_header *sph;
-	__u32 length = 0;
-	bool found = false;
-	__u8 uuid_ix = 1;
-
-	*cbs_data = NULL;
+	__u32 length;
+	__u8 *data;
+	int ret;
 
 	if ((data = (__u8*) malloc(sizeof (__u8) * WDC_C2_LOG_BUF_LEN)) == NULL) {
 		fprintf(stderr, "ERROR : WDC : malloc : %s\n", strerror(errno));
-		return false;
+		return NULL;
 	}
 	memset(data, 0, sizeof (__u8) * WDC_C2_LOG_BUF_LEN);
 
@@ -1600,59 +1795,133 @@ static bool get_dev_mgment_cbs_data(int fd, __u8 log_id, void **cbs_data)
 			NVME_NO_LOG_LSP, 0, 0, false, uuid_ix, WDC_C2_LOG_BUF_LEN, data);
 	if (ret) {
 		fprintf(stderr, "ERROR : WDC : Unable to get C2 Log Page length, ret = 0x%x\n", ret);
-		goto end;
+		goto free;
 	}
 
 	hdr_ptr = (struct wdc_c2_log_page_header *)data;
+	length = le32_to_cpu(hdr_ptr->length);
+	if (length <= WDC_C2_LOG_BUF_LEN)
+		return data;
 
-	if (le32_to_cpu(hdr_ptr->length) > WDC_C2_LOG_BUF_LEN) {
-		/* Log Page buffer too small, free and reallocate the necessary size */
-		free(data);
-		data = calloc(le32_to_cpu(hdr_ptr->length), sizeof(__u8));
-		if (data == NULL) {
-			fprintf(stderr, "ERROR : WDC : malloc : %s\n", strerror(errno));
-			return false;
-		}
+	/* Log Page buffer too small, free and reallocate the necessary size */
+	free(data);
+	data = calloc(length, sizeof(__u8));
+	if (data == NULL) {
+		fprintf(stderr, "ERROR : WDC : malloc : %s\n", strerror(errno));
+		return NULL;
 	}
 
 	/* get the log page data */
 	ret = nvme_get_log14(fd, 0xFFFFFFFF, WDC_NVME_GET_DEV_MGMNT_LOG_PAGE_OPCODE,
-			NVME_NO_LOG_LSP, 0, 0, false, uuid_ix, le32_to_cpu(hdr_ptr->length), data);
-
+			NVME_NO_LOG_LSP, 0, 0, false, uuid_ix, length, data);
 	if (ret) {
 		fprintf(stderr, "ERROR : WDC : Unable to read C2 Log Page data, ret = 0x%x\n", ret);
-		goto end;
+		goto free;
+	}
+	return data;
+free:
+	free(data);
+	return NULL;
+}
+
+/*
+ * Returns the data of a 0xC2 log page entry. It stays valid until the next
+ * call, except for the customer id and supported log pages, which are kept
+ * in the device descriptor.
+ */
+static bool get_dev_mgment_cbs_data(int fd, __u8 log_id, void **cbs_data)
+{
+	static __u8 *data;
+	struct wdc_dev_desc *desc = wdc_get_dev_desc(fd);
+	struct wdc_c2_log_page_header *hdr_ptr;
+	struct wdc_c2_log_subpage_header *sph;
+	__u8 *state = NULL, uuid_ix[2] = { 1, 0 };
+	bool found = false, read_err = false;
+	__u32 len;
+	int i;
+
+	*cbs_data = NULL;
+
+	if (desc && log_id == WDC_C2_CUSTOMER_ID_ID) {
+		state = &desc->info.cust_id_state;
+		*cbs_data = &desc->info.cust_id;
+	} else if (desc && log_id == WDC_C2_LOG_PAGES_SUPPORTED_ID) {
+		state = &desc->info.log_pages_state;
+		*cbs_data = &desc->info.log_pages_len;
 	}
+	if (state && *state == WDC_C2_ENTRY_PRESENT)
+		return true;
+	*cbs_data = NULL;
+	if (state && *state == WDC_C2_ENTRY_ABSENT)
+		goto not_found;
 
-	/* Check the log data to see if the WD version of log page ID's is found */
+	/* try the UUID index the entries were found with before first */
+	if (desc && desc->info.c2_uuid_ix == 0) {
+		uuid_ix[0] = 0;
+		uuid_ix[1] = 1;
+	}
 
-	length = sizeof(struct wdc_c2_log_page_header);
-	hdr_ptr = (struct wdc_c2_log_page_header *)data;
-	sph = (struct wdc_c2_log_subpage_header *)(data + length);
-	found = wdc_get_dev_mng_log_entry(hdr_ptr->length, log_id, hdr_ptr, &sph);
+	for (i = 0; i < 2 && !found; i++) {
+		free(data);
+		data = wdc_read_c2_log(fd, uuid_ix[i]);
+		/*
+		 * Keep the original behaviour of only trying UUID index 0
+		 * when 1 could be read, but fall back to 1 when 0 fails.
+		 */
+		if (!data) {
+			if (uuid_ix[i] == 1)
+				return false;
+			read_err = true;
+			continue;
+		}
+
+		/* Check the log data to see if the WD version of log page ID's is found */
+		hdr_ptr = (struct wdc_c2_log_page_header *)data;
+		sph = (struct wdc_c2_log_subpage_header *)(data + sizeof(*hdr_ptr));
+		found = wdc_get_dev_mng_log_entry(hdr_ptr->length, log_id, hdr_ptr, &sph) &&
+			sph;
+	}
 
 	if (found) {
 		*cbs_data = (void *)&sph->data;
-	} else {
-		/* not found with uuid = 1 try with uuid = 0 */
-		uuid_ix = 0;
-		/* get the log page data */
-		ret = nvme_get_log14(fd, 0xFFFFFFFF, WDC_NVME_GET_DEV_MGMNT_LOG_PAGE_OPCODE,
-				NVME_NO_LOG_LSP, 0, 0, false, uuid_ix, le32_to_cpu(hdr_ptr->length), data);
+		if (desc && desc->info.c2_uuid_ix != uuid_ix[i - 1]) {
+			desc->info.c2_uuid_ix = uuid_ix[i - 1];
+			if (!state)
+				wdc_dev_desc_save(desc);
+		}
+		if (!state)
+			return true;
 
-		hdr_ptr = (struct wdc_c2_log_page_header *)data;
-		sph = (struct wdc_c2_log_subpage_header *)(data + length);
-		found = wdc_get_dev_mng_log_entry(hdr_ptr->length, log_id, hdr_ptr, &sph);
-		if (found) {
-			*cbs_data = (void *)&sph->data;
+		len = le32_to_cpu(sph->length);
+		len = len > sizeof(*sph) - sizeof(sph->data) ?
+			len - (sizeof(*sph) - sizeof(sph->data)) : 0;
+		if (log_id == WDC_C2_CUSTOMER_ID_ID) {
+			desc->info.cust_id = *(__u32 *)*cbs_data;
+			*cbs_data = &desc->info.cust_id;
 		} else {
-			/* WD version not found  */
-			fprintf(stderr, "ERROR : WDC : Unable to find correct version of page 0xC2, entry id = %d\n", log_id);
+			len = min(len, sizeof(desc->info.log_pages_len) +
+					sizeof(desc->info.log_pages));
+			memcpy(&desc->info.log_pages_len, *cbs_data, len);
+			len = len > sizeof(desc->info.log_pages_len) ?
+				len - sizeof(desc->info.log_pages_len) : 0;
+			if (le32_to_cpu(desc->info.log_pages_len) > len)
+				desc->info.log_pages_len = cpu_to_le32(len);
+			*cbs_data = &desc->info.log_pages_len;
 		}
+		*state = WDC_C2_ENTRY_PRESENT;
+		wdc_dev_desc_save(desc);
+		return true;
 	}
-end:
-	free(data);
-	return found;
+
+	/* only remember the entry as absent if the log could be read */
+	if (read_err)
+		return false;
+	if (state)
+		*state = WDC_C2_ENTRY_ABSENT;
+not_found:
+	/* WD version not found  */
+	fprintf(stderr, "ERROR : WDC : Unable to find correct version of page 0xC2, entry id = %d\n", log_id);
+	return false;
 }
 
 static bool wdc_nvme_check_supported_log_page(int fd, __u8 log_id)
@@ -1828,6 +2097,285 @@ static __u32 wdc_dump_dui_data_v2(int fd, __u32 dataLen, __u64 offset, __u8 *dum
 	return ret;
 }
 
+/*
+ * Chunked transfer of a large dump into a file. The device is read in
+ * chunks of at most MDTS into two large aligned buffers while a writer
+ * thread flushes the other one, so the device does not wait for the file
+ * system. With resume set the data already in the file is kept and only
+ * the rest is read; callers must first check with wdc_dump_resume_match()
+ * that the file belongs to the same capture.
+ */
+#define WDC_DUMP_BUF_SIZE	(4 * 1024 * 1024)
+#define WDC_DUMP_ALIGN		4096
+
+struct wdc_dump {
+	int fd;			/* device */
+	int out;		/* output file */
+	__u64 offset;		/* device offset of the first byte */
+	__u64 length;		/* bytes to transfer */
+	off_t file_offset;	/* output file offset of the first byte */
+	__u32 xfer;		/* requested chunk size */
+	bool fixed_xfer;	/* xfer is required by firmware, never clamp it */
+	bool resume;
+	bool verbose;
+	int (*read)(struct wdc_dump *d, void *buf, __u32 len, __u64 offset,
+		    bool last);
+	void *priv;
+};
+
+struct wdc_dump_writer {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int out;
+	__u8 *buf[2];
+	size_t len[2];
+	bool full[2];
+	bool done;
+	int err;
+};
+
+static void *wdc_dump_write_thread(void *arg)
+{
+	struct wdc_dump_writer *w = arg;
+	size_t written;
+	ssize_t ret;
+	int i = 0;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->full[i] && !w->done)
+			pthread_cond_wait(&w->cond, &w->lock);
+		if (!w->full[i])
+			break;
+		pthread_mutex_unlock(&w->lock);
+
+		for (written = 0, ret = 0; written < w->len[i]; written += ret) {
+			ret = write(w->out, w->buf[i] + written, w->len[i] - written);
+			if (ret <= 0)
+				break;
+		}
+
+		pthread_mutex_lock(&w->lock);
+		if (written < w->len[i] && !w->err)
+			w->err = ret < 0 ? -errno : -EIO;
+		w->full[i] = false;
+		pthread_cond_broadcast(&w->cond);
+		i ^= 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+static __u32 wdc_dump_xfer_size(struct wdc_dump *d)
+{
+	struct nvme_id_ctrl ctrl;
+	__u32 xfer = d->xfer, max;
+
+	if (nvme_identify_ctrl(d->fd, &ctrl) || !ctrl.mdts || ctrl.mdts >= 20)
+		return xfer;
+
+	/* MDTS is in units of the minimum page size, which is at least 4k */
+	max = 4096 << ctrl.mdts;
+	if (xfer > max && d->fixed_xfer) {
+		fprintf(stderr, "ERROR : WDC : transfer size 0x%x is required but exceeds MDTS (0x%x)\n",
+				xfer, max);
+		return 0;
+	}
+	if (xfer > max) {
+		if (d->verbose)
+			fprintf(stderr, "INFO : WDC : transfer size 0x%x exceeds MDTS, using 0x%x\n",
+					xfer, max);
+		xfer = max;
+	}
+	return xfer;
+}
+
+static int wdc_dump_chunked(struct wdc_dump *d)
+{
+	struct wdc_dump_writer w = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.out = d->out,
+	};
+	struct timespec start, end;
+	__u64 done = 0, pos;
+	size_t buf_size, len;
+	pthread_t writer;
+	double secs;
+	struct stat st;
+	__u32 xfer;
+	int i, cur = 0, ret = 0;
+
+	xfer = wdc_dump_xfer_size(d);
+	if (!xfer) {
+		if (!d->fixed_xfer)
+			fprintf(stderr, "ERROR : WDC : Invalid length\n");
+		return -EINVAL;
+	}
+
+	if (d->resume && !fstat(d->out, &st) && st.st_size > d->file_offset) {
+		done = (st.st_size - d->file_offset) & ~(__u64)(WDC_DUMP_ALIGN - 1);
+		done = min(done, d->length);
+		if (done)
+			fprintf(stderr, "INFO : WDC : resuming at offset 0x%"PRIx64"\n",
+					(uint64_t)(d->offset + done));
+	}
+	if (ftruncate(d->out, d->file_offset + done) < 0 ||
+	    lseek(d->out, d->file_offset + done, SEEK_SET) < 0) {
+		fprintf(stderr, "ERROR : WDC : output file : %s\n", strerror(errno));
+		return -errno;
+	}
+
+	buf_size = max(WDC_DUMP_BUF_SIZE / xfer, 1) * (size_t)xfer;
+	for (i = 0; i < 2; i++) {
+		if (posix_memalign((void **)&w.buf[i], WDC_DUMP_ALIGN, buf_size)) {
+			fprintf(stderr, "ERROR : WDC : malloc : %s\n", strerror(ENOMEM));
+			ret = -ENOMEM;
+			goto free;
+		}
+	}
+
+	ret = pthread_create(&writer, NULL, wdc_dump_write_thread, &w);
+	if (ret) {
+		fprintf(stderr, "ERROR : WDC : pthread_create : %s\n", strerror(ret));
+		ret = -ret;
+		goto free;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pos = done;
+	while (pos < d->length) {
+		pthread_mutex_lock(&w.lock);
+		while (w.full[cur] && !w.err)
+			pthread_cond_wait(&w.cond, &w.lock);
+		ret = w.err;
+		pthread_mutex_unlock(&w.lock);
+		if (ret)
+			break;
+
+		/* fill the buffer, it is handed to the writer even on error */
+		for (len = 0; len < buf_size && pos < d->length; ) {
+			__u32 chunk = min((__u64)xfer, d->length - pos);
+
+			ret = d->read(d, w.buf[cur] + len, chunk, d->offset + pos,
+				      pos + chunk >= d->length);
+			if (ret) {
+				fprintf(stderr, "%s: ERROR : WDC : Get chunk at offset 0x%"PRIx64", size = 0x%x\n",
+						__func__, (uint64_t)(d->offset + pos), chunk);
+				break;
+			}
+			len += chunk;
+			pos += chunk;
+		}
+
+		pthread_mutex_lock(&w.lock);
+		w.len[cur] = len;
+		w.full[cur] = len != 0;
+		pthread_cond_broadcast(&w.cond);
+		pthread_mutex_unlock(&w.lock);
+		cur ^= 1;
+		if (ret)
+			break;
+	}
+
+	pthread_mutex_lock(&w.lock);
+	w.done = true;
+	pthread_cond_broadcast(&w.cond);
+	pthread_mutex_unlock(&w.lock);
+	pthread_join(writer, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!ret && w.err) {
+		fprintf(stderr, "ERROR : WDC : Failed to flush dump data to file : %s\n",
+				strerror(-w.err));
+		ret = w.err;
+	}
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "INFO : WDC : 0x%"PRIx64" bytes in %.2f s, %.1f MiB/s\n",
+			(uint64_t)(pos - done), secs,
+			secs > 0 ? (pos - done) / secs / (1024 * 1024) : 0.0);
+	if (ret)
+		fprintf(stderr, "INFO : WDC : 0x%"PRIx64" of 0x%"PRIx64" bytes retrieved, rerun with --resume to continue\n",
+				(uint64_t)pos, (uint64_t)d->length);
+free:
+	free(w.buf[0]);
+	free(w.buf[1]);
+	return ret;
+}
+
+static int wdc_dump_open_output(char *file, bool resume)
+{
+	int output;
+
+	output = open(file, (resume ? O_RDWR : O_WRONLY | O_TRUNC) | O_CREAT, 0666);
+	if (output < 0)
+		fprintf(stderr, "Failed to open output file %s: %s!\n",
+				file, strerror(errno));
+	return output;
+}
+
+/*
+ * A resumed dump is only valid if the file was started from the same
+ * capture, which is identified by the header the device returns now.
+ */
+static bool wdc_dump_resume_match(int out, const void *hdr, size_t len)
+{
+	__u8 *old;
+	bool match;
+
+	old = malloc(len);
+	if (!old)
+		return false;
+	match = pread(out, old, len, 0) == (ssize_t)len &&
+		!memcmp(old, hdr, len);
+	free(old);
+	if (!match)
+		fprintf(stderr, "INFO : WDC : output file is from a different capture, restarting at offset 0\n");
+	return match;
+}
+
+/*
+ * The DUI header identifies the capture; it is only in the file when the
+ * dump started at offset 0, anything else cannot be checked and restarts.
+ */
+static bool wdc_dui_resume_match(int out, void *hdr, __u64 offset)
+{
+	if (offset) {
+		fprintf(stderr, "INFO : WDC : cannot verify a capture started at an offset, restarting at offset 0x%"PRIx64"\n",
+				(uint64_t)offset);
+		return false;
+	}
+	return wdc_dump_resume_match(out, hdr, WDC_NVME_CAP_DUI_HEADER_SIZE);
+}
+
+static int wdc_dump_dui_read(struct wdc_dump *d, void *buf, __u32 len,
+		__u64 offset, bool last)
+{
+	return wdc_dump_dui_data(d->fd, len, (__u32)offset, buf, last);
+}
+
+static int wdc_dump_dui_read_v2(struct wdc_dump *d, void *buf, __u32 len,
+		__u64 offset, bool last)
+{
+	return wdc_dump_dui_data_v2(d->fd, len, offset, buf, last);
+}
+
+static int wdc_dump_telemetry_read(struct wdc_dump *d, void *buf, __u32 len,
+		__u64 offset, bool last)
+{
+	int err;
+
+	err = nvme_get_telemetry_log(d->fd, buf, 0, *(int *)d->priv, len, offset);
+	if (err < 0)
+		perror("get-telemetry-log");
+	else if (err > 0) {
+		nvme_show_status(err);
+		fprintf(stderr, "%s: Failed to acquire full telemetry log!\n", __func__);
+	}
+	return err;
+}
+
 static int wdc_do_dump(int fd, __u32 opcode,__u32 data_len,
 		__u32 cdw12, char *file, __u32 xfer_size)
 {
@@ -1949,12 +2497,20 @@ static int wdc_do_dump_e6(int fd, __u32 opcode,__u32 data_len,
 	return ret;
 }
 
-static int wdc_do_cap_telemetry_log(int fd, char *file, __u32 bs, int type, int data_area)
+static int wdc_do_cap_telemetry_log(int fd, char *file, __u32 bs, int type, int data_area,
+		bool resume)
 {
 	struct nvme_telemetry_log_page_hdr *hdr;
-	size_t full_size, offset = WDC_TELEMETRY_HEADER_LENGTH;
+	size_t full_size;
 	int err = 0, output;
-	void *page_log;
+	struct wdc_dump dump = {
+		.fd = fd,
+		.offset = WDC_TELEMETRY_HEADER_LENGTH,
+		.file_offset = WDC_TELEMETRY_HEADER_LENGTH,
+		.xfer = bs,
+		.resume = resume,
+		.read = wdc_dump_telemetry_read,
+	};
 	__u32 host_gen = 1;
 	int ctrl_init = 0;
 	__u32 result;
@@ -1997,31 +2553,42 @@ static int wdc_do_cap_telemetry_log(int fd, char *file, __u32 bs, int type, int
 		goto close_fd;
 	}
 
-	hdr = malloc(bs);
-	page_log = malloc(bs);
-	if (!hdr || !page_log) {
+	hdr = malloc(WDC_TELEMETRY_HEADER_LENGTH);
+	if (!hdr) {
 		fprintf(stderr, "%s: Failed to allocate 0x%x bytes for log: %s\n",
-				__func__, bs, strerror(errno));
+				__func__, WDC_TELEMETRY_HEADER_LENGTH, strerror(errno));
 		err = -ENOMEM;
 		goto free_mem;
 	}
-	memset(hdr, 0, bs);
+	memset(hdr, 0, WDC_TELEMETRY_HEADER_LENGTH);
 
-	output = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	output = wdc_dump_open_output(file, resume);
 	if (output < 0) {
-		fprintf(stderr, "%s: Failed to open output file %s: %s!\n",
-				__func__, file, strerror(errno));
 		err = output;
 		goto free_mem;
 	}
 
-	err = nvme_get_telemetry_log(fd, hdr, host_gen, ctrl_init, WDC_TELEMETRY_HEADER_LENGTH, 0);
-	if (err < 0)
-		perror("get-telemetry-log");
-	else if (err > 0) {
-		nvme_show_status(err);
-		fprintf(stderr, "%s: Failed to acquire telemetry header!\n", __func__);
-		goto close_output;
+	/*
+	 * Setting the create bit would replace the host snapshot the file
+	 * was started from, so a resume first reads the current header
+	 * without it and only takes a new snapshot if that does not match.
+	 * The header carries the data generation number and area sizes, so
+	 * comparing it catches a snapshot taken since the file was started.
+	 */
+	if (resume) {
+		err = nvme_get_telemetry_log(fd, hdr, 0, ctrl_init, WDC_TELEMETRY_HEADER_LENGTH, 0);
+		dump.resume = !err && wdc_dump_resume_match(output, hdr,
+						WDC_TELEMETRY_HEADER_LENGTH);
+	}
+	if (!dump.resume) {
+		err = nvme_get_telemetry_log(fd, hdr, host_gen, ctrl_init, WDC_TELEMETRY_HEADER_LENGTH, 0);
+		if (err < 0)
+			perror("get-telemetry-log");
+		else if (err > 0) {
+			nvme_show_status(err);
+			fprintf(stderr, "%s: Failed to acquire telemetry header!\n", __func__);
+			goto close_output;
+		}
 	}
 
 	err = write(output, (void *) hdr, WDC_TELEMETRY_HEADER_LENGTH);
@@ -2046,40 +2613,15 @@ static int wdc_do_cap_telemetry_log(int fd, char *file, __u32 bs, int type, int
 		goto close_output;
 	}
 
-	/*
-	 * Continuously pull data until the offset hits the end of the last
-	 * block.
-	 */
-	while (offset < full_size) {
-		if ((full_size - offset) < bs)
-			bs = (full_size - offset);
-
-
-		err = nvme_get_telemetry_log(fd, page_log, 0, ctrl_init, bs, offset);
-		if (err < 0) {
-			perror("get-telemetry-log");
-			break;
-		} else if (err > 0) {
-			nvme_show_status(err);
-			fprintf(stderr, "%s: Failed to acquire full telemetry log!\n", __func__);
-			nvme_show_status(err);
-			break;
-		}
-
-		err = write(output, (void *) page_log, bs);
-		if (err != bs) {
-			fprintf(stderr, "%s: Failed to flush telemetry data to file!, err = %d\n", __func__, err);
-			break;
-		}
-		err = 0;
-		offset += bs;
-	}
+	dump.out = output;
+	dump.length = full_size - WDC_TELEMETRY_HEADER_LENGTH;
+	dump.priv = &ctrl_init;
+	err = wdc_dump_chunked(&dump);
 
 close_output:
 	close(output);
 free_mem:
 	free(hdr);
-	free(page_log);
 close_fd:
 	close(fd);
 
@@ -2087,7 +2629,8 @@ close_fd:
 
 }
 
-static int wdc_do_cap_diag(int fd, char *file, __u32 xfer_size, int type, int data_area)
+static int wdc_do_cap_diag(int fd, char *file, __u32 xfer_size, int type, int data_area,
+		bool resume)
 {
 	int ret = -1;
 	__u32 e6_log_hdr_size = WDC_NVME_CAP_DIAG_HEADER_TOC_SIZE;
@@ -2127,7 +2670,7 @@ static int wdc_do_cap_diag(int fd, char *file, __u32 xfer_size, int type, int da
 	} else if ((type == WDC_TELEMETRY_TYPE_HOST) ||
 			(type == WDC_TELEMETRY_TYPE_CONTROLLER)) {
 		/* Get the desired telemetry log page */
-		ret = wdc_do_cap_telemetry_log(fd, file, xfer_size, type, data_area);
+		ret = wdc_do_cap_telemetry_log(fd, file, xfer_size, type, data_area, resume);
 	} else
 		fprintf(stderr, "%s: ERROR : Invalid type : %d\n", __func__, type);
 
@@ -2136,7 +2679,8 @@ out:
 	return ret;
 }
 
-static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, int verbose, __u64 file_size, __u64 offset)
+static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, bool fixed_xfer, int data_area, int verbose,
+		__u64 file_size, __u64 offset, bool resume)
 {
 	int ret = 0;
 	__u32 dui_log_hdr_size = WDC_NVME_CAP_DUI_HEADER_SIZE;
@@ -2145,13 +2689,17 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 	__u32 cap_dui_length;
 	__u64 cap_dui_length_v3;
 	__u64 cap_dui_length_v4;
-	__u8 *dump_data = NULL;
-	__u8 *buffer_addr;
 	__s64 total_size = 0;
-	int i;
 	int j;
 	bool last_xfer = false;
-	int err = 0, output = 0;
+	int err = 0, output = -1;
+	struct wdc_dump dump = {
+		.fd = fd,
+		.xfer = xfer_size,
+		.fixed_xfer = fixed_xfer,
+		.verbose = verbose,
+		.read = wdc_dump_dui_read_v2,
+	};
 
 	log_hdr = (struct wdc_dui_log_hdr *) malloc(dui_log_hdr_size);
 	if (log_hdr == NULL) {
@@ -2173,7 +2721,6 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 	if ((log_hdr->hdr_version & 0xFF) == 0x00 ||
         (log_hdr->hdr_version & 0xFF) == 0x01)	{
 		__s32 log_size = 0;
-		__u32 curr_data_offset = 0;
 
 		cap_dui_length = le32_to_cpu(log_hdr->log_size);
 
@@ -2207,23 +2754,14 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 
 			total_size = log_size;
 
-			dump_data = (__u8 *) malloc(sizeof (__u8) * xfer_size);
-			if (dump_data == NULL) {
-				fprintf(stderr, "%s: ERROR : dump data V1 malloc failed : status %s, size = 0x%x\n",
-						__func__, strerror(errno), (unsigned int)xfer_size);
-				ret = -1;
-				goto out;
-			}
-			memset(dump_data, 0, sizeof (__u8) * xfer_size);
-
-			output = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			output = wdc_dump_open_output(file, resume);
 			if (output < 0) {
-				fprintf(stderr, "%s: Failed to open output file %s: %s!\n",
-						__func__, file, strerror(errno));
 				ret = output;
-				goto free_mem;
+				goto out;
 			}
 
+			dump.resume = resume && wdc_dui_resume_match(output, log_hdr, 0);
+
 			/* write the telemetry and log headers into the dump_file */
 			err = write(output, (void *)log_hdr, WDC_NVME_CAP_DUI_HEADER_SIZE);
 			if (err != WDC_NVME_CAP_DUI_HEADER_SIZE) {
@@ -2231,43 +2769,19 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 				goto free_mem;
 			}
 
-			log_size -= WDC_NVME_CAP_DUI_HEADER_SIZE;
-			curr_data_offset = WDC_NVME_CAP_DUI_HEADER_SIZE;
-			i = 0;
-			buffer_addr = dump_data;
-
-			for(; log_size > 0; log_size -= xfer_size) {
-				xfer_size = min(xfer_size, log_size);
-
-				if (log_size <= xfer_size)
-					last_xfer = true;
-
-				ret = wdc_dump_dui_data(fd, xfer_size, curr_data_offset, buffer_addr, last_xfer);
-				if (ret != 0) {
-					fprintf(stderr, "%s: ERROR : WDC : Get chunk %d, size = 0x%"PRIx64", offset = 0x%x, addr = %p\n",
-							__func__, i, (uint64_t)log_size, curr_data_offset, buffer_addr);
-					fprintf(stderr, "%s: ERROR : WDC : NVMe Status:%s(%x)\n", __func__, nvme_status_to_string(ret), ret);
-					break;
-				}
-
-				/* write the dump data into the file */
-				err = write(output, (void *)buffer_addr, xfer_size);
-				if (err != xfer_size) {
-					fprintf(stderr, "%s: ERROR : WDC : Failed to flush DUI data to file! chunk %d, err = 0x%x, xfer_size = 0x%x\n",
-							__func__, i, err, xfer_size);
-					goto free_mem;
-				}
-
-				curr_data_offset += xfer_size;
-				i++;
-			}
+			dump.out = output;
+			dump.offset = WDC_NVME_CAP_DUI_HEADER_SIZE;
+			dump.file_offset = WDC_NVME_CAP_DUI_HEADER_SIZE;
+			if (log_size > WDC_NVME_CAP_DUI_HEADER_SIZE)
+				dump.length = log_size - WDC_NVME_CAP_DUI_HEADER_SIZE;
+			dump.read = wdc_dump_dui_read;
+			ret = wdc_dump_chunked(&dump);
 		}
 	}
 	else if (((log_hdr->hdr_version & 0xFF) == 0x02) ||
 		((log_hdr->hdr_version & 0xFF) == 0x03)) {					/* Process Version 2 or 3 header */
 		__s64 log_size = 0;
 		__u64 curr_data_offset = 0;
-		__u64 xfer_size_long = (__u64)xfer_size;
 
 		log_hdr_v3 = (struct wdc_dui_log_hdr_v3 *)log_hdr;
 
@@ -2311,21 +2825,10 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 				goto out;
 			}
 
-			dump_data = (__u8 *) malloc(sizeof (__u8) * xfer_size_long);
-			if (dump_data == NULL) {
-				fprintf(stderr, "%s: ERROR : dump data v3 malloc failed : status %s, size = 0x%"PRIx64"\n",
-						__func__, strerror(errno), (uint64_t)xfer_size_long);
-				ret = -1;
-				goto out;
-			}
-			memset(dump_data, 0, sizeof (__u8) * xfer_size_long);
-
-			output = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			output = wdc_dump_open_output(file, resume);
 			if (output < 0) {
-				fprintf(stderr, "%s: Failed to open output file %s: %s!\n",
-						__func__, file, strerror(errno));
 				ret = output;
-				goto free_mem;
+				goto out;
 			}
 
 			curr_data_offset = 0;
@@ -2345,34 +2848,12 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 
 			}
 
-			i = 0;
-			buffer_addr = dump_data;
-
-			for(; log_size > 0; log_size -= xfer_size_long) {
-				xfer_size_long = min(xfer_size_long, log_size);
-
-				if (log_size <= xfer_size_long)
-					last_xfer = true;
-
-				ret = wdc_dump_dui_data_v2(fd, (__u32)xfer_size_long, curr_data_offset, buffer_addr, last_xfer);
-				if (ret != 0) {
-					fprintf(stderr, "%s: ERROR : WDC : Get chunk %d, size = 0x%"PRIx64", offset = 0x%"PRIx64", addr = %p\n",
-							__func__, i, (uint64_t)total_size, (uint64_t)curr_data_offset, buffer_addr);
-					fprintf(stderr, "%s: ERROR : WDC : NVMe Status:%s(%x)\n", __func__, nvme_status_to_string(ret), ret);
-					break;
-				}
-
-				/* write the dump data into the file */
-				err = write(output, (void *)buffer_addr, xfer_size_long);
-				if (err != xfer_size_long) {
-					fprintf(stderr, "%s: ERROR : WDC : Failed to flush DUI data to file! chunk %d, err = 0x%x, xfer_size = 0x%"PRIx64"\n",
-							__func__, i, err, (uint64_t)xfer_size_long);
-					goto free_mem;
-				}
-
-				curr_data_offset += xfer_size_long;
-				i++;
-			}
+			dump.out = output;
+			dump.offset = curr_data_offset;
+			dump.length = log_size > 0 ? log_size : 0;
+			dump.resume = resume && wdc_dui_resume_match(output, log_hdr,
+							curr_data_offset);
+			ret = wdc_dump_chunked(&dump);
 		}
 	}
 	else if ((log_hdr->hdr_version & 0xFF) == 0x04)	{
@@ -2380,7 +2861,6 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 		__u64 curr_data_offset = 0;
 		struct wdc_dui_log_hdr_v4 *log_hdr_v4;
 		log_hdr_v4 = (struct wdc_dui_log_hdr_v4 *)log_hdr;
-		__s64 xfer_size_long = (__s64)xfer_size;
 		__s64 section_size_bytes = 0;
 
 		cap_dui_length_v4 = le64_to_cpu(log_hdr_v4->log_size_sectors) * WDC_NVME_SN730_SECTOR_SIZE;
@@ -2425,21 +2905,10 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 				goto out;
 			}
 
-			dump_data = (__u8 *) malloc(sizeof (__u8) * xfer_size_long);
-			if (dump_data == NULL) {
-				fprintf(stderr, "%s: ERROR : dump data V4 malloc failed : status %s, size = 0x%x\n",
-						__func__, strerror(errno), (unsigned int)xfer_size_long);
-				ret = -1;
-				goto out;
-			}
-			memset(dump_data, 0, sizeof (__u8) * xfer_size_long);
-
-			output = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			output = wdc_dump_open_output(file, resume);
 			if (output < 0) {
-				fprintf(stderr, "%s: Failed to open output file %s: %s!\n",
-						__func__, file, strerror(errno));
 				ret = output;
-				goto free_mem;
+				goto out;
 			}
 
 			curr_data_offset = 0;
@@ -2459,34 +2928,12 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 
 			}
 
-			i = 0;
-			buffer_addr = dump_data;
-
-			for(; log_size > 0; log_size -= xfer_size_long) {
-				xfer_size_long = min(xfer_size_long, log_size);
-
-				if (log_size <= xfer_size_long)
-					last_xfer = true;
-
-				ret = wdc_dump_dui_data_v2(fd, (__u32)xfer_size_long, curr_data_offset, buffer_addr, last_xfer);
-				if (ret != 0) {
-					fprintf(stderr, "%s: ERROR : WDC : Get chunk %d, size = 0x%"PRIx64", offset = 0x%"PRIx64", addr = %p\n",
-							__func__, i, (uint64_t)log_size, (uint64_t)curr_data_offset, buffer_addr);
-					fprintf(stderr, "%s: ERROR : WDC : NVMe Status:%s(%x)\n", __func__, nvme_status_to_string(ret), ret);
-					break;
-				}
-
-				/* write the dump data into the file */
-				err = write(output, (void *)buffer_addr, xfer_size_long);
-				if (err != xfer_size_long) {
-					fprintf(stderr, "%s: ERROR : WDC : Failed to flush DUI data to file! chunk %d, err = 0x%x, xfer_size_long = 0x%"PRIx64"\n",
-							__func__, i, err, (uint64_t)xfer_size_long);
-					goto free_mem;
-				}
-
-				curr_data_offset += xfer_size_long;
-				i++;
-			}
+			dump.out = output;
+			dump.offset = curr_data_offset;
+			dump.length = log_size > 0 ? log_size : 0;
+			dump.resume = resume && wdc_dui_resume_match(output, log_hdr,
+							curr_data_offset);
+			ret = wdc_dump_chunked(&dump);
 		}
 	}
 	else {
@@ -2500,8 +2947,8 @@ static int wdc_do_cap_dui(int fd, char *file, __u32 xfer_size, int data_area, in
 		fprintf(stderr, "INFO : WDC : Capture Device Unit Info log, length = 0x%"PRIx64"\n", (uint64_t)total_size);
 
  free_mem:
-	close(output);
-	free(dump_data);
+	if (output >= 0)
+		close(output);
 
  out:
 	free(log_hdr);
@@ -2552,7 +2999,7 @@ static int wdc_cap_diag(int argc, char **argv, struct command *command,
 
 	capabilities = wdc_get_drive_capabilities(fd);
 	if ((capabilities & WDC_DRIVE_CAP_CAP_DIAG) == WDC_DRIVE_CAP_CAP_DIAG)
-		return wdc_do_cap_diag(fd, f, xfer_size, 0, 0);
+		return wdc_do_cap_diag(fd, f, xfer_size, 0, 0, false);
 
 	fprintf(stderr, "ERROR : WDC: unsupported device for this command\n");
 	return 0;
@@ -2799,6 +3246,7 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 	char *offset = "Output file data offset. Currently only supported on the SN340 device.";
 	char *type = "Telemetry type - NONE, HOST, or CONTROLLER. Currently only supported on the SN640 and SN840 devices.";
 	char *verbose = "Display more debug messages.";
+	char *resume = "Keep the data already in the output file and retrieve the rest.";
 	char f[PATH_MAX] = {0};
 	char fileSuffix[PATH_MAX] = {0};
 	__u32 xfer_size = 0;
@@ -2816,6 +3264,7 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 		__u64 offset;
 		char *type;
 		int verbose;
+		int resume;
 	};
 
 	struct config cfg = {
@@ -2826,6 +3275,7 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 		.offset = 0,
 		.type = NULL,
 		.verbose = 0,
+		.resume = 0,
 	};
 
 	OPT_ARGS(opts) = {
@@ -2836,6 +3286,7 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 		OPT_LONG("offset",        'e', &cfg.offset,    offset),
 		OPT_FILE("type",          't', &cfg.type,      type),
 		OPT_FLAG("verbose",       'v', &cfg.verbose,   verbose),
+		OPT_FLAG("resume",        'r', &cfg.resume,    resume),
 		OPT_END()
 	};
 
@@ -2856,7 +3307,7 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 		int verify_file;
 
 		/* verify the passed in file name and path is valid before getting the dump data */
-		verify_file = open(cfg.file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		verify_file = open(cfg.file, O_WRONLY | O_CREAT | (cfg.resume ? 0 : O_TRUNC), 0666);
 		if (verify_file < 0) {
 			fprintf(stderr, "ERROR : WDC: open : %s\n", strerror(errno));
 			return -1;
@@ -2911,7 +3362,8 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 			return -1;
 		}
 
-		return wdc_do_cap_diag(fd, f, xfer_size, telemetry_type, telemetry_data_area);
+		return wdc_do_cap_diag(fd, f, xfer_size, telemetry_type, telemetry_data_area,
+				cfg.resume);
 	}
 	if ((capabilities & WDC_DRIVE_CAP_DUI) == WDC_DRIVE_CAP_DUI) {
 		if (cfg.data_area == 0) {
@@ -2921,10 +3373,12 @@ static int wdc_vs_internal_fw_log(int argc, char **argv, struct command *command
 		/* FW requirement - xfer size must be 256k for data area 4 */
 		if (cfg.data_area >= 4)
 			xfer_size = 0x40000;
-		return wdc_do_cap_dui(fd, f, xfer_size, cfg.data_area, cfg.verbose, cfg.file_size, cfg.offset);
+		return wdc_do_cap_dui(fd, f, xfer_size, cfg.data_area >= 4, cfg.data_area, cfg.verbose,
+				cfg.file_size, cfg.offset, cfg.resume);
 	}
 	if ((capabilities & WDC_DRIVE_CAP_DUI_DATA) == WDC_DRIVE_CAP_DUI_DATA)
-		return wdc_do_cap_dui(fd, f, xfer_size, WDC_NVME_DUI_MAX_DATA_AREA, cfg.verbose, 0, 0);
+		return wdc_do_cap_dui(fd, f, xfer_size, false, WDC_NVME_DUI_MAX_DATA_AREA, cfg.verbose,
+				0, 0, cfg.resume);
 	if ((capabilities & WDC_SN730B_CAP_VUC_LOG) == WDC_SN730B_CAP_VUC_LOG)
 		return wdc_do_sn730_get_and_tar(fd, f);
 
@@ -3243,15 +3697,66 @@ static const char* wdc_purge_mon_status_to_string(__u32 status)
 	return str;
 }
 
+static int wdc_progress_purge(struct nvme_progress *p)
+{
+	__u8 output[WDC_NVME_PURGE_MONITOR_DATA_LEN];
+	struct wdc_nvme_purge_monitor_data *mon;
+	struct nvme_passthru_cmd admin_cmd;
+	__u32 total;
+	int ret;
+
+	memset(output, 0, sizeof (output));
+	memset(&admin_cmd, 0, sizeof (admin_cmd));
+	admin_cmd.opcode = WDC_NVME_PURGE_MONITOR_OPCODE;
+	admin_cmd.addr = (__u64)(uintptr_t)output;
+	admin_cmd.data_len = WDC_NVME_PURGE_MONITOR_DATA_LEN;
+	admin_cmd.cdw10 = WDC_NVME_PURGE_MONITOR_CMD_CDW10;
+	admin_cmd.timeout_ms = WDC_NVME_PURGE_MONITOR_TIMEOUT;
+
+	ret = nvme_submit_admin_passthru(p->fd, &admin_cmd);
+	if (ret)
+		return ret;
+
+	mon = (struct wdc_nvme_purge_monitor_data *) output;
+	switch (admin_cmd.result) {
+	case WDC_NVME_PURGE_STATE_BUSY:
+		total = le32_to_cpu(mon->entire_progress_total);
+		if (total)
+			p->percent = (double)le32_to_cpu(
+				mon->entire_progress_current) * 100 / total;
+		break;
+	case WDC_NVME_PURGE_STATE_IDLE:
+	case WDC_NVME_PURGE_STATE_DONE:
+		p->done = true;
+		break;
+	default:
+		p->done = true;
+		p->result = -EIO;
+		p->state = wdc_purge_mon_status_to_string(admin_cmd.result);
+	}
+	return 0;
+}
+
 static int wdc_purge(int argc, char **argv,
 		struct command *command, struct plugin *plugin)
 {
 	const char *desc = "Send a Purge command.";
+	const char *wait = "Wait for the purge to complete.";
+	struct nvme_progress p;
 	char *err_str;
 	int fd, ret;
 	struct nvme_passthru_cmd admin_cmd;
 
+	struct config {
+		int wait;
+	};
+
+	struct config cfg = {
+		.wait = 0,
+	};
+
 	OPT_ARGS(opts) = {
+		OPT_FLAG("wait", 'w', &cfg.wait, wait),
 		OPT_END()
 	};
 
@@ -3283,6 +3788,11 @@ static int wdc_purge(int argc, char **argv,
 
 	fprintf(stderr, "%s", err_str);
 	fprintf(stderr, "NVMe Status:%s(%x)\n", nvme_status_to_string(ret), ret);
+	if (!ret && cfg.wait) {
+		nvme_progress_init(&p, devicename, fd, "purge",
+				   wdc_progress_purge);
+		ret = nvme_progress_wait(&p, 1, stdout);
+	}
 	return ret;
 }
 
@@ -4522,7 +5032,7 @@ static int wdc_get_c0_log_page(int fd, char *format, int uuid_index)
 	int i = 0;
 	__u8 *data;
 	__u32 *cust_id;
-	uint32_t device_id, read_vendor_id;
+	uint32_t device_id = -1, read_vendor_id = -1;
 
 	if (!wdc_check_device(fd))
 		return -1;
@@ -4532,7 +5042,7 @@ static int wdc_get_c0_log_page(int fd, char *format, int uuid_index)
 		return fmt;
 	}
 
-	ret = wdc_get_pci_ids(&device_id, &read_vendor_id);
+	ret = wdc_get_pci_ids(fd, &device_id, &read_vendor_id);
 
 	switch (device_id) {
 
@@ -4764,7 +5274,7 @@ static int wdc_get_ca_log_page(int fd, char *format)
 	__u8 *data;
 	__u32 *cust_id;
 	struct wdc_ssd_ca_perf_stats *perf;
-	uint32_t read_device_id, read_vendor_id;
+	uint32_t read_device_id = -1, read_vendor_id = -1;
 
 	if (!wdc_check_device(fd))
 		return -1;
@@ -4785,7 +5295,7 @@ static int wdc_get_ca_log_page(int fd, char *format)
 		return -1;
 	}
 
-	ret = wdc_get_pci_ids(&read_device_id, &read_vendor_id);
+	ret = wdc_get_pci_ids(fd, &read_device_id, &read_vendor_id);
 
 	cust_id = (__u32*)data;
 
@@ -0,0 +1,357 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements waiting for operations which continue in the
+ * background after their command completed, like sanitize and device
+ * self-test, on any number of devices at once. Every device is polled
+ * at an interval of a tenth of its estimated remaining time, so a long
+ * operation is polled rarely and a nearly finished one often.
+ *
+ * Right after the command the device may still report the outcome of an
+ * earlier operation. A completed state only counts once the operation
+ * was seen in progress, or once it differs from the one read before the
+ * command was submitted, see nvme_progress_prepare().
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "progress.h"
+#include "common.h"
+
+#define PROGRESS_MIN_INTERVAL	1.0
+#define PROGRESS_MAX_INTERVAL	60.0
+
+/* short device self-test takes at most two minutes */
+#define PROGRESS_SHORT_DST_TIME	120
+
+/*
+ * How long an unchanged completed state is taken for the outcome of an
+ * earlier operation, rather than of one which finished before the first
+ * poll.
+ */
+#define PROGRESS_START_TIME	10.0
+
+static double progress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void progress_print_time(FILE *out, double secs)
+{
+	long s = secs + 0.5;
+
+	fprintf(out, "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+}
+
+static __u64 progress_hash(const void *data, size_t len)
+{
+	const __u8 *b = data;
+	__u64 h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ b[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+int nvme_progress_sanitize(struct nvme_progress *p)
+{
+	struct nvme_sanitize_log_page log;
+	__u32 est;
+	int err;
+
+	err = nvme_sanitize_log(p->fd, false, &log);
+	if (err)
+		return err;
+
+	p->percent = le16_to_cpu(log.progress) * 100.0 / 65536;
+	p->outcome = le16_to_cpu(log.status) |
+		(__u64)le32_to_cpu(log.cdw10_info) << 16;
+	switch (le16_to_cpu(log.status) & NVME_SANITIZE_LOG_STATUS_MASK) {
+	case NVME_SANITIZE_LOG_IN_PROGESS:
+		p->running = true;
+		break;
+	case NVME_SANITIZE_LOG_COMPLETED_SUCCESS:
+	case NVME_SANITIZE_LOG_ND_COMPLETED_SUCCESS:
+		p->done = true;
+		break;
+	case NVME_SANITIZE_LOG_COMPLETED_FAILED:
+		p->done = true;
+		p->result = -EIO;
+		p->state = "failed";
+		break;
+	default:
+		p->done = true;
+		p->result = -EIO;
+		p->state = "never sanitized";
+		break;
+	}
+
+	switch (p->arg) {
+	case NVME_SANITIZE_ACT_OVERWRITE:
+		est = le32_to_cpu(log.est_ovrwrt_time);
+		break;
+	case NVME_SANITIZE_ACT_BLOCK_ERASE:
+		est = le32_to_cpu(log.est_blk_erase_time);
+		break;
+	case NVME_SANITIZE_ACT_CRYPTO_ERASE:
+		est = le32_to_cpu(log.est_crypto_erase_time);
+		break;
+	default:
+		est = 0xffffffff;
+	}
+	p->estimate = est == 0xffffffff ? -1 : (long)est;
+	return 0;
+}
+
+int nvme_progress_self_test(struct nvme_progress *p)
+{
+	struct nvme_self_test_log log;
+	struct nvme_id_ctrl ctrl;
+	__u8 res;
+	int err;
+
+	err = nvme_self_test_log(p->fd, sizeof(log), &log);
+	if (err)
+		return err;
+
+	/* a new result moves the older ones down */
+	p->outcome = progress_hash(log.result, sizeof(log.result));
+	p->running = log.crnt_dev_selftest_oprn & 0xf;
+	switch (log.crnt_dev_selftest_oprn & 0xf) {
+	case 0:
+		p->done = true;
+		res = log.result[0].dsts & NVME_ST_RES_MASK;
+		if (res != NVME_ST_RES_NO_ERR && res != NVME_ST_RES_NOT_USED) {
+			p->result = -EIO;
+			p->state = res == NVME_ST_RES_ABORTED ?
+				"aborted" : "failed";
+		}
+		return 0;
+	case NVME_ST_CODE_SHORT_OP:
+		p->estimate = PROGRESS_SHORT_DST_TIME;
+		break;
+	case NVME_ST_CODE_EXT_OP:
+		if (p->estimate < 0 && !nvme_identify_ctrl(p->fd, &ctrl) &&
+		    ctrl.edstt)
+			p->estimate = le16_to_cpu(ctrl.edstt) * 60;
+		break;
+	}
+	p->percent = log.crnt_dev_selftest_compln;
+	return 0;
+}
+
+int nvme_progress_format(struct nvme_progress *p)
+{
+	struct nvme_id_ns ns;
+	int err;
+
+	err = nvme_identify_ns(p->fd, p->nsid, false, &ns);
+	if (err)
+		return err;
+
+	/* Format NVM only completes once the format is done */
+	p->running = true;
+
+	/* format progress indicator: bit 7 supported, percent remaining */
+	if (!(ns.fpi & 0x80) || !(ns.fpi & 0x7f)) {
+		p->done = true;
+		return 0;
+	}
+	p->percent = 100 - (ns.fpi & 0x7f);
+	return 0;
+}
+
+void nvme_progress_init(struct nvme_progress *p, const char *dev, int fd,
+			const char *what, int (*poll)(struct nvme_progress *))
+{
+	memset(p, 0, sizeof(*p));
+	p->dev = dev;
+	p->fd = fd;
+	p->what = what;
+	p->poll = poll;
+	p->nsid = NVME_NSID_ALL;
+	p->estimate = -1;
+}
+
+/*
+ * Reads the state of the device before the command starting the operation
+ * is submitted, so the outcome of an earlier operation is not mistaken
+ * for the new one.
+ */
+void nvme_progress_prepare(struct nvme_progress *p)
+{
+	p->have_before = !p->poll(p);
+	p->before = p->outcome;
+	p->percent = 0;
+	p->estimate = -1;
+	p->done = false;
+	p->result = 0;
+	p->state = NULL;
+}
+
+/*
+ * Remaining seconds from the device estimate of the whole operation, or
+ * extrapolated from the progress made since the first poll; negative if
+ * unknown.
+ */
+static double progress_remaining(struct nvme_progress *p, double now)
+{
+	double rate;
+
+	if (p->estimate >= 0 && p->percent > 0)
+		return p->estimate * (100 - p->percent) / 100;
+	if (p->estimate >= 0)
+		return max(p->estimate - (now - p->start), 0.0);
+	if (p->first_time < 0 || p->percent <= p->first_percent)
+		return -1;
+	rate = (p->percent - p->first_percent) / (now - p->first_time);
+	return (100 - p->percent) / rate;
+}
+
+static void progress_poll(struct nvme_progress *p, double now, FILE *out)
+{
+	double remaining;
+	int err;
+
+	p->running = false;
+	err = p->poll(p);
+	if (err) {
+		if (err < 0)
+			err = -errno;
+		fprintf(out, "%s: %s progress: %s\n", basename((char *)p->dev),
+			p->what, err < 0 ? strerror(-err) :
+			nvme_status_to_string(err));
+		fflush(out);
+		p->done = true;
+		p->result = err;
+		return;
+	}
+
+	if (p->running)
+		p->started = true;
+	if (p->done && !p->started && p->have_before &&
+	    p->outcome == p->before && now - p->start < PROGRESS_START_TIME) {
+		/* still the earlier operation, the new one is not reported */
+		p->done = false;
+		p->result = 0;
+		p->state = NULL;
+		p->next = now + PROGRESS_MIN_INTERVAL;
+		return;
+	}
+
+	fprintf(out, "%s: %s ", basename((char *)p->dev), p->what);
+	if (p->done) {
+		fprintf(out, "%s after ", p->result ?
+			(p->state ?: "failed") : "completed");
+		progress_print_time(out, now - p->start);
+		fprintf(out, "\n");
+		fflush(out);
+		return;
+	}
+
+	if (p->first_time < 0) {
+		p->first_time = now;
+		p->first_percent = p->percent;
+	}
+	remaining = progress_remaining(p, now);
+	fprintf(out, "%.1f%%", p->percent);
+	if (remaining >= 0) {
+		fprintf(out, ", ");
+		progress_print_time(out, remaining);
+		fprintf(out, " remaining");
+		p->interval = remaining / 10;
+	} else {
+		p->interval *= 2;
+	}
+	fprintf(out, "\n");
+	fflush(out);
+
+	p->interval = min(max(p->interval, PROGRESS_MIN_INTERVAL),
+			  PROGRESS_MAX_INTERVAL);
+	p->next = now + p->interval;
+}
+
+/*
+ * Polls every operation until all of them are done. Returns 0 if all
+ * succeeded, otherwise the result of the first one which did not.
+ */
+int nvme_progress_wait(struct nvme_progress *p, int nr, FILE *out)
+{
+	int i, pending = nr, err = 0;
+	struct timespec ts;
+	double now, next;
+
+	now = progress_now();
+	for (i = 0; i < nr; i++) {
+		p[i].start = p[i].next = now;
+		p[i].interval = PROGRESS_MIN_INTERVAL / 2;
+		p[i].first_time = -1;
+		if (p[i].done)
+			pending--;
+	}
+
+	while (pending) {
+		now = progress_now();
+		next = now + PROGRESS_MAX_INTERVAL;
+		for (i = 0; i < nr; i++) {
+			if (p[i].done)
+				continue;
+			if (p[i].next <= now) {
+				progress_poll(&p[i], now, out);
+				if (p[i].done) {
+					pending--;
+					continue;
+				}
+			}
+			next = min(next, p[i].next);
+		}
+		if (!pending)
+			break;
+
+		now = progress_now();
+		if (next > now) {
+			ts.tv_sec = next - now;
+			ts.tv_nsec = (next - now - ts.tv_sec) * 1e9;
+			while (nanosleep(&ts, &ts) && errno == EINTR)
+				;
+		}
+	}
+
+	for (i = 0; i < nr && !err; i++)
+		err = p[i].result;
+	if (err < 0)
+		errno = -err;
+	return err;
+}
+
+int (*nvme_progress_poller(const char *cmd))(struct nvme_progress *)
+{
+	if (!strcmp(cmd, "sanitize"))
+		return nvme_progress_sanitize;
+	if (!strcmp(cmd, "device-self-test"))
+		return nvme_progress_self_test;
+	if (!strcmp(cmd, "format"))
+		return nvme_progress_format;
+	return NULL;
+}
@@ -0,0 +1,49 @@
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <linux/types.h>
+
+/*
+ * A long running operation on one device, watched by nvme_progress_wait().
+ * The poll callback reads the device's progress and fills in percent,
+ * estimate and, once the operation is over, done and result.
+ */
+struct nvme_progress {
+	const char *dev;
+	const char *what;	/* name of the operation, e.g. "sanitize" */
+	int fd;
+	__u32 nsid;
+	int arg;		/* operation specific, e.g. the sanitize action */
+	int (*poll)(struct nvme_progress *p);
+
+	double percent;
+	long estimate;		/* seconds the whole operation takes, or -1 */
+	bool done;
+	int result;		/* 0 if the operation succeeded */
+	const char *state;	/* why it failed, if known */
+	bool running;		/* the operation is reported in progress */
+	__u64 outcome;		/* identifies the last operation completed */
+
+	/* used by nvme_progress_wait() */
+	double start, next, interval;
+	double first_time, first_percent;
+	bool started;		/* reported in progress since it was submitted */
+	bool have_before;
+	__u64 before;		/* outcome before it was submitted */
+};
+
+int nvme_progress_sanitize(struct nvme_progress *p);
+int nvme_progress_self_test(struct nvme_progress *p);
+int nvme_progress_format(struct nvme_progress *p);
+
+void nvme_progress_init(struct nvme_progress *p, const char *dev, int fd,
+			const char *what, int (*poll)(struct nvme_progress *));
+void nvme_progress_prepare(struct nvme_progress *p);
+int nvme_progress_wait(struct nvme_progress *p, int nr, FILE *out);
+
+/* the poll function for a built-in command, NULL if it can not wait */
+int (*nvme_progress_poller(const char *cmd))(struct nvme_progress *);
+
+#endif
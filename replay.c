@@ -0,0 +1,606 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements replaying the passthrough commands recorded with
+ * NVME_RECORD=<file> against a device, and comparing the latencies of
+ * the replay, or of a second recording, with the original run.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "nvme-print.h"
+#include "replay.h"
+#include "common.h"
+#include "util/argconfig.h"
+
+struct replay_cmd {
+	struct nvme_record_cmd rec;
+	void *out;	/* data sent to the controller */
+	void *in;	/* data the controller returned */
+};
+
+struct replay_log {
+	struct replay_cmd *cmds;
+	int nr_cmds;
+};
+
+/* outcome of running a recorded command again */
+struct replay_run {
+	__u64 duration_ns;
+	int status;
+	bool data_differs;
+	bool skipped;	/* may change the device, not replayed */
+};
+
+static void replay_free_log(struct replay_log *log)
+{
+	int i;
+
+	for (i = 0; i < log->nr_cmds; i++) {
+		free(log->cmds[i].out);
+		free(log->cmds[i].in);
+	}
+	free(log->cmds);
+}
+
+static int replay_read_data(FILE *f, __u32 len, void **buf)
+{
+	if (!len)
+		return 0;
+	*buf = malloc(len);
+	if (!*buf)
+		return -ENOMEM;
+	if (fread(*buf, 1, len, f) != len)
+		return -EIO;
+	return 0;
+}
+
+static int replay_read_log(const char *path, struct replay_log *log)
+{
+	struct nvme_record_file_hdr hdr;
+	struct replay_cmd *cmds, *cmd;
+	int err = 0, alloc = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		return -errno;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, NVME_RECORD_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != 1 || hdr.rec_size != sizeof(cmd->rec)) {
+		fprintf(stderr, "%s is not a command recording\n", path);
+		err = -EINVAL;
+		goto close;
+	}
+
+	while (1) {
+		if (log->nr_cmds == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			cmds = realloc(log->cmds, alloc * sizeof(*cmds));
+			if (!cmds) {
+				err = -ENOMEM;
+				break;
+			}
+			log->cmds = cmds;
+		}
+		cmd = &log->cmds[log->nr_cmds];
+		memset(cmd, 0, sizeof(*cmd));
+		if (fread(&cmd->rec, sizeof(cmd->rec), 1, f) != 1)
+			break;
+		log->nr_cmds++;
+		err = replay_read_data(f, cmd->rec.out_len, &cmd->out);
+		if (!err)
+			err = replay_read_data(f, cmd->rec.in_len, &cmd->in);
+		if (err) {
+			fprintf(stderr, "%s: command %d is truncated\n", path,
+				log->nr_cmds - 1);
+			break;
+		}
+	}
+close:
+	fclose(f);
+	return err;
+}
+
+static __u64 replay_now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void replay_sleep_until(__u64 ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000ULL,
+		.tv_nsec = ns % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static int replay_issue(int fd, struct replay_cmd *cmd, struct replay_run *run)
+{
+	struct nvme_record_cmd *rec = &cmd->rec;
+	struct nvme_passthru_cmd64 c = {
+		.opcode		= rec->opcode,
+		.flags		= rec->flags,
+		.nsid		= rec->nsid,
+		.cdw2		= rec->cdw2,
+		.cdw3		= rec->cdw3,
+		.metadata_len	= rec->metadata_len,
+		.data_len	= rec->data_len,
+		.cdw10		= rec->cdw[0],
+		.cdw11		= rec->cdw[1],
+		.cdw12		= rec->cdw[2],
+		.cdw13		= rec->cdw[3],
+		.cdw14		= rec->cdw[4],
+		.cdw15		= rec->cdw[5],
+		.timeout_ms	= rec->timeout_ms,
+	};
+	void *data = NULL, *metadata = NULL;
+	__u64 start;
+	int err;
+
+	if (rec->data_len) {
+		data = calloc(1, rec->data_len);
+		if (!data)
+			return -ENOMEM;
+		if (rec->out_len)
+			memcpy(data, cmd->out, min(rec->out_len, rec->data_len));
+	}
+	if (rec->metadata_len) {
+		metadata = calloc(1, rec->metadata_len);
+		if (!metadata) {
+			free(data);
+			return -ENOMEM;
+		}
+	}
+	c.addr = (__u64)(uintptr_t)data;
+	c.metadata = (__u64)(uintptr_t)metadata;
+
+	start = replay_now_ns(CLOCK_MONOTONIC_RAW);
+	switch (rec->queue) {
+	case NVME_TRACE_ADMIN:
+		err = nvme_submit_admin_passthru(fd,
+					(struct nvme_passthru_cmd *)&c);
+		break;
+	case NVME_TRACE_IO:
+		err = nvme_submit_io_passthru(fd,
+					(struct nvme_passthru_cmd *)&c);
+		break;
+	default:
+		err = nvme_submit_io_passthru64(fd, &c);
+		break;
+	}
+	run->duration_ns = replay_now_ns(CLOCK_MONOTONIC_RAW) - start;
+	run->status = err < 0 ? -errno : err;
+	run->data_differs = !run->status && rec->in_len &&
+		memcmp(data, cmd->in, rec->in_len);
+
+	free(data);
+	free(metadata);
+	return 0;
+}
+
+/*
+ * Commands which only read data or state. Everything else, including
+ * vendor specific commands, may change the device and is only replayed
+ * with --force. Log specific fields of Get Log Page create telemetry
+ * snapshots or persistent event log contexts, so those are left out too.
+ */
+static bool replay_cmd_is_read_only(struct nvme_record_cmd *rec)
+{
+	if (rec->queue != NVME_TRACE_ADMIN) {
+		switch (rec->opcode) {
+		case nvme_cmd_read:
+		case nvme_cmd_compare:
+		case nvme_cmd_verify:
+		case nvme_cmd_resv_report:
+		case nvme_zns_cmd_mgmt_recv:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	switch (rec->opcode) {
+	case nvme_admin_get_log_page:
+		return !((rec->cdw[0] >> 8) & 0xf);
+	case nvme_admin_identify:
+	case nvme_admin_get_features:
+	case nvme_admin_directive_recv:
+	case nvme_admin_nvme_mi_recv:
+	case nvme_admin_security_recv:
+	case nvme_admin_get_lba_status:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int replay_log(int fd, struct replay_log *log, bool paced, bool force,
+		      struct replay_run *runs)
+{
+	__u64 base = replay_now_ns(CLOCK_MONOTONIC);
+	__u64 first = log->nr_cmds ? log->cmds[0].rec.start_ns : 0;
+	int i, err;
+
+	for (i = 0; i < log->nr_cmds; i++) {
+		if (!force && !replay_cmd_is_read_only(&log->cmds[i].rec)) {
+			runs[i].skipped = true;
+			continue;
+		}
+		if (paced)
+			replay_sleep_until(base + log->cmds[i].rec.start_ns -
+					   first);
+		err = replay_issue(fd, &log->cmds[i], &runs[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/* a second recording of the same sequence serves as the replay */
+static int replay_from_log(struct replay_log *log, struct replay_log *other,
+			   struct replay_run *runs)
+{
+	struct replay_cmd *a, *b;
+	int i;
+
+	if (log->nr_cmds != other->nr_cmds) {
+		fprintf(stderr, "recordings have %d and %d commands\n",
+			log->nr_cmds, other->nr_cmds);
+		return -EINVAL;
+	}
+	for (i = 0; i < log->nr_cmds; i++) {
+		a = &log->cmds[i];
+		b = &other->cmds[i];
+		if (a->rec.queue != b->rec.queue ||
+		    a->rec.opcode != b->rec.opcode) {
+			fprintf(stderr, "recordings differ at command %d\n", i);
+			return -EINVAL;
+		}
+		runs[i].duration_ns = b->rec.duration_ns;
+		runs[i].status = b->rec.status;
+		runs[i].data_differs = a->rec.in_len != b->rec.in_len ||
+			(a->rec.in_len && memcmp(a->in, b->in, a->rec.in_len));
+	}
+	return 0;
+}
+
+static const char *replay_queue(__u8 queue)
+{
+	return queue == NVME_TRACE_ADMIN ? "admin" : "io";
+}
+
+static void replay_show_skipped(struct replay_log *log,
+				struct replay_run *runs)
+{
+	struct nvme_record_cmd *rec, *prev;
+	int i, j, count;
+
+	for (i = 0; i < log->nr_cmds; i++) {
+		rec = &log->cmds[i].rec;
+		if (!runs[i].skipped)
+			continue;
+		/* report every opcode once, where it was first skipped */
+		for (j = 0; j < i; j++) {
+			prev = &log->cmds[j].rec;
+			if (runs[j].skipped && prev->queue == rec->queue &&
+			    prev->opcode == rec->opcode)
+				break;
+		}
+		if (j < i)
+			continue;
+		for (count = 0, j = i; j < log->nr_cmds; j++)
+			if (runs[j].skipped &&
+			    log->cmds[j].rec.queue == rec->queue &&
+			    log->cmds[j].rec.opcode == rec->opcode)
+				count++;
+		fprintf(stderr, "skipped %d %s command%s with opcode 0x%02x\n",
+			count, replay_queue(rec->queue), count == 1 ? "" : "s",
+			rec->opcode);
+	}
+}
+
+static double replay_delta(__u64 before, __u64 after)
+{
+	return before ? ((double)after - before) * 100 / before : 0;
+}
+
+struct replay_summary {
+	__u8 queue;
+	__u8 opcode;
+	int count;
+	__u64 before_ns;
+	__u64 after_ns;
+	int status_mismatches;
+	int data_mismatches;
+};
+
+static int replay_summarize(struct replay_log *log, struct replay_run *runs,
+			    struct replay_summary **summary)
+{
+	struct replay_summary *s = NULL, *e;
+	struct nvme_record_cmd *rec;
+	int i, j, n = 0;
+
+	for (i = 0; i < log->nr_cmds; i++) {
+		rec = &log->cmds[i].rec;
+		if (runs[i].skipped)
+			continue;
+		for (j = 0; j < n; j++)
+			if (s[j].queue == rec->queue && s[j].opcode == rec->opcode)
+				break;
+		if (j == n) {
+			e = realloc(s, (n + 1) * sizeof(*s));
+			if (!e) {
+				free(s);
+				return -ENOMEM;
+			}
+			s = e;
+			memset(&s[n++], 0, sizeof(*s));
+			s[j].queue = rec->queue;
+			s[j].opcode = rec->opcode;
+		}
+		s[j].count++;
+		s[j].before_ns += rec->duration_ns;
+		s[j].after_ns += runs[i].duration_ns;
+		if (runs[i].status != rec->status)
+			s[j].status_mismatches++;
+		if (runs[i].data_differs)
+			s[j].data_mismatches++;
+	}
+	*summary = s;
+	return n;
+}
+
+static void replay_show_normal(struct replay_log *log, struct replay_run *runs,
+			       struct replay_summary *s, int n, bool verbose)
+{
+	struct nvme_record_cmd *rec;
+	__u64 before = 0, after = 0;
+	int i, count = 0;
+
+	if (verbose) {
+		printf("%6s %-5s %-4s %12s %12s %8s\n", "seq", "queue", "op",
+		       "recorded_ns", "replayed_ns", "delta");
+		for (i = 0; i < log->nr_cmds; i++) {
+			rec = &log->cmds[i].rec;
+			if (runs[i].skipped) {
+				printf("%6d %-5s 0x%02x %12llu %12s\n", i,
+				       replay_queue(rec->queue), rec->opcode,
+				       (unsigned long long)rec->duration_ns,
+				       "skipped");
+				continue;
+			}
+			printf("%6d %-5s 0x%02x %12llu %12llu %+7.1f%%", i,
+			       replay_queue(rec->queue), rec->opcode,
+			       (unsigned long long)rec->duration_ns,
+			       (unsigned long long)runs[i].duration_ns,
+			       replay_delta(rec->duration_ns,
+					    runs[i].duration_ns));
+			if (runs[i].status != rec->status)
+				printf(" status %#x != %#x", runs[i].status,
+				       rec->status);
+			if (runs[i].data_differs)
+				printf(" data differs");
+			printf("\n");
+		}
+		printf("\n");
+	}
+
+	printf("%-5s %-4s %8s %14s %14s %8s %8s %8s\n", "queue", "op", "count",
+	       "recorded_avg", "replayed_avg", "delta", "status", "data");
+	for (i = 0; i < n; i++) {
+		printf("%-5s 0x%02x %8d %14llu %14llu %+7.1f%% %8d %8d\n",
+		       replay_queue(s[i].queue), s[i].opcode, s[i].count,
+		       (unsigned long long)(s[i].before_ns / s[i].count),
+		       (unsigned long long)(s[i].after_ns / s[i].count),
+		       replay_delta(s[i].before_ns, s[i].after_ns),
+		       s[i].status_mismatches, s[i].data_mismatches);
+		before += s[i].before_ns;
+		after += s[i].after_ns;
+		count += s[i].count;
+	}
+	printf("total %d commands, %llu ns recorded, %llu ns replayed "\
+	       "(%+.1f%%)\n", count, (unsigned long long)before,
+	       (unsigned long long)after, replay_delta(before, after));
+}
+
+static void replay_show_json(struct replay_log *log, struct replay_run *runs,
+			     struct replay_summary *s, int n, bool verbose)
+{
+	struct json_object *root, *cmds, *summary, *o;
+	struct nvme_record_cmd *rec;
+	int i;
+
+	root = json_create_object();
+	if (verbose) {
+		cmds = json_create_array();
+		for (i = 0; i < log->nr_cmds; i++) {
+			rec = &log->cmds[i].rec;
+			o = json_create_object();
+			json_object_add_value_uint(o, "seq", i);
+			json_object_add_value_string(o, "queue",
+						     replay_queue(rec->queue));
+			json_object_add_value_uint(o, "opcode", rec->opcode);
+			json_object_add_value_uint(o, "recorded_ns",
+						   rec->duration_ns);
+			json_object_add_value_int(o, "skipped",
+						  runs[i].skipped);
+			if (runs[i].skipped) {
+				json_array_add_value_object(cmds, o);
+				continue;
+			}
+			json_object_add_value_uint(o, "replayed_ns",
+						   runs[i].duration_ns);
+			json_object_add_value_int(o, "recorded_status",
+						  rec->status);
+			json_object_add_value_int(o, "replayed_status",
+						  runs[i].status);
+			json_object_add_value_int(o, "data_differs",
+						  runs[i].data_differs);
+			json_array_add_value_object(cmds, o);
+		}
+		json_object_add_value_array(root, "commands", cmds);
+	}
+
+	summary = json_create_array();
+	for (i = 0; i < n; i++) {
+		o = json_create_object();
+		json_object_add_value_string(o, "queue",
+					     replay_queue(s[i].queue));
+		json_object_add_value_uint(o, "opcode", s[i].opcode);
+		json_object_add_value_uint(o, "count", s[i].count);
+		json_object_add_value_uint(o, "recorded_avg_ns",
+					   s[i].before_ns / s[i].count);
+		json_object_add_value_uint(o, "replayed_avg_ns",
+					   s[i].after_ns / s[i].count);
+		json_object_add_value_uint(o, "status_mismatches",
+					   s[i].status_mismatches);
+		json_object_add_value_uint(o, "data_mismatches",
+					   s[i].data_mismatches);
+		json_array_add_value_object(summary, o);
+	}
+	json_object_add_value_array(root, "summary", summary);
+	json_print_object(root, NULL);
+	printf("\n");
+	json_free_object(root);
+}
+
+int nvme_replay(const char *desc, int argc, char **argv)
+{
+	const char *input = "recording to replay (required)";
+	const char *compare = "compare with this recording instead of "\
+		"replaying against a device";
+	const char *pace = "original: keep the recorded command spacing, "\
+		"fast: issue commands back to back (default)";
+	const char *verbose = "show every command";
+	const char *force = "also replay commands which may change data "\
+		"or device state";
+	const char *output_format = "Output format: normal|json";
+	struct replay_log log = { }, other = { };
+	struct replay_summary *summary = NULL;
+	struct replay_run *runs = NULL;
+	enum nvme_print_flags flags;
+	int err, fd = -1, n;
+	bool paced;
+
+	struct config {
+		char *input;
+		char *compare;
+		char *pace;
+		char *output_format;
+		int verbose;
+		int force;
+	};
+
+	struct config cfg = {
+		.input = "",
+		.compare = "",
+		.pace = "fast",
+		.output_format = "normal",
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("input",        'i', &cfg.input,         input),
+		OPT_FILE("compare",      'c', &cfg.compare,       compare),
+		OPT_STRING("pace",       'p', "MODE", &cfg.pace,  pace),
+		OPT_FMT("output-format", 'o', &cfg.output_format, output_format),
+		OPT_FLAG("verbose",      'v', &cfg.verbose,       verbose),
+		OPT_FLAG("force",        'f', &cfg.force,         force),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	err = flags = validate_output_format(cfg.output_format);
+	if (flags < 0)
+		return err;
+	if (flags != JSON && flags != NORMAL) {
+		fprintf(stderr, "Invalid output format\n");
+		return -EINVAL;
+	}
+	if (strcmp(cfg.pace, "fast") && strcmp(cfg.pace, "original")) {
+		fprintf(stderr, "Invalid pace %s\n", cfg.pace);
+		return -EINVAL;
+	}
+	paced = !strcmp(cfg.pace, "original");
+	if (!strlen(cfg.input)) {
+		fprintf(stderr, "Required parameter --input not given\n");
+		return -EINVAL;
+	}
+	if (!strlen(cfg.compare)) {
+		if (optind >= argc) {
+			fprintf(stderr, "Device or --compare required\n");
+			return -EINVAL;
+		}
+		fd = get_dev(argc, argv);
+		if (fd < 0)
+			return fd;
+	}
+
+	err = replay_read_log(cfg.input, &log);
+	if (err)
+		goto free;
+	runs = calloc(log.nr_cmds + 1, sizeof(*runs));
+	if (!runs) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	if (fd < 0) {
+		err = replay_read_log(cfg.compare, &other);
+		if (!err)
+			err = replay_from_log(&log, &other, runs);
+	} else {
+		err = replay_log(fd, &log, paced, cfg.force, runs);
+		if (!err)
+			replay_show_skipped(&log, runs);
+	}
+	if (err)
+		goto free;
+
+	err = n = replay_summarize(&log, runs, &summary);
+	if (n < 0)
+		goto free;
+	err = 0;
+	if (flags == JSON)
+		replay_show_json(&log, runs, summary, n, cfg.verbose);
+	else
+		replay_show_normal(&log, runs, summary, n, cfg.verbose);
+free:
+	free(summary);
+	free(runs);
+	replay_free_log(&other);
+	replay_free_log(&log);
+	if (fd >= 0)
+		close(fd);
+	return err;
+}
@@ -0,0 +1,6 @@
+#ifndef _REPLAY_H
+#define _REPLAY_H
+
+extern int nvme_replay(const char *desc, int argc, char **argv);
+
+#endif
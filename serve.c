@@ -0,0 +1,1122 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License version
+ * 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ *
+ * This file implements a local server which runs sub-commands on
+ * behalf of clients connected to a Unix socket. Requests and responses
+ * are JSON objects, one per line.
+ *
+ * The command handlers keep state in globals, so every request is run
+ * in a child process forked from the server. Devices stay open, and
+ * Identify Controller data and the sysfs topology stay cached in the
+ * server, and children inherit all of them. The server itself does no
+ * device I/O: a child reads Identify data the server is missing and
+ * passes it back. Requests for the same controller are run one at a
+ * time, requests for different controllers run concurrently.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+
+#include "nvme.h"
+#include "nvme-ioctl.h"
+#include "batch.h"
+#include "serve.h"
+#include "common.h"
+#include "util/argconfig.h"
+
+#define SERVE_DEF_JOBS		8
+#define SERVE_MAX_REQUEST	65536
+#define SERVE_MAX_ARGS		128
+#define SERVE_UEVENT_BUF	8192
+#define SERVE_MAX_PENDING	(16 << 20)	/* unsent response bytes */
+
+/* child exit code telling the server to drop its Identify cache */
+#define SERVE_CHILD_ID_DROPPED	1
+
+enum serve_watch_type {
+	WATCH_LISTEN,
+	WATCH_SIGNAL,
+	WATCH_UEVENT,
+	WATCH_CLIENT,
+	WATCH_CHILD,
+};
+
+struct serve_watch {
+	enum serve_watch_type type;
+	void *obj;
+};
+
+struct serve_client {
+	struct serve_watch watch;
+	int fd;
+	char *buf;
+	size_t len;
+	char *out;		/* responses the socket didn't take yet */
+	size_t out_len;
+	bool gone;		/* closed once the event loop is done with it */
+	struct serve_client *next;
+};
+
+struct serve_req {
+	struct serve_watch watch;
+	struct serve_client *client;
+	char *id;		/* raw JSON of the request id */
+	char *plugin;
+	char *command;
+	char **args;
+	int nr_args;
+	char *dev;		/* device argument, if any */
+	char key[32];		/* controller the request is serialized on */
+	pid_t pid;
+	int pipe_fd;
+	int id_fd;		/* Identify data read by the child, if any */
+	int wstatus;
+	bool reaped;
+	char *out;
+	size_t out_len;
+	struct serve_req *next;
+};
+
+struct serve {
+	struct plugin *plugin;
+	int jobs;
+	int running;
+	int listen_fd;
+	int sig_fd;
+	int nl_fd;
+	int epoll_fd;
+	bool stopping;
+	bool aborting;
+	struct serve_watch listen_watch;
+	struct serve_watch sig_watch;
+	struct serve_watch nl_watch;
+	struct serve_client *clients;
+	struct serve_req *queue;
+	struct serve_req *active;
+};
+
+static void free_req(struct serve_req *req)
+{
+	int i;
+
+	for (i = 0; i < req->nr_args; i++)
+		free(req->args[i]);
+	free(req->args);
+	free(req->id);
+	free(req->plugin);
+	free(req->command);
+	free(req->out);
+	if (req->id_fd >= 0)
+		close(req->id_fd);
+	free(req);
+}
+
+static int parse_args(const char **p, struct serve_req *req)
+{
+	char **args;
+	int err;
+
+	if (*(*p)++ != '[')
+		return -EINVAL;
+	batch_skip_ws(p);
+	if (**p == ']') {
+		(*p)++;
+		return 0;
+	}
+	while (1) {
+		if (req->nr_args == SERVE_MAX_ARGS)
+			return -E2BIG;
+		args = realloc(req->args, (req->nr_args + 1) * sizeof(*args));
+		if (!args)
+			return -ENOMEM;
+		req->args = args;
+		batch_skip_ws(p);
+		err = batch_json_parse_string(p, &req->args[req->nr_args]);
+		if (err)
+			return err;
+		req->nr_args++;
+		batch_skip_ws(p);
+		if (**p == ',') {
+			(*p)++;
+			continue;
+		}
+		if (*(*p)++ != ']')
+			return -EINVAL;
+		return 0;
+	}
+}
+
+/*
+ * A request looks like
+ *   {"id": 1, "plugin": "intel", "command": "smart-log-add",
+ *    "args": ["/dev/nvme0", "-o", "json"]}
+ * where id and plugin are optional. Unknown members are ignored.
+ */
+static int parse_request(const char *line, struct serve_req *req)
+{
+	const char *p = line, *start;
+	char *key;
+	int err;
+
+	batch_skip_ws(&p);
+	if (*p++ != '{')
+		return -EINVAL;
+	batch_skip_ws(&p);
+	if (*p == '}')
+		return -EINVAL;
+
+	while (1) {
+		batch_skip_ws(&p);
+		err = batch_json_parse_string(&p, &key);
+		if (err)
+			return err;
+		batch_skip_ws(&p);
+		if (*p++ != ':') {
+			free(key);
+			return -EINVAL;
+		}
+		batch_skip_ws(&p);
+
+		if (!strcmp(key, "id")) {
+			start = p;
+			err = batch_json_skip_value(&p, 0);
+			if (!err) {
+				free(req->id);
+				req->id = strndup(start, p - start);
+				if (!req->id)
+					err = -ENOMEM;
+			}
+		} else if (!strcmp(key, "command")) {
+			free(req->command);
+			req->command = NULL;
+			err = batch_json_parse_string(&p, &req->command);
+		} else if (!strcmp(key, "plugin")) {
+			free(req->plugin);
+			req->plugin = NULL;
+			err = batch_json_parse_string(&p, &req->plugin);
+		} else if (!strcmp(key, "args")) {
+			err = parse_args(&p, req);
+		} else {
+			err = batch_json_skip_value(&p, 0);
+		}
+		free(key);
+		if (err)
+			return err;
+
+		batch_skip_ws(&p);
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+		if (*p++ != '}')
+			return -EINVAL;
+		break;
+	}
+
+	batch_skip_ws(&p);
+	if (*p || !req->command)
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * Commands are serialized per controller, so namespace block devices
+ * map to the controller they belong to. Devices are named by path or
+ * by their name alone, like nvme0.
+ */
+static void req_set_device(struct serve_req *req)
+{
+	int ctrl, ns, i;
+
+	for (i = 0; i < req->nr_args; i++) {
+		if (!strncmp(req->args[i], "/dev/", 5) ||
+		    nvme_dev_name_parse(req->args[i], &ctrl, &ns)) {
+			req->dev = req->args[i];
+			break;
+		}
+	}
+	if (!req->dev)
+		return;
+
+	if (nvme_dev_name_parse(req->dev, &ctrl, &ns))
+		snprintf(req->key, sizeof(req->key), "nvme%d", ctrl);
+	else
+		snprintf(req->key, sizeof(req->key), "%s",
+			 strrchr(req->dev, '/') + 1);
+}
+
+static void write_response(FILE *f, const char *id, int status,
+			   const char *error, struct batch_result *res)
+{
+	fprintf(f, "{\"id\":%s,\"status\":%d", id ?: "null", status);
+	if (error) {
+		fprintf(f, ",\"error\":");
+		batch_print_json_string(f, error, strlen(error));
+	}
+	if (res)
+		batch_print_output(f, res);
+	fprintf(f, "}\n");
+}
+
+static void client_watch(struct serve *srv, struct serve_client *client,
+			 __u32 events)
+{
+	struct epoll_event ev = {
+		.events = events,
+		.data.ptr = &client->watch,
+	};
+
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) < 0)
+		client->gone = true;
+}
+
+/* sends what the socket takes, returns the number of bytes or -1 */
+static ssize_t client_write(struct serve_client *client, const char *buf,
+			    size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = send(client->fd, buf + done, len - done,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/*
+ * Responses the socket doesn't take at once are queued and sent when
+ * the client reads again, so a client which stops reading doesn't stall
+ * the server. A client which lets too much pile up is dropped.
+ */
+static void client_send(struct serve *srv, struct serve_client *client,
+			const char *buf, size_t len)
+{
+	ssize_t n = 0;
+	char *out;
+
+	if (!client || client->gone)
+		return;
+
+	if (!client->out_len) {
+		n = client_write(client, buf, len);
+		if (n < 0) {
+			client->gone = true;
+			return;
+		}
+		if ((size_t)n == len)
+			return;
+	}
+	buf += n;
+	len -= n;
+
+	if (client->out_len + len > SERVE_MAX_PENDING) {
+		client->gone = true;
+		return;
+	}
+	out = realloc(client->out, client->out_len + len);
+	if (!out) {
+		client->gone = true;
+		return;
+	}
+	memcpy(out + client->out_len, buf, len);
+	if (!client->out_len)
+		client_watch(srv, client, EPOLLIN | EPOLLOUT);
+	client->out = out;
+	client->out_len += len;
+}
+
+static void write_client(struct serve *srv, struct serve_client *client)
+{
+	ssize_t n;
+
+	n = client_write(client, client->out, client->out_len);
+	if (n < 0) {
+		client->gone = true;
+		return;
+	}
+	client->out_len -= n;
+	memmove(client->out, client->out + n, client->out_len);
+	if (!client->out_len)
+		client_watch(srv, client, EPOLLIN);
+}
+
+static void send_error(struct serve *srv, struct serve_client *client,
+		       const char *id, int status, const char *error)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return;
+	write_response(f, id, status, error, NULL);
+	fclose(f);
+	client_send(srv, client, buf, len);
+	free(buf);
+}
+
+/* read the Identify data the server is missing and pass it back */
+static int child_identify(struct serve_req *req, int id_fd)
+{
+	struct nvme_id_ctrl id;
+	int fd, err;
+
+	fd = nvme_dev_cache_open(req->dev);
+	if (fd < 0)
+		return fd;
+	err = nvme_identify_ctrl(fd, &id);
+	close(fd);
+	if (err)
+		return err;
+	return write(id_fd, &id, sizeof(id)) == sizeof(id) ? 0 : -EIO;
+}
+
+static void __attribute__((noreturn))
+run_child(struct serve *srv, struct serve_req *req, int fd, int id_fd)
+{
+	char *argv[SERVE_MAX_ARGS + 3];
+	unsigned int gen = nvme_identify_cache_generation();
+	struct batch_result res;
+	char *buf = NULL;
+	size_t len = 0;
+	sigset_t mask;
+	int argc = 0, i, err;
+	FILE *f;
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	if (id_fd >= 0) {
+		child_identify(req, id_fd);
+		close(id_fd);
+	}
+
+	if (req->plugin)
+		argv[argc++] = req->plugin;
+	argv[argc++] = req->command;
+	for (i = 0; i < req->nr_args; i++)
+		argv[argc++] = req->args[i];
+	argv[argc] = NULL;
+
+	err = batch_exec(srv->plugin, argc, argv, &res);
+
+	f = open_memstream(&buf, &len);
+	if (f) {
+		if (err)
+			write_response(f, req->id, err, strerror(-err), NULL);
+		else
+			write_response(f, req->id, res.status, NULL, &res);
+		fclose(f);
+	}
+	while (buf && len) {
+		ssize_t n = write(fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		buf += n;
+		len -= n;
+	}
+
+	_exit(gen != nvme_identify_cache_generation() ?
+	      SERVE_CHILD_ID_DROPPED : 0);
+}
+
+static int start_req(struct serve *srv, struct serve_req *req)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	int fds[2], id_fds[2] = { -1, -1 }, fd, err;
+
+	/*
+	 * Keep the device open for later. Opening it does no I/O, reading
+	 * Identify data does and is left to the child.
+	 */
+	if (req->dev) {
+		fd = nvme_dev_cache_open(req->dev);
+		if (fd >= 0) {
+			if (!nvme_identify_cache_has(fd) &&
+			    pipe2(id_fds, O_CLOEXEC | O_NONBLOCK) < 0)
+				id_fds[0] = id_fds[1] = -1;
+			close(fd);
+		}
+	}
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		err = -errno;
+		goto close_id;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	req->pid = fork();
+	if (req->pid < 0) {
+		err = -errno;
+		close(fds[0]);
+		close(fds[1]);
+		goto close_id;
+	}
+	if (!req->pid) {
+		close(fds[0]);
+		if (id_fds[0] >= 0)
+			close(id_fds[0]);
+		run_child(srv, req, fds[1], id_fds[1]);
+	}
+
+	close(fds[1]);
+	if (id_fds[1] >= 0)
+		close(id_fds[1]);
+	req->id_fd = id_fds[0];
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	req->pipe_fd = fds[0];
+	req->watch.type = WATCH_CHILD;
+	req->watch.obj = req;
+	ev.data.ptr = &req->watch;
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, req->pipe_fd, &ev);
+
+	req->next = srv->active;
+	srv->active = req;
+	srv->running++;
+	return 0;
+
+close_id:
+	if (id_fds[0] >= 0) {
+		close(id_fds[0]);
+		close(id_fds[1]);
+	}
+	return err;
+}
+
+static bool dev_busy(struct serve *srv, struct serve_req *req)
+{
+	struct serve_req *r;
+
+	if (!req->key[0])
+		return false;
+	for (r = srv->active; r; r = r->next)
+		if (!strcmp(r->key, req->key))
+			return true;
+	return false;
+}
+
+/* start queued requests, in order, as jobs and devices become free */
+static void dispatch(struct serve *srv)
+{
+	struct serve_req **pp = &srv->queue, *req;
+	int err;
+
+	/* list-style commands in the children find the topology cached */
+	if (*pp && srv->running < srv->jobs)
+		nvme_topology_cache_refresh();
+
+	while (*pp && srv->running < srv->jobs) {
+		req = *pp;
+		if (dev_busy(srv, req)) {
+			pp = &req->next;
+			continue;
+		}
+		*pp = req->next;
+		err = start_req(srv, req);
+		if (err) {
+			send_error(srv, req->client, req->id, err,
+				   strerror(-err));
+			free_req(req);
+		}
+	}
+}
+
+static void queue_req(struct serve *srv, struct serve_req *req)
+{
+	struct serve_req **pp;
+
+	for (pp = &srv->queue; *pp; pp = &(*pp)->next)
+		;
+	req->next = NULL;
+	*pp = req;
+}
+
+/* cache the Identify data the child read, it has exited by now */
+static void serve_cache_identify(struct serve_req *req)
+{
+	struct nvme_id_ctrl id;
+	int fd;
+
+	if (read(req->id_fd, &id, sizeof(id)) != sizeof(id))
+		return;
+	fd = nvme_dev_cache_open(req->dev);
+	if (fd < 0)
+		return;
+	nvme_identify_cache_add(fd, &id);
+	close(fd);
+}
+
+static void finish_req(struct serve *srv, struct serve_req *req)
+{
+	struct serve_req **pp;
+	char msg[64];
+
+	if (req->pipe_fd >= 0 || !req->reaped)
+		return;
+
+	if (WIFEXITED(req->wstatus) &&
+	    WEXITSTATUS(req->wstatus) == SERVE_CHILD_ID_DROPPED) {
+		/* the command may have changed the controller */
+		nvme_identify_cache_enable(false);
+		nvme_identify_cache_enable(true);
+	} else if (req->id_fd >= 0) {
+		serve_cache_identify(req);
+	}
+
+	if (req->out_len) {
+		client_send(srv, req->client, req->out, req->out_len);
+	} else {
+		if (WIFSIGNALED(req->wstatus))
+			snprintf(msg, sizeof(msg), "command killed by signal %d",
+				 WTERMSIG(req->wstatus));
+		else
+			snprintf(msg, sizeof(msg), "command returned no result");
+		send_error(srv, req->client, req->id, -EIO, msg);
+	}
+
+	for (pp = &srv->active; *pp; pp = &(*pp)->next) {
+		if (*pp == req) {
+			*pp = req->next;
+			break;
+		}
+	}
+	srv->running--;
+	free_req(req);
+}
+
+static void read_child(struct serve *srv, struct serve_req *req)
+{
+	char buf[4096], *out;
+	ssize_t n;
+
+	while ((n = read(req->pipe_fd, buf, sizeof(buf))) > 0) {
+		out = realloc(req->out, req->out_len + n);
+		if (!out)
+			break;
+		memcpy(out + req->out_len, buf, n);
+		req->out = out;
+		req->out_len += n;
+	}
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, req->pipe_fd, NULL);
+	close(req->pipe_fd);
+	req->pipe_fd = -1;
+	finish_req(srv, req);
+}
+
+static void reap_children(struct serve *srv)
+{
+	struct serve_req *req;
+	int wstatus;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+		for (req = srv->active; req; req = req->next) {
+			if (req->pid != pid)
+				continue;
+			req->wstatus = wstatus;
+			req->reaped = true;
+			finish_req(srv, req);
+			break;
+		}
+	}
+}
+
+static void handle_line(struct serve *srv, struct serve_client *client,
+			char *line)
+{
+	struct serve_req *req;
+	int err;
+
+	batch_skip_ws((const char **)&line);
+	if (!*line)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req) {
+		send_error(srv, client, NULL, -ENOMEM, "out of memory");
+		return;
+	}
+	req->client = client;
+	req->pipe_fd = -1;
+	req->id_fd = -1;
+
+	err = parse_request(line, req);
+	if (err) {
+		send_error(srv, client, req->id, err, "invalid request");
+		free_req(req);
+		return;
+	}
+	if (!req->plugin && (!strcmp(req->command, "serve") ||
+			     !strcmp(req->command, "batch") ||
+			     !strcmp(req->command, "monitor"))) {
+		send_error(srv, client, req->id, -EINVAL,
+			   "command not supported by the server");
+		free_req(req);
+		return;
+	}
+
+	req_set_device(req);
+	queue_req(srv, req);
+}
+
+static void close_client(struct serve *srv, struct serve_client *client)
+{
+	struct serve_client **pp;
+	struct serve_req *req;
+
+	/* results of requests still running are dropped */
+	for (req = srv->queue; req; req = req->next)
+		if (req->client == client)
+			req->client = NULL;
+	for (req = srv->active; req; req = req->next)
+		if (req->client == client)
+			req->client = NULL;
+
+	for (pp = &srv->clients; *pp; pp = &(*pp)->next) {
+		if (*pp == client) {
+			*pp = client->next;
+			break;
+		}
+	}
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	free(client->buf);
+	free(client->out);
+	free(client);
+}
+
+static void read_client(struct serve *srv, struct serve_client *client)
+{
+	char *buf, *line, *nl;
+	ssize_t n;
+
+	buf = realloc(client->buf, client->len + 4096 + 1);
+	if (!buf) {
+		close_client(srv, client);
+		return;
+	}
+	client->buf = buf;
+
+	n = read(client->fd, client->buf + client->len, 4096);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n <= 0) {
+		close_client(srv, client);
+		return;
+	}
+	client->len += n;
+	client->buf[client->len] = '\0';
+
+	line = client->buf;
+	while (!client->gone && (nl = strchr(line, '\n'))) {
+		*nl = '\0';
+		handle_line(srv, client, line);
+		line = nl + 1;
+	}
+	client->len -= line - client->buf;
+	memmove(client->buf, line, client->len);
+
+	if (client->len > SERVE_MAX_REQUEST) {
+		send_error(srv, client, NULL, -E2BIG, "request too long");
+		client->gone = true;
+	}
+}
+
+static void accept_client(struct serve *srv)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct serve_client *client;
+	int fd;
+
+	fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	client = calloc(1, sizeof(*client));
+	if (!client) {
+		close(fd);
+		return;
+	}
+	client->fd = fd;
+	client->watch.type = WATCH_CLIENT;
+	client->watch.obj = client;
+	ev.data.ptr = &client->watch;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		close(fd);
+		free(client);
+		return;
+	}
+	client->next = srv->clients;
+	srv->clients = client;
+}
+
+static int serve_listen(struct serve *srv, const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	mode_t mask;
+	int err;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return -ENAMETOOLONG;
+	}
+	strcpy(addr.sun_path, path);
+
+	srv->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (srv->listen_fd < 0) {
+		perror("socket");
+		return -errno;
+	}
+
+	/* replace a socket left behind by an earlier instance, if any */
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		if (!connect(srv->listen_fd, (struct sockaddr *)&addr,
+			     sizeof(addr))) {
+			fprintf(stderr, "%s: a server is already running\n",
+				path);
+			close(srv->listen_fd);
+			srv->listen_fd = -1;
+			return -EADDRINUSE;
+		}
+		unlink(path);
+	}
+
+	mask = umask(0077);
+	err = bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(mask);
+	if (err < 0 || listen(srv->listen_fd, 16) < 0) {
+		perror(path);
+		return -errno;
+	}
+	return 0;
+}
+
+/*
+ * The topology is only cached while uevents tell when controllers and
+ * namespaces come and go.
+ */
+static void serve_open_uevents(struct serve *srv)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,	/* kernel uevents */
+	};
+
+	srv->nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			    NETLINK_KOBJECT_UEVENT);
+	if (srv->nl_fd < 0)
+		return;
+	if (bind(srv->nl_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(srv->nl_fd);
+		srv->nl_fd = -1;
+		return;
+	}
+	nvme_topology_cache_enable(true);
+}
+
+static bool uevent_changes_topology(char *buf, int len)
+{
+	bool add_remove = false, nvme = false;
+	char *p;
+
+	/* the first string is the "action@devpath" summary */
+	for (p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+		if (!strcmp(p, "ACTION=add") || !strcmp(p, "ACTION=remove"))
+			add_remove = true;
+		else if (!strncmp(p, "SUBSYSTEM=nvme", 14) ||
+			 !strncmp(p, "DEVNAME=nvme", 12))
+			nvme = true;
+	}
+	return add_remove && nvme;
+}
+
+static void read_uevents(struct serve *srv)
+{
+	char buf[SERVE_UEVENT_BUF];
+	struct sockaddr_nl addr;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+	struct msghdr hdr = {
+		.msg_name = &addr,
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	ssize_t len;
+
+	if (srv->nl_fd < 0)
+		return;
+	while (1) {
+		hdr.msg_namelen = sizeof(addr);
+		len = recvmsg(srv->nl_fd, &hdr, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == ENOBUFS) {
+				/* uevents were lost */
+				nvme_topology_cache_invalidate();
+				continue;
+			}
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		/* only trust messages sent by the kernel */
+		if (addr.nl_pid != 0 || !len)
+			continue;
+		buf[len] = '\0';
+		if (uevent_changes_topology(buf, len))
+			nvme_topology_cache_invalidate();
+	}
+}
+
+static int serve_setup(struct serve *srv)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	srv->sig_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (srv->sig_fd < 0) {
+		perror("signalfd");
+		return -errno;
+	}
+
+	srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (srv->epoll_fd < 0) {
+		perror("epoll_create1");
+		return -errno;
+	}
+
+	srv->listen_watch.type = WATCH_LISTEN;
+	ev.data.ptr = &srv->listen_watch;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev) < 0)
+		return -errno;
+
+	srv->sig_watch.type = WATCH_SIGNAL;
+	ev.data.ptr = &srv->sig_watch;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->sig_fd, &ev) < 0)
+		return -errno;
+
+	serve_open_uevents(srv);
+	srv->nl_watch.type = WATCH_UEVENT;
+	ev.data.ptr = &srv->nl_watch;
+	if (srv->nl_fd >= 0 &&
+	    epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->nl_fd, &ev) < 0) {
+		nvme_topology_cache_enable(false);
+		close(srv->nl_fd);
+		srv->nl_fd = -1;
+	}
+	return 0;
+}
+
+static void handle_signals(struct serve *srv)
+{
+	struct signalfd_siginfo si;
+
+	while (read(srv->sig_fd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo == SIGCHLD) {
+			reap_children(srv);
+			continue;
+		}
+		/*
+		 * stop accepting requests and let running ones finish, a
+		 * second signal doesn't wait for clients to read responses
+		 */
+		if (srv->stopping)
+			srv->aborting = true;
+		srv->stopping = true;
+	}
+}
+
+static bool serve_sending(struct serve *srv)
+{
+	struct serve_client *client;
+
+	for (client = srv->clients; client; client = client->next)
+		if (client->out_len && !client->gone)
+			return !srv->aborting;
+	return false;
+}
+
+static void close_gone_clients(struct serve *srv)
+{
+	struct serve_client *client, *next;
+
+	for (client = srv->clients; client; client = next) {
+		next = client->next;
+		if (client->gone)
+			close_client(srv, client);
+	}
+}
+
+static int serve_loop(struct serve *srv)
+{
+	struct epoll_event events[16];
+	struct serve_watch *w;
+	int i, n;
+
+	while (!srv->stopping || srv->active || serve_sending(srv)) {
+		n = epoll_wait(srv->epoll_fd, events, ARRAY_SIZE(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			return -errno;
+		}
+
+		for (i = 0; i < n; i++) {
+			w = events[i].data.ptr;
+			switch (w->type) {
+			case WATCH_LISTEN:
+				if (!srv->stopping)
+					accept_client(srv);
+				break;
+			case WATCH_SIGNAL:
+				handle_signals(srv);
+				break;
+			case WATCH_UEVENT:
+				read_uevents(srv);
+				break;
+			case WATCH_CLIENT:
+				if (events[i].events & EPOLLOUT)
+					write_client(srv, w->obj);
+				if (events[i].events & ~EPOLLOUT)
+					read_client(srv, w->obj);
+				/* the client may be gone, events are stale */
+				i = n;
+				break;
+			case WATCH_CHILD:
+				read_child(srv, w->obj);
+				i = n;
+				break;
+			}
+		}
+		close_gone_clients(srv);
+		if (!srv->stopping) {
+			/* see devices a finished command added or removed */
+			read_uevents(srv);
+			dispatch(srv);
+		}
+	}
+	return 0;
+}
+
+static void serve_cleanup(struct serve *srv, const char *path)
+{
+	struct serve_req *req;
+
+	while (srv->clients)
+		close_client(srv, srv->clients);
+	while (srv->queue) {
+		req = srv->queue;
+		srv->queue = req->next;
+		free_req(req);
+	}
+	if (srv->epoll_fd >= 0)
+		close(srv->epoll_fd);
+	if (srv->sig_fd >= 0)
+		close(srv->sig_fd);
+	if (srv->nl_fd >= 0)
+		close(srv->nl_fd);
+	if (srv->listen_fd >= 0) {
+		close(srv->listen_fd);
+		unlink(path);
+	}
+	nvme_dev_cache_enable(false);
+	nvme_identify_cache_enable(false);
+	nvme_topology_cache_enable(false);
+}
+
+int nvme_serve(const char *desc, int argc, char **argv,
+	       struct plugin *plugin)
+{
+	const char *socket_path = "path of the Unix socket to listen on";
+	const char *jobs = "maximum number of requests run concurrently "\
+		"(default 8)";
+	struct serve srv = {
+		.plugin = plugin,
+		.listen_fd = -1,
+		.sig_fd = -1,
+		.nl_fd = -1,
+		.epoll_fd = -1,
+	};
+	int err;
+
+	struct config {
+		char *socket;
+		int jobs;
+	};
+
+	struct config cfg = {
+		.socket = NULL,
+		.jobs = SERVE_DEF_JOBS,
+	};
+
+	OPT_ARGS(opts) = {
+		OPT_FILE("socket", 's', &cfg.socket, socket_path),
+		OPT_INT("jobs",    'j', &cfg.jobs,   jobs),
+		OPT_END()
+	};
+
+	err = argconfig_parse(argc, argv, desc, opts);
+	if (err)
+		return err;
+
+	if (!cfg.socket) {
+		fprintf(stderr, "a socket path (--socket) is required\n");
+		return -EINVAL;
+	}
+	srv.jobs = cfg.jobs > 0 ? cfg.jobs : 1;
+
+	nvme_dev_cache_enable(true);
+	nvme_identify_cache_enable(true);
+
+	err = serve_listen(&srv, cfg.socket);
+	if (!err)
+		err = serve_setup(&srv);
+	if (!err)
+		err = serve_loop(&srv);
+
+	serve_cleanup(&srv, cfg.socket);
+	return err;
+}
@@ -0,0 +1,9 @@
+#ifndef _SERVE_H
+#define _SERVE_H
+
+#include "plugin.h"
+
+extern int nvme_serve(const char *desc, int argc, char **argv,
+		      struct plugin *plugin);
+
+#endif
@@ -0,0 +1,79 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" nvme batch against the mock device :-
+
+    1. Run a batch of commands with JSON and with plain output.
+    2. Every command gets one record with its line number and status,
+       JSON output embedded as "output", other output as "stdout".
+    3. batch, serve and monitor cannot be run from a batch.
+"""
+
+import json
+import unittest
+
+from nvme_mock import TestNVMeMock
+
+
+class TestNVMeBatch(TestNVMeMock):
+
+    """ Represents nvme batch test on a mock device. """
+
+    def test_batch(self):
+        """ Testcase main """
+        self.add_ctrl(0, nsids=[1])
+        cmds = [
+            "# comment and empty lines are skipped",
+            "",
+            "id-ctrl /dev/nvme0 -o json",
+            "nvme id-ctrl /dev/nvme0",
+            "get-log /dev/nvme0 --log-id=0xc0 --log-len=16",
+            "batch",
+            "nvme serve --socket=/nonexistent/sock",
+            "monitor",
+        ]
+        proc = self.nvme("batch", input="\n".join(cmds) + "\n")
+        self.assertEqual(proc.returncode, 1)
+        recs = [json.loads(line) for line in proc.stdout.splitlines()]
+        self.assertEqual([r["line"] for r in recs], list(range(3, 9)))
+        self.assertEqual([r["command"] for r in recs], cmds[2:])
+
+        self.assertEqual(recs[0]["status"], 0)
+        self.assertEqual(recs[0]["output"]["sn"].strip(), "MOCK0000")
+        self.assertNotIn("stdout", recs[0])
+
+        self.assertEqual(recs[1]["status"], 0)
+        self.assertIn("sn        : MOCK0000", recs[1]["stdout"])
+        self.assertNotIn("output", recs[1])
+
+        # no log-c0.bin fixture: Invalid Field
+        self.assertNotEqual(recs[2]["status"], 0)
+
+        for rec in recs[3:]:
+            self.assertNotEqual(rec["status"], 0)
+            self.assertEqual(rec["stdout"], "")
+            self.assertNotEqual(rec["stderr"], "")
+
+    def test_stop_on_error(self):
+        """ Testcase --stop-on-error """
+        self.add_ctrl(0)
+        proc = self.nvme("batch", "--stop-on-error", input="batch\n"
+                         "id-ctrl /dev/nvme0\n")
+        self.assertEqual(proc.returncode, 1)
+        self.assertEqual(len(proc.stdout.splitlines()), 1)
+
+
+if __name__ == "__main__":
+    unittest.main()
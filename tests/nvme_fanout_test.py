@@ -0,0 +1,84 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" nvme --all and --all-namespaces against the mock device :-
+
+    Two subsystems, the first with one controller and two namespaces,
+    the second with two controllers sharing one namespace:
+
+    1. --all runs the command once per controller.
+    2. --all-namespaces runs it once per namespace, a shared namespace
+       only once.
+    3. With -o json the results are one JSON array in device order.
+    4. Without it every output line is prefixed by the device, and the
+       exit status is non-zero if the command failed on any device.
+"""
+
+import json
+import unittest
+
+from nvme_mock import TestNVMeMock
+
+
+class TestNVMeFanout(TestNVMeMock):
+
+    """ Represents nvme --all test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeFanout. """
+        super().setUp()
+        self.add_ctrl(0, nsids=[1, 2])
+        self.add_ctrl(1, nsids=[1])
+        self.add_ctrl(2, nsids=[1], subsys=1)
+
+    def test_all(self):
+        """ Testcase --all """
+        proc = self.nvme("--all", "id-ctrl", "-o", "json")
+        self.assertEqual(proc.returncode, 0)
+        res = json.loads(proc.stdout)
+        self.assertEqual([r["device"] for r in res],
+                         ["/dev/nvme0", "/dev/nvme1", "/dev/nvme2"])
+        self.assertEqual([r["status"] for r in res], [0, 0, 0])
+        self.assertEqual([r["output"]["sn"].strip() for r in res],
+                         ["MOCK0000", "MOCK0001", "MOCK0002"])
+
+    def test_all_namespaces(self):
+        """ Testcase --all-namespaces """
+        proc = self.nvme("--all-namespaces", "id-ns", "-o", "json")
+        self.assertEqual(proc.returncode, 0)
+        res = json.loads(proc.stdout)
+        self.assertEqual([r["device"] for r in res],
+                         ["/dev/nvme0n1", "/dev/nvme0n2", "/dev/nvme1n1"])
+        for r in res:
+            self.assertEqual(r["status"], 0)
+            self.assertEqual(r["output"]["nsze"], 1 << 20)
+
+    def test_all_failure(self):
+        """ Testcase --all with a command failing on some devices """
+        self.write("log-c0.bin", b"x" * 16, "nvme1")
+        proc = self.nvme("--all", "get-log", "--log-id=0xc0",
+                         "--log-len=16")
+        self.assertEqual(proc.returncode, 1)
+        lines = proc.stdout.splitlines()
+        self.assertTrue(lines)
+        for line in lines:
+            self.assertTrue(line.startswith("nvme1: "), line)
+        self.assertIn('"xxxxxxxxxxxxxxxx"', proc.stdout)
+        self.assertIn("nvme0: ", proc.stderr)
+        self.assertIn("nvme2: ", proc.stderr)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,124 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" nvme feature-snapshot and feature-diff against the mock device :-
+
+    1. Save a snapshot of the features which don't fail, with the data
+       buffer of the APST feature.
+    2. Compare the device with its snapshot: nothing differs.
+    3. Change a value and a data byte: both differ, unless excluded.
+    4. A feature missing from the profile only differs with --strict.
+    5. Compare two snapshots without a device.
+"""
+
+import unittest
+
+from nvme_mock import TestNVMeMock
+
+SNAPSHOT = """0x02 current 0x00000004
+0x07 current 0x00010001
+0x0c current 0x00000001 010203
+"""
+
+
+class TestNVMeFeatureSnapshot(TestNVMeMock):
+
+    """ Represents nvme feature-snapshot test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeFeatureSnapshot. """
+        super().setUp()
+        self.add_ctrl(0)
+        self.write("feature-02", "0x4")
+        self.write("feature-07", "0x10001")
+        self.write("feature-0c", "1")
+        self.write("feature-0c.bin", b"\x01\x02\x03")
+
+    def snapshot(self, name):
+        """ Save a snapshot of nvme0 and return its path. """
+        path = self.path(name)
+        proc = self.nvme("feature-snapshot", "/dev/nvme0",
+                         "--output-file=" + path)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        return path
+
+    def diff(self, *args):
+        """ Run feature-diff and return the exit status and output. """
+        proc = self.nvme("feature-diff", *args)
+        return proc.returncode, proc.stdout
+
+    def test_snapshot(self):
+        """ Testcase snapshot of the device """
+        proc = self.nvme("feature-snapshot", "/dev/nvme0")
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        lines = proc.stdout.splitlines()
+        self.assertTrue(lines[0].startswith("#"))
+        self.assertEqual("\n".join(lines[1:]) + "\n", SNAPSHOT)
+
+    def test_diff(self):
+        """ Testcase diff of the device with changed features """
+        snap = self.snapshot("a.feat")
+        self.assertEqual(self.diff("/dev/nvme0", "--profile=" + snap),
+                         (0, ""))
+
+        self.write("feature-07", "0x10003")
+        self.write("feature-0c.bin", b"\x01\x02\x04")
+        rc, out = self.diff("/dev/nvme0", "--profile=" + snap)
+        self.assertEqual(rc, 1)
+        self.assertIn("0x07 (Number of Queues) current: 0x00010003, "
+                      "profile 0x00010001", out)
+        self.assertIn("data byte 2 is 0x04, profile 0x03", out)
+        self.assertIn("2 differences", out)
+
+        rc, out = self.diff("/dev/nvme0", "--profile=" + snap,
+                            "--exclude=7,0xc")
+        self.assertEqual((rc, out), (0, ""))
+
+    def test_strict(self):
+        """ Testcase --strict with a partial profile """
+        self.write("profile.feat", "# without Power Management\n"
+                   "0x07 current 0x00010001\n")
+        profile = "--profile=" + self.path("profile.feat")
+        self.assertEqual(self.diff("/dev/nvme0", profile), (0, ""))
+
+        rc, out = self.diff("/dev/nvme0", profile, "--strict")
+        self.assertEqual(rc, 1)
+        self.assertIn("0x02 (Power Management) current: not in profile",
+                      out)
+        self.assertEqual(self.diff("/dev/nvme0", profile, "--strict",
+                                   "--exclude=0x2,0xc"), (0, ""))
+
+    def test_diff_snapshots(self):
+        """ Testcase diff of two snapshots """
+        before = self.snapshot("before.feat")
+        self.write("feature-02", "0x2")
+        after = self.snapshot("after.feat")
+        rc, out = self.diff("--snapshot=" + after, "--profile=" + before)
+        self.assertEqual(rc, 1)
+        self.assertIn("0x02 (Power Management) current: 0x00000002, "
+                      "profile 0x00000004", out)
+        self.assertEqual(self.diff("--snapshot=" + after,
+                                   "--profile=" + after), (0, ""))
+
+        # features only in the profile are reported as missing
+        self.write("partial.feat", "0x07 current 0x00010001\n")
+        rc, out = self.diff("--snapshot=" + self.path("partial.feat"),
+                            "--profile=" + before)
+        self.assertEqual(rc, 1)
+        self.assertIn("0x02 (Power Management) current: missing", out)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,85 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" Hex dump output against the mock device :-
+
+    1. Dump a log page of every length up to a few rows, and a few
+       long ones, with 'nvme get-log'.
+    2. The dump is byte for byte what the original printf based dump
+       printed, which scripts may be parsing. Every caller dumps 16
+       bytes per row in groups of one byte, so that is what is checked.
+"""
+
+import random
+import unittest
+
+from nvme_mock import TestNVMeMock
+
+
+def hexdump(buf, width=16, group=1):
+    """ The dump the original d() printed. """
+    out = "     " + "".join("%3x" % i for i in range(16))
+    ascii = ""
+    for row in range(0, len(buf), width):
+        chunk = buf[row:row + width]
+        out += "\n%04x:" % row
+        for i, byte in enumerate(chunk):
+            out += (" %02x" if (row + i) % group == 0 else "%02x") % byte
+        text = "".join(chr(c) if 0x21 <= c <= 0x7e else "." for c in chunk)
+        if len(chunk) < width:
+            b = width - len(chunk)
+            out += " " + " " * (2 * b + b // group + (1 if b % group else 0))
+            # one character more, left over from the row before
+            if row:
+                text += ascii[len(chunk)]
+        out += ' "%s"' % text
+        ascii = text
+    return out + "\n"
+
+
+class TestNVMeHexdump(TestNVMeMock):
+
+    """ Represents hex dump test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeHexdump. """
+        super().setUp()
+        self.add_ctrl(0)
+        rand = random.Random(0)
+        # printable and unprintable bytes, both edges of the range
+        self.log = bytes(rand.choice(b"\x00\x20\x21\x41\x7e\x7f\xff") if
+                         i % 3 else rand.randrange(256)
+                         for i in range(100003))
+        self.write("log-c0.bin", self.log)
+
+    def dump(self, length):
+        """ Return the dump of the first length bytes of the log. """
+        proc = self.nvme("get-log", "/dev/nvme0", "--log-id=0xc0",
+                         "--log-len=%d" % length)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        header, _, out = proc.stdout.partition("\n")
+        self.assertEqual(header, "Device:nvme0 log-id:192 "
+                         "namespace-id:0xffffffff")
+        return out
+
+    def test_hexdump(self):
+        """ Testcase main """
+        for length in list(range(1, 300)) + [4096, 65552, 100003]:
+            self.assertEqual(self.dump(length), hexdump(self.log[:length]),
+                             "log-len %d" % length)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,117 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" Base class for the testcases run against the mock device :-
+
+    Every testcase gets its own NVME_MOCK fixture directory, see the
+    MOCK DEVICE section of nvme(1), so no NVMe device is needed. The
+    fixtures are built with the helpers below; fixtures of a controller
+    are written to <dir>/<controller>, fixtures shared by all of them
+    to <dir>.
+"""
+
+import os
+import shutil
+import struct
+import subprocess
+import tempfile
+import unittest
+
+SUBSYS = os.path.join("sys", "class", "nvme-subsystem")
+
+
+def id_ctrl(sn, nn=1, elpe=0, lpa=0, oncs=0):
+    """ Build Identify Controller data. """
+    data = bytearray(4096)
+    struct.pack_into("<HH", data, 0, 0x1b36, 0x1af4)
+    data[4:24] = sn.ljust(20).encode()
+    data[24:64] = b"Mock Controller".ljust(40)
+    data[64:72] = b"1.0".ljust(8)
+    data[261] = lpa
+    data[262] = elpe
+    struct.pack_into("<IH", data, 516, nn, oncs)
+    return bytes(data)
+
+
+def id_ns(nsze=1 << 20, lba_shift=9):
+    """ Build Identify Namespace data with a single LBA format. """
+    data = bytearray(4096)
+    struct.pack_into("<QQQ", data, 0, nsze, nsze, nsze // 2)
+    data[130] = lba_shift
+    return bytes(data)
+
+
+class TestNVMeMock(unittest.TestCase):
+
+    """ Represents a testcase run against the mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeMock. """
+        here = os.path.dirname(os.path.abspath(__file__))
+        self.nvme_bin = os.environ.get("NVME_BIN",
+                                       os.path.join(here, "..", "nvme"))
+        self.mock_dir = tempfile.mkdtemp(prefix="nvme-mock-")
+
+    def tearDown(self):
+        """ Post Section for TestNVMeMock. """
+        shutil.rmtree(self.mock_dir, ignore_errors=True)
+
+    def path(self, name, ctrl=None):
+        """ Return the path of a fixture. """
+        if ctrl is None:
+            return os.path.join(self.mock_dir, name)
+        return os.path.join(self.mock_dir, ctrl, name)
+
+    def write(self, name, data, ctrl=None):
+        """ Write a fixture, for a controller or for all of them. """
+        path = self.path(name, ctrl)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "wb" if isinstance(data, bytes) else "w") as f:
+            f.write(data)
+
+    def add_ctrl(self, instance, nsids=(), subsys=None, sn=None):
+        """ Add controller nvme<instance> with the given namespaces to
+            subsystem nvme-subsys<subsys>, by default its own, and write
+            its Identify Controller data. """
+        ctrl = "nvme%d" % instance
+        subsys = instance if subsys is None else subsys
+        sdir = os.path.join(SUBSYS, "nvme-subsys%d" % subsys)
+        self.write(os.path.join(sdir, "subsysnqn"),
+                   "nqn.2014-08.org.nvmexpress:mock%d\n" % subsys)
+        for attr, value in (("transport", "pcie"),
+                            ("address", "0000:00:%02x.0" % instance),
+                            ("state", "live")):
+            self.write(os.path.join(sdir, ctrl, attr), value + "\n")
+        for nsid in nsids:
+            self.write(os.path.join(sdir, "nvme%dn%d" % (subsys, nsid),
+                                    "nsid"), "%d\n" % nsid)
+            self.write(os.path.join(sdir, ctrl, "nvme%dc%dn%d" %
+                                    (subsys, instance, nsid), "nsid"),
+                       "%d\n" % nsid)
+        self.write("identify-01.bin",
+                   id_ctrl(sn or "MOCK%04d" % instance, nn=max(nsids or
+                                                               [1])), ctrl)
+        self.write("identify-00.bin", id_ns(), ctrl)
+        return ctrl
+
+    def nvme(self, *args, **kwargs):
+        """ Run nvme against the mock device and return the completed
+            process, with stdout and stderr as text. """
+        env = dict(os.environ, NVME_MOCK=self.mock_dir)
+        env.update(kwargs.pop("env", {}))
+        return subprocess.run([self.nvme_bin] + list(args), env=env,
+                              stdout=subprocess.PIPE,
+                              stderr=subprocess.PIPE,
+                              universal_newlines=True, **kwargs)
@@ -0,0 +1,160 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" nvme monitor against the mock device :-
+
+    The discovery controller and the controllers it connects exist only
+    in the sysfs tree of an NVME_MOCK fixture directory, so this test
+    needs no NVMe device and no target:
+
+    1. Start 'nvme monitor' on a discovery log with two subsystems, one
+       of them listed twice, and a referral to a second discovery
+       controller whose log lists a third subsystem.
+    2. Each subsystem and both discovery controllers are connected once.
+    3. Drop one subsystem from the log and send SIGHUP.
+    4. Only the controller of the dropped subsystem is removed, the
+       referral is not followed again.
+"""
+
+import os
+import shutil
+import signal
+import struct
+import subprocess
+import tempfile
+import time
+import unittest
+
+DISC_NQN = "nqn.2014-08.org.nvmexpress.discovery"
+NVME_NQN_DISC = 1
+NVME_NQN_NVME = 2
+NVMF_TRTYPE_TCP = 3
+NVMF_ADDR_FAMILY_IP4 = 1
+
+
+def disc_entry(subtype, nqn, traddr, trsvcid):
+    """ Build a 1024 byte discovery log page entry. """
+    entry = bytearray(1024)
+    entry[0] = NVMF_TRTYPE_TCP
+    entry[1] = NVMF_ADDR_FAMILY_IP4
+    entry[2] = subtype
+    entry[32:32 + len(trsvcid)] = trsvcid.encode()
+    entry[256:256 + len(nqn)] = nqn.encode()
+    entry[512:512 + len(traddr)] = traddr.encode()
+    return bytes(entry)
+
+
+def disc_log(genctr, entries):
+    """ Build a discovery log page: the header, then the entries. """
+    hdr = bytearray(1024)
+    struct.pack_into("<QQ", hdr, 0, genctr, len(entries))
+    return bytes(hdr) + b"".join(entries)
+
+
+class TestNVMeMonitor(unittest.TestCase):
+
+    """ Represents nvme monitor test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeMonitor. """
+        here = os.path.dirname(os.path.abspath(__file__))
+        self.nvme_bin = os.environ.get("NVME_BIN",
+                                       os.path.join(here, "..", "nvme"))
+        self.mock_dir = tempfile.mkdtemp(prefix="nvme-monitor-")
+        self.sys_nvme = os.path.join(self.mock_dir, "sys", "class", "nvme")
+        os.makedirs(self.sys_nvme)
+        os.makedirs(os.path.join(self.mock_dir, "nvme0"))
+        self.monitor = None
+
+    def tearDown(self):
+        """ Post Section for TestNVMeMonitor. """
+        if self.monitor and self.monitor.poll() is None:
+            self.monitor.kill()
+            self.monitor.wait()
+        shutil.rmtree(self.mock_dir, ignore_errors=True)
+
+    def write_log(self, ctrl, data):
+        """ Set the discovery log returned by a controller, or by all
+            controllers without their own when ctrl is None. """
+        path = self.mock_dir if ctrl is None else \
+            os.path.join(self.mock_dir, ctrl)
+        with open(os.path.join(path, "log-70.bin"), "wb") as log:
+            log.write(data)
+
+    def controllers(self):
+        """ Return (subsysnqn, address) of all controllers. """
+        ctrls = []
+        for name in sorted(os.listdir(self.sys_nvme)):
+            attrs = []
+            for attr in ("subsysnqn", "address"):
+                with open(os.path.join(self.sys_nvme, name, attr)) as f:
+                    attrs.append(f.read().strip())
+            ctrls.append(tuple(attrs))
+        return sorted(ctrls)
+
+    def wait_for(self, expected, timeout=5):
+        """ Wait until the controllers match expected. """
+        deadline = time.time() + timeout
+        while self.controllers() != expected and time.time() < deadline:
+            time.sleep(0.05)
+        self.assertEqual(self.controllers(), expected)
+
+    def test_monitor_log_change(self):
+        """ Testcase main """
+        port = "traddr=127.0.0.1,trsvcid=4420"
+        referral = "traddr=127.0.0.2,trsvcid=8009"
+        self.write_log("nvme0", disc_log(1, [
+            disc_entry(NVME_NQN_NVME, "nqn.test:a", "127.0.0.1", "4420"),
+            disc_entry(NVME_NQN_NVME, "nqn.test:b", "127.0.0.1", "4420"),
+            disc_entry(NVME_NQN_NVME, "nqn.test:a", "127.0.0.1", "4420"),
+            disc_entry(NVME_NQN_DISC, DISC_NQN, "127.0.0.2", "8009"),
+        ]))
+        self.write_log(None, disc_log(1, [
+            disc_entry(NVME_NQN_NVME, "nqn.test:c", "127.0.0.2", "4420"),
+        ]))
+
+        env = dict(os.environ, NVME_MOCK=self.mock_dir)
+        self.monitor = subprocess.Popen(
+            [self.nvme_bin, "monitor", "--transport=tcp",
+             "--traddr=127.0.0.1", "--trsvcid=8009", "--batch-delay=0"],
+            env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+        self.wait_for(sorted([
+            (DISC_NQN, "traddr=127.0.0.1,trsvcid=8009"),
+            (DISC_NQN, referral),
+            ("nqn.test:a", port),
+            ("nqn.test:b", port),
+            ("nqn.test:c", "traddr=127.0.0.2,trsvcid=4420"),
+        ]))
+
+        self.write_log("nvme0", disc_log(2, [
+            disc_entry(NVME_NQN_NVME, "nqn.test:a", "127.0.0.1", "4420"),
+            disc_entry(NVME_NQN_DISC, DISC_NQN, "127.0.0.2", "8009"),
+        ]))
+        self.monitor.send_signal(signal.SIGHUP)
+
+        self.wait_for(sorted([
+            (DISC_NQN, "traddr=127.0.0.1,trsvcid=8009"),
+            (DISC_NQN, referral),
+            ("nqn.test:a", port),
+            ("nqn.test:c", "traddr=127.0.0.2,trsvcid=4420"),
+        ]))
+
+        self.monitor.send_signal(signal.SIGTERM)
+        self.assertEqual(self.monitor.wait(timeout=5), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,137 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" NVME_RECORD and nvme replay against the mock device :-
+
+    1. Record Identify, Set Features and Get Features in one batch.
+    2. Replay skips Set Features unless --force is given.
+    3. Replay after the Identify data changed reports it as different.
+    4. --compare compares two recordings without a device.
+    5. Commands of the processes --all starts are recorded, and so is
+       the data sent by a bidirectional command.
+"""
+
+import json
+import unittest
+
+from nvme_mock import TestNVMeMock, id_ctrl
+
+NVME_ADMIN_IDENTIFY = 0x06
+NVME_ADMIN_SET_FEATURES = 0x09
+NVME_ADMIN_GET_FEATURES = 0x0a
+
+BATCH = """id-ctrl /dev/nvme0
+set-feature /dev/nvme0 --feature-id=7 --value=0x20002
+get-feature /dev/nvme0 --feature-id=7
+id-ctrl /dev/nvme0
+"""
+
+
+class TestNVMeReplay(TestNVMeMock):
+
+    """ Represents nvme replay test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeReplay. """
+        super().setUp()
+        self.add_ctrl(0, nsids=[1])
+        self.write("feature-07", "0x10001")
+
+    def record(self, name, *args, **kwargs):
+        """ Run nvme with NVME_RECORD set and return the recording. """
+        path = self.path(name)
+        proc = self.nvme(*args, env={"NVME_RECORD": path}, **kwargs)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        return path
+
+    def replay(self, *args):
+        """ Replay and return the summary, by opcode. """
+        proc = self.nvme("replay", "--output-format=json", *args)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        summary = json.loads(proc.stdout)["summary"]
+        for op in summary:
+            self.assertEqual(op["queue"], "admin")
+        return {op["opcode"]: op for op in summary}, proc.stderr
+
+    def test_replay(self):
+        """ Testcase replay of read-only commands only """
+        rec = self.record("a.rec", "batch", input=BATCH)
+        ops, err = self.replay("/dev/nvme0", "--input=" + rec)
+        self.assertEqual(sorted(ops), [NVME_ADMIN_IDENTIFY,
+                                       NVME_ADMIN_GET_FEATURES])
+        self.assertEqual(ops[NVME_ADMIN_IDENTIFY]["count"], 2)
+        self.assertEqual(ops[NVME_ADMIN_GET_FEATURES]["count"], 1)
+        for op in ops.values():
+            self.assertEqual(op["status_mismatches"], 0)
+            self.assertEqual(op["data_mismatches"], 0)
+        self.assertIn("skipped 1 admin command with opcode 0x09", err)
+
+    def test_replay_force(self):
+        """ Testcase replay of all commands with --force """
+        rec = self.record("a.rec", "batch", input=BATCH)
+        ops, err = self.replay("/dev/nvme0", "--input=" + rec, "--force")
+        self.assertEqual(sorted(ops), [NVME_ADMIN_IDENTIFY,
+                                       NVME_ADMIN_SET_FEATURES,
+                                       NVME_ADMIN_GET_FEATURES])
+        self.assertEqual(ops[NVME_ADMIN_SET_FEATURES]["count"], 1)
+        self.assertNotIn("skipped", err)
+
+    def test_replay_data_differs(self):
+        """ Testcase replay after the Identify data changed """
+        rec = self.record("a.rec", "batch", input=BATCH)
+        self.write("identify-01.bin", id_ctrl("CHANGED"), "nvme0")
+        ops, _ = self.replay("/dev/nvme0", "--input=" + rec)
+        self.assertEqual(ops[NVME_ADMIN_IDENTIFY]["data_mismatches"], 2)
+        self.assertEqual(ops[NVME_ADMIN_GET_FEATURES]["data_mismatches"], 0)
+
+    def test_compare(self):
+        """ Testcase --compare of two recordings """
+        rec_a = self.record("a.rec", "batch", input=BATCH)
+        ops, _ = self.replay("--input=" + rec_a, "--compare=" + rec_a)
+        self.assertEqual(len(ops), 3)
+        for op in ops.values():
+            self.assertEqual(op["recorded_avg_ns"], op["replayed_avg_ns"])
+            self.assertEqual(op["data_mismatches"], 0)
+
+        self.write("identify-01.bin", id_ctrl("CHANGED"), "nvme0")
+        rec_b = self.record("b.rec", "batch", input=BATCH)
+        ops, _ = self.replay("--input=" + rec_a, "--compare=" + rec_b)
+        self.assertEqual(ops[NVME_ADMIN_IDENTIFY]["data_mismatches"], 2)
+        self.assertEqual(ops[NVME_ADMIN_SET_FEATURES]["data_mismatches"], 0)
+
+    def test_record_fanout(self):
+        """ Testcase recording of the processes --all starts """
+        self.add_ctrl(1, nsids=[1])
+        self.add_ctrl(2, nsids=[1])
+        rec = self.record("a.rec", "--all", "id-ctrl")
+        ops, _ = self.replay("--input=" + rec, "--compare=" + rec)
+        self.assertEqual(ops[NVME_ADMIN_IDENTIFY]["count"], 3)
+
+    def test_record_bidirectional(self):
+        """ Testcase recording of the data sent and returned """
+        self.write("admin-c3.bin", b"B" * 512)
+        self.write("in.bin", b"A" * 512)
+        rec = self.record("a.rec", "admin-passthru", "/dev/nvme0",
+                          "--opcode=0xc3", "--data-len=512", "--write",
+                          "--read", "--input-file=" + self.path("in.bin"))
+        with open(rec, "rb") as f:
+            data = f.read()
+        self.assertEqual(data.count(b"A" * 512), 1)
+        self.assertEqual(data.count(b"B" * 512), 1)
+        self.assertLess(data.index(b"A" * 512), data.index(b"B" * 512))
+
+
+if __name__ == "__main__":
+    unittest.main()
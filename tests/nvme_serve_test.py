@@ -0,0 +1,136 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" nvme serve against the mock device :-
+
+    1. Start 'nvme serve' on a socket in the fixture directory.
+    2. Requests are answered with their id, status and output.
+    3. Invalid requests and nested serve, batch and monitor requests
+       get an error.
+    4. A client which doesn't read its responses doesn't hold up the
+       responses to another client.
+    5. A second server on the same socket is refused.
+    6. The server exits on SIGTERM.
+"""
+
+import json
+import os
+import signal
+import socket
+import subprocess
+import time
+import unittest
+
+from nvme_mock import TestNVMeMock
+
+
+class TestNVMeServe(TestNVMeMock):
+
+    """ Represents nvme serve test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeServe. """
+        super().setUp()
+        self.add_ctrl(0, nsids=[1])
+        self.add_ctrl(1, nsids=[1])
+        self.sock = os.path.join(self.mock_dir, "serve.sock")
+        env = dict(os.environ, NVME_MOCK=self.mock_dir)
+        self.server = subprocess.Popen(
+            [self.nvme_bin, "serve", "--socket=" + self.sock],
+            env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        deadline = time.time() + 5
+        while not os.path.exists(self.sock) and time.time() < deadline:
+            time.sleep(0.05)
+
+    def tearDown(self):
+        """ Post Section for TestNVMeServe. """
+        if self.server.poll() is None:
+            self.server.kill()
+            self.server.wait()
+        super().tearDown()
+
+    def connect(self):
+        """ Connect a client to the server. """
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.settimeout(10)
+        client.connect(self.sock)
+        return client
+
+    @staticmethod
+    def request(client, *reqs):
+        """ Send requests and return the responses, by id. """
+        client.sendall("".join(json.dumps(r) + "\n" for r in reqs).encode())
+        buf = b""
+        while buf.count(b"\n") < len(reqs):
+            data = client.recv(65536)
+            if not data:
+                break
+            buf += data
+        resps = [json.loads(line) for line in buf.decode().splitlines()]
+        return {r["id"]: r for r in resps}
+
+    def test_serve(self):
+        """ Testcase main """
+        client = self.connect()
+        resps = self.request(client,
+                             {"id": 1, "command": "id-ctrl",
+                              "args": ["/dev/nvme0", "-o", "json"]},
+                             {"id": "b", "command": "id-ctrl",
+                              "args": ["nvme1"]},
+                             {"id": 3, "command": "serve",
+                              "args": ["--socket=/nonexistent/sock"]},
+                             {"id": 4, "command": "batch"},
+                             {"id": 5, "command": "monitor"},
+                             {"id": 6, "args": []})
+        self.assertEqual(sorted(resps, key=str), [1, 3, 4, 5, 6, "b"])
+
+        self.assertEqual(resps[1]["status"], 0)
+        self.assertEqual(resps[1]["output"]["sn"].strip(), "MOCK0000")
+        self.assertEqual(resps["b"]["status"], 0)
+        self.assertIn("sn        : MOCK0001", resps["b"]["stdout"])
+        for i in (3, 4, 5, 6):
+            self.assertNotEqual(resps[i]["status"], 0)
+            self.assertIn("error", resps[i])
+        client.close()
+
+        self.server.send_signal(signal.SIGTERM)
+        self.assertEqual(self.server.wait(timeout=5), 0)
+        self.assertFalse(os.path.exists(self.sock))
+
+    def test_slow_client(self):
+        """ Testcase a client which stops reading """
+        slow = self.connect()
+        req = {"command": "id-ctrl", "args": ["nvme0", "-o", "json"]}
+        slow.sendall((json.dumps(req) + "\n").encode() * 300)
+
+        # queued behind the requests of the slow client for nvme0
+        client = self.connect()
+        client.settimeout(10)
+        resps = self.request(client, {"id": 1, "command": "id-ctrl",
+                                      "args": ["nvme0", "-o", "json"]})
+        self.assertEqual(resps[1]["output"]["sn"].strip(), "MOCK0000")
+        slow.close()
+        client.close()
+
+    def test_socket_in_use(self):
+        """ Testcase a second server on the same socket """
+        self.connect().close()
+        proc = self.nvme("serve", "--socket=" + self.sock, timeout=5)
+        self.assertNotEqual(proc.returncode, 0)
+        self.assertIsNone(self.server.poll())
+
+
+if __name__ == "__main__":
+    unittest.main()
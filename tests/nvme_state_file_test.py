@@ -0,0 +1,138 @@
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+# MA  02110-1301, USA.
+#
+""" error-log and persistent-event-log --state-file on the mock device :-
+
+    1. The first run reports the whole log.
+    2. A second run reports nothing new.
+    3. After new entries were added only those are reported.
+    4. After the log started over, or was rewritten, the entries which
+       are new are reported.
+"""
+
+import json
+import struct
+import unittest
+
+from nvme_mock import TestNVMeMock, id_ctrl
+
+NVME_TIMESTAMP_EVENT = 0x03
+
+
+def error_log(counts, entries=64):
+    """ Build an Error Information log, newest entry first. """
+    data = bytearray(64 * entries)
+    for i, count in enumerate(counts):
+        struct.pack_into("<QHH", data, 64 * i, count, 1, i)
+    return bytes(data)
+
+
+def persistent_event_log(timestamps, sn):
+    """ Build a Persistent Event log of Timestamp events. """
+    events = b""
+    for ts in timestamps:
+        events += struct.pack("<BBBBHQ6xHHQ", NVME_TIMESTAMP_EVENT, 0, 21,
+                              0, 1, ts, 0, 8, ts)
+    head = bytearray(512)
+    struct.pack_into("<B3xIQ2xHQ", head, 0, 0x0d, len(timestamps),
+                     len(head) + len(events), len(head),
+                     max(timestamps) + 1000)
+    head[56:76] = sn.ljust(20).encode()
+    head[480:512] = b"\xff" * 32
+    return bytes(head) + events
+
+
+class TestNVMeStateFile(TestNVMeMock):
+
+    """ Represents --state-file test on a mock device. """
+
+    def setUp(self):
+        """ Pre Section for TestNVMeStateFile. """
+        super().setUp()
+        self.add_ctrl(0)
+        self.write("identify-01.bin", id_ctrl("MOCK0000", elpe=63), "nvme0")
+        self.state = self.path("nvme.state")
+
+    def error_counts(self):
+        """ Return the error counts reported by error-log. """
+        proc = self.nvme("error-log", "/dev/nvme0",
+                         "--state-file=" + self.state)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        return [json.loads(line)["error_count"]
+                for line in proc.stdout.splitlines()]
+
+    def event_timestamps(self):
+        """ Return the event timestamps reported by persistent-event-log. """
+        proc = self.nvme("persistent-event-log", "/dev/nvme0",
+                         "--action=0", "--output-format=json",
+                         "--state-file=" + self.state)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        return [e["event_time_stamp"] for e in
+                json.loads(proc.stdout)["list_of_event_entries"]]
+
+    def test_error_log(self):
+        """ Testcase error-log --state-file """
+        self.write("log-01.bin", error_log([3, 2, 1]))
+        self.assertEqual(self.error_counts(), [1, 2, 3])
+        self.assertEqual(self.error_counts(), [])
+
+        self.write("log-01.bin", error_log([5, 4, 3, 2, 1]))
+        self.assertEqual(self.error_counts(), [4, 5])
+        self.assertEqual(self.error_counts(), [])
+
+        # the count went backwards, e.g. after a controller reset
+        self.write("log-01.bin", error_log([2, 1]))
+        self.assertEqual(self.error_counts(), [1, 2])
+        self.assertEqual(self.error_counts(), [])
+
+    def test_persistent_event_log(self):
+        """ Testcase persistent-event-log --state-file """
+        self.write("log-0d.bin",
+                   persistent_event_log([1000, 2000, 3000], "MOCK0000"))
+        self.assertEqual(self.event_timestamps(), [1000, 2000, 3000])
+        self.assertEqual(self.event_timestamps(), [])
+
+        self.write("log-0d.bin",
+                   persistent_event_log([1000, 2000, 3000, 4000],
+                                        "MOCK0000"))
+        self.assertEqual(self.event_timestamps(), [4000])
+        self.assertEqual(self.event_timestamps(), [])
+
+        # the oldest events were dropped, so the last one moved
+        self.write("log-0d.bin",
+                   persistent_event_log([3000, 4000, 5000], "MOCK0000"))
+        self.assertEqual(self.event_timestamps(), [5000])
+        self.assertEqual(self.event_timestamps(), [])
+
+    def test_controllers(self):
+        """ Testcase one state file for two controllers """
+        self.add_ctrl(1)
+        self.write("identify-01.bin", id_ctrl("MOCK0001", elpe=63), "nvme1")
+        self.write("log-01.bin", error_log([2, 1]), "nvme0")
+        self.write("log-01.bin", error_log([7, 6, 5]), "nvme1")
+        self.assertEqual(self.error_counts(), [1, 2])
+
+        proc = self.nvme("error-log", "/dev/nvme1",
+                         "--state-file=" + self.state)
+        self.assertEqual(proc.returncode, 0, proc.stderr)
+        self.assertEqual(len(proc.stdout.splitlines()), 3)
+        self.assertEqual(self.error_counts(), [])
+        with open(self.state) as f:
+            self.assertEqual(sorted(f.read().splitlines()),
+                             ["2 MOCK0000", "7 MOCK0001"])
+
+
+if __name__ == "__main__":
+    unittest.main()